@@ -0,0 +1,677 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+A small 68000 core for running the decrunchers, counting cycles.
+
+Only the user mode integer instructions are implemented, which is all the
+decrunchers need. The cycle counts follow the instruction timing tables of
+the 68000 user's manual, without any wait states for shared memory. The
+scaled index addressing of the 68020 is accepted as well, so the headers
+for the 68020 can be run, though their cycles are still counted as for a
+68000.
+
+Memory is a flat, big-endian array from address 0. An instruction in the
+A-line range (opcodes $Axxx) calls the trap method, which can emulate an
+operating system call and return to the caller. Execution stops when the
+program counter reaches the stop address, or on an error.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class M68k {
+	// Effective address: a register, or a memory address, or an immediate
+	enum Kind { DATA_REG, ADDR_REG, MEMORY, IMMEDIATE };
+	struct EA {
+		Kind kind;
+		unsigned value;
+	};
+
+	static unsigned sizeMask(int size) {
+		return size == 1 ? 0xFF : size == 2 ? 0xFFFF : 0xFFFFFFFF;
+	}
+
+	static unsigned signBit(int size) {
+		return size == 1 ? 0x80 : size == 2 ? 0x8000 : 0x80000000;
+	}
+
+	static int signExtend(unsigned value, int size) {
+		return size == 1 ? (int) (signed char) value : size == 2 ? (int) (short) value : (int) value;
+	}
+
+	bool valid(unsigned address, int size) {
+		if (address + size > memory.size()) {
+			fail("Access outside memory at $%06X", address);
+			return false;
+		}
+		return true;
+	}
+
+	unsigned fetch16() {
+		unsigned value = read(pc, 2);
+		pc += 2;
+		return value;
+	}
+
+	unsigned fetch32() {
+		unsigned value = read(pc, 4);
+		pc += 4;
+		return value;
+	}
+
+	// Address of an indexed mode from its extension word
+	unsigned indexed(unsigned base) {
+		unsigned ext = fetch16();
+		unsigned index = ext & 0x8000 ? a[(ext >> 12) & 7] : d[(ext >> 12) & 7];
+		if (!(ext & 0x800)) index = (int) (short) index;
+		if (ext & 0x100) {
+			fail("Full extension words are not supported");
+		}
+		return base + (index << ((ext >> 9) & 3)) + (int) (signed char) ext;
+	}
+
+	// Effective address calculation time, as in the 68000 manual
+	static int eaCycles(int mode, int reg, int size) {
+		int extra = size == 4 ? 4 : 0;
+		switch (mode) {
+		case 0: case 1: return 0;
+		case 2: case 3: return 4 + extra;
+		case 4: return 6 + extra;
+		case 5: return 8 + extra;
+		case 6: return 10 + extra;
+		}
+		switch (reg) {
+		case 0: return 8 + extra;
+		case 1: return 12 + extra;
+		case 2: return 8 + extra;
+		case 3: return 10 + extra;
+		}
+		return 4 + extra;
+	}
+
+	EA decode(int mode, int reg, int size) {
+		EA ea;
+		ea.kind = MEMORY;
+		switch (mode) {
+		case 0: ea.kind = DATA_REG; ea.value = reg; return ea;
+		case 1: ea.kind = ADDR_REG; ea.value = reg; return ea;
+		case 2: ea.value = a[reg]; return ea;
+		case 3:
+			ea.value = a[reg];
+			a[reg] += size == 1 && reg == 7 ? 2 : size;
+			return ea;
+		case 4:
+			a[reg] -= size == 1 && reg == 7 ? 2 : size;
+			ea.value = a[reg];
+			return ea;
+		case 5: ea.value = a[reg] + (int) (short) fetch16(); return ea;
+		case 6: ea.value = indexed(a[reg]); return ea;
+		}
+		switch (reg) {
+		case 0: ea.value = (int) (short) fetch16(); return ea;
+		case 1: ea.value = fetch32(); return ea;
+		case 2: ea.value = pc; ea.value += (int) (short) fetch16(); return ea;
+		case 3: ea.value = indexed(pc); return ea;
+		case 4:
+			ea.kind = IMMEDIATE;
+			ea.value = size == 4 ? fetch32() : fetch16() & sizeMask(size);
+			return ea;
+		}
+		fail("Invalid addressing mode");
+		ea.value = 0;
+		return ea;
+	}
+
+	unsigned get(const EA& ea, int size) {
+		switch (ea.kind) {
+		case DATA_REG: return d[ea.value] & sizeMask(size);
+		case ADDR_REG: return a[ea.value] & sizeMask(size);
+		case MEMORY: return read(ea.value, size);
+		default: return ea.value;
+		}
+	}
+
+	void put(const EA& ea, int size, unsigned value) {
+		value &= sizeMask(size);
+		switch (ea.kind) {
+		case DATA_REG: d[ea.value] = (d[ea.value] & ~sizeMask(size)) | value; break;
+		case ADDR_REG: a[ea.value] = value; break;
+		case MEMORY: write(ea.value, size, value); break;
+		default: fail("Write to immediate"); break;
+		}
+	}
+
+	void setNZ(unsigned result, int size) {
+		result &= sizeMask(size);
+		n = (result & signBit(size)) != 0;
+		z = result == 0;
+	}
+
+	void setLogic(unsigned result, int size) {
+		setNZ(result, size);
+		v = c = false;
+	}
+
+	unsigned add(unsigned s, unsigned t, bool carry_in, int size, bool extend) {
+		unsigned mask = sizeMask(size);
+		unsigned long long wide = (unsigned long long) (s & mask) + (t & mask) + (carry_in ? 1 : 0);
+		unsigned result = (unsigned) wide & mask;
+		unsigned sign = signBit(size);
+		c = x = (wide >> (size * 8)) != 0;
+		v = ((s ^ result) & (t ^ result) & sign) != 0;
+		n = (result & sign) != 0;
+		z = extend ? z && result == 0 : result == 0;
+		return result;
+	}
+
+	// Computes t - s. Compare leaves the extend flag alone.
+	unsigned sub(unsigned s, unsigned t, bool borrow_in, int size, bool extend, bool compare = false) {
+		unsigned mask = sizeMask(size);
+		s &= mask;
+		t &= mask;
+		unsigned result = (t - s - (borrow_in ? 1 : 0)) & mask;
+		unsigned sign = signBit(size);
+		c = (unsigned long long) s + (borrow_in ? 1 : 0) > t;
+		if (!compare) x = c;
+		v = ((s ^ t) & (result ^ t) & sign) != 0;
+		n = (result & sign) != 0;
+		z = extend ? z && result == 0 : result == 0;
+		return result;
+	}
+
+	bool condition(int cc) {
+		switch (cc) {
+		case 0: return true;
+		case 1: return false;
+		case 2: return !c && !z;
+		case 3: return c || z;
+		case 4: return !c;
+		case 5: return c;
+		case 6: return !z;
+		case 7: return z;
+		case 8: return !v;
+		case 9: return v;
+		case 10: return !n;
+		case 11: return n;
+		case 12: return n == v;
+		case 13: return n != v;
+		case 14: return !z && n == v;
+		default: return z || n != v;
+		}
+	}
+
+	void push32(unsigned value) {
+		a[7] -= 4;
+		write(a[7], 4, value);
+	}
+
+	unsigned pop32() {
+		unsigned value = read(a[7], 4);
+		a[7] += 4;
+		return value;
+	}
+
+	unsigned shift(int type, bool left, unsigned value, int count, int size) {
+		unsigned mask = sizeMask(size);
+		unsigned sign = signBit(size);
+		int bits = size * 8;
+		value &= mask;
+		v = false;
+		if (count == 0) {
+			c = type == 2 ? x : false;
+			setNZ(value, size);
+			return value;
+		}
+		for (int i = 0 ; i < count ; i++) {
+			bool out;
+			if (left) {
+				out = (value & sign) != 0;
+				unsigned in = type == 3 ? out : type == 2 ? x : 0;
+				unsigned shifted = ((value << 1) | in) & mask;
+				if (type == 0 && ((shifted ^ value) & sign)) v = true;
+				value = shifted;
+			} else {
+				out = (value & 1) != 0;
+				unsigned in = type == 3 ? out : type == 2 ? x : type == 0 ? (value & sign) != 0 : 0;
+				value = (value >> 1) | (in ? sign : 0);
+			}
+			c = out;
+			if (type != 3) x = out;
+		}
+		(void) bits;
+		setNZ(value, size);
+		return value;
+	}
+
+	void execute(unsigned op);
+
+public:
+	std::vector<unsigned char> memory;
+	unsigned d[8];
+	unsigned a[8];
+	unsigned pc;
+	bool x, n, z, v, c;
+
+	unsigned long long cycles;
+	unsigned long long instructions;
+	unsigned stop_address;
+	std::string error;
+
+	M68k(size_t memory_size) : memory(memory_size), pc(0), x(false), n(false), z(false), v(false), c(false),
+		cycles(0), instructions(0), stop_address(0xFFFFFFFF)
+	{
+		for (int i = 0 ; i < 8 ; i++) d[i] = a[i] = 0;
+	}
+
+	virtual ~M68k() {}
+
+	// Called for an A-line opcode at the given address, with the program
+	// counter after it. Returns false to stop.
+	virtual bool trap(unsigned address) {
+		fail("Unexpected A-line opcode at $%06X", address);
+		return false;
+	}
+
+	void fail(const char *format, unsigned value = 0) {
+		if (!error.empty()) return;
+		char buffer[100];
+		snprintf(buffer, sizeof(buffer), format, value);
+		error = buffer;
+	}
+
+	unsigned read(unsigned address, int size) {
+		if (!valid(address, size)) return 0;
+		unsigned value = 0;
+		for (int i = 0 ; i < size ; i++) value = (value << 8) | memory[address + i];
+		return value;
+	}
+
+	void write(unsigned address, int size, unsigned value) {
+		if (!valid(address, size)) return;
+		for (int i = size - 1 ; i >= 0 ; i--) {
+			memory[address + i] = value;
+			value >>= 8;
+		}
+	}
+
+	// Run until the stop address is reached or an error occurs. At least
+	// one instruction is run. Returns whether the stop address was reached.
+	bool run(unsigned long long max_instructions) {
+		do {
+			if (instructions++ >= max_instructions) {
+				fail("Too many instructions");
+				break;
+			}
+			if (pc & 1) {
+				fail("Odd program counter $%06X", pc);
+				break;
+			}
+			unsigned address = pc;
+			unsigned op = fetch16();
+			if ((op & 0xF000) == 0xA000) {
+				if (!trap(address)) break;
+				continue;
+			}
+			execute(op);
+		} while (error.empty() && pc != stop_address);
+		return error.empty() && pc == stop_address;
+	}
+};
+
+inline void M68k::execute(unsigned op) {
+	int reg = op & 7;
+	int mode = (op >> 3) & 7;
+	int reg9 = (op >> 9) & 7;
+	static const int size_of[4] = { 1, 2, 4, 0 };
+
+	switch (op >> 12) {
+	case 0x0: {
+		// Immediate operations
+		int size = size_of[(op >> 6) & 3];
+		int kind = (op >> 9) & 7;
+		if (op & 0x100 || size == 0 || kind == 4 || kind == 7) break;
+		unsigned imm = size == 4 ? fetch32() : fetch16() & sizeMask(size);
+		EA ea = decode(mode, reg, size);
+		unsigned t = get(ea, size);
+		bool reg_dest = mode == 0;
+		switch (kind) {
+		case 0: put(ea, size, t | imm); setLogic(t | imm, size); break;
+		case 1: put(ea, size, t & imm); setLogic(t & imm, size); break;
+		case 2: put(ea, size, sub(imm, t, false, size, false)); break;
+		case 3: put(ea, size, add(imm, t, false, size, false)); break;
+		case 5: put(ea, size, t ^ imm); setLogic(t ^ imm, size); break;
+		case 6:
+			sub(imm, t, false, size, false, true);
+			cycles += (size == 4 ? (reg_dest ? 14 : 12) : 8) + eaCycles(mode, reg, size);
+			return;
+		}
+		cycles += size == 4 ? (reg_dest ? 16 : 20) : (reg_dest ? 8 : 12);
+		cycles += eaCycles(mode, reg, size);
+		return;
+	}
+	case 0x1: case 0x2: case 0x3: {
+		// MOVE and MOVEA
+		int size = (op >> 12) == 1 ? 1 : (op >> 12) == 3 ? 2 : 4;
+		int dmode = (op >> 6) & 7;
+		EA src = decode(mode, reg, size);
+		unsigned value = get(src, size);
+		cycles += 4 + eaCycles(mode, reg, size);
+		if (dmode == 1) {
+			a[reg9] = signExtend(value, size);
+			return;
+		}
+		EA dst = decode(dmode, reg9, size);
+		put(dst, size, value);
+		setLogic(value, size);
+		cycles += dmode == 4 ? (size == 4 ? 8 : 4) : eaCycles(dmode, reg9, size);
+		return;
+	}
+	case 0x4: {
+		if (op == 0x4E75) {
+			// RTS
+			pc = pop32();
+			cycles += 16;
+			return;
+		}
+		if (op == 0x4E71) {
+			// NOP
+			cycles += 4;
+			return;
+		}
+		if ((op & 0xFFC0) == 0x4E80 || (op & 0xFFC0) == 0x4EC0) {
+			// JSR and JMP
+			EA ea = decode(mode, reg, 4);
+			static const int jmp_cycles[8] = { 0, 0, 8, 0, 0, 10, 14, 0 };
+			int time = mode == 7 ? (reg == 0 ? 10 : reg == 1 ? 12 : reg == 2 ? 10 : 14) : jmp_cycles[mode];
+			if (op & 0x40) {
+				cycles += time;
+			} else {
+				push32(pc);
+				cycles += time + 8;
+			}
+			pc = ea.value;
+			return;
+		}
+		if ((op & 0xF1C0) == 0x41C0) {
+			// LEA
+			EA ea = decode(mode, reg, 4);
+			a[reg9] = ea.value;
+			cycles += mode == 6 || (mode == 7 && reg == 3) ? 12 : eaCycles(mode, reg, 2);
+			return;
+		}
+		if ((op & 0xFFC0) == 0x4840 && mode != 0) {
+			// PEA
+			EA ea = decode(mode, reg, 4);
+			push32(ea.value);
+			cycles += 8 + (mode == 6 || (mode == 7 && reg == 3) ? 12 : eaCycles(mode, reg, 2));
+			return;
+		}
+		if ((op & 0xFFF8) == 0x4840) {
+			// SWAP
+			d[reg] = (d[reg] >> 16) | (d[reg] << 16);
+			setLogic(d[reg], 4);
+			cycles += 4;
+			return;
+		}
+		if ((op & 0xFFB8) == 0x4880) {
+			// EXT
+			if (op & 0x40) {
+				d[reg] = (int) (short) d[reg];
+				setLogic(d[reg], 4);
+			} else {
+				d[reg] = (d[reg] & 0xFFFF0000) | ((int) (signed char) d[reg] & 0xFFFF);
+				setLogic(d[reg], 2);
+			}
+			cycles += 4;
+			return;
+		}
+		if ((op & 0xFB80) == 0x4880) {
+			// MOVEM
+			int size = op & 0x40 ? 4 : 2;
+			unsigned mask = fetch16();
+			int count = 0;
+			if (op & 0x400) {
+				// Memory to registers
+				unsigned address = mode == 3 ? a[reg] : decode(mode, reg, size).value;
+				for (int i = 0 ; i < 16 ; i++) {
+					if (mask & (1 << i)) {
+						unsigned value = signExtend(read(address, size), size);
+						if (i < 8) d[i] = value; else a[i - 8] = value;
+						address += size;
+						count++;
+					}
+				}
+				if (mode == 3) a[reg] = address;
+				cycles += 12 + (mode <= 3 ? 0 : eaCycles(mode, reg, 2) - 4) + count * (size == 4 ? 8 : 4);
+			} else if (mode == 4) {
+				// Registers to memory, predecrement
+				unsigned address = a[reg];
+				for (int i = 0 ; i < 16 ; i++) {
+					if (mask & (1 << i)) {
+						int r = 15 - i;
+						address -= size;
+						write(address, size, r < 8 ? d[r] : a[r - 8]);
+						count++;
+					}
+				}
+				a[reg] = address;
+				cycles += 8 + count * (size == 4 ? 8 : 4);
+			} else {
+				unsigned address = decode(mode, reg, size).value;
+				for (int i = 0 ; i < 16 ; i++) {
+					if (mask & (1 << i)) {
+						write(address, size, i < 8 ? d[i] : a[i - 8]);
+						address += size;
+						count++;
+					}
+				}
+				cycles += 8 + (mode == 2 ? 0 : eaCycles(mode, reg, 2) - 4) + count * (size == 4 ? 8 : 4);
+			}
+			return;
+		}
+		int size = size_of[(op >> 6) & 3];
+		if (size != 0 && (op & 0xFF00) == 0x4A00) {
+			// TST
+			EA ea = decode(mode, reg, size);
+			setLogic(get(ea, size), size);
+			cycles += 4 + eaCycles(mode, reg, size);
+			return;
+		}
+		if (size != 0 && ((op & 0xFF00) == 0x4200 || (op & 0xFF00) == 0x4400 || (op & 0xFF00) == 0x4600)) {
+			// CLR, NEG and NOT
+			EA ea = decode(mode, reg, size);
+			unsigned value = get(ea, size);
+			if ((op & 0xFF00) == 0x4200) {
+				put(ea, size, 0);
+				setLogic(0, size);
+			} else if ((op & 0xFF00) == 0x4400) {
+				put(ea, size, sub(value, 0, false, size, false));
+			} else {
+				put(ea, size, ~value);
+				setLogic(~value, size);
+			}
+			cycles += mode == 0 ? (size == 4 ? 6 : 4) : (size == 4 ? 12 : 8) + eaCycles(mode, reg, size);
+			return;
+		}
+		break;
+	}
+	case 0x5: {
+		int size = size_of[(op >> 6) & 3];
+		if (size == 0) {
+			if (mode == 1) {
+				// DBcc
+				int disp = (short) fetch16();
+				if (condition((op >> 8) & 15)) {
+					cycles += 12;
+					return;
+				}
+				unsigned count = (d[reg] - 1) & 0xFFFF;
+				d[reg] = (d[reg] & 0xFFFF0000) | count;
+				if (count == 0xFFFF) {
+					cycles += 14;
+				} else {
+					pc = pc - 2 + disp;
+					cycles += 10;
+				}
+				return;
+			}
+			// Scc
+			EA ea = decode(mode, reg, 1);
+			bool cc = condition((op >> 8) & 15);
+			put(ea, 1, cc ? 0xFF : 0);
+			cycles += mode == 0 ? (cc ? 6 : 4) : 8 + eaCycles(mode, reg, 1);
+			return;
+		}
+		// ADDQ and SUBQ
+		unsigned imm = reg9 == 0 ? 8 : reg9;
+		if (mode == 1) {
+			a[reg] = op & 0x100 ? a[reg] - imm : a[reg] + imm;
+			cycles += 8;
+			return;
+		}
+		EA ea = decode(mode, reg, size);
+		unsigned t = get(ea, size);
+		put(ea, size, op & 0x100 ? sub(imm, t, false, size, false) : add(imm, t, false, size, false));
+		cycles += mode == 0 ? (size == 4 ? 8 : 4) : (size == 4 ? 12 : 8) + eaCycles(mode, reg, size);
+		return;
+	}
+	case 0x6: {
+		// Bcc, BRA and BSR
+		int cc = (op >> 8) & 15;
+		int disp = (signed char) op;
+		unsigned base = pc;
+		bool word = disp == 0;
+		if (word) disp = (short) fetch16();
+		if (cc == 1) {
+			push32(pc);
+			pc = base + disp;
+			cycles += 18;
+			return;
+		}
+		if (condition(cc)) {
+			pc = base + disp;
+			cycles += 10;
+		} else {
+			cycles += word ? 12 : 8;
+		}
+		return;
+	}
+	case 0x7: {
+		// MOVEQ
+		if (op & 0x100) break;
+		d[reg9] = (int) (signed char) op;
+		setLogic(d[reg9], 4);
+		cycles += 4;
+		return;
+	}
+	case 0x8: case 0x9: case 0xB: case 0xC: case 0xD: {
+		int group = op >> 12;
+		int opmode = (op >> 6) & 7;
+		if ((group == 0xC) && (opmode == 3 || opmode == 7)) {
+			// MULU and MULS
+			EA ea = decode(mode, reg, 2);
+			unsigned s = get(ea, 2);
+			int ones = 0;
+			if (opmode == 3) {
+				d[reg9] = (d[reg9] & 0xFFFF) * s;
+				for (unsigned b = s ; b ; b >>= 1) ones += b & 1;
+			} else {
+				d[reg9] = (int) (short) d[reg9] * (int) (short) s;
+				for (unsigned b = (s << 1) ; b ; b >>= 1) ones += ((b ^ (b >> 1)) & 1);
+			}
+			setLogic(d[reg9], 4);
+			cycles += 38 + 2 * ones + eaCycles(mode, reg, 2);
+			return;
+		}
+		if ((group == 0x9 || group == 0xD) && (opmode == 3 || opmode == 7)) {
+			// ADDA and SUBA
+			int size = opmode == 7 ? 4 : 2;
+			EA ea = decode(mode, reg, size);
+			unsigned s = signExtend(get(ea, size), size);
+			a[reg9] = group == 0xD ? a[reg9] + s : a[reg9] - s;
+			cycles += (size == 4 && (mode <= 1 || (mode == 7 && reg == 4)) ? 8 : size == 4 ? 6 : 8) + eaCycles(mode, reg, size);
+			return;
+		}
+		if (group == 0xB && (opmode == 3 || opmode == 7)) {
+			// CMPA
+			int size = opmode == 7 ? 4 : 2;
+			EA ea = decode(mode, reg, size);
+			sub(signExtend(get(ea, size), size), a[reg9], false, 4, false, true);
+			cycles += 6 + eaCycles(mode, reg, size);
+			return;
+		}
+		int size = size_of[opmode & 3];
+		if ((group == 0x9 || group == 0xD) && (opmode & 4) && mode <= 1) {
+			// ADDX and SUBX
+			if (mode == 1) break;
+			d[reg9] = (d[reg9] & ~sizeMask(size)) | (group == 0xD
+				? add(d[reg], d[reg9], x, size, true)
+				: sub(d[reg], d[reg9], x, size, true));
+			cycles += size == 4 ? 8 : 4;
+			return;
+		}
+		if (group == 0xB && (opmode & 4)) {
+			// EOR
+			if (mode == 1) break;
+			EA ea = decode(mode, reg, size);
+			unsigned value = get(ea, size) ^ d[reg9];
+			put(ea, size, value);
+			setLogic(value, size);
+			cycles += mode == 0 ? (size == 4 ? 8 : 4) : (size == 4 ? 12 : 8) + eaCycles(mode, reg, size);
+			return;
+		}
+		if ((group == 0x8 || group == 0xC) && (opmode & 4) && mode <= 1) break;
+		EA ea = decode(mode, reg, size);
+		unsigned s = get(ea, size);
+		if (opmode & 4) {
+			// Dn op <ea> to memory
+			unsigned t = s;
+			unsigned r = d[reg9];
+			unsigned value;
+			switch (group) {
+			case 0x8: value = t | r; setLogic(value, size); break;
+			case 0x9: value = sub(r, t, false, size, false); break;
+			case 0xC: value = t & r; setLogic(value, size); break;
+			default: value = add(r, t, false, size, false); break;
+			}
+			put(ea, size, value);
+			cycles += (size == 4 ? 12 : 8) + eaCycles(mode, reg, size);
+			return;
+		}
+		unsigned t = d[reg9];
+		unsigned value;
+		switch (group) {
+		case 0x8: value = t | s; setLogic(value, size); break;
+		case 0x9: value = sub(s, t, false, size, false); break;
+		case 0xB: sub(s, t, false, size, false, true); value = t; break;
+		case 0xC: value = t & s; setLogic(value, size); break;
+		default: value = add(s, t, false, size, false); break;
+		}
+		d[reg9] = (d[reg9] & ~sizeMask(size)) | (value & sizeMask(size));
+		cycles += (size == 4 ? (group == 0xB ? 6 : (mode <= 1 || (mode == 7 && reg == 4)) ? 8 : 6) : 4) + eaCycles(mode, reg, size);
+		return;
+	}
+	case 0xE: {
+		// Shifts and rotates
+		int size = size_of[(op >> 6) & 3];
+		bool left = (op & 0x100) != 0;
+		if (size == 0) {
+			// Memory shift by one
+			EA ea = decode(mode, reg, 2);
+			put(ea, 2, shift((op >> 9) & 3, left, get(ea, 2), 1, 2));
+			cycles += 8 + eaCycles(mode, reg, 2);
+			return;
+		}
+		int count = op & 0x20 ? d[reg9] & 63 : reg9 == 0 ? 8 : reg9;
+		d[reg] = (d[reg] & ~sizeMask(size)) | shift((op >> 3) & 3, left, d[reg], count, size);
+		cycles += (size == 4 ? 8 : 6) + 2 * count;
+		return;
+	}
+	}
+	fail("Unimplemented opcode $%04X", op);
+}
@@ -0,0 +1,492 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Benchmark of the compressors and the decompressor.
+
+Every file in the given directories is compressed with each compressor
+(Shrinkler and CShrinkler at each of the given presets, and minishrinkler
+with its default settings) and decompressed again with shrinkler_dec, which
+also verifies the compressors. Each tool is run the given number of times,
+and the fastest run is used.
+
+For each compressor and preset, the benchmark reports the throughput of
+compression and decompression in MB/s of original data, the compression
+ratio, and the peak memory used by any single run of the compressor. The
+results are written as JSON. If the results of an earlier run are given as
+a baseline, falling behind the throughput of the baseline by more than the
+tolerance is reported as a regression.
+
+The benchmark exits with an error if any file fails to verify or if any
+regression is found.
+
+Requires a POSIX system.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+// Resources used by one run of a tool
+struct RunResult {
+	bool ok;
+	double seconds;
+	long peak_memory_kb;
+};
+
+// Results of one file with one compressor
+struct FileResult {
+	string file;
+	int original_size;
+	int compressed_size;
+	double compress_seconds;
+	double decompress_seconds;
+	long peak_memory_kb;
+	bool verified;
+};
+
+// Accumulated results of one compressor and preset
+struct ToolResult {
+	string tool;
+	int preset; // 0 for none
+	vector<FileResult> files;
+	double original_size;
+	double compressed_size;
+	double compress_seconds;
+	double decompress_seconds;
+	long peak_memory_kb;
+	int failures;
+
+	ToolResult(const string& tool, int preset) : tool(tool), preset(preset),
+		original_size(0), compressed_size(0), compress_seconds(0), decompress_seconds(0), peak_memory_kb(0), failures(0) {}
+
+	double compressMBs() {
+		return compress_seconds > 0 ? original_size / compress_seconds / 1e6 : 0;
+	}
+
+	double decompressMBs() {
+		return decompress_seconds > 0 ? original_size / decompress_seconds / 1e6 : 0;
+	}
+
+	double ratio() {
+		return original_size > 0 ? compressed_size / original_size : 0;
+	}
+};
+
+// Compressor invocation. The preset option is given as -<preset> if nonzero.
+struct Compressor {
+	string name;
+	string path;
+	vector<string> options;
+	bool presets;
+};
+
+static double timeSeconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Run a program with its output discarded
+static RunResult run(const vector<string>& args) {
+	RunResult result;
+	result.ok = false;
+	result.seconds = 0;
+	result.peak_memory_kb = 0;
+
+	vector<char*> argv;
+	for (int i = 0 ; i < args.size() ; i++) {
+		argv.push_back((char *) args[i].c_str());
+	}
+	argv.push_back(NULL);
+
+	double start = timeSeconds();
+	pid_t pid = fork();
+	if (pid < 0) return result;
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, 1);
+			dup2(null_fd, 2);
+		}
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid) return result;
+	result.seconds = timeSeconds() - start;
+#ifdef __APPLE__
+	result.peak_memory_kb = usage.ru_maxrss / 1024;
+#else
+	result.peak_memory_kb = usage.ru_maxrss;
+#endif
+	result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	return result;
+}
+
+// Fastest of several runs, with the largest peak memory. Fails if any run fails.
+static RunResult runBest(const vector<string>& args, int runs) {
+	RunResult best = run(args);
+	for (int r = 1 ; r < runs && best.ok ; r++) {
+		RunResult result = run(args);
+		best.ok = result.ok;
+		best.seconds = std::min(best.seconds, result.seconds);
+		best.peak_memory_kb = std::max(best.peak_memory_kb, result.peak_memory_kb);
+	}
+	return best;
+}
+
+static bool readFile(const string& filename, vector<unsigned char>& contents) {
+	contents.clear();
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (!file) return false;
+	unsigned char buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		contents.insert(contents.end(), buffer, buffer + n);
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+// Regular files in a directory, sorted by name
+static vector<string> listFiles(const string& dirname) {
+	vector<string> files;
+	DIR *dir = opendir(dirname.c_str());
+	if (!dir) {
+		printf("Error: Could not open directory %s\n\n", dirname.c_str());
+		exit(1);
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		string path = dirname + "/" + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			files.push_back(path);
+		}
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+	return files;
+}
+
+static void benchFile(ToolResult& result, const Compressor& compressor, const string& file, const string& work_dir,
+                      const string& decompressor, int runs) {
+	string packed = work_dir + "/bench.shr";
+	string unpacked = work_dir + "/bench.out";
+
+	FileResult fr;
+	fr.file = file;
+	fr.compressed_size = 0;
+	fr.compress_seconds = 0;
+	fr.decompress_seconds = 0;
+	fr.peak_memory_kb = 0;
+	fr.verified = false;
+
+	vector<unsigned char> original;
+	vector<unsigned char> compressed;
+	vector<unsigned char> decompressed;
+	readFile(file, original);
+	fr.original_size = original.size();
+
+	vector<string> args;
+	args.push_back(compressor.path);
+	args.insert(args.end(), compressor.options.begin(), compressor.options.end());
+	if (result.preset != 0) {
+		char preset_option[4];
+		sprintf(preset_option, "-%d", result.preset);
+		args.push_back(preset_option);
+	}
+	args.push_back(file);
+	args.push_back(packed);
+	RunResult compress = runBest(args, runs);
+	fr.compress_seconds = compress.seconds;
+	fr.peak_memory_kb = compress.peak_memory_kb;
+
+	if (compress.ok && readFile(packed, compressed)) {
+		fr.compressed_size = compressed.size();
+		args.clear();
+		args.push_back(decompressor);
+		args.push_back(packed);
+		args.push_back(unpacked);
+		RunResult decompress = runBest(args, runs);
+		fr.decompress_seconds = decompress.seconds;
+		fr.verified = decompress.ok && readFile(unpacked, decompressed) && decompressed == original;
+	}
+	remove(packed.c_str());
+	remove(unpacked.c_str());
+
+	result.files.push_back(fr);
+	result.original_size += fr.original_size;
+	result.compressed_size += fr.compressed_size;
+	result.compress_seconds += fr.compress_seconds;
+	result.decompress_seconds += fr.decompress_seconds;
+	result.peak_memory_kb = std::max(result.peak_memory_kb, fr.peak_memory_kb);
+	if (!fr.verified) {
+		result.failures++;
+		printf("  FAILED: %s\n", file.c_str());
+	}
+}
+
+static string jsonString(const string& s) {
+	string out = "\"";
+	for (int i = 0 ; i < s.size() ; i++) {
+		char c = s[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if ((unsigned char) c < 0x20) {
+			char escape[8];
+			sprintf(escape, "\\u%04x", c);
+			out += escape;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+// Write the results as JSON. Each tool result is on a line of its own,
+// which is what readBaseline expects.
+static bool writeResults(const char *filename, vector<ToolResult>& results, int runs) {
+	FILE *file = fopen(filename, "w");
+	if (!file) return false;
+	fprintf(file, "{\n  \"runs\": %d,\n  \"results\": [\n", runs);
+	for (int t = 0 ; t < results.size() ; t++) {
+		ToolResult& r = results[t];
+		fprintf(file, "    { \"tool\": %s, \"preset\": %d, \"files\": %d, \"original\": %.0f, \"compressed\": %.0f, "
+		              "\"ratio\": %.6f, \"compress_mb_s\": %.6f, \"decompress_mb_s\": %.6f, \"peak_memory_kb\": %ld, \"failures\": %d }%s\n",
+			jsonString(r.tool).c_str(), r.preset, (int) r.files.size(), r.original_size, r.compressed_size,
+			r.ratio(), r.compressMBs(), r.decompressMBs(), r.peak_memory_kb, r.failures, t + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"files\": [\n");
+	bool first = true;
+	for (int t = 0 ; t < results.size() ; t++) {
+		ToolResult& r = results[t];
+		for (int f = 0 ; f < r.files.size() ; f++) {
+			FileResult& fr = r.files[f];
+			fprintf(file, "%s    { \"tool\": %s, \"preset\": %d, \"file\": %s, \"original\": %d, \"compressed\": %d, "
+			              "\"compress_seconds\": %.6f, \"decompress_seconds\": %.6f, \"peak_memory_kb\": %ld, \"verified\": %s }",
+				first ? "" : ",\n", jsonString(r.tool).c_str(), r.preset, jsonString(fr.file).c_str(), fr.original_size, fr.compressed_size,
+				fr.compress_seconds, fr.decompress_seconds, fr.peak_memory_kb, fr.verified ? "true" : "false");
+			first = false;
+		}
+	}
+	fprintf(file, "\n  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+// Baseline throughput of one compressor and preset
+struct Baseline {
+	string tool;
+	int preset;
+	double compress_mb_s;
+	double decompress_mb_s;
+};
+
+// Read the tool results of a file written by writeResults
+static vector<Baseline> readBaseline(const char *filename) {
+	vector<Baseline> baselines;
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		printf("Error: Could not open baseline file %s\n\n", filename);
+		exit(1);
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		char tool[256];
+		Baseline b;
+		const char *compress = strstr(line, "\"compress_mb_s\":");
+		const char *decompress = strstr(line, "\"decompress_mb_s\":");
+		if (sscanf(line, " { \"tool\": \"%255[^\"]\", \"preset\": %d,", tool, &b.preset) == 2 && compress && decompress &&
+		    sscanf(compress, "\"compress_mb_s\": %lf", &b.compress_mb_s) == 1 &&
+		    sscanf(decompress, "\"decompress_mb_s\": %lf", &b.decompress_mb_s) == 1 &&
+		    strstr(line, "\"file\":") == NULL) {
+			b.tool = tool;
+			baselines.push_back(b);
+		}
+	}
+	fclose(file);
+	return baselines;
+}
+
+static bool regressed(double value, double baseline, double tolerance) {
+	return baseline > 0 && value < baseline * (1 - tolerance / 100);
+}
+
+static void usage() {
+	printf("Usage: bench <options> <directories>\n");
+	printf("\n");
+	printf("Available options are (default values in parentheses):\n");
+	printf(" --presets LIST     Presets for Shrinkler and CShrinkler, separated by commas (1,3,5)\n");
+	printf(" --runs N           Number of runs of each tool, of which the fastest is used (1)\n");
+	printf(" --json FILE        Write results as JSON (bench.json)\n");
+	printf(" --baseline FILE    Compare throughput against the results of an earlier run\n");
+	printf(" --tolerance PCT    Allowed throughput loss relative to the baseline (10)\n");
+	printf(" --work DIR         Directory for temporary files (.)\n");
+	printf(" --shrinkler PATH   Shrinkler executable (build/native/Shrinkler)\n");
+	printf(" --cshrinkler PATH  CShrinkler executable (build/native_c/CShrinkler)\n");
+	printf(" --mini PATH        minishrinkler executable (minichruncher_c/minishrinkler)\n");
+	printf(" --dec PATH         shrinkler_dec executable (decruncher_c/shrinkler_dec)\n");
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, const char *argv[]) {
+	vector<int> presets;
+	int runs = 1;
+	const char *json_file = "bench.json";
+	const char *baseline_file = NULL;
+	double tolerance = 10;
+	string work_dir = ".";
+	string shrinkler = "build/native/Shrinkler";
+	string cshrinkler = "build/native_c/CShrinkler";
+	string mini = "minichruncher_c/minishrinkler";
+	string decompressor = "decruncher_c/shrinkler_dec";
+	vector<string> dirs;
+
+	for (int i = 1 ; i < argc ; i++) {
+		string arg = argv[i];
+		if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-') {
+			if (i + 1 >= argc) usage();
+			const char *value = argv[++i];
+			if (arg == "--presets") {
+				presets.clear();
+				for (const char *p = value ; *p ; p++) {
+					if (*p >= '1' && *p <= '9') {
+						presets.push_back(*p - '0');
+					} else if (*p != ',') {
+						usage();
+					}
+				}
+			} else if (arg == "--runs") {
+				runs = std::max(1, atoi(value));
+			} else if (arg == "--json") {
+				json_file = value;
+			} else if (arg == "--baseline") {
+				baseline_file = value;
+			} else if (arg == "--tolerance") {
+				tolerance = atof(value);
+			} else if (arg == "--work") {
+				work_dir = value;
+			} else if (arg == "--shrinkler") {
+				shrinkler = value;
+			} else if (arg == "--cshrinkler") {
+				cshrinkler = value;
+			} else if (arg == "--mini") {
+				mini = value;
+			} else if (arg == "--dec") {
+				decompressor = value;
+			} else {
+				usage();
+			}
+		} else {
+			dirs.push_back(arg);
+		}
+	}
+	if (dirs.empty()) usage();
+	if (presets.empty()) {
+		presets.push_back(1);
+		presets.push_back(3);
+		presets.push_back(5);
+	}
+
+	vector<string> files;
+	for (int d = 0 ; d < dirs.size() ; d++) {
+		vector<string> dir_files = listFiles(dirs[d]);
+		files.insert(files.end(), dir_files.begin(), dir_files.end());
+	}
+
+	vector<Compressor> compressors(3);
+	compressors[0].name = "Shrinkler";
+	compressors[0].path = shrinkler;
+	compressors[0].options.push_back("-d");
+	compressors[0].options.push_back("-p");
+	compressors[0].presets = true;
+	compressors[1].name = "CShrinkler";
+	compressors[1].path = cshrinkler;
+	compressors[1].options.push_back("-d");
+	compressors[1].options.push_back("-p");
+	compressors[1].presets = true;
+	compressors[2].name = "minishrinkler";
+	compressors[2].path = mini;
+	compressors[2].presets = false;
+
+	printf("Benchmarking %d files in %d directories, %d run%s each...\n\n",
+		(int) files.size(), (int) dirs.size(), runs, runs == 1 ? "" : "s");
+	vector<ToolResult> results;
+	for (int c = 0 ; c < compressors.size() ; c++) {
+		Compressor& compressor = compressors[c];
+		for (int p = 0 ; p < (compressor.presets ? presets.size() : 1) ; p++) {
+			ToolResult result(compressor.name, compressor.presets ? presets[p] : 0);
+			printf("%s%s%s...\n", compressor.name.c_str(), compressor.presets ? " -" : "",
+				compressor.presets ? string(1, '0' + presets[p]).c_str() : "");
+			fflush(stdout);
+			for (int f = 0 ; f < files.size() ; f++) {
+				benchFile(result, compressor, files[f], work_dir, decompressor, runs);
+			}
+			results.push_back(result);
+		}
+	}
+
+	vector<Baseline> baselines;
+	if (baseline_file) {
+		baselines = readBaseline(baseline_file);
+	}
+
+	printf("\nTool           Preset  Original  Compressed   Ratio  Compress  Decompress  Peak memory\n");
+	printf("                          bytes       bytes             MB/s        MB/s           KB\n");
+	int failures = 0;
+	int regressions = 0;
+	for (int t = 0 ; t < results.size() ; t++) {
+		ToolResult& r = results[t];
+		char preset[4] = "-";
+		if (r.preset != 0) sprintf(preset, "%d", r.preset);
+		printf("%-14s %6s %9.0f %11.0f %7.4f %9.3f %11.3f %12ld\n", r.tool.c_str(), preset,
+			r.original_size, r.compressed_size, r.ratio(), r.compressMBs(), r.decompressMBs(), r.peak_memory_kb);
+		failures += r.failures;
+		for (int b = 0 ; b < baselines.size() ; b++) {
+			if (baselines[b].tool != r.tool || baselines[b].preset != r.preset) continue;
+			if (regressed(r.compressMBs(), baselines[b].compress_mb_s, tolerance)) {
+				printf("  Regression: compression %.3f MB/s, baseline %.3f MB/s\n", r.compressMBs(), baselines[b].compress_mb_s);
+				regressions++;
+			}
+			if (regressed(r.decompressMBs(), baselines[b].decompress_mb_s, tolerance)) {
+				printf("  Regression: decompression %.3f MB/s, baseline %.3f MB/s\n", r.decompressMBs(), baselines[b].decompress_mb_s);
+				regressions++;
+			}
+		}
+	}
+	printf("\n");
+
+	if (!writeResults(json_file, results, runs)) {
+		printf("Error while writing file %s\n\n", json_file);
+		return 1;
+	}
+	printf("Results written to %s\n\n", json_file);
+
+	if (failures > 0) {
+		printf("%d file%s failed to verify.\n\n", failures, failures == 1 ? "" : "s");
+	}
+	if (regressions > 0) {
+		printf("%d throughput regression%s beyond %.0f%%.\n\n", regressions, regressions == 1 ? "" : "s", tolerance);
+	}
+	return failures > 0 || regressions > 0 ? 1 : 0;
+}
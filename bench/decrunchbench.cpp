@@ -0,0 +1,684 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Benchmark of the Amiga decrunchers, counting 68000 cycles.
+
+Every file in the given directories is crunched by Shrinkler in each mode,
+and the crunched result is decrunched by the Amiga code on a small 68000
+core (M68k.h), which counts the cycles taken. For the executable modes
+(plain, overlap and mini), the file is wrapped as the single code hunk of
+an executable, and the crunched executable is loaded as by LoadSeg and run
+from its first hunk until it jumps to the decrunched program. For the data
+mode, the crunched data is decrunched by ShrinklerDecompress. The
+decrunched data is compared to the original file in all modes.
+
+Exec and dos are emulated just enough for the decrunch headers. Memory has
+no wait states, and the cycles of the emulated library calls themselves
+are not counted.
+
+For each mode, the benchmark reports the cycles per decrunched byte. The
+results are written as JSON. If the results of an earlier run are given as
+a baseline, a number of cycles per byte higher than that of the baseline by
+more than the tolerance is reported as a regression. Since the cycle counts
+are exact, the tolerance only needs to cover changes in the compressor.
+
+The benchmark exits with an error if any file fails to decrunch correctly
+or if any regression is found.
+
+Requires a POSIX system.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "M68k.h"
+
+using std::string;
+using std::vector;
+
+// Amiga hunk types
+static const unsigned HUNK_CODE    = 0x3E9;
+static const unsigned HUNK_DATA    = 0x3EA;
+static const unsigned HUNK_BSS     = 0x3EB;
+static const unsigned HUNK_RELOC32 = 0x3EC;
+static const unsigned HUNK_SYMBOL  = 0x3F0;
+static const unsigned HUNK_DEBUG   = 0x3F1;
+static const unsigned HUNK_END     = 0x3F2;
+static const unsigned HUNK_HEADER  = 0x3F3;
+
+// Library vector offsets
+static const int EXEC_Forbid         = -132;
+static const int EXEC_Permit         = -138;
+static const int EXEC_AllocMem       = -198;
+static const int EXEC_FreeMem        = -210;
+static const int EXEC_OldOpenLibrary = -408;
+static const int EXEC_CloseLibrary   = -414;
+static const int EXEC_CacheClearU    = -636;
+static const int DOS_Write           = -48;
+static const int DOS_Output          = -60;
+
+// An Amiga with just enough of exec and dos for the decrunchers. Library
+// vectors are A-line opcodes followed by RTS, so calls to them are trapped.
+class Amiga : public M68k {
+	static const unsigned MEMORY_SIZE = 16 << 20;
+	static const unsigned STACK_SIZE  = 64 << 10;
+	static const unsigned EXEC_BASE   = 0x1000;
+	static const unsigned DOS_BASE    = 0x2000;
+	static const unsigned VECTORS     = 0x400;
+	static const unsigned HEAP_START  = 0x10000;
+
+	unsigned heap;
+
+	void makeLibrary(unsigned base, int version) {
+		for (unsigned lvo = 6 ; lvo <= VECTORS ; lvo += 6) {
+			write(base - lvo, 2, 0xA000);
+			write(base - lvo + 2, 2, 0x4E75); // rts
+		}
+		write(base + 20, 2, version);
+	}
+
+public:
+	// Return address for the code being run. Reaching it stops the run.
+	static const unsigned EXIT_ADDRESS = 0x100;
+
+	string output;
+
+	Amiga() : M68k(MEMORY_SIZE), heap(HEAP_START) {
+		write(4, 4, EXEC_BASE);
+		makeLibrary(EXEC_BASE, 40);
+		makeLibrary(DOS_BASE, 40);
+		a[7] = MEMORY_SIZE;
+	}
+
+	// Allocate cleared memory. Returns 0 if there is not enough.
+	unsigned alloc(unsigned size) {
+		unsigned address = heap;
+		if (size > MEMORY_SIZE - STACK_SIZE - address) return 0;
+		heap = (heap + size + 7) & ~7;
+		return address;
+	}
+
+	void push(unsigned value) {
+		a[7] -= 4;
+		write(a[7], 4, value);
+	}
+
+	virtual bool trap(unsigned address) {
+		if (address < EXEC_BASE && address >= EXEC_BASE - VECTORS) {
+			switch ((int) (address - EXEC_BASE)) {
+			case EXEC_Forbid:
+			case EXEC_Permit:
+			case EXEC_FreeMem:
+			case EXEC_CloseLibrary:
+			case EXEC_CacheClearU:
+				return true;
+			case EXEC_AllocMem:
+				d[0] = alloc(d[0]);
+				return true;
+			case EXEC_OldOpenLibrary:
+				d[0] = DOS_BASE;
+				return true;
+			}
+		} else if (address < DOS_BASE && address >= DOS_BASE - VECTORS) {
+			switch ((int) (address - DOS_BASE)) {
+			case DOS_Output:
+				d[0] = 1;
+				return true;
+			case DOS_Write:
+				for (unsigned i = 0 ; i < d[3] ; i++) output += (char) read(d[2] + i, 1);
+				d[0] = d[3];
+				return true;
+			}
+		} else {
+			return M68k::trap(address);
+		}
+		fail("Unsupported library call at $%06X", address);
+		return false;
+	}
+
+	// Load an executable as LoadSeg does. Each hunk is preceded by the size
+	// of its allocation and the BCPL pointer to the next hunk. Returns the
+	// addresses of the hunk data, or nothing if the executable is invalid.
+	vector<unsigned> loadSeg(const vector<unsigned char>& file) {
+		vector<unsigned> hunks;
+		int pos = 0;
+		int length = file.size() / 4;
+		#define NEXT() (pos < length ? (pos++, (unsigned) file[pos * 4 - 4] << 24 | file[pos * 4 - 3] << 16 | file[pos * 4 - 2] << 8 | file[pos * 4 - 1]) : 0)
+		if (NEXT() != HUNK_HEADER || NEXT() != 0) return hunks;
+		unsigned table_size = NEXT();
+		unsigned first = NEXT();
+		unsigned last = NEXT();
+		if (first != 0 || last + 1 != table_size || table_size > 1000) return hunks;
+		for (unsigned h = 0 ; h < table_size ; h++) {
+			unsigned size = NEXT();
+			if ((size >> 30) == 3) NEXT();
+			unsigned segment = alloc((size & 0x3FFFFFFF) * 4 + 8);
+			if (segment == 0) return vector<unsigned>();
+			write(segment, 4, (size & 0x3FFFFFFF) * 4 + 8);
+			if (h > 0) write(hunks[h - 1] - 4, 4, (segment + 4) >> 2);
+			hunks.push_back(segment + 8);
+		}
+		// The hunk end marker is optional before the next hunk
+		unsigned h = 0;
+		bool in_hunk = false;
+		while (pos < length) {
+			unsigned type = NEXT() & 0x3FFFFFFF;
+			if (type == HUNK_CODE || type == HUNK_DATA || type == HUNK_BSS) {
+				if (in_hunk) h++;
+				if (h >= table_size) return vector<unsigned>();
+				in_hunk = true;
+			} else if (!in_hunk) {
+				return vector<unsigned>();
+			}
+			switch (type) {
+			case HUNK_CODE:
+			case HUNK_DATA:
+			{
+				unsigned size = NEXT();
+				for (unsigned i = 0 ; i < size ; i++) write(hunks[h] + i * 4, 4, NEXT());
+				break;
+			}
+			case HUNK_BSS:
+				NEXT();
+				break;
+			case HUNK_RELOC32:
+				for (unsigned count ; (count = NEXT()) != 0 ; ) {
+					unsigned target = NEXT();
+					if (target >= table_size) return vector<unsigned>();
+					for (unsigned i = 0 ; i < count ; i++) {
+						unsigned offset = hunks[h] + NEXT();
+						write(offset, 4, read(offset, 4) + hunks[target]);
+					}
+				}
+				break;
+			case HUNK_SYMBOL:
+				for (unsigned size ; (size = NEXT()) != 0 ; ) pos += size + 1;
+				break;
+			case HUNK_DEBUG:
+				pos += NEXT();
+				break;
+			case HUNK_END:
+				h++;
+				in_hunk = false;
+				break;
+			default:
+				return vector<unsigned>();
+			}
+		}
+		#undef NEXT
+		if (h + (in_hunk ? 1 : 0) != table_size) return vector<unsigned>();
+		return hunks;
+	}
+};
+
+// Crunching mode
+struct Mode {
+	const char *name;
+	const char *option;
+	bool executable;
+	// Index of the hunk holding the decrunched program
+	int program_hunk;
+};
+
+static const Mode modes[] = {
+	{ "plain",   NULL, true,  0 },
+	{ "overlap", "-o", true,  1 },
+	{ "mini",    "-m", true,  1 },
+	{ "data",    "-d", false, 0 },
+};
+
+static const int NUM_MODES = sizeof(modes) / sizeof(modes[0]);
+
+// Results of one file in one mode
+struct FileResult {
+	string file;
+	int original_size;
+	int compressed_size;
+	unsigned long long cycles;
+	bool verified;
+};
+
+// Accumulated results of one mode
+struct ModeResult {
+	string mode;
+	vector<FileResult> files;
+	double original_size;
+	double compressed_size;
+	double cycles;
+	int skipped;
+	int failures;
+
+	ModeResult(const string& mode) : mode(mode), original_size(0), compressed_size(0), cycles(0), skipped(0), failures(0) {}
+
+	double cyclesPerByte() {
+		return original_size > 0 ? cycles / original_size : 0;
+	}
+};
+
+// Run a program with its output discarded
+static bool run(const vector<string>& args) {
+	vector<char*> argv;
+	for (int i = 0 ; i < args.size() ; i++) {
+		argv.push_back((char *) args[i].c_str());
+	}
+	argv.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0) return false;
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, 1);
+			dup2(null_fd, 2);
+		}
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) != pid) return false;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool readFile(const string& filename, vector<unsigned char>& contents) {
+	contents.clear();
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (!file) return false;
+	unsigned char buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		contents.insert(contents.end(), buffer, buffer + n);
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+static bool writeFile(const string& filename, const vector<unsigned char>& contents) {
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (!file) return false;
+	bool ok = contents.empty() || fwrite(&contents[0], 1, contents.size(), file) == contents.size();
+	return fclose(file) == 0 && ok;
+}
+
+// Regular files in a directory, sorted by name
+static vector<string> listFiles(const string& dirname) {
+	vector<string> files;
+	DIR *dir = opendir(dirname.c_str());
+	if (!dir) {
+		printf("Error: Could not open directory %s\n\n", dirname.c_str());
+		exit(1);
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		string path = dirname + "/" + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			files.push_back(path);
+		}
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+	return files;
+}
+
+static void putLongword(vector<unsigned char>& out, unsigned value) {
+	out.push_back(value >> 24);
+	out.push_back(value >> 16);
+	out.push_back(value >> 8);
+	out.push_back(value);
+}
+
+// An executable with the data, padded to whole longwords, as its only hunk
+static vector<unsigned char> makeExecutable(const vector<unsigned char>& data) {
+	vector<unsigned char> exe;
+	unsigned longwords = (data.size() + 3) / 4;
+	putLongword(exe, HUNK_HEADER);
+	putLongword(exe, 0);
+	putLongword(exe, 1);
+	putLongword(exe, 0);
+	putLongword(exe, 0);
+	putLongword(exe, longwords);
+	putLongword(exe, HUNK_CODE);
+	putLongword(exe, longwords);
+	exe.insert(exe.end(), data.begin(), data.end());
+	exe.resize(exe.size() + longwords * 4 - data.size(), 0);
+	putLongword(exe, HUNK_END);
+	return exe;
+}
+
+// Run the Amiga code and compare the result with the original data.
+// Returns whether the code ran to its end and produced the original.
+static bool decrunch(const Mode& mode, const vector<unsigned char>& crunched, const vector<unsigned char>& original,
+                     const vector<unsigned char>& decompressor, unsigned long long *cycles_out) {
+	const unsigned long long MAX_INSTRUCTIONS = 100ULL * original.size() + 10000000;
+	Amiga amiga;
+	unsigned destination;
+	if (mode.executable) {
+		vector<unsigned> hunks = amiga.loadSeg(crunched);
+		if (hunks.size() <= mode.program_hunk) return false;
+		// Started by the shell with an empty command line
+		unsigned args = amiga.alloc(4);
+		amiga.write(args, 1, '\n');
+		amiga.d[0] = 1;
+		amiga.a[0] = args;
+		amiga.push(Amiga::EXIT_ADDRESS);
+		amiga.pc = hunks[0];
+		amiga.stop_address = hunks[mode.program_hunk];
+		destination = hunks[mode.program_hunk];
+	} else {
+		unsigned code = amiga.alloc(decompressor.size());
+		unsigned source = amiga.alloc(crunched.size() + 4);
+		destination = amiga.alloc(original.size() + 4);
+		if (code == 0 || source == 0 || destination == 0) return false;
+		for (int i = 0 ; i < decompressor.size() ; i++) amiga.write(code + i, 1, decompressor[i]);
+		for (int i = 0 ; i < crunched.size() ; i++) amiga.write(source + i, 1, crunched[i]);
+		amiga.a[0] = source;
+		amiga.a[1] = destination;
+		amiga.a[2] = 0;
+		amiga.d[7] = 1;
+		amiga.push(Amiga::EXIT_ADDRESS);
+		amiga.pc = code;
+		amiga.stop_address = Amiga::EXIT_ADDRESS;
+	}
+	if (!amiga.run(MAX_INSTRUCTIONS)) {
+		printf("  Error: %s\n", amiga.error.c_str());
+		return false;
+	}
+	*cycles_out = amiga.cycles;
+	for (int i = 0 ; i < original.size() ; i++) {
+		if (amiga.memory[destination + i] != original[i]) return false;
+	}
+	return true;
+}
+
+static void benchFile(ModeResult& result, const Mode& mode, const string& file, const string& work_dir,
+                      const string& shrinkler, const vector<string>& options, const vector<unsigned char>& decompressor) {
+	string input = work_dir + "/decrunchbench.in";
+	string packed = work_dir + "/decrunchbench.shr";
+
+	FileResult fr;
+	fr.file = file;
+	fr.compressed_size = 0;
+	fr.cycles = 0;
+	fr.verified = false;
+
+	vector<unsigned char> original;
+	vector<unsigned char> crunched;
+	readFile(file, original);
+	fr.original_size = original.size();
+	if (original.empty()) {
+		result.skipped++;
+		return;
+	}
+
+	vector<string> args;
+	args.push_back(shrinkler);
+	args.push_back("-p");
+	if (mode.option) args.push_back(mode.option);
+	args.insert(args.end(), options.begin(), options.end());
+	if (mode.executable) {
+		writeFile(input, makeExecutable(original));
+		args.push_back(input);
+	} else {
+		args.push_back(file);
+	}
+	args.push_back(packed);
+	bool crunched_ok = run(args) && readFile(packed, crunched);
+	remove(input.c_str());
+	remove(packed.c_str());
+	if (!crunched_ok) {
+		// Not every file can be crunched in every mode (e.g. too large for mini)
+		result.skipped++;
+		return;
+	}
+
+	fr.compressed_size = crunched.size();
+	fr.verified = decrunch(mode, crunched, original, decompressor, &fr.cycles);
+
+	result.files.push_back(fr);
+	if (!fr.verified) {
+		result.failures++;
+		printf("  FAILED: %s\n", file.c_str());
+		return;
+	}
+	result.original_size += fr.original_size;
+	result.compressed_size += fr.compressed_size;
+	result.cycles += fr.cycles;
+}
+
+static string jsonString(const string& s) {
+	string out = "\"";
+	for (int i = 0 ; i < s.size() ; i++) {
+		char c = s[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if ((unsigned char) c < 0x20) {
+			char escape[8];
+			sprintf(escape, "\\u%04x", c);
+			out += escape;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+// Write the results as JSON. Each mode result is on a line of its own,
+// which is what readBaseline expects.
+static bool writeResults(const char *filename, vector<ModeResult>& results) {
+	FILE *file = fopen(filename, "w");
+	if (!file) return false;
+	fprintf(file, "{\n  \"results\": [\n");
+	for (int m = 0 ; m < results.size() ; m++) {
+		ModeResult& r = results[m];
+		fprintf(file, "    { \"mode\": %s, \"files\": %d, \"original\": %.0f, \"compressed\": %.0f, "
+		              "\"cycles\": %.0f, \"cycles_per_byte\": %.6f, \"skipped\": %d, \"failures\": %d }%s\n",
+			jsonString(r.mode).c_str(), (int) r.files.size(), r.original_size, r.compressed_size,
+			r.cycles, r.cyclesPerByte(), r.skipped, r.failures, m + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"files\": [\n");
+	bool first = true;
+	for (int m = 0 ; m < results.size() ; m++) {
+		ModeResult& r = results[m];
+		for (int f = 0 ; f < r.files.size() ; f++) {
+			FileResult& fr = r.files[f];
+			fprintf(file, "%s    { \"mode\": %s, \"file\": %s, \"original\": %d, \"compressed\": %d, "
+			              "\"cycles\": %llu, \"verified\": %s }",
+				first ? "" : ",\n", jsonString(r.mode).c_str(), jsonString(fr.file).c_str(), fr.original_size, fr.compressed_size,
+				fr.cycles, fr.verified ? "true" : "false");
+			first = false;
+		}
+	}
+	fprintf(file, "\n  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+// Baseline speed of one mode
+struct Baseline {
+	string mode;
+	double cycles_per_byte;
+};
+
+// Read the mode results of a file written by writeResults
+static vector<Baseline> readBaseline(const char *filename) {
+	vector<Baseline> baselines;
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		printf("Error: Could not open baseline file %s\n\n", filename);
+		exit(1);
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		char mode[256];
+		Baseline b;
+		const char *cycles = strstr(line, "\"cycles_per_byte\":");
+		if (sscanf(line, " { \"mode\": \"%255[^\"]\",", mode) == 1 && cycles &&
+		    sscanf(cycles, "\"cycles_per_byte\": %lf", &b.cycles_per_byte) == 1) {
+			b.mode = mode;
+			baselines.push_back(b);
+		}
+	}
+	fclose(file);
+	return baselines;
+}
+
+static void usage() {
+	printf("Usage: decrunchbench <options> <directories>\n");
+	printf("\n");
+	printf("Available options are (default values in parentheses):\n");
+	printf(" --modes LIST       Modes to benchmark, separated by commas (plain,overlap,mini,data)\n");
+	printf(" --options LIST     Extra Shrinkler options, separated by commas (-1)\n");
+	printf(" --json FILE        Write results as JSON (decrunchbench.json)\n");
+	printf(" --baseline FILE    Compare cycles per byte against the results of an earlier run\n");
+	printf(" --tolerance PCT    Allowed increase in cycles per byte relative to the baseline (1)\n");
+	printf(" --work DIR         Directory for temporary files (.)\n");
+	printf(" --shrinkler PATH   Shrinkler executable (build/native/Shrinkler)\n");
+	printf(" --decompress PATH  Assembled ShrinklerDecompress (decrunchers_bin/ShrinklerDecompress.bin)\n");
+	printf("\n");
+	exit(1);
+}
+
+static vector<string> splitList(const char *list) {
+	vector<string> items;
+	string item;
+	for (const char *p = list ; ; p++) {
+		if (*p == ',' || *p == '\0') {
+			if (!item.empty()) items.push_back(item);
+			item.clear();
+			if (*p == '\0') break;
+		} else {
+			item += *p;
+		}
+	}
+	return items;
+}
+
+int main(int argc, const char *argv[]) {
+	vector<string> mode_names;
+	vector<string> options;
+	options.push_back("-1");
+	const char *json_file = "decrunchbench.json";
+	const char *baseline_file = NULL;
+	double tolerance = 1;
+	string work_dir = ".";
+	string shrinkler = "build/native/Shrinkler";
+	string decompress = "decrunchers_bin/ShrinklerDecompress.bin";
+	vector<string> dirs;
+
+	for (int i = 1 ; i < argc ; i++) {
+		string arg = argv[i];
+		if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-') {
+			if (i + 1 >= argc) usage();
+			const char *value = argv[++i];
+			if (arg == "--modes") {
+				mode_names = splitList(value);
+			} else if (arg == "--options") {
+				options = splitList(value);
+			} else if (arg == "--json") {
+				json_file = value;
+			} else if (arg == "--baseline") {
+				baseline_file = value;
+			} else if (arg == "--tolerance") {
+				tolerance = atof(value);
+			} else if (arg == "--work") {
+				work_dir = value;
+			} else if (arg == "--shrinkler") {
+				shrinkler = value;
+			} else if (arg == "--decompress") {
+				decompress = value;
+			} else {
+				usage();
+			}
+		} else {
+			dirs.push_back(arg);
+		}
+	}
+	if (dirs.empty()) usage();
+
+	vector<const Mode*> selected;
+	for (int m = 0 ; m < NUM_MODES ; m++) {
+		if (mode_names.empty() || std::find(mode_names.begin(), mode_names.end(), modes[m].name) != mode_names.end()) {
+			selected.push_back(&modes[m]);
+		}
+	}
+	if (selected.size() < std::max<size_t>(mode_names.size(), 1)) usage();
+
+	vector<unsigned char> decompressor;
+	for (int m = 0 ; m < selected.size() ; m++) {
+		if (!selected[m]->executable && !readFile(decompress, decompressor)) {
+			printf("Error: Could not read %s\n\n", decompress.c_str());
+			return 1;
+		}
+	}
+
+	vector<string> files;
+	for (int d = 0 ; d < dirs.size() ; d++) {
+		vector<string> dir_files = listFiles(dirs[d]);
+		files.insert(files.end(), dir_files.begin(), dir_files.end());
+	}
+
+	printf("Benchmarking %d files in %d directories...\n\n", (int) files.size(), (int) dirs.size());
+	vector<ModeResult> results;
+	for (int m = 0 ; m < selected.size() ; m++) {
+		ModeResult result(selected[m]->name);
+		printf("%s...\n", selected[m]->name);
+		fflush(stdout);
+		for (int f = 0 ; f < files.size() ; f++) {
+			benchFile(result, *selected[m], files[f], work_dir, shrinkler, options, decompressor);
+		}
+		results.push_back(result);
+	}
+
+	vector<Baseline> baselines;
+	if (baseline_file) {
+		baselines = readBaseline(baseline_file);
+	}
+
+	printf("\nMode      Files  Original  Compressed      Cycles  Cycles/byte\n");
+	int failures = 0;
+	int regressions = 0;
+	for (int m = 0 ; m < results.size() ; m++) {
+		ModeResult& r = results[m];
+		printf("%-8s %6d %9.0f %11.0f %11.0f %12.2f\n", r.mode.c_str(), (int) r.files.size() - r.failures,
+			r.original_size, r.compressed_size, r.cycles, r.cyclesPerByte());
+		if (r.skipped > 0) {
+			printf("  %d file%s could not be crunched in this mode\n", r.skipped, r.skipped == 1 ? "" : "s");
+		}
+		failures += r.failures;
+		for (int b = 0 ; b < baselines.size() ; b++) {
+			if (baselines[b].mode != r.mode) continue;
+			if (baselines[b].cycles_per_byte > 0 && r.cyclesPerByte() > baselines[b].cycles_per_byte * (1 + tolerance / 100)) {
+				printf("  Regression: %.2f cycles per byte, baseline %.2f\n", r.cyclesPerByte(), baselines[b].cycles_per_byte);
+				regressions++;
+			}
+		}
+	}
+	printf("\n");
+
+	if (!writeResults(json_file, results)) {
+		printf("Error while writing file %s\n\n", json_file);
+		return 1;
+	}
+	printf("Results written to %s\n\n", json_file);
+
+	if (failures > 0) {
+		printf("%d file%s failed to decrunch correctly.\n\n", failures, failures == 1 ? "" : "s");
+	}
+	if (regressions > 0) {
+		printf("%d speed regression%s beyond %.0f%%.\n\n", regressions, regressions == 1 ? "" : "s", tolerance);
+	}
+	return failures > 0 || regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Microbenchmarks of the inner data structures of the parser.
+
+The structures are driven by a trace of a real parse, as written to
+trace_cpp.bin by the --trace option of a Shrinkler built with TRACE=1. The
+positions, edges and
+matches of the trace are replayed against each structure in the pattern the
+parser uses it:
+
+CuckooHash:      Edges are put into maps by target position and offset. At
+                 each position, the map of edges ending there is moved into
+                 the map of best edges by offset and cleared.
+Heap:            Edges are inserted as they are created, removed when their
+                 target is reached, and the largest removed whenever more
+                 edges than the reference capacity are in the heap.
+BucketQueue:     The same as Heap, for the bucket queue alternative.
+RefEdgeFactory:  Edges are created as in the trace and destroyed in creation
+                 order whenever the factory is full.
+MatchFinder:     Matches are found at every position where the parser looked
+                 for matches in the first iteration. Requires the parsed data.
+HashChainFinder: The same as MatchFinder, for the hash chain alternative with
+                 a window of 1 MB.
+
+The map and heap benchmarks are templates over the structure, so proposed
+replacements with the same interface can be compared directly against the
+current ones. Each benchmark is repeated, and the fastest run is reported.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "../cruncher/LZParser.h"
+#include "../cruncher/MatchFinder.h"
+#include "../cruncher/HashChainFinder.h"
+#include "../cruncher/Timer.h"
+#include "../cruncher/Trace.h"
+
+using std::vector;
+
+// Replayed trace events
+struct TraceEvent {
+	enum { ASSIMILATE, CREATE } type;
+	int pos;
+	int offset;
+	int length;
+	int total_size;
+};
+
+struct Trace {
+	vector<TraceEvent> events;
+	vector<int> first_iteration_positions;
+	int n_creates;
+	int max_length;
+	long n_matches;
+};
+
+static Trace readTrace(const char *filename, int max_creates) {
+	Trace trace;
+	trace.n_creates = 0;
+	trace.max_length = 0;
+	trace.n_matches = 0;
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		printf("Error: Could not open trace file %s\n\n", filename);
+		exit(1);
+	}
+	if (!readTraceHeader(file)) {
+		printf("Error: %s is not a trace file\n\n", filename);
+		exit(1);
+	}
+	TraceRecord record;
+	int last_pos = 0;
+	bool first_iteration = true;
+	while (readTraceRecord(file, &record) && trace.n_creates < max_creates) {
+		TraceEvent e;
+		if (record.type == TRACE_ASSIMILATE_START) {
+			e.type = TraceEvent::ASSIMILATE;
+			e.pos = record.values[0];
+			if (e.pos < last_pos) first_iteration = false;
+			if (first_iteration) trace.first_iteration_positions.push_back(e.pos);
+			last_pos = e.pos;
+			trace.events.push_back(e);
+		} else if (record.type == TRACE_EDGE_CREATED) {
+			e.type = TraceEvent::CREATE;
+			e.pos = record.values[0];
+			e.offset = record.values[1];
+			e.length = record.values[2];
+			e.total_size = record.values[3];
+			trace.max_length = max(trace.max_length, e.length);
+			trace.n_creates++;
+			trace.events.push_back(e);
+		} else if (first_iteration && record.type == TRACE_MATCH) {
+			trace.n_matches++;
+		}
+	}
+	fclose(file);
+	return trace;
+}
+
+// Edges of all create events, allocated up front
+class TraceEdges {
+	RefEdgeFactory factory;
+public:
+	vector<RefEdge*> edges;
+
+	TraceEdges(const Trace& trace) : factory(max(1, trace.n_creates)) {
+		for (int i = 0 ; i < trace.events.size() ; i++) {
+			const TraceEvent& e = trace.events[i];
+			if (e.type == TraceEvent::CREATE) {
+				edges.push_back(factory.create(e.pos, e.offset, e.length, e.total_size, NULL));
+			}
+		}
+	}
+
+	~TraceEdges() {
+		for (int i = 0 ; i < edges.size() ; i++) {
+			factory.destroy(edges[i], false);
+		}
+	}
+};
+
+template <class Map>
+long benchMap(const Trace& trace, const vector<RefEdge*>& edges) {
+	int ring_size = 1;
+	while (ring_size <= trace.max_length) ring_size *= 2;
+	vector<Map> edges_to_pos(ring_size);
+	Map best_for_offset;
+	long ops = 0;
+	int edge_index = 0;
+	int last_pos = 0;
+	for (int i = 0 ; i < trace.events.size() ; i++) {
+		const TraceEvent& e = trace.events[i];
+		if (e.type == TraceEvent::CREATE) {
+			Map& edges_to = edges_to_pos[(e.pos + e.length) & (ring_size - 1)];
+			if (edges_to.count(e.offset) == 0) {
+				edges_to[e.offset] = edges[edge_index];
+			}
+			ops += 2 + best_for_offset.count(e.offset);
+			edge_index++;
+		} else {
+			if (e.pos < last_pos) {
+				best_for_offset.clear();
+				for (int t = 0 ; t < ring_size ; t++) {
+					edges_to_pos[t].clear();
+				}
+			}
+			last_pos = e.pos;
+			Map& edges_here = edges_to_pos[e.pos & (ring_size - 1)];
+			for (typename Map::iterator it = edges_here.begin() ; it != edges_here.end() ; it++) {
+				best_for_offset[it->first] = it->second;
+				ops++;
+			}
+			edges_here.clear();
+			ops++;
+		}
+	}
+	return ops;
+}
+
+template <class Queue>
+long benchHeap(const Trace& trace, const vector<RefEdge*>& edges, int capacity) {
+	int ring_size = 1;
+	while (ring_size <= trace.max_length) ring_size *= 2;
+	vector<vector<RefEdge*> > edges_to_pos(ring_size);
+	Queue queue;
+	long ops = 0;
+	int edge_index = 0;
+	int last_pos = 0;
+	for (int i = 0 ; i < trace.events.size() ; i++) {
+		const TraceEvent& e = trace.events[i];
+		if (e.type == TraceEvent::CREATE) {
+			RefEdge *edge = edges[edge_index++];
+			queue.insert(edge);
+			edges_to_pos[(e.pos + e.length) & (ring_size - 1)].push_back(edge);
+			ops++;
+			if (queue.size() > capacity) {
+				queue.remove_largest();
+				ops++;
+			}
+		} else {
+			if (e.pos < last_pos) {
+				queue.clear();
+				for (int t = 0 ; t < ring_size ; t++) {
+					edges_to_pos[t].clear();
+				}
+			}
+			last_pos = e.pos;
+			vector<RefEdge*>& edges_here = edges_to_pos[e.pos & (ring_size - 1)];
+			for (int j = 0 ; j < edges_here.size() ; j++) {
+				queue.remove(edges_here[j]);
+				ops++;
+			}
+			edges_here.clear();
+		}
+	}
+	return ops;
+}
+
+long benchFactory(const Trace& trace, int capacity) {
+	RefEdgeFactory factory(capacity);
+	vector<RefEdge*> live(capacity);
+	int oldest = 0;
+	int n_live = 0;
+	long ops = 0;
+	for (int i = 0 ; i < trace.events.size() ; i++) {
+		const TraceEvent& e = trace.events[i];
+		if (e.type != TraceEvent::CREATE) continue;
+		if (factory.full()) {
+			factory.destroy(live[oldest], true);
+			oldest = (oldest + 1) % capacity;
+			n_live--;
+			ops++;
+		}
+		live[(oldest + n_live++) % capacity] = factory.create(e.pos, e.offset, e.length, e.total_size, NULL);
+		ops++;
+	}
+	while (n_live > 0) {
+		factory.destroy(live[oldest], false);
+		oldest = (oldest + 1) % capacity;
+		n_live--;
+	}
+	return ops;
+}
+
+long benchMatchFinder(MatchFinder& finder, const vector<int>& positions) {
+	long matches = 0;
+	for (int i = 0 ; i < positions.size() ; i++) {
+		finder.beginMatching(positions[i]);
+		int match_pos, match_length;
+		while (finder.nextMatch(&match_pos, &match_length)) {
+			matches++;
+		}
+	}
+	return matches;
+}
+
+static void report(const char *name, long ops, double seconds) {
+	printf("%-16s %12ld %10.3f %10.2f\n", name, ops, seconds * 1000, ops > 0 ? seconds * 1e9 / ops : 0.0);
+	fflush(stdout);
+}
+
+// Run a benchmark the given number of times and report the fastest run
+#define BENCH(name, repeat, call) do { \
+	double best = 0; \
+	long ops = 0; \
+	for (int r = 0 ; r < repeat ; r++) { \
+		double start = timeSeconds(); \
+		ops = call; \
+		double seconds = timeSeconds() - start; \
+		if (r == 0 || seconds < best) best = seconds; \
+	} \
+	report(name, ops, best); \
+} while (0)
+
+static void usage() {
+	printf("Usage: microbench <options> <trace file>\n");
+	printf("\n");
+	printf("Available options are (default values in parentheses):\n");
+	printf(" --data FILE        Data parsed in the trace, to benchmark the match finder\n");
+	printf(" --repeat N         Number of runs of each benchmark (3)\n");
+	printf(" --max-edges N      Maximum number of edges to read from the trace (2000000)\n");
+	printf(" -1, ..., -9        Preset for the match finder options, as for Shrinkler (-3)\n");
+	printf(" -r, --references   Reference edge capacity, as for Shrinkler (100000)\n");
+	printf(" -e, --effort       Match finder effort, as for Shrinkler (300)\n");
+	printf(" -a, --same-length  Match finder same length, as for Shrinkler (30)\n");
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, const char *argv[]) {
+	const char *trace_file = NULL;
+	const char *data_file = NULL;
+	int repeat = 3;
+	int max_edges = 2000000;
+	int references = 100000;
+	int effort = 300;
+	int same_length = 30;
+	for (int i = 1 ; i < argc ; i++) {
+		const char *arg = argv[i];
+		if (arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9' && arg[2] == 0) {
+			int p = arg[1] - '0';
+			effort = 100*p;
+			same_length = 10*p;
+		} else if (arg[0] == '-') {
+			if (i + 1 >= argc) usage();
+			const char *value = argv[++i];
+			if (strcmp(arg, "--data") == 0) {
+				data_file = value;
+			} else if (strcmp(arg, "--repeat") == 0) {
+				repeat = max(1, atoi(value));
+			} else if (strcmp(arg, "--max-edges") == 0) {
+				max_edges = max(1, atoi(value));
+			} else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--references") == 0) {
+				references = max(1000, atoi(value));
+			} else if (strcmp(arg, "-e") == 0 || strcmp(arg, "--effort") == 0) {
+				effort = max(0, atoi(value));
+			} else if (strcmp(arg, "-a") == 0 || strcmp(arg, "--same-length") == 0) {
+				same_length = max(1, atoi(value));
+			} else {
+				usage();
+			}
+		} else if (trace_file == NULL) {
+			trace_file = arg;
+		} else {
+			usage();
+		}
+	}
+	if (trace_file == NULL) usage();
+
+	printf("Reading trace %s...\n", trace_file);
+	fflush(stdout);
+	Trace trace = readTrace(trace_file, max_edges);
+	printf("%d positions, %d edges, %ld matches in first iteration\n\n",
+		(int) (trace.events.size() - trace.n_creates), trace.n_creates, trace.n_matches);
+
+	printf("Benchmark                 Ops    Time ms      ns/op\n");
+	{
+		TraceEdges trace_edges(trace);
+		BENCH("CuckooHash", repeat, benchMap<CuckooHash<RefEdge*> >(trace, trace_edges.edges));
+		BENCH("Heap", repeat, benchHeap<Heap<RefEdge*> >(trace, trace_edges.edges, references));
+		BENCH("BucketQueue", repeat, benchHeap<BucketQueue<RefEdge*> >(trace, trace_edges.edges, references));
+	}
+	BENCH("RefEdgeFactory", repeat, benchFactory(trace, references));
+
+	if (data_file) {
+		FILE *file = fopen(data_file, "rb");
+		if (!file) {
+			printf("Error: Could not open data file %s\n\n", data_file);
+			exit(1);
+		}
+		vector<unsigned char> data;
+		int c;
+		while ((c = fgetc(file)) != EOF) {
+			data.push_back(c);
+		}
+		fclose(file);
+		if (data.empty()) {
+			printf("Error: Data file %s is empty\n\n", data_file);
+			exit(1);
+		}
+		SuffixArrayFinder finder(&data[0], data.size(), 2, effort, same_length);
+		BENCH("MatchFinder", repeat, benchMatchFinder(finder, trace.first_iteration_positions));
+		HashChainFinder chain_finder(&data[0], data.size(), 2, effort, same_length, 1 << 20);
+		BENCH("HashChainFinder", repeat, benchMatchFinder(chain_finder, trace.first_iteration_positions));
+	}
+	printf("\n");
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Print a binary parse trace, as written to trace_cpp.bin by the --trace
+option of a Shrinkler built with TRACE=1, as text.
+
+Each record is printed on a line of its own, with the names and values of
+its fields, in the same format as the text trace of the C version. Only the
+records of the given types are printed if any are given.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../cruncher/Trace.h"
+
+static void usage() {
+	printf("Usage: tracedump <trace file> [<record type> ...]\n");
+	printf("\n");
+	printf("Record types are:");
+	for (int t = 0 ; t < NUM_TRACE_RECORD_TYPES ; t++) {
+		printf(" %s", trace_formats[t].name);
+	}
+	printf("\n\n");
+	exit(1);
+}
+
+int main(int argc, const char *argv[]) {
+	if (argc < 2) usage();
+	bool selected[NUM_TRACE_RECORD_TYPES];
+	for (int t = 0 ; t < NUM_TRACE_RECORD_TYPES ; t++) {
+		selected[t] = argc == 2;
+	}
+	for (int i = 2 ; i < argc ; i++) {
+		int t = 0;
+		while (t < NUM_TRACE_RECORD_TYPES && strcmp(argv[i], trace_formats[t].name) != 0) t++;
+		if (t == NUM_TRACE_RECORD_TYPES) usage();
+		selected[t] = true;
+	}
+
+	FILE *file = fopen(argv[1], "rb");
+	if (!file) {
+		printf("Error: Could not open trace file %s\n\n", argv[1]);
+		exit(1);
+	}
+	if (!readTraceHeader(file)) {
+		printf("Error: %s is not a trace file\n\n", argv[1]);
+		exit(1);
+	}
+	printf("=== C++ VERSION TRACE START ===\n");
+	TraceRecord record;
+	while (readTraceRecord(file, &record)) {
+		if (!selected[record.type]) continue;
+		const TraceRecordFormat& format = trace_formats[record.type];
+		if (record.type == TRACE_EDGE_CREATED) {
+			printf("LZPARSER: DECISION pos=%d offset=%d length=%d total_size=%d reason=NEW_EDGE\n",
+				record.values[0], record.values[1], record.values[2], record.values[3]);
+		}
+		printf("LZPARSER: %s", format.name);
+		for (int v = 0 ; v < format.n_values ; v++) {
+			printf(" %s=%d", format.value_names[v], record.values[v]);
+		}
+		printf("\n");
+	}
+	printf("=== C++ VERSION TRACE END ===\n");
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,155 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Bucket-based priority queue with removal support, with the same interface
+as Heap. Used in place of Heap when built with SHRINKLER_BUCKET_QUEUE.
+
+The element type must have an accessible _heap_index integer field, and
+BucketKey must be specialized for it to give the integer key of an element.
+The key must not change while the element is in the queue.
+
+Elements are kept in unordered buckets by key, with the _heap_index giving
+the place of the element in its bucket, so insertion and removal take
+constant time. The largest element is taken from the highest nonempty
+bucket. Equal keys are removed most recently inserted first.
+
+The buckets cover a window of consecutive keys, which moves up with the
+largest key inserted. Elements with keys below the window are kept in a
+single unordered list, which is only searched when the window runs empty.
+
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+using std::max;
+
+template <class T> struct BucketKey;
+
+template <class T, class Key = BucketKey<T> >
+class BucketQueue {
+	static const int WINDOW_SIZE = 1 << 12;
+
+	// Ring of buckets, indexed by key modulo the window size
+	vector<vector<T> > buckets;
+	vector<T> below;
+	Key key;
+
+	// Lowest key in the window, highest key with a nonempty bucket (or
+	// higher), and the number of elements in the window.
+	int base;
+	int top;
+	int window_count;
+
+	vector<T>& container(int k) {
+		return k >= base ? buckets[k & (WINDOW_SIZE - 1)] : below;
+	}
+
+	void add(vector<T>& list, T t) {
+		t->_heap_index = list.size();
+		list.push_back(t);
+	}
+
+	T remove_index(vector<T>& list, int i) {
+		T removed = list[i];
+		T last = list[list.size()-1];
+		list[i] = last;
+		last->_heap_index = i;
+		list.pop_back();
+		return removed;
+	}
+
+	// Move the window up to end at new_top. Buckets falling out of the
+	// window are moved to the list below it.
+	void slide(int new_top) {
+		int new_base = new_top - WINDOW_SIZE + 1;
+		for (int k = base ; k < new_base && k <= top ; k++) {
+			vector<T>& bucket = buckets[k & (WINDOW_SIZE - 1)];
+			for (int i = 0 ; i < bucket.size() ; i++) {
+				add(below, bucket[i]);
+			}
+			window_count -= bucket.size();
+			bucket.clear();
+		}
+		base = new_base;
+	}
+
+	// Move the empty window down to end at the largest key below it
+	void refill() {
+		int max_key = key(below[0]);
+		for (int i = 1 ; i < below.size() ; i++) {
+			max_key = max(max_key, key(below[i]));
+		}
+		base = max_key - WINDOW_SIZE + 1;
+		top = max_key;
+		int i = 0;
+		while (i < below.size()) {
+			int k = key(below[i]);
+			if (k >= base) {
+				add(buckets[k & (WINDOW_SIZE - 1)], remove_index(below, i));
+				window_count++;
+			} else {
+				i++;
+			}
+		}
+	}
+
+public:
+	BucketQueue() : buckets(WINDOW_SIZE), base(0), top(0), window_count(0) {}
+
+	void insert(T t) {
+		int k = key(t);
+		if (size() == 0) {
+			base = k - WINDOW_SIZE / 2;
+			top = k;
+		}
+		if (k >= base + WINDOW_SIZE) slide(k);
+		if (k >= base) {
+			add(buckets[k & (WINDOW_SIZE - 1)], t);
+			window_count++;
+			top = max(top, k);
+		} else {
+			add(below, t);
+		}
+	}
+
+	void remove(T t) {
+		if (contains(t)) {
+			int k = key(t);
+			if (k >= base) window_count--;
+			remove_index(container(k), t->_heap_index);
+		}
+	}
+
+	T remove_largest() {
+		if (window_count == 0) refill();
+		while (buckets[top & (WINDOW_SIZE - 1)].empty()) top--;
+		vector<T>& bucket = buckets[top & (WINDOW_SIZE - 1)];
+		window_count--;
+		return remove_index(bucket, bucket.size()-1);
+	}
+
+	bool contains(T t) {
+		vector<T>& list = container(key(t));
+		return t->_heap_index < list.size() && list[t->_heap_index] == t;
+	}
+
+	int size() {
+		return window_count + below.size();
+	}
+
+	void clear() {
+		if (window_count > 0) {
+			for (int k = max(base, top - WINDOW_SIZE + 1) ; k <= top ; k++) {
+				buckets[k & (WINDOW_SIZE - 1)].clear();
+			}
+		}
+		below.clear();
+		window_count = 0;
+	}
+
+};
@@ -4,22 +4,110 @@
 
 Abstract interface for entropy coding.
 
+Coders whose sizes do not depend on previously coded bits can cache the
+sizes of numbers in a NumberSizeTable. Small numbers are looked up in a
+table of their own. For larger numbers, the size is the size of the prefix
+giving the number of bits plus the sizes of the bits themselves, looked up
+a byte at a time. The memory and build time of the table thus stay the same
+however large the numbers get.
+
 */
 
 #pragma once
 
 #include "assert.h"
 
+#include <algorithm>
 #include <vector>
 
+using std::min;
 using std::vector;
 
+class NumberSizeTable {
+public:
+	// Contexts of a number, relative to its base context
+	static const int NUM_BIT_CONTEXTS = 64;
+
+	// Numbers below this have their sizes in the direct table
+	static const int DIRECT_NUMBERS = 1 << 16;
+
+private:
+	vector<unsigned short> direct;
+	// Size of the prefix of numbers with the given number of data bits
+	// (less one), less the sizes of zero bits in the positions above them
+	int prefix_size[32];
+	// Summed sizes of the bits of each byte of the data bits
+	int byte_sizes[4][256];
+
+	// Bit position of the most significant one bit of a number > 0
+	static int topBit(unsigned number) {
+#if defined(__GNUC__)
+		return 31 - __builtin_clz(number);
+#else
+		int bit = 0;
+		while (number >>= 1) bit++;
+		return bit;
+#endif
+	}
+
+	int computeSize(int number) const {
+		int top = topBit(number);
+		unsigned data = number - (1u << top);
+		return prefix_size[top - 1] + byte_sizes[0][data & 255] + byte_sizes[1][(data >> 8) & 255]
+		     + byte_sizes[2][(data >> 16) & 255] + byte_sizes[3][data >> 24];
+	}
+
+public:
+	// Fill the table from the sizes of coding each bit value in each context
+	// of the number. The direct table covers numbers up to max_number. The
+	// given size is added per bit of the number, counting the prefix bits.
+	void build(const int bit_sizes[NUM_BIT_CONTEXTS][2], int max_number, int size_per_bit = 0) {
+		// Data bit i is coded in context i * 2 + 1, and the prefix bits for
+		// i data bits (less one) in contexts 2, 4, ..., i * 2 + 2.
+		int above_size = 0;
+		for (int i = 31 ; i >= 0 ; i--) {
+			int unary_size = 0;
+			for (int j = 0 ; j < i ; j++) {
+				unary_size += bit_sizes[j * 2 + 2][1];
+			}
+			if (i * 2 + 2 < NUM_BIT_CONTEXTS) {
+				unary_size += bit_sizes[i * 2 + 2][0];
+			}
+			prefix_size[i] = unary_size - above_size + size_per_bit * 2 * (i + 1);
+			above_size += bit_sizes[i * 2 + 1][0];
+		}
+		for (int byte = 0 ; byte < 4 ; byte++) {
+			byte_sizes[byte][0] = 0;
+			for (int bit = 0 ; bit < 8 ; bit++) {
+				byte_sizes[byte][0] += bit_sizes[(byte * 8 + bit) * 2 + 1][0];
+			}
+			for (int value = 1 ; value < 256 ; value++) {
+				// Flip the lowest one bit of the value from zero
+				int lowest = topBit(value & -value);
+				int context = (byte * 8 + lowest) * 2 + 1;
+				byte_sizes[byte][value] = byte_sizes[byte][value & (value - 1)] - bit_sizes[context][0] + bit_sizes[context][1];
+			}
+		}
+
+		direct.resize(max_number < DIRECT_NUMBERS ? max_number + 1 : DIRECT_NUMBERS);
+		for (int number = 2 ; number < direct.size() ; number++) {
+			direct[number] = computeSize(number);
+		}
+	}
+
+	// Coded size of a number >= 2
+	int size(int number) const {
+		if (number < direct.size()) return direct[number];
+		return computeSize(number);
+	}
+};
+
 class Coder {
 	bool cacheable;
 	bool has_cache;
 	int number_context_offset;
 	int n_number_contexts;
-	vector<vector<unsigned short> > cache;
+	vector<NumberSizeTable> cache;
 
 protected:
 	Coder() : cacheable(false), has_cache(false)
@@ -31,40 +119,26 @@ protected:
 	}
 
 public:
-	// Set parameters for number size cache
+	// Set parameters for number size cache. The direct tables cover numbers
+	// up to max_number, and keep their capacity when refilled.
 	void setNumberContexts(int number_context_offset, int n_number_contexts, int max_number) {
 		if (!cacheable) return;
 
 		this->number_context_offset = number_context_offset;
 		this->n_number_contexts = n_number_contexts;
-		cache.clear();
+		cache.resize(n_number_contexts);
 		for (int context_index = 0 ; context_index < n_number_contexts ; context_index++) {
 			int base_context = number_context_offset + (context_index << 8);
-			cache.push_back(vector<unsigned short>());
-			vector<unsigned short>& c = cache.back();
-			c.resize(4);
-			c[2] = code(base_context + 2, 0) + code(base_context + 1, 0);
-			c[3] = code(base_context + 2, 0) + code(base_context + 1, 1);
-			int prev_base = 2;
-			for (int data_bits = 2 ; data_bits < 30 ; data_bits++) {
-				int base = c.size();
-				int base_sizedif = - code(base_context + data_bits * 2 - 2, 0)
-				                   + code(base_context + data_bits * 2 - 2, 1)
-				                   + code(base_context + data_bits * 2, 0);
-				for (int msb = 0 ; msb <= 1 ; msb++) {
-					int sizedif = base_sizedif + code(base_context + data_bits * 2 - 1, msb);
-					for (int tail = 0 ; tail < 1 << (data_bits - 1) ; tail++) {
-						int size = c[prev_base + tail] + sizedif;
-						c.push_back(size);
-						if (c.size() > max_number) goto next_context;
-					}
-				}
-				prev_base = base;
+			int bit_sizes[NumberSizeTable::NUM_BIT_CONTEXTS][2];
+			for (int context = 0 ; context < NumberSizeTable::NUM_BIT_CONTEXTS ; context++) {
+				bit_sizes[context][0] = code(base_context + context, 0);
+				bit_sizes[context][1] = code(base_context + context, 1);
 			}
-			next_context:;
+			cache[context_index].build(bit_sizes, max_number);
 #if 0
-			for (int i = 2 ; i < c.size() ; i++) {
-				assert(c[i] == encodeNumber(base_context, i));
+			has_cache = false;
+			for (int i = 2 ; i <= max_number ; i++) {
+				assert(cache[context_index].size(i) == encodeNumber(base_context, i));
 			}
 #endif
 		}
@@ -82,30 +156,34 @@ public:
 	// Encode a number >= 2 using a variable-length encoding.
 	// Returns the coded size of the number (in fractional bits).
 	int encodeNumber(int base_context, int number) {
+		return encodeNumberAs<Coder>(base_context, number);
+	}
+
+	// As encodeNumber, with the bits coded through the code method of the
+	// given (final) subclass, so the calls can be resolved at compile time.
+	template <class CoderT>
+	int encodeNumberAs(int base_context, int number) {
 		assert(number >= 2);
+		CoderT *coder = static_cast<CoderT*>(this);
 
 		if (has_cache) {
-			int context_index = (base_context - number_context_offset) >> 8;
-			vector<unsigned short>& cache_for_context = cache[context_index];
-			if (number < cache_for_context.size()) {
-				return cache_for_context[number];
-			}
+			return cache[(base_context - number_context_offset) >> 8].size(number);
 		}
 
 		int size = 0;
 		int context;
 		int i;
-		for (i = 0 ; (4 << i) <= number ; i++) {
+		for (i = 0 ; (number >> 2) >= (1 << i) ; i++) {
 			context = base_context + (i * 2 + 2);
-			size += code(context, 1);
+			size += coder->code(context, 1);
 		}
 		context = base_context + (i * 2 + 2);
-		size += code(context, 0);
+		size += coder->code(context, 0);
 
 		for (; i >= 0 ; i--) {
 			int bit = ((number >> i) & 1);
 			context = base_context + (i * 2 + 1);
-			size += code(context, bit);
+			size += coder->code(context, bit);
 		}
 
 		return size;
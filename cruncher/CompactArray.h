@@ -0,0 +1,109 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Compact read-only arrays for the suffix array data of the match finder.
+
+A PackedIndexArray holds indices into data of up to 16 MB in three bytes
+each, and larger ones as plain ints.
+
+A CompactLCPArray holds LCP values in one byte each, or in two bytes each
+if many values do not fit in a byte. Values which do not fit are kept in a
+sorted side table, which is searched when the stored value is the maximum.
+
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+
+class PackedIndexArray {
+	static const int PACKED_LIMIT = 1 << 24;
+
+	vector<unsigned char> packed;
+	vector<int> wide;
+	bool is_packed;
+
+public:
+	PackedIndexArray() : is_packed(false) {}
+
+	void assign(const int *values, int count) {
+		is_packed = count <= PACKED_LIMIT;
+		if (is_packed) {
+			packed.resize(count * 3);
+			for (int i = 0 ; i < count ; i++) {
+				packed[i * 3 + 0] = values[i];
+				packed[i * 3 + 1] = values[i] >> 8;
+				packed[i * 3 + 2] = values[i] >> 16;
+			}
+			vector<int>().swap(wide);
+		} else {
+			wide.assign(values, values + count);
+			vector<unsigned char>().swap(packed);
+		}
+	}
+
+	int operator[](int i) const {
+		if (!is_packed) return wide[i];
+		const unsigned char *p = &packed[i * 3];
+		return p[0] | (p[1] << 8) | (p[2] << 16);
+	}
+};
+
+class CompactLCPArray {
+	// Use two bytes per value if more values than this fraction do not fit
+	// in a byte
+	static const int MAX_BYTE_OVERFLOW_SHIFT = 6;
+
+	vector<unsigned char> bytes;
+	vector<unsigned short> shorts;
+	int max_small;
+	vector<int> overflow_index;
+	vector<int> overflow_value;
+
+	int overflow(int i) const {
+		int o = std::lower_bound(overflow_index.begin(), overflow_index.end(), i) - overflow_index.begin();
+		return overflow_value[o];
+	}
+
+public:
+	CompactLCPArray() : max_small(0) {}
+
+	void assign(const int *values, int count) {
+		int byte_overflows = 0;
+		for (int i = 0 ; i < count ; i++) {
+			if (values[i] >= 255) byte_overflows++;
+		}
+		max_small = byte_overflows > (count >> MAX_BYTE_OVERFLOW_SHIFT) ? 65535 : 255;
+		vector<unsigned char>().swap(bytes);
+		vector<unsigned short>().swap(shorts);
+		overflow_index.clear();
+		overflow_value.clear();
+		if (max_small == 255) {
+			bytes.resize(count);
+		} else {
+			shorts.resize(count);
+		}
+		for (int i = 0 ; i < count ; i++) {
+			int value = values[i];
+			if (value >= max_small) {
+				value = max_small;
+				overflow_index.push_back(i);
+				overflow_value.push_back(values[i]);
+			}
+			if (max_small == 255) {
+				bytes[i] = value;
+			} else {
+				shorts[i] = value;
+			}
+		}
+	}
+
+	int operator[](int i) const {
+		int value = max_small == 255 ? bytes[i] : shorts[i];
+		return value == max_small ? overflow(i) : value;
+	}
+};
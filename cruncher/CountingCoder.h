@@ -5,21 +5,28 @@
 A dummy entropy coder which counts the occurrences of symbols for estimating
 the sizes using a SizeMeasuringCoder during the next compression pass.
 
+The counts can be saved to a file and loaded as the initial estimate of a
+later crunch of similar data, so that fewer iterations are needed.
+
 */
 
 #pragma once
 
+#include <algorithm>
+#include <cstdio>
 #include <vector>
 
+using std::fill;
 using std::vector;
 
 #include "Coder.h"
+#include "Threads.h"
 
 struct ContextCounts {
 	int counts[2];
 };
 
-class CountingCoder : public Coder {
+class CountingCoder final : public Coder {
 	vector<ContextCounts> context_counts;
 
 	friend class SizeMeasuringCoder;
@@ -29,21 +36,86 @@ public:
 		context_counts.resize(n_contexts, init_counts);
 	}
 
-	CountingCoder(CountingCoder *old_counts, CountingCoder *new_counts) {
-		for (int i = 0 ; i < old_counts->context_counts.size() ; i++) {
-			struct ContextCounts old_count = old_counts->context_counts[i];
+	CountingCoder(CountingCoder *old_counts, CountingCoder *new_counts) : context_counts(old_counts->context_counts) {
+		mix(new_counts);
+	}
+
+	virtual int code(int context_index, int bit) {
+		context_counts[context_index].counts[bit]++;
+		return 0;
+	}
+
+	// Set all counts to zero
+	void reset() {
+		struct ContextCounts init_counts = { { 0, 0 } };
+		fill(context_counts.begin(), context_counts.end(), init_counts);
+	}
+
+	// Mix new counts into these counts, which are weighted by three quarters
+	void mix(const CountingCoder *new_counts) {
+		for (int i = 0 ; i < context_counts.size() ; i++) {
+			struct ContextCounts old_count = context_counts[i];
 			struct ContextCounts new_count = new_counts->context_counts[i];
 			struct ContextCounts mixed_count = { {
 				(old_count.counts[0] * 3 + new_count.counts[0]) / 4,
 				(old_count.counts[1] * 3 + new_count.counts[1]) / 4
 			} };
-			context_counts.push_back(mixed_count);
+			context_counts[i] = mixed_count;
 		}
 	}
 
-	virtual int code(int context_index, int bit) {
-		context_counts[context_index].counts[bit]++;
-		return 0;
+	// Add the counts of another coder to the counts of this one
+	void add(const CountingCoder *other) {
+		for (int i = 0 ; i < context_counts.size() ; i++) {
+			context_counts[i].counts[0] += other->context_counts[i].counts[0];
+			context_counts[i].counts[1] += other->context_counts[i].counts[1];
+		}
+	}
+
+	// Divide all counts, rounding down
+	void divide(int divisor) {
+		for (int i = 0 ; i < context_counts.size() ; i++) {
+			context_counts[i].counts[0] /= divisor;
+			context_counts[i].counts[1] /= divisor;
+		}
+	}
+
+	// Write the counts as text to an open file
+	void write(FILE *file) const {
+		fprintf(file, "ShrinklerCounts %d\n", (int) context_counts.size());
+		for (int i = 0 ; i < context_counts.size() ; i++) {
+			fprintf(file, "%d %d\n", context_counts[i].counts[0], context_counts[i].counts[1]);
+		}
+	}
+
+	// Read counts written by write. Fails if they were written for a
+	// different number of contexts.
+	bool read(FILE *file) {
+		int n_contexts;
+		bool ok = fscanf(file, " ShrinklerCounts %d", &n_contexts) == 1 && n_contexts == context_counts.size();
+		for (int i = 0 ; ok && i < context_counts.size() ; i++) {
+			int *counts = context_counts[i].counts;
+			ok = fscanf(file, "%d %d", &counts[0], &counts[1]) == 2 && counts[0] >= 0 && counts[1] >= 0;
+		}
+		return ok;
+	}
+
+	// Write the counts as text
+	bool save(const char *filename) const {
+		FILE *file = fopen(filename, "w");
+		if (!file) return false;
+		write(file);
+		bool ok = !ferror(file);
+		return fclose(file) == 0 && ok;
+	}
+
+	// Read counts written by save
+	bool load(const char *filename) {
+		FILE *file = fopen(filename, "r");
+		if (!file) return false;
+		bool ok = read(file);
+		fclose(file);
+		return ok;
 	}
 
 	void printRange(FILE *out, int first, int num) {
@@ -58,3 +130,26 @@ public:
 	}
 
 };
+
+// Final counts of several parses, which may finish at the same time. The
+// collected counts are the average over the parses.
+class CountCollector {
+	CountingCoder sum;
+	int n_parses;
+	Mutex mutex;
+public:
+	CountCollector(int n_contexts) : sum(n_contexts), n_parses(0) {}
+
+	void add(const CountingCoder *counts) {
+		MutexLock lock(mutex);
+		sum.add(counts);
+		n_parses++;
+	}
+
+	bool save(const char *filename) {
+		MutexLock lock(mutex);
+		CountingCoder average = sum;
+		if (n_parses > 1) average.divide(n_parses);
+		return average.save(filename);
+	}
+};
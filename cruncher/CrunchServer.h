@@ -0,0 +1,288 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Crunch server for build systems which run the cruncher many times.
+
+The server listens on a Unix domain socket and runs each job it receives on
+one of a fixed number of worker threads. A job is a working directory and a
+command line as for the cruncher itself. It runs in a forked copy of the
+server process, so it starts out with everything the server has already set
+up, such as tables and loaded code, and an error in one job cannot affect
+the server or the other jobs. The output of the job is streamed back to the
+client as it is printed, followed by the exit status of the job.
+
+A client sends its working directory and command line to the server, copies
+the output of the job to its own standard output and exits with the status
+of the job. If no server is listening, the client runs the job itself.
+
+All messages are sent in native byte order. A request is a count of strings
+followed by the strings, each as a length and the characters. The first
+string is the working directory. A reply is a sequence of frames, each a
+type byte, a length and that many bytes: output of the job ('o'), or its
+exit status as a 32-bit integer ('x'), which ends the reply.
+
+Only available on platforms with Unix domain sockets.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#include "Threads.h"
+#include "Timer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CRUNCH_SERVER
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+typedef int (*CrunchJobFunc)(int argc, const char *argv[]);
+
+#ifdef CRUNCH_SERVER
+
+// Send all of a buffer, returning false if the peer has gone
+static bool sendAll(int fd, const void *data, size_t length) {
+	const char *p = (const char *) data;
+	while (length > 0) {
+		ssize_t n = write(fd, p, length);
+		if (n <= 0) return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+// Receive a whole buffer, returning false if the peer has gone
+static bool receiveAll(int fd, void *data, size_t length) {
+	char *p = (char *) data;
+	while (length > 0) {
+		ssize_t n = read(fd, p, length);
+		if (n <= 0) return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+static bool sendFrame(int fd, char type, const void *data, unsigned length) {
+	return sendAll(fd, &type, 1) && sendAll(fd, &length, sizeof(length)) && sendAll(fd, data, length);
+}
+
+static bool sendStrings(int fd, const vector<string>& strings) {
+	unsigned count = strings.size();
+	if (!sendAll(fd, &count, sizeof(count))) return false;
+	for (unsigned i = 0 ; i < count ; i++) {
+		unsigned length = strings[i].size();
+		if (!sendAll(fd, &length, sizeof(length)) || !sendAll(fd, strings[i].data(), length)) return false;
+	}
+	return true;
+}
+
+static bool receiveStrings(int fd, vector<string>& strings) {
+	static const unsigned MAX_STRINGS = 4096;
+	static const unsigned MAX_STRING_LENGTH = 65536;
+	unsigned count;
+	if (!receiveAll(fd, &count, sizeof(count)) || count == 0 || count > MAX_STRINGS) return false;
+	strings.resize(count);
+	for (unsigned i = 0 ; i < count ; i++) {
+		unsigned length;
+		if (!receiveAll(fd, &length, sizeof(length)) || length > MAX_STRING_LENGTH) return false;
+		strings[i].resize(length);
+		if (length > 0 && !receiveAll(fd, &strings[i][0], length)) return false;
+	}
+	return true;
+}
+
+static bool socketAddress(const char *path, struct sockaddr_un *address) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address->sun_path)) return false;
+	strcpy(address->sun_path, path);
+	return true;
+}
+
+// Worker of the server. Takes connections one at a time and runs the job of
+// each in a child process, forwarding its output.
+class ServerWorker : public Job {
+	int listen_fd;
+	CrunchJobFunc job;
+	Mutex& log_mutex;
+
+	// Run the job in a child process with its output going to the pipe.
+	// Never returns in the child.
+	pid_t startJob(const vector<string>& request, int pipe_fds[2]) {
+		pid_t pid = fork();
+		if (pid != 0) return pid;
+		close(listen_fd);
+		close(pipe_fds[0]);
+		int null_fd = open("/dev/null", O_RDONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, 0);
+			close(null_fd);
+		}
+		dup2(pipe_fds[1], 1);
+		dup2(pipe_fds[1], 2);
+		close(pipe_fds[1]);
+		if (chdir(request[0].c_str()) != 0) {
+			printf("Error: Could not change to directory %s\n\n", request[0].c_str());
+			fflush(stdout);
+			_exit(1);
+		}
+		vector<const char*> argv;
+		argv.push_back("Shrinkler");
+		for (int i = 1 ; i < request.size() ; i++) {
+			argv.push_back(request[i].c_str());
+		}
+		argv.push_back(NULL);
+		int status = job(argv.size() - 1, &argv[0]);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(status);
+	}
+
+	void serve(int fd) {
+		vector<string> request;
+		if (!receiveStrings(fd, request)) return;
+		double start = timeSeconds();
+		int pipe_fds[2];
+		if (pipe(pipe_fds) != 0) return;
+		pid_t pid = startJob(request, pipe_fds);
+		close(pipe_fds[1]);
+
+		// Forward output until the job closes its end of the pipe. If the
+		// client goes away, the output is still drained.
+		bool connected = pid > 0;
+		char buffer[4096];
+		ssize_t n;
+		while (pid > 0 && (n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+			connected = connected && sendFrame(fd, 'o', buffer, n);
+		}
+		close(pipe_fds[0]);
+
+		int status = 1;
+		if (pid > 0) {
+			int wait_status;
+			if (waitpid(pid, &wait_status, 0) == pid) {
+				if (WIFEXITED(wait_status)) {
+					status = WEXITSTATUS(wait_status);
+				} else if (WIFSIGNALED(wait_status)) {
+					status = 128 + WTERMSIG(wait_status);
+				}
+			}
+		}
+		if (connected) {
+			sendFrame(fd, 'x', &status, sizeof(status));
+		}
+
+		MutexLock lock(log_mutex);
+		printf("Job in %s finished with status %d after %.2f seconds\n", request[0].c_str(), status, timeSeconds() - start);
+		fflush(stdout);
+	}
+
+public:
+	ServerWorker(int listen_fd, CrunchJobFunc job, Mutex& log_mutex) : listen_fd(listen_fd), job(job), log_mutex(log_mutex) {}
+
+	virtual void run() {
+		while (true) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0) continue;
+			serve(fd);
+			close(fd);
+		}
+	}
+};
+
+// Serve jobs on the socket at the given path, running up to n_workers jobs
+// at a time. Only returns if the socket cannot be set up.
+static int runServer(const char *path, int n_workers, CrunchJobFunc job) {
+	struct sockaddr_un address;
+	if (!socketAddress(path, &address)) {
+		printf("Error: Socket path %s is too long.\n\n", path);
+		return 1;
+	}
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0) {
+		printf("Error: Could not listen on socket %s\n\n", path);
+		return 1;
+	}
+	// Clients going away must not stop the server
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Serving crunch jobs on %s with %d worker%s...\n\n", path, n_workers, n_workers == 1 ? "" : "s");
+	fflush(stdout);
+	Mutex log_mutex;
+	vector<Job*> jobs;
+	for (int w = 0 ; w < n_workers ; w++) {
+		jobs.push_back(new ServerWorker(listen_fd, job, log_mutex));
+	}
+	runJobs(jobs, n_workers);
+	return 0;
+}
+
+// Run a job in the server listening on the socket at the given path, copying
+// its output to standard output. Returns the exit status of the job, or -1
+// if no server could be reached.
+static int runClient(const char *path, int argc, const char *argv[]) {
+	struct sockaddr_un address;
+	if (!socketAddress(path, &address)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	vector<string> request;
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		close(fd);
+		return -1;
+	}
+	request.push_back(cwd);
+	for (int i = 1 ; i < argc ; i++) {
+		request.push_back(argv[i]);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	if (!sendStrings(fd, request)) {
+		close(fd);
+		return -1;
+	}
+
+	vector<char> buffer;
+	int status = -1;
+	char type;
+	unsigned length;
+	while (receiveAll(fd, &type, 1) && receiveAll(fd, &length, sizeof(length))) {
+		buffer.resize(length);
+		if (length > 0 && !receiveAll(fd, &buffer[0], length)) break;
+		if (type == 'o') {
+			fwrite(&buffer[0], 1, length, stdout);
+			fflush(stdout);
+		} else if (type == 'x' && length == sizeof(status)) {
+			memcpy(&status, &buffer[0], sizeof(status));
+			break;
+		}
+	}
+	close(fd);
+	if (status == -1) {
+		printf("\nError: Lost connection to crunch server on %s\n\n", path);
+		return 1;
+	}
+	return status;
+}
+
+#endif
@@ -4,6 +4,12 @@
 
 Cuckoo hash map. Used for mapping offsets to edges in the LZ parser.
 
+Clearing a map which has not grown beyond its initial size keeps its array
+for reuse, so maps which are repeatedly filled and cleared do not churn the
+heap.
+
+The total number of rehashes of all maps is counted for statistics.
+
 */
 
 #pragma once
@@ -14,6 +20,11 @@ Cuckoo hash map. Used for mapping offsets to edges in the LZ parser.
 
 using std::pair;
 
+#include "Threads.h"
+
+// Number of rehashes of all cuckoo hash maps
+Counter cuckoo_hash_rehashes;
+
 template <typename V> class CuckooHash;
 
 template <typename V>
@@ -67,8 +78,8 @@ private:
 	static const int INITIAL_SIZE_LOG = 2;
 
 	value_type* element_array;
-	unsigned n_elements:26;
-	unsigned hash_shift:6;
+	unsigned n_elements;
+	unsigned hash_shift;
 
 	int array_size() const {
 		return 1 << (sizeof(hash_type) * 8 - hash_shift);
@@ -103,6 +114,7 @@ private:
 	}
 
 	void rehash() {
+		cuckoo_hash_rehashes.increment();
 		int old_size = array_size();
 		value_type* old_array = get_array();
 		n_elements = 0;
@@ -151,10 +163,29 @@ public:
 	}
 
 	void clear() {
+		if (element_array != NULL && hash_shift == sizeof(hash_type) * 8 - INITIAL_SIZE_LOG) {
+			for (int i = 0 ; i < (1 << INITIAL_SIZE_LOG) ; i++) {
+				element_array[i].first = UNUSED;
+				element_array[i].second = V();
+			}
+			n_elements = 0;
+			return;
+		}
 		delete[] element_array;
 		init();
 	}
 
+	// Exchange the contents of two maps
+	void swap(CuckooHash& other) {
+		std::swap(element_array, other.element_array);
+		unsigned n = n_elements;
+		n_elements = other.n_elements;
+		other.n_elements = n;
+		unsigned s = hash_shift;
+		hash_shift = other.hash_shift;
+		other.hash_shift = s;
+	}
+
 	iterator begin() const {
 		return CuckooHashIterator<V>(this, 0);
 	}
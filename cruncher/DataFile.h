@@ -4,6 +4,31 @@
 
 Operations on raw data files, including loading, crunching and saving.
 
+Data can also be loaded from and saved to an already open stream, such as
+standard input and output. Streams are read in chunks, without seeking.
+
+Where supported, files are memory mapped on load rather than read into a
+buffer, so that large files are only present in memory once.
+
+In block mode, the data is split into blocks of a fixed size, which are
+crunched separately, each with fresh contexts, so that they can be crunched
+and decrunched in parallel. The crunched data then starts with an index of
+longwords: the block size, the number of blocks and the crunched size of
+each block, followed by the crunched blocks in order. Block mode is
+signalled by a flag in the data file header.
+
+Seekable data is also crunched in blocks, but the index follows the blocks,
+as pairs of longwords giving the uncompressed and crunched offset of each
+block, plus a final pair giving the total sizes. The data file header is
+extended with the block size and the offset of the index within the
+crunched data, so readers can decrunch just the blocks covering a range.
+
+Data can also be crunched against a dictionary, such as data shared by many
+small files. The dictionary precedes the data as history for references,
+but is not crunched itself, and the literal contexts can optionally start
+out adapted to it. The decruncher must be given the same dictionary. Use of
+a dictionary, and priming of the contexts, are signalled by header flags.
+
 */
 
 #pragma once
@@ -21,6 +46,7 @@ using std::pair;
 using std::string;
 
 #include "AmigaWords.h"
+#include "MappedFile.h"
 #include "Pack.h"
 #include "RangeDecoder.h"
 #include "Verifier.h"
@@ -28,6 +54,10 @@ using std::string;
 #define SHRINKLER_MAJOR_VERSION 4
 #define SHRINKLER_MINOR_VERSION 7
 #define FLAG_PARITY_CONTEXT (1 << 0)
+#define FLAG_BLOCKS (1 << 1)
+#define FLAG_SEEKABLE (1 << 2)
+#define FLAG_DICTIONARY (1 << 3)
+#define FLAG_PRIMED (1 << 4)
 
 struct DataHeader {
 	char magic[4];
@@ -40,72 +70,308 @@ struct DataHeader {
 	Longword flags;
 };
 
+// Extension of the data file header for seekable data
+struct SeekableHeader {
+	Longword block_size;
+	Longword index_offset;
+};
+
 class DataFile {
 	DataHeader header;
-	vector<unsigned char> data;
+	SeekableHeader seekable_header;
+	bool seekable;
+
+	// Contents, either in the owned buffer or in the mapping of a loaded file
+	vector<unsigned char> buffer;
+	MappedFile mapping;
+	unsigned char *data;
+	int data_length;
+
+	static void check_length(size_t length) {
+		if (length > MAX_DATA_LENGTH) {
+			printf("Error: Data larger than %d MB is not supported\n\n", (int) (MAX_DATA_LENGTH >> 20));
+			exit(1);
+		}
+	}
+
+	void use_buffer() {
+		check_length(buffer.size());
+		mapping.unmap();
+		data = buffer.empty() ? NULL : &buffer[0];
+		data_length = buffer.size();
+	}
+
+	// The data, preceded in memory by the dictionary of the parameters as
+	// parseData expects. With a dictionary, the two are copied into the
+	// given buffer.
+	unsigned char *dictionary_data(PackParams *params, vector<unsigned char>& history_buffer) {
+		if (params->dictionary_length == 0) return data;
+		history_buffer.assign(params->dictionary, params->dictionary + params->dictionary_length);
+		history_buffer.insert(history_buffer.end(), data, data + data_length);
+		return &history_buffer[params->dictionary_length];
+	}
+
+	int block_count(PackParams *params) {
+		return max(1, (data_length + params->block_size - 1) / params->block_size);
+	}
+
+	int block_length(PackParams *params, int b) {
+		return min(params->block_size, data_length - b * params->block_size);
+	}
+
+	// Verification of a crunched block, run while the following blocks are
+	// crunched
+	class BlockVerifyJob : public Job {
+		DataFile *file;
+		PackParams *params;
+		vector<unsigned char> pack_buffer;
+		unsigned char *data;
+		int data_length;
+
+	public:
+		int margin;
+		bool ok;
+
+		BlockVerifyJob(DataFile *file, PackParams *params, const vector<unsigned char>& pack_buffer, unsigned char *data, int data_length)
+			: file(file), params(params), pack_buffer(pack_buffer), data(data), data_length(data_length), margin(0), ok(false) {}
 
-	vector<unsigned char> compress(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace = false) {
+		void run() {
+			ok = file->verify_data(params, pack_buffer, data, data_length, &margin);
+		}
+	};
+
+	// Crunch each block separately. With several threads, all blocks are
+	// parsed concurrently up front. Encoding remains sequential. Each block
+	// is verified on another thread as soon as it is crunched, giving its
+	// front overlap margin, or -1 if it is incorrect.
+	vector<vector<unsigned char> > compress_blocks(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace, PackOutput& output, vector<int>& margins) {
+		int n_blocks = block_count(params);
+		vector<vector<unsigned char> > pack_buffers(n_blocks);
+		vector<BlockVerifyJob*> verify_jobs;
+		JobQueue verify_queue;
+
+		// Print compression status header
+		const char *ordinals[] = { "st", "nd", "rd", "th" };
+		output.print("Block  Original");
+		for (int p = 1 ; p <= params->iterations ; p++) {
+			output.print("  After %d%s pass", p, ordinals[min(p,4)-1]);
+		}
+		output.print("\n");
+
+		vector<ParseJob*> parse_jobs;
+		if (params->threads > 1 && n_blocks > 1) {
+			vector<Job*> jobs;
+			bool combined_progress = show_progress && !params->progress;
+			CombinedProgress progress;
+			for (int b = 0 ; b < n_blocks ; b++) {
+				int length = block_length(params, b);
+				PackBlockStats *stats = params->stats ? params->stats->block(b, length) : NULL;
+				BlockProgress *block_progress = combined_progress ? progress.add(length, params->iterations) : NULL;
+				ParseJob *job = new ParseJob(data + b * params->block_size, length, 0, params, edge_factory->capacity(), stats, b, block_progress);
+				parse_jobs.push_back(job);
+				jobs.push_back(job);
+			}
+			if (combined_progress) progress.begin();
+			runJobs(jobs, params->threads);
+			if (combined_progress) progress.end();
+		}
+
+		for (int b = 0 ; b < n_blocks ; b++) {
+			output.print("%4d  ", b);
+			RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffers[b]);
+			range_coder.reset();
+			if (!parse_jobs.empty()) {
+				ParseJob *job = parse_jobs[b];
+				job->output.flush(output);
+				job->result.encode(LZEncoder(&range_coder, params->parity_context));
+				edge_factory->max_edge_count = max(edge_factory->max_edge_count, job->max_edge_count);
+				edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, job->max_cleaned_edges);
+				delete job;
+			} else {
+				int length = block_length(params, b);
+				PackBlockStats *stats = params->stats ? params->stats->block(b, length) : NULL;
+				LZParseResult result = parseData(data + b * params->block_size, length, 0, params, edge_factory, params->threads, show_progress, output, enable_trace && b == 0, stats, b);
+				result.encode(LZEncoder(&range_coder, params->parity_context));
+			}
+			range_coder.finish();
+			output.print("\n");
+			fflush(stdout);
+
+			BlockVerifyJob *job = new BlockVerifyJob(this, params, pack_buffers[b], data + b * params->block_size, block_length(params, b));
+			verify_jobs.push_back(job);
+			verify_queue.add(job);
+		}
+		output.print("\n");
+
+		verify_queue.finish();
+		margins.clear();
+		for (int b = 0 ; b < n_blocks ; b++) {
+			margins.push_back(verify_jobs[b]->ok ? verify_jobs[b]->margin : -1);
+			delete verify_jobs[b];
+		}
+
+		return pack_buffers;
+	}
+
+	vector<unsigned char> compress(PackParams *params, unsigned char *source, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace, PackOutput& output) {
 		vector<unsigned char> pack_buffer;
 		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 
 		// Print compression status header
 		const char *ordinals[] = { "st", "nd", "rd", "th" };
-		printf("Original");
+		output.print("Original");
 		for (int p = 1 ; p <= params->iterations ; p++) {
-			printf("  After %d%s pass", p, ordinals[min(p,4)-1]);
+			output.print("  After %d%s pass", p, ordinals[min(p,4)-1]);
 		}
-		printf("\n");
+		output.print("\n");
 
 		// Crunch the data
 		range_coder.reset();
-		packData(&data[0], data.size(), 0, params, &range_coder, edge_factory, show_progress, enable_trace);
+		range_coder.setContexts(primedContexts(params));
+		PackBlockStats *stats = params->stats ? params->stats->block(0, data_length) : NULL;
+		LZParseResult result = parseData(source, data_length, 0, params, edge_factory, params->threads, show_progress, output, enable_trace, stats);
+		result.encode(LZEncoder(&range_coder, params->parity_context));
 		range_coder.finish();
-		printf("\n\n");
+		output.print("\n\n");
 		fflush(stdout);
 
 		return pack_buffer;		
 	}
 
-	int verify(PackParams *params, vector<unsigned char>& pack_buffer) {
-		printf("Verifying... ");
-		fflush(stdout);
+	// Verify crunched data against the given part of the data, which is
+	// preceded in memory by the dictionary, if any. Gives the front overlap
+	// margin. Returns false after printing the error if the data is
+	// incorrect. Can be called concurrently.
+	bool verify_data(PackParams *params, vector<unsigned char>& pack_buffer, unsigned char *data, int data_length, int *margin_out) {
 		RangeDecoder decoder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
-		LZDecoder lzd(&decoder, params->parity_context);
 
 		// Verify data
 		bool error = false;
-		LZVerifier verifier(0, &data[0], data.size(), data.size(), 1);
+		LZVerifier verifier(0, data, data_length, data_length, 1, decoder, params->dictionary_length);
 		decoder.reset();
-		decoder.setListener(&verifier);
-		if (!lzd.decode(verifier)) {
-			error = true;
+		decoder.setContexts(primedContexts(params));
+		if (params->parity_context) {
+			error = !BasicLZDecoder<RangeDecoder, 1>(&decoder, true).decode(verifier, params->dictionary_length);
+		} else {
+			error = !BasicLZDecoder<RangeDecoder, 0>(&decoder, false).decode(verifier, params->dictionary_length);
 		}
 
 		// Check length
-		if (!error && verifier.size() != data.size()) {
-			printf("Verify error: data has incorrect length (%d, should have been %d)!\n", verifier.size(), (int) data.size());
+		if (!error && verifier.size() != data_length) {
+			printf("Verify error: data has incorrect length (%d, should have been %d)!\n", verifier.size(), data_length);
 			error = true;
 		}
 
-		if (error) {
+		*margin_out = verifier.front_overlap_margin;
+		return !error;
+	}
+
+	int verify(PackParams *params, vector<unsigned char>& pack_buffer, unsigned char *source, PackOutput& output) {
+		output.print("Verifying... ");
+		fflush(stdout);
+		int front_overlap_margin;
+		if (!verify_data(params, pack_buffer, source, data_length, &front_overlap_margin)) {
 			internal_error();
 		}
+		output.print("OK\n\n");
+
+		return front_overlap_margin + pack_buffer.size() - data_length;
+	}
 
-		printf("OK\n\n");
+	// Check the verification of crunched blocks. The margin is that of
+	// decrunching all blocks in order, with the index read first.
+	int verify_blocks(PackParams *params, vector<vector<unsigned char> >& pack_buffers, const vector<int>& margins, int index_size, PackOutput& output) {
+		output.print("Verifying... ");
+		fflush(stdout);
+		int packed_pos = index_size;
+		int front_overlap_margin = 0;
+		for (int b = 0 ; b < pack_buffers.size() ; b++) {
+			int block_start = b * params->block_size;
+			int margin = margins[b];
+			if (margin < 0) {
+				internal_error();
+			}
+			front_overlap_margin = max(front_overlap_margin, block_start + margin - packed_pos);
+			packed_pos += pack_buffers[b].size();
+			// The output of a block must not run into the data following it
+			front_overlap_margin = max(front_overlap_margin, block_start + block_length(params, b) - packed_pos);
+		}
+		output.print("OK\n\n");
 
-		return verifier.front_overlap_margin + pack_buffer.size() - data.size();
+		return front_overlap_margin + packed_pos - data_length;
 	}
 
 public:
+	// Positions in the data are ints, and the cruncher adds lengths and
+	// offsets to them, so leave plenty of room.
+	static const size_t MAX_DATA_LENGTH = (size_t) 1 << 30;
+
+	// Data file header, including its extension for seekable data
+	vector<unsigned char> header_bytes() {
+		const unsigned char *bytes = (const unsigned char *) &header;
+		vector<unsigned char> out(bytes, bytes + sizeof(DataHeader));
+		if (seekable) {
+			const unsigned char *seekable_bytes = (const unsigned char *) &seekable_header;
+			out.insert(out.end(), seekable_bytes, seekable_bytes + sizeof(SeekableHeader));
+		}
+		return out;
+	}
+
+	DataFile() : seekable(false), data(NULL), data_length(0) {}
+
+	void load(FILE *file) {
+		const int CHUNK_SIZE = 65536;
+		size_t length = 0;
+		while (true) {
+			buffer.resize(length + CHUNK_SIZE);
+			size_t n = fread(&buffer[length], 1, CHUNK_SIZE, file);
+			length += n;
+			if (n < CHUNK_SIZE) break;
+		}
+		buffer.resize(length);
+		use_buffer();
+		if (ferror(file)) {
+			printf("Error while reading input stream\n\n");
+			exit(1);
+		}
+	}
+
+	void save(FILE *file, bool write_header) {
+		bool ok = true;
+		if (write_header) {
+			vector<unsigned char> bytes = header_bytes();
+			ok = fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+		}
+		if (!ok || fwrite(data, 1, data_length, file) != data_length || fflush(file) != 0) {
+			printf("Error while writing output stream\n\n");
+			exit(1);
+		}
+	}
+
+	void load(const unsigned char *contents, int length) {
+		buffer.assign(contents, contents + length);
+		use_buffer();
+	}
+
 	void load(const char *filename) {
+		if (mapping.map(filename)) {
+			check_length(mapping.size());
+			buffer.clear();
+			data = mapping.data();
+			data_length = mapping.size();
+			return;
+		}
+
 		FILE *file;
 		if ((file = fopen(filename, "rb"))) {
 			fseek(file, 0, SEEK_END);
-			int length = ftell(file);
+			long length = ftell(file);
 			fseek(file, 0, SEEK_SET);
-			data.resize(length);
-			if (fread(&data[0], 1, data.size(), file) == data.size()) {
+			if (length >= 0) check_length(length);
+			buffer.resize(length >= 0 ? length : 0);
+			if (length >= 0 && fread(&buffer[0], 1, buffer.size(), file) == buffer.size()) {
 				fclose(file);
+				use_buffer();
 				return;
 			}
 		}
@@ -114,14 +380,23 @@ public:
 		exit(1);
 	}
 
+	void save(vector<unsigned char>& out, bool write_header) {
+		out.clear();
+		if (write_header) {
+			out = header_bytes();
+		}
+		out.insert(out.end(), data, data + data_length);
+	}
+
 	void save(const char *filename, bool write_header) {
 		FILE *file;
 		if ((file = fopen(filename, "wb"))) {
 			bool ok = true;
 			if (write_header) {
-				ok = fwrite(&header, 1, sizeof(DataHeader), file) == sizeof(DataHeader);
+				vector<unsigned char> bytes = header_bytes();
+				ok = fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
 			}
-			if (ok && fwrite(&data[0], 1, data.size(), file) == data.size()) {
+			if (ok && fwrite(data, 1, data_length, file) == data_length) {
 				fclose(file);
 				return;
 			}
@@ -132,28 +407,123 @@ public:
 	}
 
 	int size(bool include_header) {
-		return (include_header ? sizeof(DataHeader) : 0) + data.size();
+		return (include_header ? header_bytes().size() : 0) + data_length;
+	}
+
+	// Length of the longest block parsed with the given parameters,
+	// including the dictionary
+	int max_parse_length(PackParams *params) {
+		int length = params->block_size > 0 ? min(params->block_size, data_length) : data_length;
+		return params->dictionary_length + length;
+	}
+
+	// Size of the crunched data for the given parameters. Nothing is printed.
+	// Can be called concurrently.
+	int packed_size(PackParams *params, int edge_capacity) {
+		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+		RefEdgeFactory edge_factory(edge_capacity);
+		PackOutput output(true);
+		if (params->block_size > 0) {
+			int n_blocks = block_count(params);
+			int size = (params->seekable ? 2 * (n_blocks + 1) : 2 + n_blocks) * sizeof(Longword);
+			for (int b = 0 ; b < n_blocks ; b++) {
+				range_coder.reset();
+				LZParseResult result = parseData(data + b * params->block_size, block_length(params, b), 0, params, &edge_factory, 1, false, output, false, NULL, b);
+				result.encode(BasicLZEncoder<RangeCoder>(&range_coder, params->parity_context));
+				range_coder.finish();
+				size += range_coder.sizeInBytes();
+			}
+			return size;
+		}
+		range_coder.reset();
+		range_coder.setContexts(primedContexts(params));
+		vector<unsigned char> history_buffer;
+		LZParseResult result = parseData(dictionary_data(params, history_buffer), data_length, 0, params, &edge_factory, 1, false, output);
+		result.encode(BasicLZEncoder<RangeCoder>(&range_coder, params->parity_context));
+		range_coder.finish();
+		return range_coder.sizeInBytes();
 	}
 
 	DataFile* crunch(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace = false) {
-		vector<unsigned char> pack_buffer = compress(params, edge_factory, show_progress, enable_trace);
-		int margin = verify(params, pack_buffer);
+		PackOutput output(false);
+		return crunch(params, edge_factory, show_progress, enable_trace, output);
+	}
 
-		printf("Minimum safety margin for overlapped decrunching: %d\n\n", margin);
+	// Crunch with all status output going to the given output, such as when
+	// several files are crunched concurrently. Can be called concurrently.
+	DataFile* crunch(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace, PackOutput& output) {
+		vector<unsigned char> pack_buffer;
+		int margin;
+		int index_offset = 0;
+		vector<int> block_margins;
+		if (params->block_size > 0 && params->seekable) {
+			vector<vector<unsigned char> > pack_buffers = compress_blocks(params, edge_factory, show_progress, enable_trace, output, block_margins);
+
+			// Blocks, followed by the offset index
+			vector<Longword> index;
+			for (int b = 0 ; b < pack_buffers.size() ; b++) {
+				index.push_back(b * params->block_size);
+				index.push_back(pack_buffer.size());
+				pack_buffer.insert(pack_buffer.end(), pack_buffers[b].begin(), pack_buffers[b].end());
+			}
+			index.push_back(data_length);
+			index.push_back(pack_buffer.size());
+			index_offset = pack_buffer.size();
+			const unsigned char *index_bytes = (const unsigned char *) &index[0];
+			pack_buffer.insert(pack_buffer.end(), index_bytes, index_bytes + index.size() * sizeof(Longword));
+
+			// The index is read first, so it must be kept clear when decrunching in place
+			margin = verify_blocks(params, pack_buffers, block_margins, 0, output) + index.size() * sizeof(Longword);
+		} else if (params->block_size > 0) {
+			vector<vector<unsigned char> > pack_buffers = compress_blocks(params, edge_factory, show_progress, enable_trace, output, block_margins);
+
+			// Block index, followed by the blocks
+			vector<Longword> index;
+			index.push_back(params->block_size);
+			index.push_back(pack_buffers.size());
+			for (int b = 0 ; b < pack_buffers.size() ; b++) {
+				index.push_back(pack_buffers[b].size());
+			}
+			const unsigned char *index_bytes = (const unsigned char *) &index[0];
+			pack_buffer.assign(index_bytes, index_bytes + index.size() * sizeof(Longword));
+			for (int b = 0 ; b < pack_buffers.size() ; b++) {
+				pack_buffer.insert(pack_buffer.end(), pack_buffers[b].begin(), pack_buffers[b].end());
+			}
+			margin = verify_blocks(params, pack_buffers, block_margins, index.size() * sizeof(Longword), output);
+		} else {
+			vector<unsigned char> history_buffer;
+			unsigned char *source = dictionary_data(params, history_buffer);
+			pack_buffer = compress(params, source, edge_factory, show_progress, enable_trace, output);
+			margin = verify(params, pack_buffer, source, output);
+		}
+
+		output.print("Minimum safety margin for overlapped decrunching: %d\n\n", margin);
 
 		DataFile *ef = new DataFile;
-		ef->data = pack_buffer;
+		ef->buffer.swap(pack_buffer);
+		ef->use_buffer();
 		ef->header.magic[0] = 'S';
 		ef->header.magic[1] = 'h';
 		ef->header.magic[2] = 'r';
 		ef->header.magic[3] = 'i';
 		ef->header.major_version = SHRINKLER_MAJOR_VERSION;
 		ef->header.minor_version = SHRINKLER_MINOR_VERSION;
-		ef->header.header_size = sizeof(DataHeader) - 8;
-		ef->header.compressed_size = pack_buffer.size();
-		ef->header.uncompressed_size = data.size();
+		ef->header.header_size = sizeof(DataHeader) - 8 + (params->seekable ? sizeof(SeekableHeader) : 0);
+		ef->header.compressed_size = ef->data_length;
+		ef->header.uncompressed_size = data_length;
 		ef->header.safety_margin = margin;
 		ef->header.flags = params->parity_context ? FLAG_PARITY_CONTEXT : 0;
+		if (params->seekable) {
+			ef->header.flags = ef->header.flags | FLAG_SEEKABLE;
+			ef->seekable = true;
+			ef->seekable_header.block_size = params->block_size;
+			ef->seekable_header.index_offset = index_offset;
+		} else if (params->block_size > 0) {
+			ef->header.flags = ef->header.flags | FLAG_BLOCKS;
+		}
+		if (params->dictionary_length > 0) {
+			ef->header.flags = ef->header.flags | FLAG_DICTIONARY | (params->prime_contexts ? FLAG_PRIMED : 0);
+		}
 
 		return ef;
 	}
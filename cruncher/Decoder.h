@@ -10,6 +10,10 @@ Abstract interface for entropy decoding.
 
 class Decoder {
 public:
+	// Largest number of continuation bits of a number, as in the decrunchers,
+	// which covers all numbers below 2^31
+	static const int NUMBER_MAX_BITS = 30;
+
 	// Decode a bit in the given context.
 	// Returns the decoded bit value.
 	virtual int decode(int context) = 0;
@@ -17,17 +21,25 @@ public:
 	// Decode a number >= 2 using a variable-length encoding.
 	// Returns the decoded number.
 	int decodeNumber(int base_context) {
+		return decodeNumberAs<Decoder>(base_context);
+	}
+
+	// As decodeNumber, with the bits decoded through the decode method of
+	// the given (final) subclass, so the calls can be resolved at compile time.
+	template <class DecoderT>
+	int decodeNumberAs(int base_context) {
+		DecoderT *decoder = static_cast<DecoderT*>(this);
 		int context;
 		int i;
-		for (i = 0 ;; i++) {
+		for (i = 0 ; i < NUMBER_MAX_BITS ; i++) {
 			context = base_context + (i * 2 + 2);
-			if (decode(context) == 0) break;
+			if (decoder->decode(context) == 0) break;
 		}
 
 		int number = 1;
 		for (; i >= 0 ; i--) {
 			context = base_context + (i * 2 + 1);
-			int bit = decode(context);
+			int bit = decoder->decode(context);
 			number = (number << 1) | bit;
 		}
 
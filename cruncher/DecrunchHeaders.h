@@ -57,3 +57,27 @@ unsigned char MiniHeader[] = {
 unsigned char MiniHeaderC[] = {
 #include "MiniHeaderC.dat"
 };
+
+unsigned char Header2_020[] = {
+#include "Header2_020.dat"
+};
+
+unsigned char Header2C_020[] = {
+#include "Header2C_020.dat"
+};
+
+unsigned char OverlapHeader_020[] = {
+#include "OverlapHeader_020.dat"
+};
+
+unsigned char OverlapHeaderC_020[] = {
+#include "OverlapHeaderC_020.dat"
+};
+
+unsigned char OverlapHeaderT_020[] = {
+#include "OverlapHeaderT_020.dat"
+};
+
+unsigned char OverlapHeaderCT_020[] = {
+#include "OverlapHeaderCT_020.dat"
+};
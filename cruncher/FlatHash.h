@@ -0,0 +1,167 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Flat hash map from integer keys. Used for mapping offsets to the best edge
+for each offset in the LZ parser.
+
+The entries live in a dense array in no particular order, so iterating over
+the map and clearing it take time proportional to the number of entries
+rather than the size of the table. The table is probed linearly and holds
+the index of the entry for each key. Erasing an entry moves the last entry
+into its place, and the table is repaired by shifting back the following
+keys in the probe sequence, so no tombstones accumulate.
+
+Looking up a key which may be absent and inserting it if needed hashes the
+key only once, through operator[].
+
+*/
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+template <typename V>
+class FlatHash {
+public:
+	typedef int key_type;
+	typedef pair<key_type, V> value_type;
+	typedef value_type* iterator;
+private:
+	typedef unsigned hash_type;
+
+	static const int EMPTY = -1;
+	static const hash_type HASH_MUL = 0x9E3779B1;
+	static const int INITIAL_SIZE_LOG = 4;
+
+	struct Slot {
+		key_type key;
+		int index;
+	};
+
+	// Live entries, and for each entry the table slot referring to it
+	vector<value_type> entries;
+	vector<int> entry_slot;
+	vector<Slot> table;
+	int hash_shift;
+
+	int mask() const {
+		return (int) table.size() - 1;
+	}
+
+	int home(key_type key) const {
+		return (int) (((hash_type) key * HASH_MUL) >> hash_shift);
+	}
+
+	// Slot holding the key, or the empty slot where it would go
+	int probe(key_type key) const {
+		int s = home(key);
+		while (table[s].index != EMPTY && table[s].key != key) s = (s + 1) & mask();
+		return s;
+	}
+
+	void resize(int size_log) {
+		table.assign(1 << size_log, Slot());
+		for (int s = 0 ; s < table.size() ; s++) {
+			table[s].index = EMPTY;
+		}
+		hash_shift = sizeof(hash_type) * 8 - size_log;
+		for (int i = 0 ; i < entries.size() ; i++) {
+			int s = probe(entries[i].first);
+			table[s].key = entries[i].first;
+			table[s].index = i;
+			entry_slot[i] = s;
+		}
+	}
+
+	// Empty the slot and move later keys of the probe sequence back into it
+	void remove_slot(int hole) {
+		int s = hole;
+		while (true) {
+			s = (s + 1) & mask();
+			if (table[s].index == EMPTY) break;
+			int h = home(table[s].key);
+			// Keys whose home lies cyclically in (hole, s] stay put
+			if (((s - h) & mask()) < ((s - hole) & mask())) continue;
+			table[hole] = table[s];
+			entry_slot[table[hole].index] = hole;
+			hole = s;
+		}
+		table[hole].index = EMPTY;
+	}
+
+public:
+	FlatHash() {
+		resize(INITIAL_SIZE_LOG);
+	}
+
+	// Remove all entries, keeping the table for reuse
+	void clear() {
+		for (int i = 0 ; i < entries.size() ; i++) {
+			table[entry_slot[i]].index = EMPTY;
+		}
+		entries.clear();
+		entry_slot.clear();
+	}
+
+	iterator begin() {
+		return entries.empty() ? NULL : &entries[0];
+	}
+
+	iterator end() {
+		return begin() + entries.size();
+	}
+
+	int size() const {
+		return entries.size();
+	}
+
+	bool empty() const {
+		return entries.empty();
+	}
+
+	int count(key_type key) const {
+		return table[probe(key)].index != EMPTY;
+	}
+
+	// Value for the key, or NULL if absent
+	V* find(key_type key) {
+		int s = probe(key);
+		return table[s].index != EMPTY ? &entries[table[s].index].second : NULL;
+	}
+
+	void erase(key_type key) {
+		int s = probe(key);
+		int i = table[s].index;
+		if (i == EMPTY) return;
+		remove_slot(s);
+		int last = entries.size() - 1;
+		if (i != last) {
+			entries[i] = entries[last];
+			entry_slot[i] = entry_slot[last];
+			table[entry_slot[i]].index = i;
+		}
+		entries.pop_back();
+		entry_slot.pop_back();
+	}
+
+	// Value for the key, inserting a default value if absent
+	V& operator[](key_type key) {
+		int s = probe(key);
+		if (table[s].index != EMPTY) return entries[table[s].index].second;
+		// Keep the table at most half full
+		if ((entries.size() + 1) * 2 > table.size()) {
+			resize(sizeof(hash_type) * 8 - hash_shift + 1);
+			s = probe(key);
+		}
+		table[s].key = key;
+		table[s].index = entries.size();
+		entries.push_back(value_type(key, V()));
+		entry_slot.push_back(s);
+		return entries.back().second;
+	}
+};
@@ -0,0 +1,123 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Match finder using hash chains over a bounded window.
+
+Every position is linked to the previous position starting with the same
+two bytes, and the chain from the current position is walked from the
+closest position and outwards. Matches are reported from shortest to
+longest: a match is reported if it is longer than all closer matches, or
+as long as the longest so far and fewer than max_same_length matches of
+that length have been reported. The walk stops when match_patience
+positions in a row have been passed over, or at the edge of the window.
+
+Positions are linked as the matching passes them, and only the links of
+the latest window_size positions are kept. The memory use is thus bounded
+by the window size rather than the data size, and no work is done before
+the first position is matched. Matching must proceed in increasing order
+of position, except that matching an earlier position starts over.
+
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+
+#include "MatchFinder.h"
+#include "MatchLength.h"
+
+class HashChainFinder : public MatchFinder {
+	static const int HASH_SIZE = 1 << 16;
+
+	// Inputs
+	const unsigned char *data;
+	int length;
+	int min_length;
+	int match_patience;
+	int max_same_length;
+	int window_size;
+
+	// Latest linked position for each pair of bytes, or -1, and for each
+	// position in the window, the previous position with the same bytes.
+	vector<int> head;
+	vector<int> prev;
+	int next_link;
+
+	// Matcher state
+	int current_pos;
+	int candidate;
+	int steps;
+	int longest;
+	int same_count;
+
+	int hash(int pos) {
+		return data[pos] | (data[pos + 1] << 8);
+	}
+
+	void link(int pos) {
+		if (pos + 1 < length) {
+			int h = hash(pos);
+			prev[pos & (window_size - 1)] = head[h];
+			head[h] = pos;
+		}
+	}
+
+public:
+	// The window size is rounded up to a power of two, but not beyond what
+	// the data needs.
+	HashChainFinder(const unsigned char *data, int length, int min_length, int match_patience, int max_same_length, int window_size) :
+		data(data), length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length),
+		head(HASH_SIZE), candidate(-1)
+	{
+		this->window_size = 1;
+		while (this->window_size < window_size && this->window_size <= length) {
+			this->window_size *= 2;
+		}
+		prev.resize(this->window_size);
+		reset();
+	}
+
+	virtual void reset() {
+		std::fill(head.begin(), head.end(), -1);
+		next_link = 0;
+	}
+
+	virtual void beginMatching(int pos) {
+		if (pos < next_link) reset();
+		for (int p = std::max(next_link, pos - window_size) ; p < pos ; p++) {
+			link(p);
+		}
+		next_link = pos;
+		current_pos = pos;
+		candidate = pos + 1 < length ? head[hash(pos)] : -1;
+		steps = 0;
+		longest = min_length - 1;
+		same_count = 0;
+	}
+
+	virtual bool nextMatch(int *match_pos_out, int *match_length_out) {
+		while (candidate >= 0 && current_pos - candidate < window_size && steps <= match_patience) {
+			int match_pos = candidate;
+			candidate = prev[match_pos & (window_size - 1)];
+			int match_length = matchLength(&data[current_pos], &data[match_pos], length - current_pos);
+			if (match_length > longest) {
+				longest = match_length;
+				same_count = 1;
+			} else if (match_length == longest && longest >= min_length && same_count < max_same_length) {
+				same_count++;
+			} else {
+				steps++;
+				continue;
+			}
+			steps = 0;
+			*match_pos_out = match_pos;
+			*match_length_out = match_length;
+			return true;
+		}
+		return false;
+	}
+};
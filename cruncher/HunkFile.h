@@ -5,6 +5,9 @@
 Operations on Amiga executables, including loading, parsing,
 hunk merging, crunching and saving.
 
+Where supported, files are memory mapped on load rather than read into a
+buffer.
+
 */
 
 #pragma once
@@ -23,6 +26,7 @@ using std::string;
 
 #include "doshunks.h"
 #include "AmigaWords.h"
+#include "MappedFile.h"
 #include "DecrunchHeaders.h"
 #include "Pack.h"
 #include "RangeDecoder.h"
@@ -78,15 +82,48 @@ public:
 
 
 class HunkFile {
-	vector<Longword> data;
+	// Contents, either in the owned buffer or in the mapping of a loaded file
+	vector<Longword> buffer;
+	MappedFile mapping;
+	Longword *data;
+	int data_size; // longwords
 	vector<HunkInfo> hunks;
 	int relocshort_total_size;
 
-	vector<unsigned char> compress_hunks(PackParams *params, bool overlap, bool mini, RefEdgeFactory *edge_factory, bool show_progress) {
+	// Data to pack for a hunk. Empty hunks have no data, only zero padding.
+	void hunk_pack_data(int h, bool mini, unsigned char **hunk_data_out, int *hunk_data_length_out, int *zero_padding_out) {
+		switch (hunks[h].type) {
+		case HUNK_CODE:
+		case HUNK_DATA:
+			{
+				unsigned char *hunk_data = (unsigned char *) &data[hunks[h].datastart];
+				int hunk_data_length = hunks[h].datasize * 4;
+				// Trim trailing zeros
+				while (hunk_data_length > 0 && hunk_data[hunk_data_length - 1] == 0) {
+					hunk_data_length--;
+				}
+				*hunk_data_out = hunk_data;
+				*hunk_data_length_out = hunk_data_length;
+				*zero_padding_out = mini ? 0 : hunks[h].memsize * 4 - hunk_data_length;
+			}
+			break;
+		default:
+			*hunk_data_out = NULL;
+			*hunk_data_length_out = 0;
+			*zero_padding_out = mini ? 0 : hunks[h].memsize * 4;
+			break;
+		}
+	}
+
+	// Crunch the hunks into one stream. The part of the stream which is
+	// settled after each hunk is written to the pipe, and the whole stream
+	// at the end.
+	vector<unsigned char> compress_hunks(PackParams *params, bool overlap, bool mini, RefEdgeFactory *edge_factory, bool show_progress, BytePipe *pipe) {
 		int numhunks = hunks.size();
 
 		vector<unsigned char> pack_buffer;
 		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
+		int piped = 0;
 
 		// Print compression status header
 		const char *ordinals[] = { "st", "nd", "rd", "th" };
@@ -99,29 +136,48 @@ class HunkFile {
 		}
 		printf("\n");
 
+		// With several threads, parse all hunks concurrently up front.
+		// Encoding remains sequential, in hunk order.
+		int packhunks = mini ? 1 : numhunks;
+		vector<ParseJob*> parse_jobs;
+		if (params->threads > 1 && packhunks > 1) {
+			vector<Job*> jobs;
+			bool combined_progress = show_progress && !params->progress;
+			CombinedProgress progress;
+			for (int h = 0 ; h < packhunks ; h++) {
+				unsigned char *hunk_data;
+				int hunk_data_length, zero_padding;
+				hunk_pack_data(h, mini, &hunk_data, &hunk_data_length, &zero_padding);
+				PackBlockStats *stats = params->stats ? params->stats->block(h, hunk_data_length) : NULL;
+				BlockProgress *block_progress = combined_progress ? progress.add(hunk_data_length, params->iterations) : NULL;
+				ParseJob *job = new ParseJob(hunk_data, hunk_data_length, zero_padding, params, edge_factory->capacity(), stats, h, block_progress);
+				parse_jobs.push_back(job);
+				jobs.push_back(job);
+			}
+			if (combined_progress) progress.begin();
+			runJobs(jobs, params->threads);
+			if (combined_progress) progress.end();
+		}
+
 		// Crunch the hunks, one by one.
-		for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
+		for (int h = 0 ; h < packhunks ; h++) {
 			printf("%4d  ", h);
 			range_coder.reset();
-			switch (hunks[h].type) {
-			case HUNK_CODE:
-			case HUNK_DATA:
-				{
-					// Pack data
-					unsigned char *hunk_data = (unsigned char *) &data[hunks[h].datastart];
-					int hunk_data_length = hunks[h].datasize * 4;
-					// Trim trailing zeros
-					while (hunk_data_length > 0 && hunk_data[hunk_data_length - 1] == 0) {
-						hunk_data_length--;
-					}
-					int zero_padding = mini ? 0 : hunks[h].memsize * 4 - hunk_data_length;
-					packData(hunk_data, hunk_data_length, zero_padding, params, &range_coder, edge_factory, show_progress);
-				}
-				break;
-			default:
-				int zero_padding = mini ? 0 : hunks[h].memsize * 4;
-				packData(NULL, 0, zero_padding, params, &range_coder, edge_factory, show_progress);
-				break;
+			if (!parse_jobs.empty()) {
+				// Encode parse result
+				ParseJob *job = parse_jobs[h];
+				job->output.flush();
+				job->result.encode(BasicLZEncoder<RangeCoder>(&range_coder, params->parity_context));
+				edge_factory->max_edge_count = max(edge_factory->max_edge_count, job->max_edge_count);
+				edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, job->max_cleaned_edges);
+				delete job;
+			} else {
+				// Pack data
+				unsigned char *hunk_data;
+				int hunk_data_length, zero_padding;
+				hunk_pack_data(h, mini, &hunk_data, &hunk_data_length, &zero_padding);
+				PackBlockStats *stats = params->stats ? params->stats->block(h, hunk_data_length) : NULL;
+				packData(hunk_data, hunk_data_length, zero_padding, params, &range_coder, edge_factory, show_progress, false, stats, h);
 			}
 
 			if (!mini) {
@@ -160,23 +216,30 @@ class HunkFile {
 			}
 			printf("\n");
 			fflush(stdout);
+
+			int settled = range_coder.settledBytes();
+			pipe->write(pack_buffer.data() + piped, settled - piped);
+			piped = settled;
 		}
 		range_coder.finish();
 		printf("\n");
 
 		// Round up compressed size to a whole number of longwords
 		pack_buffer.resize((pack_buffer.size() + 3) & -4, 0);
+		pipe->write(pack_buffer.data() + piped, pack_buffer.size() - piped);
+		pipe->close();
 		return pack_buffer;
 	}
 
-	vector<pair<int,int> > verify(vector<unsigned char>& pack_buffer, bool overlap, bool mini) {
+	// Verify the crunched stream, read from the pipe as it is produced.
+	// Returns false after printing the error if the stream is incorrect.
+	bool verify(BytePipe *pipe, bool overlap, bool mini, vector<pair<int,int> >& count_and_hunksize) {
 		int numhunks = hunks.size();
-		vector<pair<int,int> > count_and_hunksize;
 
-		printf("Verifying... ");
-		fflush(stdout);
+		vector<unsigned char> pack_buffer;
 		RangeDecoder decoder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
-		LZDecoder lzd(&decoder, true);
+		decoder.setPipe(pipe);
+		BasicLZDecoder<RangeDecoder, 1> lzd(&decoder, true);
 		for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
 			unsigned char *hunk_data;
 			int hunk_data_length = hunks[h].datasize * 4;
@@ -196,9 +259,8 @@ class HunkFile {
 
 			// Verify data
 			bool error = false;
-			LZVerifier verifier(h, hunk_data, hunk_data_length, hunks[h].memsize * sizeof(Longword), sizeof(Longword));
+			LZVerifier verifier(h, hunk_data, hunk_data_length, hunks[h].memsize * sizeof(Longword), sizeof(Longword), decoder);
 			decoder.reset();
-			decoder.setListener(&verifier);
 			if (!lzd.decode(verifier)) {
 				error = true;
 			}
@@ -210,7 +272,7 @@ class HunkFile {
 			}
 
 			if (error) {
-				internal_error();
+				return false;
 			}
 
 			if (!mini) {
@@ -218,23 +280,64 @@ class HunkFile {
 				for (int rh = 0 ; rh < numhunks ; rh++) {
 					int delta;
 					do {
-						delta = decoder.decodeNumber(LZEncoder::NUM_CONTEXTS);
+						delta = decoder.decodeNumberAs<RangeDecoder>(LZEncoder::NUM_CONTEXTS);
 					} while (delta != 2);
 				}
 			}
 
 			int margin = verifier.front_overlap_margin;
-			int count = verifier.compressed_read_count;
+			int count = verifier.compressedReadCount();
 			int min_hunksize = (margin == 0 ? 1 : (margin + 3) / 4) + count;
 			count_and_hunksize.push_back(make_pair(count, min_hunksize));
 		}
-		printf("OK\n\n");
 
-		return count_and_hunksize;
+		return true;
+	}
+
+	// Verification of the crunched hunks, run while they are crunched
+	class VerifyJob : public Job {
+		HunkFile *file;
+		bool overlap;
+		bool mini;
+
+	public:
+		BytePipe pipe;
+		vector<pair<int,int> > count_and_hunksize;
+		bool ok;
+
+		VerifyJob(HunkFile *file, bool overlap, bool mini) : file(file), overlap(overlap), mini(mini), ok(false) {}
+
+		void run() {
+			try {
+				ok = file->verify(&pipe, overlap, mini, count_and_hunksize);
+			} catch (BytePipe::Cancelled&) {
+				ok = false;
+			}
+		}
+	};
+
+	void resize(int size) {
+		mapping.unmap();
+		buffer.resize(size);
+		data = buffer.empty() ? NULL : &buffer[0];
+		data_size = size;
 	}
 
 public:
+	HunkFile() : data(NULL), data_size(0) {}
+
 	void load(const char *filename) {
+		if (mapping.map(filename)) {
+			if (mapping.size() & 3) {
+				printf("File %s has an illegal size!\n\n", filename);
+				exit(1);
+			}
+			buffer.clear();
+			data = (Longword *) mapping.data();
+			data_size = mapping.size() / 4;
+			return;
+		}
+
 		FILE *file;
 		if ((file = fopen(filename, "rb"))) {
 			fseek(file, 0, SEEK_END);
@@ -245,8 +348,8 @@ public:
 				fclose(file);
 				exit(1);
 			}
-			data.resize(length / 4);
-			if (fread(&data[0], 4, data.size(), file) == data.size()) {
+			resize(length / 4);
+			if (fread(data, 4, data_size, file) == data_size) {
 				fclose(file);
 				return;
 			}
@@ -259,7 +362,7 @@ public:
 	void save(const char *filename) {
 		FILE *file;
 		if ((file = fopen(filename, "wb"))) {
-			if (fwrite(&data[0], 4, data.size(), file) == data.size()) {
+			if (fwrite(data, 4, data_size, file) == data_size) {
 				fclose(file);
 				return;
 			}
@@ -270,12 +373,12 @@ public:
 	}
 
 	int size() {
-		return data.size() * 4;		
+		return data_size * 4;		
 	}
 
 	bool analyze() {
 		int index = 0;
-		int length = data.size();
+		int length = data_size;
 
 		if (data[index++] != HUNK_HEADER) {
 			printf("No hunk header!\n");
@@ -545,7 +648,7 @@ public:
 	HunkFile* merge_hunks(const vector<pair<unsigned, vector<int> > >& hunklist) {
 		int numhunks = hunks.size();
 		int dnh = hunklist.size();
-		int bufsize = data.size()+relocshort_total_size+3; // Reloc can write 3 further temporarily.
+		int bufsize = data_size+relocshort_total_size+3; // Reloc can write 3 further temporarily.
 
 		// Calculate safe size of new file buffer
 		for (int dh = 0 ; dh < dnh ; dh++) {
@@ -562,7 +665,7 @@ public:
 
 		// Processed file
 		HunkFile *ef = new HunkFile;
-		ef->data.resize(bufsize, 0);
+		ef->resize(bufsize);
 		ef->hunks.resize(dnh);
 
 		vector<int> dhunk(numhunks);
@@ -695,7 +798,7 @@ public:
 		// There must be a HUNK_END after last hunk!
 		ef->data[dpos++] = HUNK_END;
 		// Note resulting file size
-		ef->data.resize(dpos);
+		ef->resize(dpos);
 
 		return ef;
 	}
@@ -712,7 +815,39 @@ public:
 		return true;
 	}
 
-	HunkFile* crunch(PackParams *params, bool overlap, bool mini, bool commandline, string *decrunch_text, unsigned flash_address, RefEdgeFactory *edge_factory, bool show_progress) {
+	// Length of the longest hunk data parsed
+	int max_parse_length(bool mini) {
+		int max_length = 0;
+		int packhunks = mini ? 1 : hunks.size();
+		for (int h = 0 ; h < packhunks ; h++) {
+			unsigned char *hunk_data;
+			int hunk_data_length, zero_padding;
+			hunk_pack_data(h, mini, &hunk_data, &hunk_data_length, &zero_padding);
+			max_length = max(max_length, hunk_data_length);
+		}
+		return max_length;
+	}
+
+	// Size of the crunched hunk data, excluding relocations, for the given
+	// parameters. Nothing is printed. Can be called concurrently.
+	int packed_size(PackParams *params, bool mini, int edge_capacity) {
+		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+		RefEdgeFactory edge_factory(edge_capacity);
+		PackOutput output(true);
+		int packhunks = mini ? 1 : hunks.size();
+		for (int h = 0 ; h < packhunks ; h++) {
+			unsigned char *hunk_data;
+			int hunk_data_length, zero_padding;
+			hunk_pack_data(h, mini, &hunk_data, &hunk_data_length, &zero_padding);
+			range_coder.reset();
+			LZParseResult result = parseData(hunk_data, hunk_data_length, zero_padding, params, &edge_factory, 1, false, output, false, NULL, h);
+			result.encode(BasicLZEncoder<RangeCoder>(&range_coder, params->parity_context));
+		}
+		range_coder.finish();
+		return range_coder.sizeInBytes();
+	}
+
+	HunkFile* crunch(PackParams *params, bool overlap, bool mini, bool commandline, bool cpu020, string *decrunch_text, unsigned flash_address, RefEdgeFactory *edge_factory, bool show_progress) {
 		int numhunks = hunks.size();
 
 		// Pad empty hunks
@@ -728,14 +863,32 @@ public:
 			printf("\n");
 		}
 
-		vector<unsigned char> pack_buffer = compress_hunks(params, overlap, mini, edge_factory, show_progress);
-		vector<pair<int,int> > count_and_hunksize = verify(pack_buffer, overlap, mini);
+		// Verify each hunk while the following hunks are crunched
+		VerifyJob verify_job(this, overlap, mini);
+		JobQueue verify_queue;
+		verify_queue.add(&verify_job);
+		vector<unsigned char> pack_buffer;
+		try {
+			pack_buffer = compress_hunks(params, overlap, mini, edge_factory, show_progress, &verify_job.pipe);
+		} catch (...) {
+			// Stop the verifier, so the queue can be finished
+			verify_job.pipe.cancel();
+			throw;
+		}
+		printf("Verifying... ");
+		fflush(stdout);
+		verify_queue.finish();
+		if (!verify_job.ok) {
+			internal_error();
+		}
+		printf("OK\n\n");
+		vector<pair<int,int> > count_and_hunksize = verify_job.count_and_hunksize;
 
 		int newnumhunks = numhunks+1;
-		int bufsize = data.size() * 11 / 10 + 1000;
+		int bufsize = data_size * 11 / 10 + 1000;
 
 		HunkFile *ef = new HunkFile;
-		ef->data.resize(bufsize, 0);
+		ef->resize(bufsize);
 
 #define WRITE_HEADER(header) do {                                             \
 	ppos = dpos;                                                              \
@@ -743,6 +896,11 @@ public:
 	dpos += sizeof(header) / sizeof(Longword);                                \
 } while (false)
 
+#define WRITE_CPU_HEADER(header) do {                                         \
+	if (cpu020) WRITE_HEADER(header##_020);                                   \
+	else WRITE_HEADER(header);                                                \
+} while (false)
+
 #define WRITE_TEXT() do {                                                     \
 	memcpy(&ef->data[dpos], decrunch_text->c_str(), decrunch_text->length()); \
 	dpos += (decrunch_text->length() + 3) / sizeof(Longword);                 \
@@ -773,19 +931,19 @@ public:
 			if (decrunch_text) {
 				int tpos;
 				if (commandline) {
-					WRITE_HEADER(OverlapHeaderCT);
+					WRITE_CPU_HEADER(OverlapHeaderCT);
 					tpos = ppos + 4;
 				} else {
-					WRITE_HEADER(OverlapHeaderT);
+					WRITE_CPU_HEADER(OverlapHeaderT);
 					tpos = ppos + 3;
 				}
 				ef->data[tpos + 6] = decrunch_text->length(); // Immediate for length of text
 				offsetp = (Word *) &ef->data[tpos + 5]; // PC offset to text
 			} else {
 				if (commandline) {
-					WRITE_HEADER(OverlapHeaderC);
+					WRITE_CPU_HEADER(OverlapHeaderC);
 				} else {
-					WRITE_HEADER(OverlapHeader);
+					WRITE_CPU_HEADER(OverlapHeader);
 				}
 			}
 		} else if (mini) {
@@ -858,9 +1016,9 @@ public:
 			ef->data[dpos++] = HUNK_CODE;
 			lpos2 = dpos++;
 			if (commandline) {
-				WRITE_HEADER(Header2C);
+				WRITE_CPU_HEADER(Header2C);
 			} else {
-				WRITE_HEADER(Header2);
+				WRITE_CPU_HEADER(Header2);
 			}
 		}
 
@@ -935,7 +1093,7 @@ public:
 		// There must be a HUNK_END after last hunk!
 		ef->data[dpos++] = HUNK_END;
 		// Note resulting file size
-		ef->data.resize(dpos);
+		ef->resize(dpos);
 
 		return ef;
 	}
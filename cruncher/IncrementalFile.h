@@ -0,0 +1,157 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Record of the parses of an earlier crunch, for incremental re-crunching.
+
+After a crunch, the data, the final parse and the final symbol counts of
+each block of data (a hunk, or a block of a data file) are written to a
+sidecar file. On the next crunch of the same file, each block is compared
+with the recorded block of the same number. The parse is kept up to the
+end of the last reference before the first change, and only the rest of
+the block is parsed, in a single iteration with the recorded counts as
+the size estimate. Unchanged blocks keep their whole parse, and need no
+match finder at all.
+
+File layout:
+  ShrinklerIncremental <number of blocks>
+  For each block:
+    Block <data length> <number of references>
+    <data bytes, followed by a newline>
+    <position> <offset> <length>, for each reference from the last
+    <symbol counts as written by CountingCoder>
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+using std::vector;
+
+#include "CountingCoder.h"
+#include "LZEncoder.h"
+#include "LZParser.h"
+#include "MatchLength.h"
+#include "Threads.h"
+
+struct IncrementalBlock {
+	vector<unsigned char> data;
+	LZParseResult result;
+	CountingCoder counts;
+
+	IncrementalBlock() : counts(LZEncoder::NUM_CONTEXTS) {}
+};
+
+class IncrementalFile {
+	vector<IncrementalBlock*> previous;
+	vector<IncrementalBlock*> recorded;
+	Mutex mutex;
+
+	static void clear(vector<IncrementalBlock*>& blocks) {
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			delete blocks[b];
+		}
+		blocks.clear();
+	}
+
+public:
+	~IncrementalFile() {
+		clear(previous);
+		clear(recorded);
+	}
+
+	// Read the blocks recorded by an earlier crunch. Returns false if the
+	// file exists, but could not be read.
+	bool load(const char *filename) {
+		FILE *file = fopen(filename, "rb");
+		if (!file) return true;
+		int n_blocks;
+		bool ok = fscanf(file, "ShrinklerIncremental %d", &n_blocks) == 1 && n_blocks >= 0;
+		for (int b = 0 ; ok && b < n_blocks ; b++) {
+			IncrementalBlock *block = new IncrementalBlock;
+			previous.push_back(block);
+			int data_length, n_edges;
+			ok = fscanf(file, " Block %d %d", &data_length, &n_edges) == 2 && data_length >= 0 && n_edges >= 0 && fgetc(file) == '\n';
+			if (!ok) break;
+			block->data.resize(data_length);
+			ok = (data_length == 0 || fread(&block->data[0], 1, data_length, file) == data_length) && fgetc(file) == '\n';
+			for (int i = 0 ; ok && i < n_edges ; i++) {
+				int pos, offset, length;
+				ok = fscanf(file, "%d %d %d", &pos, &offset, &length) == 3 && pos > 0 && offset > 0 && offset <= pos &&
+				     length >= 2 && pos + length <= data_length;
+				block->result.edges.push_back(LZResultEdge(pos, offset, length));
+			}
+			ok = ok && block->counts.read(file);
+		}
+		fclose(file);
+		if (!ok) clear(previous);
+		return ok;
+	}
+
+	// Write the blocks recorded during this crunch
+	bool save(const char *filename) {
+		FILE *file = fopen(filename, "wb");
+		if (!file) return false;
+		fprintf(file, "ShrinklerIncremental %d\n", (int) recorded.size());
+		IncrementalBlock empty;
+		for (int b = 0 ; b < recorded.size() ; b++) {
+			IncrementalBlock *block = recorded[b] ? recorded[b] : &empty;
+			const vector<LZResultEdge>& edges = block->result.edges;
+			fprintf(file, "Block %d %d\n", (int) block->data.size(), (int) edges.size());
+			if (!block->data.empty()) {
+				fwrite(&block->data[0], 1, block->data.size(), file);
+			}
+			fprintf(file, "\n");
+			for (int i = 0 ; i < edges.size() ; i++) {
+				fprintf(file, "%d %d %d\n", edges[i].pos, edges[i].offset, edges[i].length);
+			}
+			block->counts.write(file);
+		}
+		bool ok = !ferror(file);
+		return fclose(file) == 0 && ok;
+	}
+
+	// The block with the given number from the earlier crunch, or NULL
+	const IncrementalBlock* block(int b) {
+		return b < previous.size() ? previous[b] : NULL;
+	}
+
+	// The part of the earlier parse of a block which is still valid for the
+	// new data of the block: the references ending before the first change.
+	// Returns where the parse of the rest of the data should start.
+	static int validPrefix(const IncrementalBlock *block, const unsigned char *data, int data_length, LZParseResult *prefix) {
+		int old_length = block->data.size();
+		int same = min(old_length, data_length) > 0 ? matchLength(&block->data[0], data, min(old_length, data_length)) : 0;
+		const vector<LZResultEdge>& edges = block->result.edges;
+		if (same == old_length && same == data_length) {
+			// Unchanged
+			prefix->edges = edges;
+			return data_length;
+		}
+
+		// The edges are in reverse order
+		int sync = 0;
+		int i = edges.size() - 1;
+		while (i >= 0 && edges[i].pos + edges[i].length <= same) {
+			sync = edges[i].pos + edges[i].length;
+			i--;
+		}
+		prefix->edges.assign(edges.begin() + (i + 1), edges.end());
+		return sync;
+	}
+
+	// Record the final parse and counts of a block during this crunch. Can
+	// be called concurrently.
+	void record(int b, const unsigned char *data, int data_length, const LZParseResult& result, const CountingCoder *counts) {
+		IncrementalBlock *block = new IncrementalBlock;
+		block->data.assign(data, data + data_length);
+		block->result.edges = result.edges;
+		block->counts = *counts;
+		MutexLock lock(mutex);
+		if (b >= recorded.size()) recorded.resize(b + 1, NULL);
+		delete recorded[b];
+		recorded[b] = block;
+	}
+};
@@ -18,33 +18,49 @@ public:
 	virtual ~LZReceiver() {}
 };
 
-class LZDecoder {
-	Decoder *decoder;
+// The decoder decodes bits through a decoder of type DecoderT and passes
+// the symbols to a receiver of type ReceiverT. With final classes, the calls
+// are resolved and inlined at compile time, as for BasicLZEncoder. LZDecoder
+// decodes through the virtual Decoder interface. The parity context can be
+// fixed at compile time as for BasicLZEncoder.
+template <class DecoderT, int PARITY_MASK = RUNTIME_PARITY>
+class BasicLZDecoder {
+	DecoderT *decoder;
 	int parity_mask;
 
-	int decode(int context) const {
+	int parityOf(int pos) const {
+		return pos & (PARITY_MASK == RUNTIME_PARITY ? parity_mask : PARITY_MASK);
+	}
+
+	int decodeBit(int context) const {
 		return decoder->decode(LZEncoder::NUM_SINGLE_CONTEXTS + context);
 	}
 
 	int decodeNumber(int context_group) const {
-		return decoder->decodeNumber(LZEncoder::NUM_SINGLE_CONTEXTS + (context_group << 8));
+		return decoder->template decodeNumberAs<DecoderT>(LZEncoder::NUM_SINGLE_CONTEXTS + (context_group << 8));
 	}
 
 public:
-	LZDecoder(Decoder *decoder, bool parity_context) : decoder(decoder), parity_mask(parity_context ? 1 : 0) {
-
+	BasicLZDecoder(DecoderT *decoder, bool parity_context) : decoder(decoder), parity_mask(parity_context ? 1 : 0) {
+		assert(PARITY_MASK == RUNTIME_PARITY || PARITY_MASK == parity_mask);
 	}
 
-	bool decode(LZReceiver& receiver) {
+	// Decode data which follows a history of the given even length, such
+	// as a dictionary. The first symbol can then be a reference.
+	template <class ReceiverT>
+	bool decode(ReceiverT& receiver, int history_length = 0) {
 		bool ref = false;
 		bool prev_was_ref = false;
 		int pos = 0;
 		int offset = 0;
+		if (history_length > 0) {
+			ref = decodeBit(LZEncoder::CONTEXT_KIND);
+		}
 		do {
 			if (ref) {
 				bool repeated = false;
 				if (!prev_was_ref) {
-					repeated = decode(LZEncoder::CONTEXT_REPEATED);
+					repeated = decodeBit(LZEncoder::CONTEXT_REPEATED);
 				}
 				if (!repeated) {
 					offset = decodeNumber(LZEncoder::CONTEXT_GROUP_OFFSET) - 2;
@@ -55,10 +71,10 @@ public:
 				pos += length;
 				prev_was_ref = true;
 			} else {
-				int parity = pos & parity_mask;
+				int parity = parityOf(pos);
 				int context = 1;
 				for (int i = 7 ; i >= 0 ; i--) {
-					int bit = decode((parity << 8) | context);
+					int bit = decodeBit((parity << 8) | context);
 					context = (context << 1) | bit;
 				}
 				unsigned char lit = context;
@@ -66,10 +82,12 @@ public:
 				pos += 1;
 				prev_was_ref = false;
 			}
-			int parity = pos & parity_mask;
-			ref = decode(LZEncoder::CONTEXT_KIND + (parity << 8));
+			int parity = parityOf(pos);
+			ref = decodeBit(LZEncoder::CONTEXT_KIND + (parity << 8));
 		} while (true);
 		return true;
 	}
 
 };
+
+typedef BasicLZDecoder<Decoder> LZDecoder;
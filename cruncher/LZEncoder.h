@@ -61,18 +61,32 @@ The entropy coder defines the final compressed data contents.
 
 #pragma once
 
+#include <vector>
+
+using std::vector;
+
 #include "Coder.h"
 
+// Parity mask of an encoder or decoder for which the parity context is given
+// at run time rather than fixed at compile time
+const int RUNTIME_PARITY = -1;
+
 class LZState {
 	unsigned after_first:1;
 	unsigned prev_was_ref:1;
 	unsigned parity:1;
-	unsigned last_offset:28;
+	int last_offset;
 
-	friend class LZEncoder;
+	template <class CoderT, int PARITY_MASK> friend class BasicLZEncoder;
 };
 
-class LZEncoder {
+// The encoder codes bits through a coder of type CoderT. With a final coder
+// class, the coding calls are resolved and inlined at compile time. LZEncoder
+// codes through the virtual Coder interface and works with any coder.
+// With a PARITY_MASK of 0 or 1, the parity context is fixed at compile time,
+// and must match the one given to the constructor.
+template <class CoderT, int PARITY_MASK = RUNTIME_PARITY>
+class BasicLZEncoder {
 	static const int NUM_SINGLE_CONTEXTS = 1;
 	static const int NUM_CONTEXT_GROUPS = 4;
 	static const int CONTEXT_GROUP_SIZE = 256;
@@ -84,7 +98,7 @@ class LZEncoder {
 	static const int CONTEXT_GROUP_OFFSET = 2;
 	static const int CONTEXT_GROUP_LENGTH = 3;
 
-	Coder *coder;
+	CoderT *coder;
 	int parity_mask;
 
 	int code(int context, int bit) const {
@@ -92,10 +106,16 @@ class LZEncoder {
 	}
 
 	int encodeNumber(int context_group, int number) const {
-		return coder->encodeNumber(NUM_SINGLE_CONTEXTS + (context_group << 8), number);
+		return coder->template encodeNumberAs<CoderT>(NUM_SINGLE_CONTEXTS + (context_group << 8), number);
 	}
 
-	friend class LZDecoder;
+	int parityOffset(int parity) const {
+		return (parity & (PARITY_MASK == RUNTIME_PARITY ? parity_mask : PARITY_MASK)) << 8;
+	}
+
+	template <class DecoderT, int DECODER_PARITY_MASK> friend class BasicLZDecoder;
+	friend class LZReferenceCost;
+	friend class LZLiteralCost;
 
 public:
 	static const int KIND_LIT = 0;
@@ -105,8 +125,8 @@ public:
 	static const int NUMBER_CONTEXT_OFFSET = (NUM_SINGLE_CONTEXTS + CONTEXT_GROUP_OFFSET * CONTEXT_GROUP_SIZE);
 	static const int NUM_NUMBER_CONTEXTS = 2;
 
-	LZEncoder(Coder *coder, bool parity_context) : coder(coder), parity_mask(parity_context ? 1 : 0) {
-
+	BasicLZEncoder(CoderT *coder, bool parity_context) : coder(coder), parity_mask(parity_context ? 1 : 0) {
+		assert(PARITY_MASK == RUNTIME_PARITY || PARITY_MASK == parity_mask);
 	}
 
 	void setInitialState(LZState *state) const {
@@ -124,7 +144,7 @@ public:
 	}
 
 	int encodeLiteral(unsigned char value, const LZState *state_before, LZState *state_after) const {
-		int parity_offset = (state_before->parity & parity_mask) << 8;
+		int parity_offset = parityOffset(state_before->parity);
 		int size = 0;
 		if (state_before->after_first) {
 			size += code(CONTEXT_KIND + parity_offset, KIND_LIT);
@@ -149,7 +169,7 @@ public:
 		assert(length >= 2);
 		assert(state_before->after_first);
 
-		int parity_offset = (state_before->parity & parity_mask) << 8;
+		int parity_offset = parityOffset(state_before->parity);
 		int size = code(CONTEXT_KIND + parity_offset, KIND_REF);
 		int rep_offset = offset == state_before->last_offset;
 		if (!state_before->prev_was_ref) {
@@ -170,8 +190,22 @@ public:
 		return size;
 	}
 
+	// Adapt the literal contexts to the given data, as coding all of it as
+	// literals would, but without coding the kind of each symbol.
+	void primeLiterals(const unsigned char *data, int length) const {
+		for (int pos = 0 ; pos < length ; pos++) {
+			int parity_offset = parityOffset(pos);
+			int context = 1;
+			for (int i = 7 ; i >= 0 ; i--) {
+				int bit = ((data[pos] >> i) & 1);
+				code(parity_offset | context, bit);
+				context = (context << 1) | bit;
+			}
+		}
+	}
+
 	int finish(const LZState *state_before) const {
-		int parity_offset = (state_before->parity & parity_mask) << 8;
+		int parity_offset = parityOffset(state_before->parity);
 		int size = code(CONTEXT_KIND + parity_offset, KIND_REF);
 		if (!state_before->prev_was_ref) {
 			size += code(CONTEXT_REPEATED, 0);
@@ -184,3 +218,146 @@ public:
 	}
 };
 
+typedef BasicLZEncoder<Coder> LZEncoder;
+
+// Approximate number of 68000 cycles spent by the decrunchers on decoding
+// the parts of the symbols, for trading crunched size for decrunch speed.
+// Each bit decoded by GetBit takes about the same time, whatever its size.
+// The speed weight is the size in bits given up per 10000 cycles saved.
+class DecrunchCycles {
+public:
+	static const int BIT = 200;
+	static const int LITERAL = 60;
+	static const int REFERENCE = 150;
+	static const int COPY = 36;
+
+	// Size penalty (in fractional bits) of the given number of cycles
+	static int cost(int cycles, int speed_weight) {
+		return (int) (((long long) cycles * speed_weight << Coder::BIT_PRECISION) / 10000);
+	}
+
+	// Number of bits decoded for a number >= 2
+	static int numberBits(int number) {
+		int bits = 0;
+		while (number >= 2) {
+			number >>= 1;
+			bits += 2;
+		}
+		return bits;
+	}
+};
+
+// Table-driven computation of the coded size of references, giving the same
+// sizes as LZEncoder::encodeReference. Only valid for coders whose sizes do
+// not depend on previously coded bits, such as SizeMeasuringCoder, and only
+// as long as those sizes do not change.
+// With a speed weight, the sizes include the penalty for the decrunch cycles.
+class LZReferenceCost {
+	int kind_size[2];
+	int repeated_size[2];
+	NumberSizeTable offset_sizes;
+	NumberSizeTable length_sizes;
+	int max_offset;
+	int max_length;
+	// Penalty per copied byte, in 1/65536 fractional bits
+	int copy_cost;
+
+	template <class CoderT>
+	static void buildNumberSizes(NumberSizeTable& table, const BasicLZEncoder<CoderT>& encoder, int context_group, int max_number, int bit_cost) {
+		int bit_sizes[NumberSizeTable::NUM_BIT_CONTEXTS][2];
+		for (int context = 0 ; context < NumberSizeTable::NUM_BIT_CONTEXTS ; context++) {
+			bit_sizes[context][0] = encoder.code((context_group << 8) + context, 0);
+			bit_sizes[context][1] = encoder.code((context_group << 8) + context, 1);
+		}
+		table.build(bit_sizes, max_number, bit_cost);
+	}
+
+public:
+	// Build tables for references with offsets and lengths up to the given
+	// maximums. The table sizes are bounded, so building is cheap even for
+	// large maximums.
+	template <class CoderT>
+	void init(const BasicLZEncoder<CoderT>& encoder, int max_offset, int max_length, int speed_weight = 0) {
+		int bit_cost = DecrunchCycles::cost(DecrunchCycles::BIT, speed_weight);
+		for (int parity = 0 ; parity < 2 ; parity++) {
+			int parity_offset = (parity & encoder.parity_mask) << 8;
+			kind_size[parity] = encoder.code(LZEncoder::CONTEXT_KIND + parity_offset, LZEncoder::KIND_REF)
+			                  + DecrunchCycles::cost(DecrunchCycles::BIT + DecrunchCycles::REFERENCE, speed_weight);
+			repeated_size[parity] = encoder.code(LZEncoder::CONTEXT_REPEATED, parity) + bit_cost;
+		}
+		buildNumberSizes(offset_sizes, encoder, LZEncoder::CONTEXT_GROUP_OFFSET, max_offset + 2, bit_cost);
+		buildNumberSizes(length_sizes, encoder, LZEncoder::CONTEXT_GROUP_LENGTH, max_length, bit_cost);
+		this->max_offset = max_offset;
+		this->max_length = max_length;
+		copy_cost = DecrunchCycles::cost(DecrunchCycles::COPY << 16, speed_weight);
+	}
+
+	// Size of a reference at pos, after the first symbol.
+	int size(int pos, bool prev_was_ref, int last_offset, int offset, int length) const {
+		assert(offset >= 1 && offset <= max_offset);
+		assert(length >= 2 && length <= max_length);
+		int rep_offset = offset == last_offset;
+		assert(!(prev_was_ref && rep_offset));
+		int size = kind_size[pos & 1] + length_sizes.size(length) + (int) (((long long) length * copy_cost) >> 16);
+		if (!prev_was_ref) {
+			size += repeated_size[rep_offset];
+		}
+		if (!rep_offset) {
+			size += offset_sizes.size(offset + 2);
+		}
+		return size;
+	}
+};
+
+// Table of the coded sizes of literals, giving the same sizes as
+// LZEncoder::encodeLiteral, with the same validity and speed weight as
+// LZReferenceCost.
+class LZLiteralCost {
+	int kind_size[2];
+	int literal_size[2][256];
+
+public:
+	template <class CoderT>
+	void init(const BasicLZEncoder<CoderT>& encoder, int speed_weight = 0) {
+		for (int parity = 0 ; parity < 2 ; parity++) {
+			int parity_offset = (parity & encoder.parity_mask) << 8;
+			kind_size[parity] = encoder.code(LZEncoder::CONTEXT_KIND + parity_offset, LZEncoder::KIND_LIT)
+			                  + DecrunchCycles::cost(DecrunchCycles::BIT, speed_weight);
+			for (int value = 0 ; value < 256 ; value++) {
+				int size = kind_size[parity] + DecrunchCycles::cost(8 * DecrunchCycles::BIT + DecrunchCycles::LITERAL, speed_weight);
+				int context = 1;
+				for (int i = 7 ; i >= 0 ; i--) {
+					int bit = ((value >> i) & 1);
+					size += encoder.code(parity_offset | context, bit);
+					context = (context << 1) | bit;
+				}
+				literal_size[parity][value] = size;
+			}
+		}
+	}
+
+	// Size of a literal at pos
+	int size(int pos, unsigned char value) const {
+		int size = literal_size[pos & 1][value];
+		return pos > 0 ? size : size - kind_size[0];
+	}
+
+	// Compute the total size of the literals before each position. The sizes
+	// are accumulated in 64 bits and stored in the given Size type, which
+	// wraps around if it is too small for them. Returns the total size.
+	template <typename Size>
+	long long accumulate(const unsigned char *data, int length, vector<Size>& sizes_before) const {
+		sizes_before.resize(length + 1);
+		long long size = 0;
+		if (length > 0) {
+			sizes_before[0] = 0;
+			size = this->size(0, data[0]);
+		}
+		for (int i = 1 ; i < length ; i++) {
+			sizes_before[i] = (Size) size;
+			size += literal_size[i & 1][data[i]];
+		}
+		sizes_before[length] = (Size) size;
+		return size;
+	}
+};
@@ -0,0 +1,158 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Parse a data block into LZ symbols in a single pass with lazy matching.
+
+This is a fast alternative to the optimal parse of LZParser, meant for
+quick development builds. At each position, the parser picks the match
+which saves the most compared to coding its bytes as literals, considering
+a repeat of the previous offset as well as the matches reported by the
+match finder. Before taking it, the parser looks one position ahead, and
+codes a literal instead if the best match there saves more.
+
+The sizes of symbols are taken from the fixed sizes of the encoder, as for
+LZParser, including any speed weight. The result is an LZParseResult like
+that of LZParser.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+using std::vector;
+
+#include "LZEncoder.h"
+#include "LZParser.h"
+#include "MatchFinder.h"
+#include "MatchLength.h"
+#include "Timer.h"
+
+class LZLazyParser {
+	struct Choice {
+		int offset;
+		int length;
+		int saving;
+	};
+
+	const unsigned char *data;
+	int data_length;
+	int zero_padding;
+	MatchFinder& finder;
+	int parse_start;
+	int speed_weight;
+	LZReferenceCost reference_cost;
+	LZLiteralCost literal_cost;
+	// Only differences of nearby sizes are used, so the sizes may wrap around
+	vector<unsigned> literal_size;
+
+	// Size saved by coding the bytes from pos as the given reference
+	// rather than as literals
+	int saving(int pos, bool prev_was_ref, int last_offset, int offset, int length) {
+		return (int) (literal_size[pos + length] - literal_size[pos]) - reference_cost.size(pos, prev_was_ref, last_offset, offset, length);
+	}
+
+	// The reference from pos which saves the most, given the symbol before it
+	Choice best_choice(int pos, bool prev_was_ref, int last_offset) {
+		Choice best = { 0, 0, 0 };
+		if (!prev_was_ref && last_offset > 0 && last_offset <= pos) {
+			int length = matchLength(&data[pos], &data[pos - last_offset], data_length - pos);
+			if (length >= 2) {
+				int s = saving(pos, prev_was_ref, last_offset, last_offset, length);
+				if (s > best.saving) {
+					Choice choice = { last_offset, length, s };
+					best = choice;
+				}
+			}
+		}
+		finder.beginMatching(pos);
+		int match_pos;
+		int match_length;
+		while (finder.nextMatch(&match_pos, &match_length)) {
+			int offset = pos - match_pos;
+			int length = min(match_length, data_length - pos);
+			if (length < 2 || (prev_was_ref && offset == last_offset)) continue;
+			int s = saving(pos, prev_was_ref, last_offset, offset, length);
+			if (s > best.saving || (s == best.saving && best.length > 0 && offset < best.offset)) {
+				Choice choice = { offset, length, s };
+				best = choice;
+			}
+		}
+		return best;
+	}
+
+public:
+	// Time spent setting up the symbol sizes in the latest parse
+	double setup_seconds;
+
+	LZLazyParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder, int parse_start = 0, int speed_weight = 0)
+		: data(data), data_length(data_length), zero_padding(zero_padding), finder(finder), parse_start(parse_start), speed_weight(speed_weight),
+		  setup_seconds(0)
+	{}
+
+	// The sizes given by the coder of the encoder must be fixed during the parse.
+	template <class CoderT>
+	LZParseResult parse(const BasicLZEncoder<CoderT>& encoder, LZProgress *progress) {
+		LZParseResult result;
+		parse(encoder, progress, result);
+		return result;
+	}
+
+	// As parse, into the given result, whose edge vector keeps its capacity
+	template <class CoderT>
+	void parse(const BasicLZEncoder<CoderT>& encoder, LZProgress *progress, LZParseResult& result) {
+		progress->begin(data_length);
+		double setup_start = timeSeconds();
+		reference_cost.init(encoder, data_length, data_length, speed_weight);
+		literal_cost.init(encoder, speed_weight);
+		literal_cost.accumulate(data, data_length, literal_size);
+		setup_seconds = timeSeconds() - setup_start;
+
+		result.data = data;
+		result.start = parse_start;
+		result.data_length = data_length;
+		result.zero_padding = zero_padding;
+		result.stopped = false;
+
+		// The first symbol of the data is always a literal
+		vector<LZResultEdge>& edges = result.edges;
+		edges.clear();
+		bool prev_was_ref = false;
+		int last_offset = 0;
+		int pos = max(1, parse_start);
+		bool have_next = false;
+		Choice next;
+		while (pos < data_length) {
+			Choice choice = have_next ? next : best_choice(pos, prev_was_ref, last_offset);
+			have_next = false;
+			if (choice.length > 0 && pos + 1 < data_length) {
+				next = best_choice(pos + 1, false, last_offset);
+				have_next = true;
+				if (next.saving > choice.saving) {
+					choice.length = 0;
+				}
+			}
+			if (choice.length > 0) {
+				edges.push_back(LZResultEdge(pos, choice.offset, choice.length));
+				pos += choice.length;
+				prev_was_ref = true;
+				last_offset = choice.offset;
+				have_next = false;
+			} else {
+				pos++;
+				prev_was_ref = false;
+			}
+			if (!progress->update(pos) && pos < data_length) {
+				result.stopped = true;
+				break;
+			}
+		}
+
+		// Edges are stored in reverse order
+		std::reverse(edges.begin(), edges.end());
+
+		progress->end();
+	}
+};
@@ -24,7 +24,31 @@ parsing at the end of the match.
 The max_edges parameter controls the total number of reference edges the
 parser will keep around for representing potential parses. Whenever the
 limit is reached, the parser will delete the least favorable of the current
-parses to free up space.
+parses to free up space. The evict_percent parameter makes the parser free
+that percentage of the limit at once instead of one edge at a time, which
+saves time when the limit is reached often, at some cost in precision.
+
+The run_length parameter is a cheaper variant of skip_length for runs of a
+single byte or of a short repeated pattern, such as zero padding. Whenever
+the data from the current position repeats the data a few bytes before it
+for at least run_length bytes, the parser adds the reference with that
+offset across the whole run and skips ahead to the end of the run, without
+finding matches for the positions inside the run. Like a skip, this drops
+the other parses in progress, so it can cost compression. A run_length of 0
+turns this off and is the default.
+
+The speed_weight parameter adds an estimate of the decrunch time of each
+symbol to its size, so the parser prefers fewer and longer references at
+some cost in size. It is given in bits per 10000 cycles of a 68000, and 0
+optimizes for size alone.
+
+The parser can start at a later position than the beginning of the data,
+in which case the data before that position is only used as a source for
+references. This is used for parsing large data in windows.
+
+The parser can record a profile of the work done in each window of the
+input (see ParseProfile.h). Without a profile, it only checks for one at
+each position and at each match, edge and eviction.
 
 */
 
@@ -37,6 +61,8 @@ parses to free up space.
 #include <utility>
 #include <list>
 #include <algorithm>
+#include <new>
+#include <cstdlib>
 
 using std::map;
 using std::max;
@@ -48,28 +74,41 @@ using std::vector;
 #include "LZEncoder.h"
 #include "MatchFinder.h"
 #include "Heap.h"
+#include "BucketQueue.h"
 #include "CuckooHash.h"
+#include "FlatHash.h"
+#include "Threads.h"
+#include "Timer.h"
+#include "Trace.h"
+#include "ParseProfile.h"
 #include "assert.h"
 
 // For each offset:
 //   Best total size with last ref having that offset
-
-class RefEdge {
+//
+// Edges live in the slab of a RefEdgeFactory and refer to their source edge
+// by 32-bit slab index (0 meaning none), which keeps the struct small.
+//
+// The total size of a parse is kept in the given Size type. RefEdge has 32-bit
+// sizes, which cover data of a few MB. Larger data is parsed with the 64-bit
+// sizes of WideRefEdge.
+
+template <class Edge> class BasicRefEdgeFactory;
+template <class Edge> class BasicLZParser;
+
+template <typename Size>
+class BasicRefEdge {
+	Size total_size;
 	int pos;
 	int offset;
 	int length;
-	int total_size;
 	int refcount;
-	RefEdge *source;
+	unsigned source;
 
-	RefEdge(int pos, int offset, int length, int total_size, RefEdge *source)
-		: pos(pos), offset(offset), length(length), total_size(total_size), source(source)
+	BasicRefEdge(int pos, int offset, int length, Size total_size, unsigned source)
+		: total_size(total_size), pos(pos), offset(offset), length(length), source(source)
 	{
-		assert(source != this);
 		refcount = 1;
-		if (source != NULL) {
-			source->refcount++;
-		}
 		_heap_index = 0;
 	}
 
@@ -77,47 +116,112 @@ class RefEdge {
 		return pos + length;
 	}
 
-	friend class RefEdgeFactory;
-	friend class LZParser;
+	friend class BasicRefEdgeFactory<BasicRefEdge>;
+	friend class BasicLZParser<BasicRefEdge>;
 	friend struct LZResultEdge;
 	friend class LZParseResult;
-	friend struct std::less<RefEdge*>;
+	friend struct std::less<BasicRefEdge*>;
+	friend struct BucketKey<BasicRefEdge*>;
 
 public:
+	typedef Size size_type;
+
+	// Largest total size of the literals of the data which leaves room for
+	// the total sizes of all parses of the data. A reference costs at most
+	// a few times the literals it replaces.
+	static const long long MAX_LITERAL_SIZE = (sizeof(Size) < sizeof(long long) ? (long long) 0x7fffffff : 0x7fffffffffffffffLL) / 4;
+
 	int _heap_index;
 };
 
+typedef BasicRefEdge<int> RefEdge;
+typedef BasicRefEdge<long long> WideRefEdge;
+
 namespace std {
-	template <> struct less<RefEdge*> {
-		bool operator()(RefEdge* const & e1, RefEdge* const & e2) const {
+	template <typename Size> struct less<BasicRefEdge<Size>*> {
+		bool operator()(BasicRefEdge<Size>* const & e1, BasicRefEdge<Size>* const & e2) const {
 			return e1->total_size < e2->total_size;
 		}
 	};
 }
 
-// Factory for RefEdge objects which recycles destroyed objects for efficiency
-class RefEdgeFactory {
+// Root edges in a bucket queue are ordered by whole bits of total size, or by
+// whole kilobits for 64-bit sizes, to keep the keys within an int.
+template <typename Size> struct BucketKey<BasicRefEdge<Size>*> {
+	int operator()(BasicRefEdge<Size>* const & e) const {
+		return (int) (e->total_size >> (Coder::BIT_PRECISION + (sizeof(Size) > sizeof(int) ? 10 : 0)));
+	}
+};
+
+// Factory for RefEdge objects which recycles destroyed objects for efficiency.
+// All edges up to the capacity are carved out of a single slab and linked by
+// index. Should the parser exceed the capacity (when no edge can be cleaned),
+// further edges are taken from overflow chunks, which never move either.
+template <class Edge>
+class BasicRefEdgeFactory {
+	static const int OVERFLOW_CHUNK_BITS = 16;
+	static const unsigned OVERFLOW_CHUNK_SIZE = 1 << OVERFLOW_CHUNK_BITS;
+
 	int edge_capacity;
 	int edge_count;
 	int cleaned_edges;
 
-	RefEdge* buffer;
+	Edge* slab;
+	unsigned slab_size;
+	vector<Edge*> overflow;
+	unsigned next_unused;
+	unsigned free_list;
+
+	unsigned index_of(Edge *edge) {
+		if (edge == NULL) return 0;
+		if (edge >= slab && edge < slab + slab_size) return edge - slab;
+		for (unsigned c = 0 ; c < overflow.size() ; c++) {
+			if (edge >= overflow[c] && edge < overflow[c] + OVERFLOW_CHUNK_SIZE) {
+				return slab_size + (c << OVERFLOW_CHUNK_BITS) + (edge - overflow[c]);
+			}
+		}
+		internal_error();
+		return 0;
+	}
+
+	static Edge* allocate(unsigned count) {
+		Edge* edges = (Edge*) malloc(count * sizeof(Edge));
+		if (edges == NULL) throw std::bad_alloc();
+		return edges;
+	}
+
 public:
 	int max_edge_count;
 	int max_cleaned_edges;
 
-	RefEdgeFactory(int edge_capacity) : edge_capacity(edge_capacity),
+	BasicRefEdgeFactory(int edge_capacity) : edge_capacity(edge_capacity),
 		edge_count(0), cleaned_edges(0), max_edge_count(0), max_cleaned_edges(0)
 	{
-		buffer = NULL;
+		// Slot 0 is reserved as the null index. Pages of the slab are
+		// not touched until the parse actually reaches them.
+		slab_size = edge_capacity + 1;
+		slab = allocate(slab_size);
+		next_unused = 1;
+		free_list = 0;
 	}
 
-	~RefEdgeFactory() {
-		while (buffer != NULL) {
-			RefEdge *edge = buffer;
-			buffer = buffer->source;
-			delete edge;
+	~BasicRefEdgeFactory() {
+		for (unsigned c = 0 ; c < overflow.size() ; c++) {
+			free(overflow[c]);
 		}
+		free(slab);
+	}
+
+	Edge* get(unsigned index) {
+		if (index < slab_size) {
+			return index == 0 ? NULL : &slab[index];
+		}
+		index -= slab_size;
+		return &overflow[index >> OVERFLOW_CHUNK_BITS][index & (OVERFLOW_CHUNK_SIZE - 1)];
+	}
+
+	Edge* source(Edge *edge) {
+		return get(edge->source);
 	}
 
 	void reset() {
@@ -125,20 +229,29 @@ public:
 		cleaned_edges = 0;
 	}
 
-	RefEdge* create(int pos, int offset, int length, int total_size, RefEdge *source) {
+	Edge* create(int pos, int offset, int length, typename Edge::size_type total_size, Edge *source) {
 		max_edge_count = max(max_edge_count, ++edge_count);
-		if (buffer == NULL) {
-			return new RefEdge(pos, offset, length, total_size, source);
+		unsigned index;
+		if (free_list != 0) {
+			index = free_list;
+			free_list = get(index)->source;
 		} else {
-			RefEdge* edge = buffer;
-			buffer = edge->source;
-			return new (edge) RefEdge(pos, offset, length, total_size, source);
+			index = next_unused++;
+			if (index >= slab_size && ((index - slab_size) & (OVERFLOW_CHUNK_SIZE - 1)) == 0) {
+				overflow.push_back(allocate(OVERFLOW_CHUNK_SIZE));
+			}
 		}
+		Edge *edge = get(index);
+		assert(source != edge);
+		if (source != NULL) {
+			source->refcount++;
+		}
+		return new (edge) Edge(pos, offset, length, total_size, index_of(source));
 	}
 
-	void destroy(RefEdge* edge, bool clean) {
-		edge->source = buffer;
-		buffer = edge;
+	void destroy(Edge* edge, bool clean) {
+		edge->source = free_list;
+		free_list = index_of(edge);
 		edge_count--;
 		if (clean) {
 			max_cleaned_edges = max(max_cleaned_edges, ++cleaned_edges);
@@ -149,12 +262,44 @@ public:
 		return edge_count >= edge_capacity;
 	}
 
+	int capacity() {
+		return edge_capacity;
+	}
+
+	int count() {
+		return edge_count;
+	}
+
 };
 
+typedef BasicRefEdgeFactory<RefEdge> RefEdgeFactory;
+typedef BasicRefEdgeFactory<WideRefEdge> WideRefEdgeFactory;
+
+// Progress of a parse. The parser reports every position it reaches through
+// update, which only records the position, for sampling from other threads,
+// and calls check whenever the position reaches next_check.
 class LZProgress {
+	Gauge reached;
+protected:
+	int next_check;
 public:
+	LZProgress() : next_check(0) {}
+
 	virtual void begin(int size) = 0;
-	virtual void update(int pos) = 0;
+
+	// Returns false to stop the parse early
+	bool update(int pos) {
+		reached.set(pos);
+		return pos < next_check || check(pos);
+	}
+
+	// Position most recently reported
+	int position() const {
+		return reached.value();
+	}
+
+	// Returns false to stop the parse early
+	virtual bool check(int pos) = 0;
 	virtual void end() = 0;
 
 	virtual ~LZProgress() {}
@@ -165,7 +310,10 @@ struct LZResultEdge {
 	int offset;
 	int length;
 
-	LZResultEdge(RefEdge *edge) : pos(edge->pos), offset(edge->offset), length(edge->length) {}
+	template <typename Size>
+	LZResultEdge(BasicRefEdge<Size> *edge) : pos(edge->pos), offset(edge->offset), length(edge->length) {}
+
+	LZResultEdge(int pos, int offset, int length) : pos(pos), offset(offset), length(length) {}
 
 	friend class LZParseResult;
 };
@@ -175,14 +323,25 @@ typedef unsigned long long result_size_t;
 class LZParseResult {
 	vector<LZResultEdge> edges;
 	const unsigned char *data;
+	int start;
 	int data_length;
 	int zero_padding;
+	bool stopped;
 public:
-	result_size_t encode(const LZEncoder& result_encoder) const {
+	LZParseResult() : data(NULL), start(0), data_length(0), zero_padding(0), stopped(false) {}
+
+	// Whether the parse was stopped early. The result is then still valid,
+	// but ends with literals from the point where the parse stopped.
+	bool isStopped() const {
+		return stopped;
+	}
+	template <class CoderT, int PARITY_MASK>
+	result_size_t encode(const BasicLZEncoder<CoderT, PARITY_MASK>& result_encoder) const {
+		// Data before the start is history, such as a dictionary
 		result_size_t size = 0;
-		int pos = 0;
+		int pos = start;
 		LZState state;
-		result_encoder.setInitialState(&state);
+		result_encoder.constructState(&state, start, false, 0);
 		for (int i = edges.size() - 1 ; i >= 0 ; i--) {
 			const LZResultEdge *edge = &edges[i];
 			while (pos < edge->pos) {
@@ -206,36 +365,181 @@ public:
 		return size;
 	}
 
-	friend class LZParser;
+	// For each segment of segment_size bytes from position from, add the
+	// number of bytes coded by references and the number of references
+	// starting in the segment
+	void countReferences(int from, int segment_size, vector<int>& covered, vector<int>& references) const {
+		for (int i = 0 ; i < edges.size() ; i++) {
+			int pos = edges[i].pos - from;
+			int end = pos + edges[i].length;
+			references[pos / segment_size]++;
+			while (pos < end) {
+				int segment_end = min(end, (pos / segment_size + 1) * segment_size);
+				covered[pos / segment_size] += segment_end - pos;
+				pos = segment_end;
+			}
+		}
+	}
+
+	// The part of the result from position from up to position to, as a
+	// result of its own. References crossing either end are cut there, and
+	// dropped if fewer than two bytes of them remain.
+	LZParseResult slice(int from, int to) const {
+		LZParseResult result;
+		result.data = data;
+		result.start = from;
+		result.data_length = to;
+		result.stopped = stopped;
+		for (int i = 0 ; i < edges.size() ; i++) {
+			LZResultEdge edge = edges[i];
+			int edge_start = max(edge.pos, from);
+			int edge_end = min(edge.pos + edge.length, to);
+			if (edge_end - edge_start < 2) continue;
+			edge.pos = edge_start;
+			edge.length = edge_end - edge_start;
+			result.edges.push_back(edge);
+		}
+		return result;
+	}
+
+	// Combine the results of parsing consecutive windows of the data, given
+	// with the start position of each window, into one result for the data
+	// from the given start.
+	static LZParseResult combine(const unsigned char *data, int start, int data_length, int zero_padding,
+	                             const vector<LZParseResult>& windows, const vector<int>& window_starts) {
+		LZParseResult result;
+		result.data = data;
+		result.start = start;
+		result.data_length = data_length;
+		result.zero_padding = zero_padding;
+		// Edges are stored in reverse order
+		for (int w = windows.size() - 1 ; w >= 0 ; w--) {
+			result.stopped |= windows[w].stopped;
+			const vector<LZResultEdge>& edges = windows[w].edges;
+			for (int i = 0 ; i < edges.size() ; i++) {
+				LZResultEdge edge = edges[i];
+				edge.pos += window_starts[w];
+				if (!result.edges.empty()) {
+					// A reference can not repeat the offset of an immediately
+					// preceding reference, so join such references.
+					LZResultEdge& next = result.edges.back();
+					if (next.pos == edge.pos + edge.length && next.offset == edge.offset) {
+						next.pos = edge.pos;
+						next.length += edge.length;
+						continue;
+					}
+				}
+				result.edges.push_back(edge);
+			}
+		}
+		return result;
+	}
+
+	template <class Edge> friend class BasicLZParser;
+	friend class LZLazyParser;
+	friend class IncrementalFile;
 };
 
-class LZParser {
+template <class Edge>
+class BasicLZParser {
 	const unsigned char *data;
 	int data_length;
 	int zero_padding;
 	MatchFinder& finder;
+	int parse_start;
 	int length_margin;
 	int skip_length;
-	const LZEncoder* encoderp;
-	RefEdgeFactory* edge_factory;
+	int evict_percent;
+	int run_length;
+	int speed_weight;
+	LZReferenceCost reference_cost;
+	LZLiteralCost literal_cost;
+	BasicRefEdgeFactory<Edge>* edge_factory;
+
+	vector<typename Edge::size_type> literal_size;
+	vector<CuckooHash<Edge*> > edges_to_pos;
+	int edges_to_pos_mask;
+	Edge* best;
+	FlatHash<Edge*> best_for_offset;
+#ifdef SHRINKLER_BUCKET_QUEUE
+	BucketQueue<Edge*> root_edges;
+#else
+	Heap<Edge*> root_edges;
+#endif
+
+	static const int INITIAL_EDGES_TO_POS_SIZE = 64;
+
+	friend class LZParser;
+
+	// Longest period of the repeated patterns taken by run_length
+	static const int MAX_RUN_PERIOD = 8;
+
+	// For each period, the end of the latest run found with that period
+	int run_end[MAX_RUN_PERIOD + 1];
+
+	// Profile being recorded, or NULL, and the parser position of the start
+	// of the profiled data. While parsing, the counts of the current window,
+	// where it ends and when its latest time was charged.
+	ParseProfile* profile;
+	int profile_start;
+	ParseProfileWindow* profile_counts;
+	int profile_window_end;
+	double profile_time;
+
+	// Charge the time since the latest charge to the current window of the
+	// profile, and move on to the window holding pos
+	void profileWindow(int pos) {
+		double now = timeSeconds();
+		if (profile_counts) profile_counts->seconds += now - profile_time;
+		profile_time = now;
+		// The last position only takes in the edges ending there
+		int p = min(pos, data_length - 1) - profile_start;
+		profile_counts = &profile->window(p);
+		profile_window_end = pos + ParseProfile::WINDOW_SIZE - p % ParseProfile::WINDOW_SIZE;
+	}
 
-	vector<int> literal_size;
-	vector<CuckooHash<RefEdge*> > edges_to_pos;
-	RefEdge* best;
-	CuckooHash<RefEdge*> best_for_offset;
-	Heap<RefEdge*> root_edges;
+	// Edges ending after the current position are kept in a ring of maps
+	// indexed by target position, covering the targets from the current
+	// position up to the size of the ring. The ring grows as needed to hold
+	// the longest edge in flight.
+	CuckooHash<Edge*>& edges_to(int target) {
+		return edges_to_pos[target & edges_to_pos_mask];
+	}
 
-	bool is_root(RefEdge *edge) {
+	bool has_edges_to(int pos, int target) {
+		return target - pos <= edges_to_pos_mask && !edges_to(target).empty();
+	}
+
+	// Make room for edges from pos to target
+	void reserve_edges_to(int pos, int target) {
+		if (target - pos <= edges_to_pos_mask) return;
+		int size = edges_to_pos_mask + 1;
+		int new_size = size;
+		while (target - pos >= new_size) new_size *= 2;
+		vector<CuckooHash<Edge*> > new_edges_to_pos(new_size);
+		for (int t = pos ; t < pos + size ; t++) {
+			new_edges_to_pos[t & (new_size - 1)].swap(edges_to(t));
+		}
+		edges_to_pos.swap(new_edges_to_pos);
+		edges_to_pos_mask = new_size - 1;
+	}
+
+	bool is_root(Edge *edge) {
 		return root_edges.contains(edge);
 	}
 
-	void remove_root(RefEdge *edge) {
+	void add_root(Edge *edge) {
+		root_edges.insert(edge);
+		max_root_edges = max(max_root_edges, root_edges.size());
+	}
+
+	void remove_root(Edge *edge) {
 		root_edges.remove(edge);
 	}
 
-	void releaseEdge(RefEdge *edge, bool clean = false) {
+	void releaseEdge(Edge *edge, bool clean = false) {
 		while (edge != NULL) {
-			RefEdge *source = edge->source;
+			Edge *source = edge_factory->source(edge);
 			if (--edge->refcount == 0) {
 				assert(!is_root(edge));
 				edge_factory->destroy(edge, clean);
@@ -247,116 +551,172 @@ class LZParser {
 	}
 
 	// Return progress
-	bool clean_worst_edge(int pos, RefEdge *exclude) {
+	bool clean_worst_edge(int pos, Edge *exclude) {
 		if (root_edges.size() == 0) return false;
-		RefEdge *worst_edge = root_edges.remove_largest();
+		Edge *worst_edge = root_edges.remove_largest();
 		if (worst_edge == best || worst_edge == exclude) return true;
-		CuckooHash<RefEdge*>& container = worst_edge->target() > pos
-			? edges_to_pos[worst_edge->target()]
-			: best_for_offset;
-		if (container.size() > 1 && container.count(worst_edge->offset) > 0) {
-			container.erase(worst_edge->offset);
-			releaseEdge(worst_edge, true);
+		if (worst_edge->target() > pos) {
+			clean_edge(edges_to(worst_edge->target()), worst_edge);
+		} else {
+			clean_edge(best_for_offset, worst_edge);
 		}
 		return true;
 	}
 
-	void put_by_offset(CuckooHash<RefEdge*>& by_offset, RefEdge* edge) {
+	template <class Map>
+	void clean_edge(Map& container, Edge *edge) {
+		if (container.size() > 1 && container.count(edge->offset) > 0) {
+			container.erase(edge->offset);
+			releaseEdge(edge, true);
+			if (profile_counts) profile_counts->evictions++;
+		}
+	}
+
+	// Clean the worst edges until the factory has room for the evicted
+	// percentage of its capacity, or at least one edge if possible
+	void clean_edges(int pos, Edge *exclude) {
+		int capacity = edge_factory->capacity();
+		int target_count = capacity - max(1, (int) ((long long) capacity * evict_percent / 100));
+		while (edge_factory->count() > target_count) {
+			if (!clean_worst_edge(pos, exclude)) break;
+		}
+	}
+
+	// Length of the longest run from pos which repeats the data a short
+	// period before it. Remembers the end of each run, so each byte is
+	// compared about once per period.
+	int find_run(int pos, int *period_out) {
+		int best_length = 0;
+		for (int p = 1 ; p <= MAX_RUN_PERIOD && p <= pos ; p++) {
+			if (run_end[p] <= pos) {
+				if (data[pos] != data[pos - p]) continue;
+				run_end[p] = pos + matchLength(&data[pos], &data[pos - p], data_length - pos);
+			}
+			if (run_end[p] - pos > best_length) {
+				best_length = run_end[p] - pos;
+				*period_out = p;
+			}
+		}
+		return best_length;
+	}
+
+	// Keep the edge if it is the first or best for its offset. The slot is
+	// found or inserted with a single lookup.
+	template <class Map>
+	void put_by_offset(Map& by_offset, Edge* edge) {
 		assert(!is_root(edge));
-		if (by_offset.count(edge->offset) == 0) {
-			by_offset[edge->offset] = edge;
-			root_edges.insert(edge);
-		} else if (edge->total_size < by_offset[edge->offset]->total_size) {
-			RefEdge* old_edge = by_offset[edge->offset];
+		Edge*& slot = by_offset[edge->offset];
+		if (slot == NULL) {
+			slot = edge;
+			add_root(edge);
+		} else if (edge->total_size < slot->total_size) {
+			Edge* old_edge = slot;
 			remove_root(old_edge);
 			releaseEdge(old_edge);
-			by_offset[edge->offset] = edge;
-			root_edges.insert(edge);
+			slot = edge;
+			add_root(edge);
 		} else {
 			releaseEdge(edge);
 		}
 	}
 
-	void newEdge(RefEdge *source, int pos, int offset, int length, FILE *trace_file = NULL) {
+	void newEdge(Edge *source, int pos, int offset, int length, TraceBuffer *trace = NULL) {
 		if (source && offset == source->offset && pos == source->target()) return;
 		int prev_target = source ? source->target() : 0;
 		int new_target = pos + length;
-		LZState state_before;
-		LZState state_after;
-		encoderp->constructState(&state_before, pos, pos == prev_target, source ? source->offset : 0);
-		int size_before = (source ? source->total_size : literal_size[data_length]) - (literal_size[data_length] - literal_size[pos]);
-		int edge_size = encoderp->encodeReference(offset, length, &state_before, &state_after);
-		int size_after = literal_size[data_length] - literal_size[new_target];
-		while (edge_factory->full()) {
-			if (!clean_worst_edge(pos, source)) break;
-		}
-		RefEdge *new_edge = edge_factory->create(pos, offset, length, size_before + edge_size + size_after, source);
-		if (trace_file) {
-			fprintf(trace_file, "LZPARSER: DECISION pos=%d offset=%d length=%d total_size=%d reason=NEW_EDGE\n",
-				pos, offset, length, size_before + edge_size + size_after);
-			fprintf(trace_file, "LZPARSER: EDGE_CREATED pos=%d offset=%d length=%d total_cost=%d source_offset=%d source_pos=%d\n",
-				pos, offset, length, size_before + edge_size + size_after, source ? source->offset : 0, source ? source->pos : 0);
+		typename Edge::size_type size_before = (source ? source->total_size : literal_size[data_length]) - (literal_size[data_length] - literal_size[pos]);
+		int edge_size = reference_cost.size(pos, pos == prev_target, source ? source->offset : 0, offset, length);
+		typename Edge::size_type size_after = literal_size[data_length] - literal_size[new_target];
+		reserve_edges_to(pos, new_target);
+		if (edge_factory->full()) {
+			clean_edges(pos, source);
 		}
-		put_by_offset(edges_to_pos[new_target], new_edge);
+		Edge *new_edge = edge_factory->create(pos, offset, length, size_before + edge_size + size_after, source);
+		TRACE(trace, TRACE_EDGE_CREATED, pos, offset, length, size_before + edge_size + size_after,
+			source ? source->offset : 0, source ? source->pos : 0);
+		if (profile_counts) profile_counts->edges++;
+		put_by_offset(edges_to(new_target), new_edge);
 	}
 
 public:
-	LZParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder, int length_margin, int skip_length, RefEdgeFactory* edge_factory)
-		: data(data), data_length(data_length), zero_padding(zero_padding), finder(finder), length_margin(length_margin), skip_length(skip_length), edge_factory(edge_factory)
+	// Statistics of the latest parse: time spent setting up the symbol
+	// sizes, and the largest number of root edges at any time.
+	double setup_seconds;
+	int max_root_edges;
+
+	BasicLZParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder, int length_margin, int skip_length, BasicRefEdgeFactory<Edge>* edge_factory, int parse_start = 0, int evict_percent = 0, int run_length = 0, int speed_weight = 0)
+		: data(data), data_length(data_length), zero_padding(zero_padding), finder(finder), parse_start(parse_start), length_margin(length_margin), skip_length(skip_length), evict_percent(evict_percent), run_length(run_length), speed_weight(speed_weight), edge_factory(edge_factory),
+		  profile(NULL), profile_start(0), profile_counts(NULL), profile_window_end(0), profile_time(0),
+		  setup_seconds(0), max_root_edges(0)
 	{
-		// Initialize edges_to_pos array
-		edges_to_pos.resize(data_length + 1);
+		// Initialize edges_to_pos ring
+		edges_to_pos.resize(INITIAL_EDGES_TO_POS_SIZE);
+		edges_to_pos_mask = INITIAL_EDGES_TO_POS_SIZE - 1;
 		best = NULL;
 	}
 
-	LZParseResult parse(const LZEncoder& encoder, LZProgress *progress, FILE *trace_file = NULL) {
+	// Add the work of each following parse to the given profile, or stop
+	// profiling if NULL. The profiled data starts at parser position
+	// data_start, at or before the parse start.
+	void setProfile(ParseProfile *profile, int data_start) {
+		this->profile = profile;
+		profile_start = data_start;
+	}
+
+	// Parse into the given result, whose edge vector keeps its capacity. The
+	// sizes given by the coder of the encoder must be fixed during the parse.
+	// Returns false, without parsing, if the total size of the literals of
+	// the data exceeds the MAX_LITERAL_SIZE of the edges.
+	template <class CoderT>
+	bool parse(const BasicLZEncoder<CoderT>& encoder, LZProgress *progress, LZParseResult& result, TraceBuffer *trace = NULL) {
+		// Accumulate literal sizes
+		double setup_start = timeSeconds();
+		literal_cost.init(encoder, speed_weight);
+		if (literal_cost.accumulate(data, data_length, literal_size) > Edge::MAX_LITERAL_SIZE) {
+			vector<typename Edge::size_type>().swap(literal_size);
+			return false;
+		}
+
 		progress->begin(data_length);
-		encoderp = &encoder;
+		reference_cost.init(encoder, data_length, data_length, speed_weight);
 
 		// Reset state
 		best_for_offset.clear();
 		root_edges.clear();
 		edge_factory->reset();
-
-		// Accumulate literal sizes
-		literal_size.resize(data_length + 1, 0);
-		int size = 0;
-		LZState literal_state;
-		encoder.setInitialState(&literal_state);
-		for (int i = 0 ; i < data_length ; i++) {
-			literal_size[i] = size;
-			size += encoder.encodeLiteral(data[i], &literal_state, &literal_state);
+		max_root_edges = 0;
+		for (int p = 0 ; p <= MAX_RUN_PERIOD ; p++) {
+			run_end[p] = 0;
 		}
-		literal_size[data_length] = size;
+		setup_seconds = timeSeconds() - setup_start;
 
 		// Parse
-		RefEdge* initial_best = edge_factory->create(0, 0, 0, literal_size[data_length], NULL);
+		Edge* initial_best = edge_factory->create(0, 0, 0, literal_size[data_length], NULL);
 		best = initial_best;
-		for (int pos = 1 ; pos <= data_length ; pos++) {
-			// Assimilate edges ending here
-			if (trace_file) {
-				fprintf(trace_file, "LZPARSER: ASSIMILATE_START pos=%d best_offset=%d best_total=%d edges_count=%d\n", 
-					pos, best ? best->offset : 0, best ? best->total_size : 0, edges_to_pos[pos].size());
+		bool stopped = false;
+		profile_counts = NULL;
+		profile_window_end = max(1, parse_start);
+		for (int pos = max(1, parse_start) ; pos <= data_length ; pos++) {
+			if (profile && pos >= profile_window_end) {
+				profileWindow(pos);
 			}
-			for (CuckooHash<RefEdge*>::iterator it = edges_to_pos[pos].begin() ; it != edges_to_pos[pos].end() ; it++) {
-				RefEdge *edge = it->second;
-				if (trace_file) {
-					fprintf(trace_file, "LZPARSER: ASSIMILATE_EDGE pos=%d edge_offset=%d edge_total=%d best_total=%d will_update=%d\n",
-						pos, edge->offset, edge->total_size, best->total_size, 
-						(edge->total_size < best->total_size || (edge->total_size == best->total_size && edge->offset < best->offset)));
-				}
+
+			// Assimilate edges ending here
+			TRACE(trace, TRACE_ASSIMILATE_START, pos, best ? best->offset : 0, best ? best->total_size : 0, edges_to(pos).size());
+			CuckooHash<Edge*>& edges_here = edges_to(pos);
+			for (typename CuckooHash<Edge*>::iterator it = edges_here.begin() ; it != edges_here.end() ; it++) {
+				Edge *edge = it->second;
+				TRACE(trace, TRACE_ASSIMILATE_EDGE, pos, edge->offset, edge->total_size, best->total_size,
+					edge->total_size < best->total_size || (edge->total_size == best->total_size && edge->offset < best->offset));
 				if (edge->total_size < best->total_size ||
 					(edge->total_size == best->total_size && edge->offset < best->offset)) {
-					if (trace_file) {
-						fprintf(trace_file, "LZPARSER: BEST_UPDATED pos=%d new_best_offset=%d new_best_total=%d\n",
-							pos, edge->offset, edge->total_size);
-					}
+					TRACE(trace, TRACE_BEST_UPDATED, pos, edge->offset, edge->total_size);
 					best = edge;
 				}
 				remove_root(edge);
 				put_by_offset(best_for_offset, edge);
 			}
-			edges_to_pos[pos].clear();
+			edges_here.clear();
 
 			// Add new edges according to matches
 			finder.beginMatching(pos);
@@ -365,49 +725,58 @@ public:
 			int max_match_length = 0;
 			while (finder.nextMatch(&match_pos, &match_length)) {
 				int offset = pos - match_pos;
-				if (trace_file) {
-					fprintf(trace_file, "LZPARSER: MATCH pos=%d match_pos=%d match_length=%d offset=%d\n",
-						pos, match_pos, match_length, offset);
-				}
+				TRACE(trace, TRACE_MATCH, pos, match_pos, match_length, offset);
+				if (profile_counts) profile_counts->matches++;
 				if (match_length > data_length - pos) {
 					match_length = data_length - pos;
 				}
 				int min_length = match_length - length_margin;
 				if (min_length < 2) min_length = 2;
 				for (int length = min_length ; length <= match_length ; length++) {
-					if (trace_file) {
-						fprintf(trace_file, "LZPARSER: EDGE_ATTEMPT pos=%d offset=%d length=%d best_offset=%d\n",
-							pos, offset, length, best ? best->offset : 0);
-					}
-					newEdge(best, pos, offset, length, trace_file);
-					if (trace_file) {
-						fprintf(trace_file, "LZPARSER: CONDITION_EVAL pos=%d offset=%d length=%d best_offset=%d count=%d condition=%d\n",
-							pos, offset, length, best ? best->offset : 0, best_for_offset.count(offset), 
-							(best->offset != offset && best_for_offset.count(offset)));
-					}
-					if (best->offset != offset && best_for_offset.count(offset)) {
-						if (trace_file) {
-							fprintf(trace_file, "LZPARSER: SECOND_EDGE pos=%d offset=%d length=%d existing_offset=%d\n",
-								pos, offset, length, best_for_offset[offset]->offset);
-						}
-						assert(best_for_offset[offset]->target() <= pos);
-						newEdge(best_for_offset[offset], pos, offset, length, trace_file);
+					TRACE(trace, TRACE_EDGE_ATTEMPT, pos, offset, length, best ? best->offset : 0);
+					newEdge(best, pos, offset, length, trace);
+					Edge **best_here = best_for_offset.find(offset);
+					TRACE(trace, TRACE_CONDITION_EVAL, pos, offset, length, best ? best->offset : 0, best_here != NULL,
+						best->offset != offset && best_here != NULL);
+					if (best->offset != offset && best_here != NULL) {
+						TRACE(trace, TRACE_SECOND_EDGE, pos, offset, length, (*best_here)->offset);
+						assert((*best_here)->target() <= pos);
+						newEdge(*best_here, pos, offset, length, trace);
 					}
 				}
 				max_match_length = max(max_match_length, match_length);
 			}
 
+			// If we are at the start of a long run, take it directly
+			int skip_match_length = max_match_length >= skip_length ? max_match_length : 0;
+			int run_period = 0;
+			if (run_length > 0 && pos < data_length && find_run(pos, &run_period) >= run_length) {
+				int length = run_end[run_period] - pos;
+				newEdge(best, pos, run_period, length, trace);
+				Edge **best_here = best_for_offset.find(run_period);
+				if (best->offset != run_period && best_here != NULL) {
+					newEdge(*best_here, pos, run_period, length, trace);
+				}
+				if (!has_edges_to(pos, pos + skip_match_length)) {
+					skip_match_length = length;
+				}
+			}
+
 			// If we have a very long match, skip ahead
-			if (max_match_length >= skip_length && !edges_to_pos[pos + max_match_length].empty()) {
+			if (skip_match_length > 0 && has_edges_to(pos, pos + skip_match_length)) {
+				if (profile_counts) {
+					profile_counts->skips++;
+					profile_counts->skipped += skip_match_length - 1;
+				}
 				root_edges.clear();
-				for (CuckooHash<RefEdge*>::iterator it = best_for_offset.begin() ; it != best_for_offset.end() ; it++) {
+				for (typename FlatHash<Edge*>::iterator it = best_for_offset.begin() ; it != best_for_offset.end() ; it++) {
 					releaseEdge(it->second);
 				}
 				best_for_offset.clear();
-				int target_pos = pos + max_match_length;
+				int target_pos = pos + skip_match_length;
 				while (pos < target_pos - 1) {
-					CuckooHash<RefEdge*>& edges = edges_to_pos[++pos];
-					for (CuckooHash<RefEdge*>::iterator it = edges.begin() ; it != edges.end() ; it++) {
+					CuckooHash<Edge*>& edges = edges_to(++pos);
+					for (typename CuckooHash<Edge*>::iterator it = edges.begin() ; it != edges.end() ; it++) {
 						releaseEdge(it->second);
 					}
 					edges.clear();
@@ -415,34 +784,117 @@ public:
 				best = initial_best;
 			}
 
-			progress->update(pos);
+			if (!progress->update(pos) && pos < data_length) {
+				// Drop all edges ending later and finish with literals
+				root_edges.clear();
+				for (int t = 0 ; t < edges_to_pos.size() ; t++) {
+					CuckooHash<Edge*>& edges = edges_to_pos[t];
+					for (typename CuckooHash<Edge*>::iterator it = edges.begin() ; it != edges.end() ; it++) {
+						releaseEdge(it->second);
+					}
+					edges.clear();
+				}
+				stopped = true;
+				break;
+			}
+		}
+		if (profile_counts) {
+			profile_counts->seconds += timeSeconds() - profile_time;
+			profile_counts = NULL;
 		}
 
 		// Clean unused paths
 		root_edges.clear();
-		for (CuckooHash<RefEdge*>::iterator it = best_for_offset.begin() ; it != best_for_offset.end() ; it++) {
-			RefEdge *edge = it->second;
+		for (typename FlatHash<Edge*>::iterator it = best_for_offset.begin() ; it != best_for_offset.end() ; it++) {
+			Edge *edge = it->second;
 			if (edge != best) {
 				releaseEdge(edge);
 			}
 		}
 
 		// Find best path
-		LZParseResult result;
+		result.edges.clear();
 		result.data = data;
+		result.start = parse_start;
 		result.data_length = data_length;
 		result.zero_padding = zero_padding;
-		RefEdge *edge = best;
+		result.stopped = stopped;
+		Edge *edge = best;
 		while (edge->length > 0) {
 			result.edges.push_back(LZResultEdge(edge));
-			edge = edge->source;
+			edge = edge_factory->source(edge);
 		}
 		releaseEdge(edge);
 		releaseEdge(best);
 
 		progress->end();
+		return true;
+	}
+
+};
 
+// Parser with the sizes of the parses kept in 32 bits, or in 64 bits for
+// data whose sizes could overflow 32 bits. The 64-bit parser and its edges
+// are only set up once such data is parsed. Its edge factory has the
+// capacity of the given one, and its edge counts are merged into it.
+class LZParser {
+	RefEdgeFactory* edge_factory;
+	WideRefEdgeFactory* wide_edge_factory;
+	BasicLZParser<RefEdge> narrow_parser;
+	BasicLZParser<WideRefEdge> wide_parser;
+
+	WideRefEdgeFactory* wideEdgeFactory() {
+		if (wide_edge_factory == NULL) {
+			wide_edge_factory = new WideRefEdgeFactory(edge_factory->capacity());
+			wide_parser.edge_factory = wide_edge_factory;
+		}
+		return wide_edge_factory;
+	}
+
+public:
+	// Statistics of the latest parse, as for BasicLZParser
+	double setup_seconds;
+	int max_root_edges;
+
+	LZParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder, int length_margin, int skip_length, RefEdgeFactory* edge_factory, int parse_start = 0, int evict_percent = 0, int run_length = 0, int speed_weight = 0)
+		: edge_factory(edge_factory), wide_edge_factory(NULL),
+		  narrow_parser(data, data_length, zero_padding, finder, length_margin, skip_length, edge_factory, parse_start, evict_percent, run_length, speed_weight),
+		  wide_parser(data, data_length, zero_padding, finder, length_margin, skip_length, NULL, parse_start, evict_percent, run_length, speed_weight),
+		  setup_seconds(0), max_root_edges(0)
+	{}
+
+	~LZParser() {
+		delete wide_edge_factory;
+	}
+
+	// As for BasicLZParser
+	void setProfile(ParseProfile *profile, int data_start) {
+		narrow_parser.setProfile(profile, data_start);
+		wide_parser.setProfile(profile, data_start);
+	}
+
+	// The sizes given by the coder of the encoder must be fixed during the parse.
+	template <class CoderT>
+	LZParseResult parse(const BasicLZEncoder<CoderT>& encoder, LZProgress *progress, TraceBuffer *trace = NULL) {
+		LZParseResult result;
+		parse(encoder, progress, result, trace);
 		return result;
 	}
 
+	// As parse, into the given result, whose edge vector keeps its capacity
+	template <class CoderT>
+	void parse(const BasicLZEncoder<CoderT>& encoder, LZProgress *progress, LZParseResult& result, TraceBuffer *trace = NULL) {
+		if (narrow_parser.parse(encoder, progress, result, trace)) {
+			setup_seconds = narrow_parser.setup_seconds;
+			max_root_edges = narrow_parser.max_root_edges;
+			return;
+		}
+		WideRefEdgeFactory *wide_factory = wideEdgeFactory();
+		wide_parser.parse(encoder, progress, result, trace);
+		setup_seconds = wide_parser.setup_seconds;
+		max_root_edges = wide_parser.max_root_edges;
+		edge_factory->max_edge_count = max(edge_factory->max_edge_count, wide_factory->max_edge_count);
+		edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, wide_factory->max_cleaned_edges);
+	}
+
 };
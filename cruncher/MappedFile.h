@@ -0,0 +1,83 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Memory mapped input files.
+
+Mapping a file avoids reading it into a separately allocated buffer before
+crunching, which saves both the copy and the memory for large files. The
+mapping is private, so the contents can be modified in memory without
+affecting the file.
+
+Mapping is only supported on POSIX systems. Elsewhere (such as on the Amiga),
+map fails and the caller reads the file as usual.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+	void *mapping;
+	size_t mapping_size;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile() : mapping(NULL), mapping_size(0) {}
+
+	~MappedFile() {
+		unmap();
+	}
+
+	// Map the whole file. Returns false if the file could not be mapped, in
+	// which case it should be read normally. Empty files are never mapped.
+	bool map(const char *filename) {
+		unmap();
+#ifdef MAPPED_FILE_MMAP
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+			close(fd);
+			return false;
+		}
+		void *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) return false;
+		mapping = m;
+		mapping_size = st.st_size;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void unmap() {
+#ifdef MAPPED_FILE_MMAP
+		if (mapping != NULL) {
+			munmap(mapping, mapping_size);
+		}
+#endif
+		mapping = NULL;
+		mapping_size = 0;
+	}
+
+	unsigned char *data() {
+		return (unsigned char *) mapping;
+	}
+
+	size_t size() {
+		return mapping_size;
+	}
+};
@@ -4,6 +4,10 @@
 
 Find repeated strings in a data block.
 
+A MatchFinder reports the matches of one position at a time to the parser.
+The SuffixArrayFinder defined here finds them in a suffix array of the whole
+data. The HashChainFinder is an alternative with bounded memory use.
+
 Matches are reported from longest to shortest. A match is only reported
 if it is closer (smaller offset, higher position) than all longer matches.
 
@@ -16,6 +20,26 @@ before the matcher gives up finding more matches.
 The max_same_length parameter controls how many matches of the same length
 are reported. The matches reported will be the closest ones of that length.
 
+If a cache directory is given, the suffix array data is loaded from or
+stored to the suffix array cache in that directory.
+
+Once constructed, the suffix array and its inverse are kept in three bytes
+per entry for data below 16 MB, and the LCP array mostly in one byte per
+entry (see CompactArray.h), down from twelve bytes per byte of data.
+
+A MatchFinderPool shares suffix arrays between all packs of the same data
+within a process, such as when trying several sets of parameters.
+
+The matches do not depend on the parse, so a finder used for several parses
+of the same data can cache them. The matches reported for each position are
+then stored in a single arena the first time the position is matched, and
+replayed whenever it is matched again. When the arena is full, positions not
+yet cached are matched from the suffix array every time.
+
+The matches of each position are found by a MatchQuery, which only reads the
+suffix array. The cache can thus be filled up front by several threads, each
+matching a chunk of positions with its own query.
+
 */
 
 #pragma once
@@ -28,20 +52,24 @@ are reported. The matches reported will be the closest ones of that length.
 using std::vector;
 
 #include "SuffixArray.h"
+#include "SuffixArrayCache.h"
+#include "MatchLength.h"
+#include "Threads.h"
+#include "Timer.h"
+#include "CompactArray.h"
 
-class MatchFinder {
-	// Inputs
-	unsigned char *data;
+// The state of finding the matches of one position. The suffix array is only
+// read, so several queries on the same finder can run concurrently.
+class MatchQuery {
+	// Suffix array and matcher parameters
+	const PackedIndexArray *suffix_array;
+	const PackedIndexArray *rev_suffix_array;
+	const CompactLCPArray *longest_common_prefix;
 	int length;
 	int min_length;
 	int match_patience;
 	int max_same_length;
 
-	// Suffix array
-	vector<int> suffix_array;
-	vector<int> rev_suffix_array;
-	vector<int> longest_common_prefix;
-
 	// Matcher parameters
 	int current_pos;
 	int min_pos;
@@ -56,47 +84,11 @@ class MatchFinder {
 	// Best matches seen with current length
 	std::priority_queue<int, vector<int>, std::greater<int> > match_buffer;
 
-	void make_suffix_array() {
-		// Use reverse suffix array to store string as integers with sentinel
-		rev_suffix_array.resize(length + 1);
-		for (int i = 0; i < length ; i++) {
-			rev_suffix_array[i] = data[i] + 1;
-		}
-		rev_suffix_array[length] = 0;
-
-		// Compute suffix array
-		suffix_array.resize(length + 1);
-		computeSuffixArray(&rev_suffix_array[0], &suffix_array[0], length + 1, 257);
-
-		// Compute reverse suffix array
-		for (int i = 0 ; i <= length ; i++) {
-			rev_suffix_array[suffix_array[i]] = i;
-		}
-
-		// Compute LCP array
-		longest_common_prefix.resize(length + 1);
-		longest_common_prefix[0] = 0;
-		longest_common_prefix[length] = 0;
-		int h = 0;
-		for (int i = 0 ; i < length ; i++) {
-			int r = rev_suffix_array[i];
-			if (r < length) {
-				int j = suffix_array[r + 1];
-				int m = length - std::max(i, j);
-				while (h < m && data[i + h] == data[j + h]) {
-					h = h + 1;
-				}
-				longest_common_prefix[r] = h;
-				if (h > 0) h = h - 1;
-			}
-		}
-	}
-
 	void extend_left() {
 		int iter = 0;
 		while (left_length >= min_length) {
-			left_length = std::min(left_length, longest_common_prefix[--left_index]);
-			int pos = suffix_array[left_index];
+			left_length = std::min(left_length, (*longest_common_prefix)[--left_index]);
+			int pos = (*suffix_array)[left_index];
 			if (pos < current_pos && pos >= min_pos) break;
 			if (++iter > match_patience) {
 				left_length = 0;
@@ -108,9 +100,9 @@ class MatchFinder {
 	void extend_right() {
 		int iter = 0;
 		while (true) {
-			right_length = std::min(right_length, longest_common_prefix[right_index]);
+			right_length = std::min(right_length, (*longest_common_prefix)[right_index]);
 			if (right_length < min_length) break;
-			int pos = suffix_array[++right_index];
+			int pos = (*suffix_array)[++right_index];
 			if (pos < current_pos && pos >= min_pos) break;
 			if (++iter > match_patience) {
 				right_length = 0;
@@ -124,30 +116,32 @@ class MatchFinder {
 	}
 
 public:
-	MatchFinder(unsigned char *data, int length, int min_length, int match_patience, int max_same_length) :
-		data(data), length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length) {
-		make_suffix_array();
-		reset();
-	}
+	MatchQuery(const PackedIndexArray *suffix_array, const PackedIndexArray *rev_suffix_array, const CompactLCPArray *longest_common_prefix,
+	           int length, int min_length, int match_patience, int max_same_length) :
+		suffix_array(suffix_array), rev_suffix_array(rev_suffix_array), longest_common_prefix(longest_common_prefix),
+		length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length) {}
 
-	void reset() {
+	int position() const {
+		return current_pos;
 	}
 
 	// Start finding matches between strings starting at pos and earlier strings.
-	void beginMatching(int pos) {
+	void begin(int pos) {
 		current_pos = pos;
 		min_pos = 0;
+		while (!match_buffer.empty()) match_buffer.pop();
 
-		left_index = rev_suffix_array[pos];
+		int index = (*rev_suffix_array)[pos];
+		left_index = index;
 		left_length = length - pos;
 		extend_left();
-		right_index = rev_suffix_array[pos];
+		right_index = index;
 		right_length = length - pos;
 		extend_right();
 	}
 
 	// Report next match. Returns whether a match was found.
-	bool nextMatch(int *match_pos_out, int *match_length_out) {
+	bool next(int *match_pos_out, int *match_length_out) {
 		if (match_buffer.empty()) {
 			// Fill match buffer
 			current_length = next_length();
@@ -156,10 +150,10 @@ public:
 			do {
 				int match_pos;
 				if (left_length > right_length) {
-					match_pos = suffix_array[left_index];
+					match_pos = (*suffix_array)[left_index];
 					extend_left();
 				} else {
-					match_pos = suffix_array[right_index];
+					match_pos = (*suffix_array)[right_index];
 					extend_right();
 				}
 				new_min_pos = std::max(new_min_pos, match_pos);
@@ -184,3 +178,337 @@ public:
 		return true;
 	}
 };
+
+// Interface of the match finders used by the parser
+class MatchFinder {
+public:
+	// Start finding matches between strings starting at pos and earlier strings.
+	virtual void beginMatching(int pos) = 0;
+
+	// Report next match. Returns whether a match was found.
+	virtual bool nextMatch(int *match_pos_out, int *match_length_out) = 0;
+
+	// Prepare for a new parse of the data
+	virtual void reset() = 0;
+
+	virtual ~MatchFinder() {}
+};
+
+class SuffixArrayFinder : public MatchFinder {
+	// Inputs
+	unsigned char *data;
+	int length;
+	int min_length;
+	int match_patience;
+	int max_same_length;
+
+	// Suffix array in compact form, owned by this finder or shared with the
+	// finder it was constructed from. It is never modified after
+	// construction.
+	PackedIndexArray suffix_array_storage;
+	PackedIndexArray rev_suffix_array_storage;
+	CompactLCPArray longest_common_prefix_storage;
+	const PackedIndexArray *suffix_array;
+	const PackedIndexArray *rev_suffix_array;
+	const CompactLCPArray *longest_common_prefix;
+
+	// Query used when matching positions one at a time
+	MatchQuery query;
+
+	// Match cache. For each position, the range of its matches in the arena,
+	// starting at NOT_CACHED if the position has not been matched to the end.
+	static const unsigned NOT_CACHED = ~0u;
+	struct CachedMatch {
+		int pos;
+		int length;
+	};
+	size_t max_cached_matches;
+	vector<unsigned> cache_index;
+	vector<unsigned> cache_end;
+	vector<CachedMatch> cache_arena;
+	int recording_pos;
+	bool replaying;
+	unsigned replay_index;
+	unsigned replay_end;
+
+	// Drop the matches of a position which was not matched to the end
+	void dropRecording() {
+		if (recording_pos >= 0) {
+			cache_arena.resize(cache_index[recording_pos]);
+			cache_index[recording_pos] = NOT_CACHED;
+		}
+		recording_pos = -1;
+	}
+
+	// Finds the matches of a chunk of positions with its own query. Gives up
+	// when the matches found by all chunks together would fill the cache.
+	struct PrecomputeJob : public Job {
+		MatchQuery query;
+		int start;
+		int end;
+		size_t max_matches;
+		Counter& matches_found;
+		vector<CachedMatch> matches;
+		vector<unsigned> ends;
+
+		PrecomputeJob(const MatchQuery& query, int start, int end, size_t max_matches, Counter& matches_found) :
+			query(query), start(start), end(end), max_matches(max_matches), matches_found(matches_found) {}
+
+		virtual void run() {
+			for (int pos = start ; pos < end ; pos++) {
+				if (matches_found.value() >= (long) max_matches) break;
+				size_t pos_start = matches.size();
+				CachedMatch match;
+				query.begin(pos);
+				while (query.next(&match.pos, &match.length)) {
+					matches.push_back(match);
+				}
+				ends.push_back(matches.size());
+				matches_found.add(matches.size() - pos_start);
+			}
+		}
+	};
+
+	// Compute the arrays, and store them to the cache directory if given
+	void make_suffix_array(int n_threads, const char *cache_dir) {
+		double start_time = timeSeconds();
+		vector<int> suffix_array;
+		vector<int> rev_suffix_array;
+		vector<int> longest_common_prefix;
+
+		// Use reverse suffix array to store string as integers with sentinel
+		rev_suffix_array.resize(length + 1);
+		for (int i = 0; i < length ; i++) {
+			rev_suffix_array[i] = data[i] + 1;
+		}
+		rev_suffix_array[length] = 0;
+
+		// Compute suffix array
+		suffix_array.resize(length + 1);
+		computeSuffixArray(&rev_suffix_array[0], &suffix_array[0], length + 1, 257, n_threads);
+
+		// Compute reverse suffix array
+		for (int i = 0 ; i <= length ; i++) {
+			rev_suffix_array[suffix_array[i]] = i;
+		}
+
+		// Compute LCP array
+		double lcp_start_time = timeSeconds();
+		suffix_array_seconds = lcp_start_time - start_time;
+		longest_common_prefix.resize(length + 1);
+		longest_common_prefix[0] = 0;
+		longest_common_prefix[length] = 0;
+		int h = 0;
+		for (int i = 0 ; i < length ; i++) {
+			int r = rev_suffix_array[i];
+			if (r < length) {
+				int j = suffix_array[r + 1];
+				int m = length - std::max(i, j);
+				if (h < m) {
+					h += matchLength(&data[i + h], &data[j + h], m - h);
+				}
+				longest_common_prefix[r] = h;
+				if (h > 0) h = h - 1;
+			}
+		}
+
+		lcp_seconds = timeSeconds() - lcp_start_time;
+
+		if (cache_dir) {
+			SuffixArrayCacheFile::save(cache_dir, data, length, &suffix_array[0], &rev_suffix_array[0], &longest_common_prefix[0]);
+		}
+
+		// Compact the arrays one at a time to keep the peak memory down
+		suffix_array_storage.assign(&suffix_array[0], length + 1);
+		vector<int>().swap(suffix_array);
+		rev_suffix_array_storage.assign(&rev_suffix_array[0], length + 1);
+		vector<int>().swap(rev_suffix_array);
+		longest_common_prefix_storage.assign(&longest_common_prefix[0], length + 1);
+		use_storage();
+	}
+
+	void use_storage() {
+		this->suffix_array = &suffix_array_storage;
+		this->rev_suffix_array = &rev_suffix_array_storage;
+		this->longest_common_prefix = &longest_common_prefix_storage;
+	}
+
+public:
+	// Time spent computing the suffix array and the LCP array. Zero if they
+	// were loaded from the cache.
+	double suffix_array_seconds;
+	double lcp_seconds;
+
+	SuffixArrayFinder(unsigned char *data, int length, int min_length, int match_patience, int max_same_length, int n_threads = 1, const char *cache_dir = NULL) :
+		data(data), length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length),
+		query(NULL, NULL, NULL, length, min_length, match_patience, max_same_length),
+		max_cached_matches(0), recording_pos(-1), suffix_array_seconds(0), lcp_seconds(0) {
+		SuffixArrayCacheFile cache_file;
+		if (cache_dir && cache_file.load(cache_dir, data, length)) {
+			suffix_array_storage.assign(cache_file.suffix_array, length + 1);
+			rev_suffix_array_storage.assign(cache_file.rev_suffix_array, length + 1);
+			longest_common_prefix_storage.assign(cache_file.longest_common_prefix, length + 1);
+			use_storage();
+		} else {
+			make_suffix_array(n_threads, cache_dir);
+		}
+		query = newQuery();
+		reset();
+	}
+
+	// Construct a finder with different matcher parameters, sharing the
+	// suffix array of an existing finder for the same data. The finders
+	// can be used concurrently, but the original must outlive the copy.
+	SuffixArrayFinder(const SuffixArrayFinder& base, int match_patience, int max_same_length) :
+		data(base.data), length(base.length), min_length(base.min_length), match_patience(match_patience), max_same_length(max_same_length),
+		suffix_array(base.suffix_array), rev_suffix_array(base.rev_suffix_array), longest_common_prefix(base.longest_common_prefix),
+		query(newQuery()),
+		max_cached_matches(0), recording_pos(-1), suffix_array_seconds(base.suffix_array_seconds), lcp_seconds(base.lcp_seconds) {
+		reset();
+	}
+
+	// A query with the parameters of this finder, for finding matches
+	// independently of the finder and of other queries
+	MatchQuery newQuery() const {
+		return MatchQuery(suffix_array, rev_suffix_array, longest_common_prefix, length, min_length, match_patience, max_same_length);
+	}
+
+	virtual void reset() {
+		dropRecording();
+		replaying = false;
+	}
+
+	// Cache the matches of each position from now on, using up to about the
+	// given number of bytes
+	void enableCache(size_t max_bytes) {
+		size_t index_bytes = (length + 1) * 2 * sizeof(unsigned);
+		if (max_bytes <= index_bytes) return;
+		max_cached_matches = std::min((max_bytes - index_bytes) / sizeof(CachedMatch), size_t(NOT_CACHED - 1));
+		cache_index.assign(length + 1, unsigned(NOT_CACHED));
+		cache_end.assign(length + 1, 0);
+		reset();
+	}
+
+	// Fill the match cache for the positions from start to the end of the
+	// data, matching chunks of positions on the given number of threads.
+	// Positions which do not fit in the cache are matched during the parse.
+	void precomputeMatches(int start, int n_threads) {
+		if (max_cached_matches == 0 || start >= length) return;
+		reset();
+		int n_chunks = std::min(n_threads * 8, length - start);
+		Counter matches_found;
+		vector<PrecomputeJob*> chunks;
+		vector<Job*> jobs;
+		for (int c = 0 ; c < n_chunks ; c++) {
+			int chunk_start = start + (int) ((long long) (length - start) * c / n_chunks);
+			int chunk_end = start + (int) ((long long) (length - start) * (c + 1) / n_chunks);
+			PrecomputeJob *chunk = new PrecomputeJob(newQuery(), chunk_start, chunk_end, max_cached_matches, matches_found);
+			chunks.push_back(chunk);
+			jobs.push_back(chunk);
+		}
+		runJobs(jobs, n_threads);
+
+		// Copy the matches into the arena in position order
+		bool full = false;
+		for (int c = 0 ; c < n_chunks ; c++) {
+			PrecomputeJob *chunk = chunks[c];
+			unsigned begin = 0;
+			for (int i = 0 ; !full && i < (int) chunk->ends.size() ; i++) {
+				int pos = chunk->start + i;
+				unsigned end = chunk->ends[i];
+				if (cache_arena.size() + (end - begin) > max_cached_matches) {
+					full = true;
+				} else if (cache_index[pos] == NOT_CACHED) {
+					cache_index[pos] = cache_arena.size();
+					cache_arena.insert(cache_arena.end(), chunk->matches.begin() + begin, chunk->matches.begin() + end);
+					cache_end[pos] = cache_arena.size();
+				}
+				begin = end;
+			}
+			delete chunk;
+		}
+	}
+
+	virtual void beginMatching(int pos) {
+		replaying = false;
+		if (max_cached_matches > 0) {
+			dropRecording();
+			if (cache_index[pos] != NOT_CACHED) {
+				replaying = true;
+				replay_index = cache_index[pos];
+				replay_end = cache_end[pos];
+				return;
+			}
+			if (cache_arena.size() < max_cached_matches) {
+				recording_pos = pos;
+				cache_index[pos] = cache_arena.size();
+			}
+		}
+		query.begin(pos);
+	}
+
+	virtual bool nextMatch(int *match_pos_out, int *match_length_out) {
+		if (replaying) {
+			if (replay_index == replay_end) return false;
+			const CachedMatch& match = cache_arena[replay_index++];
+			*match_pos_out = match.pos;
+			*match_length_out = match.length;
+			return true;
+		}
+		if (!query.next(match_pos_out, match_length_out)) {
+			if (recording_pos == query.position()) {
+				cache_end[recording_pos] = cache_arena.size();
+				recording_pos = -1;
+			}
+			return false;
+		}
+		if (recording_pos == query.position()) {
+			CachedMatch match = { *match_pos_out, *match_length_out };
+			cache_arena.push_back(match);
+		}
+		return true;
+	}
+};
+
+class MatchFinderPool {
+	struct Entry {
+		vector<unsigned char> data;
+		int min_length;
+		SuffixArrayFinder *finder;
+	};
+	vector<Entry*> entries;
+	Mutex mutex;
+
+public:
+	~MatchFinderPool() {
+		for (int e = 0 ; e < entries.size() ; e++) {
+			delete entries[e]->finder;
+			delete entries[e];
+		}
+	}
+
+	// Create a finder for the given data, sharing the suffix array of any
+	// earlier finder created from this pool for the same data. The suffix
+	// array is constructed on the first request and kept until the pool is
+	// destroyed. Can be called concurrently.
+	SuffixArrayFinder* newFinder(unsigned char *data, int length, int min_length, int match_patience, int max_same_length, int n_threads = 1, const char *cache_dir = NULL) {
+		MutexLock lock(mutex);
+		Entry *entry = NULL;
+		for (int e = 0 ; e < entries.size() ; e++) {
+			Entry *candidate = entries[e];
+			if (candidate->data.size() == length && candidate->min_length == min_length &&
+			    (length == 0 || memcmp(&candidate->data[0], data, length) == 0)) {
+				entry = candidate;
+				break;
+			}
+		}
+		if (entry == NULL) {
+			entry = new Entry;
+			entry->data.assign(data, data + length);
+			entry->min_length = min_length;
+			entry->finder = new SuffixArrayFinder(length == 0 ? data : &entry->data[0], length, min_length, match_patience, max_same_length, n_threads, cache_dir);
+			entries.push_back(entry);
+		}
+		return new SuffixArrayFinder(*entry->finder, match_patience, max_same_length);
+	}
+};
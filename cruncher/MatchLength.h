@@ -0,0 +1,37 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Length of the common prefix of two byte strings.
+
+On little-endian targets with GCC builtins, eight bytes are compared at a
+time, and the first differing byte is located from the trailing zero bits
+of the difference. Elsewhere, bytes are compared one at a time.
+
+*/
+
+#pragma once
+
+#include <cstring>
+#include <stdint.h>
+
+// Number of equal bytes at the start of a and b, at most max_length
+inline int matchLength(const unsigned char *a, const unsigned char *b, int max_length) {
+	int length = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (length + 8 <= max_length) {
+		uint64_t wa, wb;
+		memcpy(&wa, a + length, 8);
+		memcpy(&wb, b + length, 8);
+		uint64_t diff = wa ^ wb;
+		if (diff != 0) {
+			return length + (__builtin_ctzll(diff) >> 3);
+		}
+		length += 8;
+	}
+#endif
+	while (length < max_length && a[length] == b[length]) {
+		length++;
+	}
+	return length;
+}
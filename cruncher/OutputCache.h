@@ -0,0 +1,151 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the output of complete crunches.
+
+When the same input is crunched with the same options again, for instance
+by a build system on several branches, the output can be taken from a cache
+directory instead of crunching again.
+
+The key of an entry describes everything the output depends on: the version
+of the cruncher, the options and the contents of the input and of any other
+files read by the crunch. Cache files are named after a hash of the key and
+contain the key itself, so a file is only used if the key matches exactly.
+Along with the output, an entry holds the texts printed after crunching and
+after saving, so that a cache hit reports the same statistics.
+
+File layout:
+  char magic[8]                     "ShrOC1"
+  int key_length, report_length, output_length, note_length
+  char key[key_length]
+  char report[report_length]        printed before saving the output
+  unsigned char output[output_length]
+  char note[note_length]            printed after saving the output
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+struct OutputCacheHeader {
+	char magic[8];
+	int key_length;
+	int report_length;
+	int output_length;
+	int note_length;
+};
+
+class OutputCache {
+	string key;
+
+	unsigned long long hash() const {
+		// 64-bit FNV-1a
+		unsigned long long h = 0xcbf29ce484222325ULL;
+		for (size_t i = 0 ; i < key.size() ; i++) {
+			h = (h ^ (unsigned char) key[i]) * 0x100000001b3ULL;
+		}
+		return h;
+	}
+
+	string filename(const char *dir) const {
+		char name[32];
+		sprintf(name, "%016llx.out", hash());
+		string path = dir;
+		if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') {
+			path += '/';
+		}
+		return path + name;
+	}
+
+	static bool readString(FILE *file, string& s, int length) {
+		s.resize(length);
+		return length == 0 || fread(&s[0], 1, length, file) == length;
+	}
+
+public:
+	// Add a named value to the key
+	void add(const char *name, long long value) {
+		char line[64];
+		sprintf(line, "=%lld\n", value);
+		key += name;
+		key += line;
+	}
+
+	// Add a named string or block of bytes to the key
+	void add(const char *name, const string& value) {
+		char line[32];
+		sprintf(line, ":%d\n", (int) value.size());
+		key += name;
+		key += line;
+		key += value;
+	}
+
+	// Add the contents of a file to the key. Returns whether it could be read.
+	bool addFile(const char *name, const char *filename) {
+		FILE *file = fopen(filename, "rb");
+		if (!file) return false;
+		string contents;
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+			contents.append(buffer, n);
+		}
+		bool ok = !ferror(file);
+		fclose(file);
+		if (ok) add(name, contents);
+		return ok;
+	}
+
+	// Look up the entry for the key. Returns whether a valid file was found.
+	bool load(const char *dir, string& report, vector<unsigned char>& output, string& note) const {
+		FILE *file = fopen(filename(dir).c_str(), "rb");
+		if (!file) return false;
+		OutputCacheHeader header;
+		string file_key;
+		bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		          memcmp(header.magic, "ShrOC1", sizeof("ShrOC1")) == 0 && header.key_length == key.size() &&
+		          header.report_length >= 0 && header.output_length >= 0 && header.note_length >= 0 &&
+		          readString(file, file_key, header.key_length) && file_key == key &&
+		          readString(file, report, header.report_length);
+		if (ok) {
+			output.resize(header.output_length);
+			ok = header.output_length == 0 || fread(&output[0], 1, header.output_length, file) == header.output_length;
+		}
+		ok = ok && readString(file, note, header.note_length) && fgetc(file) == EOF;
+		fclose(file);
+		return ok;
+	}
+
+	// Store the entry for the key. Failure to write the cache is not an error.
+	void save(const char *dir, const string& report, const vector<unsigned char>& output, const string& note) const {
+		OutputCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		strcpy(header.magic, "ShrOC1");
+		header.key_length = key.size();
+		header.report_length = report.size();
+		header.output_length = output.size();
+		header.note_length = note.size();
+		string path = filename(dir);
+		string temp_path = path + ".tmp";
+		FILE *file = fopen(temp_path.c_str(), "wb");
+		if (!file) return;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		          fwrite(key.data(), 1, key.size(), file) == key.size() &&
+		          fwrite(report.data(), 1, report.size(), file) == report.size() &&
+		          (output.empty() || fwrite(&output[0], 1, output.size(), file) == output.size()) &&
+		          fwrite(note.data(), 1, note.size(), file) == note.size();
+		ok = fclose(file) == 0 && ok;
+		remove(path.c_str());
+		if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+			remove(temp_path.c_str());
+		}
+	}
+};
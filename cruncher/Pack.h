@@ -4,16 +4,80 @@
 
 Pack a data block in multiple iterations, reporting progress along the way.
 
+With more than one thread, each iteration runs several candidate parses in
+parallel, one per thread. The first candidate uses the given parameters,
+while the others consider more matches. The smallest result is kept, and
+its symbol frequencies are used for the next iteration. All candidates share
+the suffix array of the match finder, but each has its own parser and edge
+factory. With a hash chain match finder, each candidate has its own finder.
+
 */
 
 #pragma once
 
+#include <climits>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+
+using std::string;
+
 #include "RangeCoder.h"
 #include "MatchFinder.h"
+#include "HashChainFinder.h"
 #include "CountingCoder.h"
 #include "SizeMeasuringCoder.h"
+#include "SizeCountingCoder.h"
 #include "LZEncoder.h"
 #include "LZParser.h"
+#include "LZLazyParser.h"
+#include "Threads.h"
+#include "Timer.h"
+#include "PackStats.h"
+#include "IncrementalFile.h"
+
+// Coders and parse result used by one parse candidate in each iteration.
+// They are reset rather than reallocated, so once they have grown to the
+// size of the data, iterations allocate nothing outside the edge factory.
+class PackContext {
+public:
+	SizeMeasuringCoder measurer;
+	CountingCoder symbol_counts;
+	SizeCountingCoder size_counter;
+	LZParseResult result;
+
+	PackContext()
+		: measurer(LZEncoder::NUM_CONTEXTS), symbol_counts(LZEncoder::NUM_CONTEXTS),
+		  size_counter(LZEncoder::NUM_CONTEXTS, &symbol_counts)
+	{}
+};
+
+// Pack contexts kept between parses, so that later blocks and files reuse
+// the contexts of earlier ones. Parses on several threads can take contexts
+// at the same time.
+class PackContextPool {
+	vector<PackContext*> contexts;
+	Mutex mutex;
+public:
+	~PackContextPool() {
+		for (int c = 0 ; c < contexts.size() ; c++) {
+			delete contexts[c];
+		}
+	}
+
+	PackContext *acquire() {
+		MutexLock lock(mutex);
+		if (contexts.empty()) return new PackContext();
+		PackContext *context = contexts.back();
+		contexts.pop_back();
+		return context;
+	}
+
+	void release(PackContext *context) {
+		MutexLock lock(mutex);
+		contexts.push_back(context);
+	}
+};
 
 struct PackParams {
 	bool parity_context;
@@ -23,129 +87,1114 @@ struct PackParams {
 	int skip_length;
 	int match_patience;
 	int max_same_length;
+
+	// Percentage of the reference edges to free at once when all are in
+	// use, or 0 to free one at a time
+	int evict_percent;
+
+	// Minimum length of a run of a repeated byte or short pattern to
+	// take directly, or 0 to parse runs like other data
+	int run_length;
+
+	// Size in bits given up per 10000 68000 cycles saved on decrunching,
+	// or 0 to parse for size alone
+	int speed_weight;
+
+	int threads;
+
+	// Directory for caching suffix arrays between runs, or NULL
+	const char *suffix_array_cache;
+
+	// Parse with a single pass of lazy matching instead of the optimal
+	// parse, for quick development builds
+	bool fast;
+
+	// Suffix arrays shared between packs within this process, or NULL
+	MatchFinderPool *finder_pool;
+
+	// Pack contexts shared between packs within this process, or NULL to
+	// give each parse its own
+	PackContextPool *context_pool;
+
+	// Window size in bytes of the hash chain match finder, or 0 to use the
+	// suffix array match finder
+	int chain_window;
+
+	// Block size for windowed parsing of large data, or 0 for none
+	int window_size;
+
+	// Segment size for hybrid parsing, or 0 to parse all data optimally.
+	// Segments whose lazy parse is unlikely to be improved on much by the
+	// optimal parser keep the lazy parse.
+	int hybrid_size;
+
+	// Memory in bytes for caching matches between the iterations of each
+	// unwindowed parse, or 0 for none
+	size_t match_cache_size;
+
+	// Size of independently crunched blocks of data files, or 0 for a
+	// single stream
+	int block_size;
+
+	// Whether crunched blocks are followed by an offset index for random
+	// access, rather than preceded by a size index
+	bool seekable;
+
+	// Dictionary of even length which references can reach into, but which
+	// is not itself packed, or NULL. The data to pack must be preceded in
+	// memory by a copy of it.
+	const unsigned char *dictionary;
+	int dictionary_length;
+
+	// Whether the literal contexts start out adapted to the dictionary
+	bool prime_contexts;
+
+	// Progress reporting for the parse, used instead of the printed
+	// progress, or NULL. The progress can stop the parse.
+	LZProgress *progress;
+
+	// Time (as given by timeSeconds) at which to stop parsing, or 0 for none
+	double deadline;
+
+	// Stop iterating after an iteration which gains fewer than this many
+	// bytes over the previous one, or 0 to run all iterations
+	int converge_bytes;
+
+	// Statistics collected for each packed block, or NULL
+	PackStats *stats;
+
+	// Symbol counts to estimate the first iteration from, instead of flat
+	// estimates, or NULL
+	const CountingCoder *initial_counts;
+
+	// Collector for the final symbol counts of each parse, or NULL
+	CountCollector *final_counts;
+
+	// Record of an earlier crunch to reuse the parse of unchanged data
+	// from, and to record the new parses in, or NULL
+	IncrementalFile *incremental;
 };
 
-class PackProgress : public LZProgress {
-	int size;
-	int steps;
-	int next_step_threshold;
+// Printed progress of one or more parses. A timer samples the positions of
+// the parses at a fixed rate and prints the percentage done, the speed of
+// the parse and the estimated time left, so the parses only record their
+// positions, and the output stays small when redirected to a log. A sample
+// is only printed if its text differs from the previous one. Without thread
+// support, the parses must poll the report instead.
+class ProgressReporter : public Job {
+	static const int SAMPLE_MILLISECONDS = 250;
+
+	JobTimer timer;
+	bool running;
+	double start_time;
+	double print_time;
+	char text[64];
 	int textlength;
 
+	void format(char *buffer, size_t size) {
+		long done, total;
+		sample(&done, &total);
+		done = max(0L, min(done, total));
+		int permille = total > 0 ? (int) (done * 1000 / total) : 0;
+		double seconds = timeSeconds() - start_time;
+		if (seconds >= 1 && done > 0) {
+			double speed = done / seconds;
+			int eta = (int) ((total - done) / speed);
+			snprintf(buffer, size, "[%d.%d%%  %d KB/s  ETA %d:%02d]", permille / 10, permille % 10, (int) (speed / 1024), eta / 60, eta % 60);
+		} else {
+			snprintf(buffer, size, "[%d.%d%%]", permille / 10, permille % 10);
+		}
+	}
+
 	void print() {
-		textlength = printf("[%d.%d%%]", steps / 10, steps % 10);
+		textlength = printf("%s", text);
 		fflush(stdout);
 	}
 
 	void rewind() {
-		printf("\033[%dD", textlength);
+		printf("\033[%dD\033[K", textlength);
+	}
+
+protected:
+	// Bytes parsed so far, and in total
+	virtual void sample(long *done, long *total) = 0;
+
+	void startReport() {
+		running = true;
+		start_time = print_time = timeSeconds();
+		format(text, sizeof(text));
+		print();
+		timer.start();
+	}
+
+	void stopReport() {
+		if (!running) return;
+		running = false;
+		timer.stop();
+		rewind();
+		fflush(stdout);
 	}
+
 public:
+	ProgressReporter() : timer(this, SAMPLE_MILLISECONDS), running(false), print_time(0), textlength(0) {}
+
+	virtual void run() {
+		char sampled[sizeof(text)];
+		format(sampled, sizeof(sampled));
+		print_time = timeSeconds();
+		if (strcmp(sampled, text) == 0) return;
+		rewind();
+		strcpy(text, sampled);
+		print();
+	}
+
+	// Print, if the sampling interval has passed, when there is no timer
+	void poll() {
+		if (timeSeconds() - print_time >= SAMPLE_MILLISECONDS / 1000.0) {
+			run();
+		}
+	}
+};
+
+// Printed progress of a single parse, for each iteration
+class PackProgress : public LZProgress, ProgressReporter {
+	int size;
+
+	virtual void sample(long *done, long *total) {
+		*done = position();
+		*total = size;
+	}
+
+public:
+	~PackProgress() {
+		stopReport();
+	}
+
 	virtual void begin(int size) {
 		this->size = size;
-		steps = 0;
-		next_step_threshold = size / 1000;
-		print();
+		next_check = JobTimer::AVAILABLE ? INT_MAX : size / 1000 + 1;
+		update(0);
+		startReport();
+	}
+
+	virtual bool check(int pos) {
+		poll();
+		next_check = pos + size / 1000 + 1;
+		return true;
+	}
+
+	virtual void end() {
+		stopReport();
+	}
+};
+
+// Progress of one of several blocks parsed concurrently, reported as part of
+// a CombinedProgress. Each begin starts another iteration.
+class BlockProgress : public LZProgress {
+	ProgressReporter *reporter;
+	int iterations;
+	Gauge size;
+	Gauge iteration;
+	Gauge finished;
+
+public:
+	BlockProgress(ProgressReporter *reporter, int size, int iterations) : reporter(reporter), iterations(iterations) {
+		this->size.set(size);
 	}
 
-	virtual void update(int pos) {
-		if (pos < next_step_threshold) return;
-		while (pos >= next_step_threshold) {
-			steps += 1;
-			next_step_threshold = (long long) size * (steps + 1) / 1000;
+	virtual void begin(int size) {
+		next_check = JobTimer::AVAILABLE ? INT_MAX : size / 1000 + 1;
+		update(0);
+		this->size.set(size);
+		iteration.set(iteration.value() + 1);
+	}
+
+	virtual bool check(int pos) {
+		reporter->poll();
+		next_check = pos + size.value() / 1000 + 1;
+		return true;
+	}
+
+	virtual void end() {
+	}
+
+	// The parse is complete, even if it stopped after fewer iterations
+	void finish() {
+		finished.set(1);
+	}
+
+	void sample(long *done, long *total) {
+		long s = size.value();
+		*total = s * iterations;
+		*done = finished.value() ? *total : s * max(0L, iteration.value() - 1) + min((long) position(), s);
+	}
+};
+
+// Printed progress of several blocks parsed concurrently, in total
+class CombinedProgress : public ProgressReporter {
+	vector<BlockProgress*> blocks;
+
+	virtual void sample(long *done, long *total) {
+		*done = 0;
+		*total = 0;
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			long block_done, block_total;
+			blocks[b]->sample(&block_done, &block_total);
+			*done += block_done;
+			*total += block_total;
 		}
-		rewind();
-		print();
+	}
+
+public:
+	~CombinedProgress() {
+		stopReport();
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			delete blocks[b];
+		}
+	}
+
+	// Progress of another block of the given size
+	BlockProgress *add(int size, int iterations) {
+		BlockProgress *block = new BlockProgress(this, size, iterations);
+		blocks.push_back(block);
+		return block;
+	}
+
+	void begin() {
+		startReport();
+	}
+
+	void end() {
+		stopReport();
+	}
+};
+
+// Status output from packing: printed directly, or collected for printing
+// later when several blocks are packed concurrently.
+class PackOutput {
+	bool buffered;
+	string text;
+public:
+	PackOutput(bool buffered) : buffered(buffered) {}
+
+	void print(const char *format, ...) {
+		va_list args;
+		va_start(args, format);
+		if (buffered) {
+			char buffer[100];
+			vsnprintf(buffer, sizeof(buffer), format, args);
+			text += buffer;
+		} else {
+			vprintf(format, args);
+		}
+		va_end(args);
+	}
+
+	void flush() {
+		fputs(text.c_str(), stdout);
+		text.clear();
+	}
+
+	// Pass the collected output on to another output
+	void flush(PackOutput& target) {
+		if (target.buffered) {
+			target.text += text;
+		} else {
+			fputs(text.c_str(), stdout);
+		}
+		text.clear();
+	}
+};
+
+// Progress of parsing one window, reported as part of parsing all the data
+class WindowProgress : public LZProgress {
+	LZProgress *progress;
+	int window_start;
+public:
+	WindowProgress(LZProgress *progress, int window_start) : progress(progress), window_start(window_start) {}
+
+	virtual void begin(int size) {
+	}
+
+	virtual bool check(int pos) {
+		return progress->update(window_start + pos);
 	}
 
 	virtual void end() {
-		rewind();
-		printf("\033[K");
-		fflush(stdout);
 	}
 };
 
 class NoProgress : public LZProgress {
 public:
 	virtual void begin(int size) {
+		next_check = INT_MAX;
 		fflush(stdout);
 	}
 
-	virtual void update(int pos) {
+	virtual bool check(int pos) {
+		return true;
 	}
 
 	virtual void end() {
 	}
 };
 
-void packData(unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace = false) {
+// Progress which forwards to another progress and stops the parse when the
+// other progress stops it, when the deadline has passed, or when the stop
+// flag has been set. Stopping sets the flag, so all parses sharing the flag
+// stop together. All of this is checked at intervals of positions.
+class StoppableProgress : public LZProgress {
+	static const int CHECK_INTERVAL = 1024;
+
+	LZProgress *progress;
+	double deadline;
+	Flag& stop;
+public:
+	StoppableProgress(LZProgress *progress, double deadline, Flag& stop) : progress(progress), deadline(deadline), stop(stop) {}
+
+	virtual void begin(int size) {
+		next_check = 0;
+		progress->begin(size);
+	}
+
+	virtual bool check(int pos) {
+		next_check = pos + CHECK_INTERVAL;
+		if (stop.isSet()) return false;
+		bool go_on = progress->update(pos);
+		if (go_on && deadline > 0) {
+			go_on = timeSeconds() < deadline;
+		}
+		if (!go_on) {
+			stop.set();
+		}
+		return go_on;
+	}
+
+	virtual void end() {
+		progress->end();
+	}
+};
+
+
+// Literal contexts adapted to the dictionary of the given parameters, if
+// they are to be primed, or none
+vector<unsigned short> primedContexts(const PackParams *params) {
+	if (!params->prime_contexts || params->dictionary_length == 0) return vector<unsigned short>();
+	RangeCoder primer(LZEncoder::NUM_CONTEXTS);
+	BasicLZEncoder<RangeCoder>(&primer, params->parity_context).primeLiterals(params->dictionary, params->dictionary_length);
+	return primer.getContexts();
+}
+
+// Size of a parse result when range coded, counting the symbols into the
+// counting coder of the size counter. The parity context is fixed at compile
+// time for the whole result.
+result_size_t measureResult(const LZParseResult& result, SizeCountingCoder *size_counter, bool parity_context) {
+	if (parity_context) {
+		return result.encode(BasicLZEncoder<SizeCountingCoder, 1>(size_counter, true));
+	}
+	return result.encode(BasicLZEncoder<SizeCountingCoder, 0>(size_counter, false));
+}
+
+// Whether an iteration gained too little over the previous one to continue.
+// A parse which ends up with the same edges as before gains nothing.
+bool converged(const PackParams *params, result_size_t previous_size, result_size_t size) {
+	if (params->converge_bytes == 0) return false;
+	return size + ((result_size_t) params->converge_bytes << (3 + Coder::BIT_PRECISION)) > previous_size;
+}
+
+// Symbol counts for estimating the first iteration of a parse
+CountingCoder *initialCounts(const PackParams *params) {
+	if (params->initial_counts) return new CountingCoder(*params->initial_counts);
+	return new CountingCoder(LZEncoder::NUM_CONTEXTS);
+}
+
+// One candidate parse per iteration, runnable on its own thread
+class ParseCandidate : public Job {
+	PackParams params;
+	int data_length;
+	int parse_start;
+	SuffixArrayFinder *suffix_finder;
+	MatchFinder *finder;
+	LZParser parser;
+	LZLazyParser lazy_parser;
+	LZProgress *progress;
+	TraceBuffer *trace;
+	vector<unsigned short> primed_contexts;
+	PackContext *context;
+
+public:
+	CountingCoder *counting_coder;
+	LZParseResult& result;
+	result_size_t real_size;
+	CountingCoder *symbol_counts;
+	PackIterationStats stats;
+
+	// The parse starts at parse_start, with the data before it as history.
+	// The candidate shares the suffix array of the base finder, or uses a
+	// hash chain finder of its own if there is no base finder.
+	ParseCandidate(unsigned char *data, int data_length, int zero_padding, int parse_start, const PackParams& params,
+	               SuffixArrayFinder *base_finder, RefEdgeFactory *edge_factory, LZProgress *progress, TraceBuffer *trace)
+		: params(params), data_length(data_length), parse_start(parse_start),
+		  suffix_finder(base_finder ? new SuffixArrayFinder(*base_finder, params.match_patience, params.max_same_length) : NULL),
+		  finder(suffix_finder ? (MatchFinder*) suffix_finder : new HashChainFinder(data, data_length, 2, params.match_patience, params.max_same_length, params.chain_window)),
+		  parser(data, data_length, zero_padding, *finder, params.length_margin, params.skip_length, edge_factory, parse_start, params.evict_percent, params.run_length, params.speed_weight),
+		  lazy_parser(data, data_length, zero_padding, *finder, parse_start, params.speed_weight),
+		  progress(progress), trace(trace), primed_contexts(primedContexts(&params)),
+		  context(params.context_pool ? params.context_pool->acquire() : new PackContext()),
+		  counting_coder(NULL), result(context->result), real_size(0), symbol_counts(&context->symbol_counts)
+	{}
+
+	// Record a profile of each parse in the statistics of the candidate. The
+	// profiled data starts at data_start.
+	void profileParses(int data_start) {
+		parser.setProfile(&stats.profile, data_start);
+	}
+
+	// Cache the matches between iterations, using up to about this many
+	// bytes. With more than one thread, the cache is filled up front.
+	void cacheMatches(size_t bytes, int n_threads) {
+		if (!suffix_finder) return;
+		suffix_finder->enableCache(bytes);
+		if (n_threads > 1) {
+			suffix_finder->precomputeMatches(parse_start, n_threads);
+		}
+	}
+
+	~ParseCandidate() {
+		if (params.context_pool) {
+			params.context_pool->release(context);
+		} else {
+			delete context;
+		}
+		delete finder;
+	}
+
+	virtual void run() {
+		// Parse data into LZ symbols
+		SizeMeasuringCoder *measurer = &context->measurer;
+		measurer->setCounts(counting_coder);
+		measurer->setNumberContexts(LZEncoder::NUMBER_CONTEXT_OFFSET, LZEncoder::NUM_NUMBER_CONTEXTS, data_length);
+		finder->reset();
+		stats.profile.clear();
+		double parse_start = timeSeconds();
+		BasicLZEncoder<SizeMeasuringCoder> measuring_encoder(measurer, params.parity_context);
+		if (params.fast) {
+			lazy_parser.parse(measuring_encoder, progress, result);
+		} else {
+			parser.parse(measuring_encoder, progress, result, trace);
+		}
+		double setup_seconds = params.fast ? lazy_parser.setup_seconds : parser.setup_seconds;
+
+		// Measure result using adaptive range coding and count symbol frequencies.
+		// The shared counting coder may still be in use by other candidates.
+		double measure_start = timeSeconds();
+		symbol_counts->reset();
+		SizeCountingCoder *size_counter = &context->size_counter;
+		size_counter->restart(symbol_counts);
+		size_counter->setContexts(primed_contexts);
+		real_size = measureResult(result, size_counter, params.parity_context);
+
+		stats.setup_seconds = setup_seconds;
+		stats.parse_seconds = measure_start - parse_start - setup_seconds;
+		stats.measure_seconds = timeSeconds() - measure_start;
+		stats.max_root_edges = parser.max_root_edges;
+		stats.stopped = result.isStopped();
+	}
+};
+
+// Record the edge counts of a parsed block and merge them back into the
+// counts of the edge factory over all blocks
+void finishBlockStats(PackBlockStats *stats, RefEdgeFactory *edge_factory, int earlier_max_edge_count, int earlier_max_cleaned_edges) {
+	stats->max_edge_count = edge_factory->max_edge_count;
+	stats->max_cleaned_edges = edge_factory->max_cleaned_edges;
+	stats->peak_memory_kb = peakMemoryKB();
+	edge_factory->max_edge_count = max(edge_factory->max_edge_count, earlier_max_edge_count);
+	edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, earlier_max_cleaned_edges);
+}
+
+// Parameters for the given parse candidate. Candidate 0 uses the parameters
+// as given, the others gradually consider more matches.
+PackParams candidateParams(const PackParams *params, int candidate) {
+	PackParams cparams = *params;
+	cparams.length_margin = min(100, params->length_margin + (candidate + 1) / 2);
+	cparams.max_same_length = min(100000, params->max_same_length * (1 + candidate / 2));
+	return cparams;
+}
+
+// Hybrid parsing keeps the lazy parse of a segment if it codes less than
+// this percentage of the segment as references, as in noise, or if its
+// references are this long on average, as in runs and repeated data. The
+// optimal parser gains little over the lazy parse of either.
+static const int HYBRID_MIN_COVERAGE_PERCENT = 25;
+static const int HYBRID_LONG_REFERENCE = 64;
+
+// Whether the optimal parser is likely to improve notably on the lazy parse
+// of a segment, given the bytes and references of the lazy parse
+inline bool hybridWorthOptimal(int length, int covered, int references) {
+	if ((long long) covered * 100 < (long long) length * HYBRID_MIN_COVERAGE_PERCENT) return false;
+	return covered < (long long) references * HYBRID_LONG_REFERENCE;
+}
+
+// Parse the block from block_start to block_end of the given window data
+// in hybrid mode. The block is parsed lazily and divided into segments of
+// hybrid_size bytes. Each run of segments worth an optimal parse is parsed
+// again optimally, and the other runs keep their lazy parse. The parts are
+// added to results in order. Statistics and profile are optional.
+template <class CoderT>
+void parseBlockHybrid(const unsigned char *window_data, int block_start, int block_end, MatchFinder *finder, const PackParams *params,
+                      RefEdgeFactory *edge_factory, const BasicLZEncoder<CoderT>& encoder, LZProgress *progress, TraceBuffer *trace,
+                      PackIterationStats *stats, ParseProfile *profile, int profile_start, vector<LZParseResult>& results) {
+	// The lazy parse is quick, so it reports no progress
+	LZLazyParser lazy_parser(window_data, block_end, 0, *finder, block_start, params->speed_weight);
+	NoProgress no_progress;
+	LZParseResult lazy_result = lazy_parser.parse(encoder, &no_progress);
+	if (stats) stats->setup_seconds += lazy_parser.setup_seconds;
+
+	int segment_size = params->hybrid_size;
+	int n_segments = (block_end - block_start + segment_size - 1) / segment_size;
+	vector<int> covered(n_segments, 0);
+	vector<int> references(n_segments, 0);
+	lazy_result.countReferences(block_start, segment_size, covered, references);
+	vector<bool> optimal(n_segments);
+	for (int s = 0 ; s < n_segments ; s++) {
+		int length = min(segment_size, block_end - block_start - s * segment_size);
+		optimal[s] = hybridWorthOptimal(length, covered[s], references[s]);
+	}
+
+	int s = 0;
+	while (s < n_segments) {
+		int run_start = block_start + s * segment_size;
+		bool run_optimal = optimal[s];
+		while (s < n_segments && optimal[s] == run_optimal) s++;
+		int run_end = min(block_end, block_start + s * segment_size);
+		if (run_optimal) {
+			LZParser parser(window_data, run_end, 0, *finder, params->length_margin, params->skip_length, edge_factory, run_start, params->evict_percent, params->run_length, params->speed_weight);
+			parser.setProfile(profile, profile_start);
+			results.push_back(parser.parse(encoder, progress, trace));
+			if (stats) {
+				stats->setup_seconds += parser.setup_seconds;
+				stats->max_root_edges = max(stats->max_root_edges, parser.max_root_edges);
+			}
+		} else {
+			results.push_back(lazy_result.slice(run_start, run_end));
+		}
+	}
+}
+
+// Parse large data in blocks of window_size bytes. Each block is parsed with
+// the preceding block available for references, so only the suffix array
+// and parser state for two blocks of data are kept at a time. The blocks
+// are combined into one result for each iteration. A dictionary counts as
+// data before the first block.
+// In hybrid mode, each block is parsed by parseBlockHybrid. Data which is
+// not parsed in windows then forms a single block, whose match finder is
+// kept between iterations.
+// If the parse is stopped, the best completed iteration is returned (or the
+// stopped one, ending with literals, if none completed).
+LZParseResult parseDataWindowed(unsigned char *data, int data_length, int zero_padding, PackParams *params, RefEdgeFactory *edge_factory,
+                                int n_threads, bool show_progress, PackOutput& output, TraceBuffer *trace, PackBlockStats *stats) {
+	int history_length = params->dictionary_length;
+	unsigned char *history_data = data - history_length;
+	int total_length = history_length + data_length;
+	int window_size = params->window_size > 0 && data_length > params->window_size ? params->window_size : total_length;
+	bool single_window = window_size == total_length;
+	MatchFinder *kept_finder = NULL;
+	vector<unsigned short> primed_contexts = primedContexts(params);
+	result_size_t best_size = (result_size_t)1 << (32 + 3 + Coder::BIT_PRECISION);
+	result_size_t previous_size = 0;
+	LZParseResult best_result;
+	CountingCoder *counting_coder = initialCounts(params);
+	CountingCoder new_counts(LZEncoder::NUM_CONTEXTS);
+	PackContext *context = params->context_pool ? params->context_pool->acquire() : new PackContext();
+	LZProgress *progress;
+	if (params->progress) {
+		progress = params->progress;
+	} else if (show_progress) {
+		progress = new PackProgress();
+	} else {
+		progress = new NoProgress();
+	}
+
+	Flag stop;
+	double iteration_time = 0;
+
+	output.print("%8d", data_length);
+	for (int i = 0 ; i < params->iterations ; i++) {
+		// Skip iterations which would not complete before the deadline
+		double iteration_start = timeSeconds();
+		if (i > 0 && params->deadline > 0 && iteration_start + iteration_time > params->deadline) break;
+		output.print("  ");
+		PackIterationStats iteration_stats;
+		long rehashes_before = cuckoo_hash_rehashes.value();
+
+		// Parse each block within its window. Blocks after a stop are all literals.
+		SizeMeasuringCoder *measurer = &context->measurer;
+		measurer->setCounts(counting_coder);
+		measurer->setNumberContexts(LZEncoder::NUMBER_CONTEXT_OFFSET, LZEncoder::NUM_NUMBER_CONTEXTS, min(total_length, 2 * window_size));
+		// Loaded counts only estimate the first iteration
+		if (i == 0 && params->initial_counts) {
+			counting_coder->reset();
+		}
+		BasicLZEncoder<SizeMeasuringCoder> measuring_encoder(measurer, params->parity_context);
+		vector<LZParseResult> windows;
+		vector<int> window_starts;
+		progress->begin(total_length);
+		for (int block_start = history_length ; block_start < total_length ; block_start += window_size) {
+			int window_start = max(0, block_start - window_size);
+			int window_end = min(total_length, block_start + window_size);
+			int window_length = window_end - window_start;
+			window_starts.push_back(window_start);
+			if (stop.isSet()) {
+				windows.push_back(LZParseResult());
+				continue;
+			}
+			SuffixArrayFinder *suffix_finder = NULL;
+			MatchFinder *finder = kept_finder;
+			if (finder != NULL) {
+				finder->reset();
+			} else if (params->chain_window > 0) {
+				finder = new HashChainFinder(&history_data[window_start], window_length, 2, params->match_patience, params->max_same_length, params->chain_window);
+			} else {
+				finder = suffix_finder = new SuffixArrayFinder(&history_data[window_start], window_length, 2, params->match_patience, params->max_same_length, n_threads, params->suffix_array_cache);
+				// A kept finder can reuse its matches in later iterations
+				if (single_window && params->iterations > 1 && params->match_cache_size > 0) {
+					suffix_finder->enableCache(params->match_cache_size);
+				}
+			}
+			LZParser parser(&history_data[window_start], window_length, 0, *finder, params->length_margin, params->skip_length, edge_factory, block_start - window_start, params->evict_percent, params->run_length, params->speed_weight);
+			LZLazyParser lazy_parser(&history_data[window_start], window_length, 0, *finder, block_start - window_start, params->speed_weight);
+			if (stats && params->stats->profiling) {
+				parser.setProfile(&iteration_stats.profile, history_length - window_start);
+			}
+			WindowProgress window_progress(progress, window_start);
+			StoppableProgress stoppable_progress(&window_progress, params->deadline, stop);
+			double parse_start = timeSeconds();
+			double setup_seconds = 0;
+			if (params->fast) {
+				windows.push_back(lazy_parser.parse(measuring_encoder, &stoppable_progress));
+				setup_seconds = lazy_parser.setup_seconds;
+			} else if (params->hybrid_size > 0) {
+				parseBlockHybrid(&history_data[window_start], block_start - window_start, window_end - window_start, finder, params, edge_factory,
+					measuring_encoder, &stoppable_progress, trace, stats ? &iteration_stats : NULL,
+					stats && params->stats->profiling ? &iteration_stats.profile : NULL, history_length - window_start, windows);
+				window_starts.resize(windows.size(), window_start);
+				setup_seconds = stats ? iteration_stats.setup_seconds : 0;
+				iteration_stats.setup_seconds = 0;
+			} else {
+				windows.push_back(parser.parse(measuring_encoder, &stoppable_progress, trace));
+				setup_seconds = parser.setup_seconds;
+			}
+			if (stats && suffix_finder) {
+				stats->suffix_array_seconds += suffix_finder->suffix_array_seconds;
+				stats->lcp_seconds += suffix_finder->lcp_seconds;
+			}
+			if (stats) {
+				iteration_stats.setup_seconds += setup_seconds;
+				iteration_stats.parse_seconds += timeSeconds() - parse_start - setup_seconds;
+				iteration_stats.max_root_edges = max(iteration_stats.max_root_edges, parser.max_root_edges);
+			}
+			if (single_window) {
+				kept_finder = finder;
+			} else {
+				delete finder;
+			}
+		}
+		progress->end();
+		LZParseResult result = LZParseResult::combine(history_data, history_length, total_length, zero_padding, windows, window_starts);
+		windows.clear();
+		if (result.isStopped() && i > 0) {
+			output.print("%14s", "stopped");
+			break;
+		}
+
+		// Measure result using adaptive range coding and count symbol frequencies
+		double measure_start = timeSeconds();
+		SizeCountingCoder *size_counter = &context->size_counter;
+		size_counter->restart(counting_coder);
+		size_counter->setContexts(primed_contexts);
+		result_size_t real_size = measureResult(result, size_counter, params->parity_context);
+		if (stats) {
+			iteration_stats.measure_seconds = timeSeconds() - measure_start;
+			iteration_stats.size = real_size / (double) (8 << Coder::BIT_PRECISION);
+			iteration_stats.cuckoo_rehashes = cuckoo_hash_rehashes.value() - rehashes_before;
+			iteration_stats.stopped = result.isStopped();
+			stats->iterations.push_back(iteration_stats);
+		}
+
+		// Choose if best
+		if (real_size < best_size) {
+			best_result = result;
+			best_size = real_size;
+		}
+
+		// Print size
+		output.print("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
+
+		// New size measurer based on frequencies
+		counting_coder->mix(&new_counts);
+
+		if (stop.isSet()) break;
+		if (i > 0 && converged(params, previous_size, real_size)) break;
+		previous_size = real_size;
+		iteration_time = timeSeconds() - iteration_start;
+	}
+	if (progress != params->progress) {
+		delete progress;
+	}
+	if (params->context_pool) {
+		params->context_pool->release(context);
+	} else {
+		delete context;
+	}
+	if (params->final_counts) params->final_counts->add(counting_coder);
+	delete counting_coder;
+	delete kept_finder;
+
+	return best_result;
+}
+
+// Parse a data block which was also parsed by an earlier crunch. The earlier
+// parse is kept up to its last reference before the first change, and the
+// rest is parsed in a single iteration, estimated from the earlier counts.
+// A finder is only built if something has changed.
+LZParseResult parseIncremental(unsigned char *data, int data_length, int zero_padding, PackParams *params, RefEdgeFactory *edge_factory,
+                               int n_threads, bool show_progress, PackOutput& output, TraceBuffer *trace, PackBlockStats *stats,
+                               const IncrementalBlock *previous, int block) {
+	vector<LZParseResult> parts(1);
+	vector<int> part_starts(2, 0);
+	int sync = IncrementalFile::validPrefix(previous, data, data_length, &parts[0]);
+	PackIterationStats iteration_stats;
+	output.print("%8d  ", data_length);
+	if (sync < data_length) {
+		SuffixArrayFinder *finder = params->chain_window > 0 ? NULL
+			: new SuffixArrayFinder(data, data_length, 2, params->match_patience, params->max_same_length, n_threads, params->suffix_array_cache);
+		if (stats && finder) {
+			stats->suffix_array_seconds = finder->suffix_array_seconds;
+			stats->lcp_seconds = finder->lcp_seconds;
+		}
+		LZProgress *progress;
+		if (params->progress) {
+			progress = params->progress;
+		} else if (show_progress) {
+			progress = new PackProgress();
+		} else {
+			progress = new NoProgress();
+		}
+		Flag stop;
+		StoppableProgress stoppable_progress(progress, params->deadline, stop);
+		ParseCandidate candidate(data, data_length, zero_padding, sync, *params, finder, edge_factory, &stoppable_progress, trace);
+		if (stats && params->stats->profiling) {
+			candidate.profileParses(0);
+		}
+		CountingCoder previous_counts = previous->counts;
+		candidate.counting_coder = &previous_counts;
+		candidate.run();
+		parts.push_back(candidate.result);
+		iteration_stats = candidate.stats;
+		if (progress != params->progress) {
+			delete progress;
+		}
+		delete finder;
+	}
+	LZParseResult result = LZParseResult::combine(data, 0, data_length, zero_padding, parts, part_starts);
+
+	// Measure the combined result and count its symbol frequencies
+	CountingCoder counts(LZEncoder::NUM_CONTEXTS);
+	SizeCountingCoder *size_counter = new SizeCountingCoder(LZEncoder::NUM_CONTEXTS, &counts);
+	size_counter->setContexts(primedContexts(params));
+	result_size_t real_size = measureResult(result, size_counter, params->parity_context);
+	delete size_counter;
+	output.print("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
+	if (stats) {
+		iteration_stats.size = real_size / (double) (8 << Coder::BIT_PRECISION);
+		iteration_stats.stopped = result.isStopped();
+		stats->iterations.push_back(iteration_stats);
+	}
+
+	// Carry the counts on as an iteration would
+	CountingCoder accumulated_counts = previous->counts;
+	accumulated_counts.add(&counts);
+	CountingCoder no_counts(LZEncoder::NUM_CONTEXTS);
+	CountingCoder final_counts(&accumulated_counts, &no_counts);
+	if (params->final_counts) params->final_counts->add(&final_counts);
+	params->incremental->record(block, data, data_length, result, &final_counts);
+	return result;
+}
+
+// Parse a data block in multiple iterations, using up to n_threads threads
+// for the parse candidates, and return the smallest parse found. With a
+// dictionary, the parse covers the dictionary preceding the data in memory,
+// starting at the data.
+// If the parse is stopped, the best completed iteration is returned (or the
+// stopped one, ending with literals, if none completed).
+// Statistics of the block are recorded if stats is not NULL.
+// With incremental crunching, the block is identified by its number.
+LZParseResult parseData(unsigned char *data, int data_length, int zero_padding, PackParams *params, RefEdgeFactory *edge_factory,
+                        int n_threads, bool show_progress, PackOutput& output, bool enable_trace = false, PackBlockStats *stats = NULL,
+                        int block = 0) {
 	// Open trace file if enabled
-	FILE *trace_file = NULL;
-	if (enable_trace) {
-		trace_file = fopen("trace_cpp.log", "w");
-		if (trace_file) {
-			fprintf(trace_file, "=== C++ VERSION TRACE START ===\n");
+	TraceBuffer *trace = enable_trace ? new TraceBuffer("trace_cpp.bin") : NULL;
+
+	// Edge counts of the block are recorded separately from earlier blocks
+	int earlier_max_edge_count = edge_factory->max_edge_count;
+	int earlier_max_cleaned_edges = edge_factory->max_cleaned_edges;
+	if (stats) {
+		edge_factory->max_edge_count = 0;
+		edge_factory->max_cleaned_edges = 0;
+	}
+
+	if ((params->window_size > 0 && data_length > params->window_size) || (params->hybrid_size > 0 && !params->fast)) {
+		LZParseResult result = parseDataWindowed(data, data_length, zero_padding, params, edge_factory, n_threads, show_progress, output, trace, stats);
+		delete trace;
+		if (stats) {
+			finishBlockStats(stats, edge_factory, earlier_max_edge_count, earlier_max_cleaned_edges);
 		}
+		return result;
+	}
+
+	const IncrementalBlock *previous = params->incremental ? params->incremental->block(block) : NULL;
+	if (previous) {
+		LZParseResult result = parseIncremental(data, data_length, zero_padding, params, edge_factory, n_threads, show_progress, output, trace, stats, previous, block);
+		delete trace;
+		if (stats) {
+			finishBlockStats(stats, edge_factory, earlier_max_edge_count, earlier_max_cleaned_edges);
+		}
+		return result;
+	}
+
+	int history_length = params->dictionary_length;
+	unsigned char *history_data = data - history_length;
+	int total_length = history_length + data_length;
+	// Candidates with a hash chain finder have nothing to share
+	SuffixArrayFinder *finder = params->chain_window > 0 ? NULL
+		: params->finder_pool
+		? params->finder_pool->newFinder(history_data, total_length, 2, params->match_patience, params->max_same_length, n_threads, params->suffix_array_cache)
+		: new SuffixArrayFinder(history_data, total_length, 2, params->match_patience, params->max_same_length, n_threads, params->suffix_array_cache);
+	if (stats && finder) {
+		stats->suffix_array_seconds = finder->suffix_array_seconds;
+		stats->lcp_seconds = finder->lcp_seconds;
 	}
-	
-	MatchFinder finder(data, data_length, 2, params->match_patience, params->max_same_length);
-	LZParser parser(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, edge_factory);
 	result_size_t real_size = 0;
 	result_size_t best_size = (result_size_t)1 << (32 + 3 + Coder::BIT_PRECISION);
-	int best_result = 0;
-	vector<LZParseResult> results(2);
-	CountingCoder *counting_coder = new CountingCoder(LZEncoder::NUM_CONTEXTS);
+	result_size_t previous_size = 0;
+	LZParseResult best_result;
+	CountingCoder *counting_coder = initialCounts(params);
+	CountingCoder new_counts(LZEncoder::NUM_CONTEXTS);
 	LZProgress *progress;
-	if (show_progress) {
+	if (params->progress) {
+		progress = params->progress;
+	} else if (show_progress) {
 		progress = new PackProgress();
 	} else {
 		progress = new NoProgress();
 	}
-	printf("%8d", data_length);
+	NoProgress no_progress;
+	Flag stop;
+	double iteration_time = 0;
+
+	// Each candidate gets its own edge factory. Only the first candidate
+	// reports progress and writes trace output. A stop of any candidate
+	// stops them all.
+	int n_candidates = max(1, params->threads);
+	vector<RefEdgeFactory*> edge_factories;
+	vector<StoppableProgress*> candidate_progresses;
+	vector<ParseCandidate*> candidates;
+	vector<Job*> jobs;
+	for (int c = 0 ; c < n_candidates ; c++) {
+		RefEdgeFactory *candidate_edge_factory = edge_factory;
+		if (c > 0) {
+			candidate_edge_factory = new RefEdgeFactory(edge_factory->capacity());
+			edge_factories.push_back(candidate_edge_factory);
+		}
+		StoppableProgress *candidate_progress = new StoppableProgress(c == 0 ? progress : &no_progress, params->deadline, stop);
+		candidate_progresses.push_back(candidate_progress);
+		ParseCandidate *candidate = new ParseCandidate(history_data, total_length, zero_padding, history_length, candidateParams(params, c),
+			finder, candidate_edge_factory, candidate_progress, c == 0 ? trace : NULL);
+		if (stats && params->stats->profiling) {
+			candidate->profileParses(history_length);
+		}
+		if (params->iterations > 1 && params->match_cache_size > 0) {
+			double precompute_start = timeSeconds();
+			candidate->cacheMatches(params->match_cache_size / n_candidates, n_threads);
+			if (stats) {
+				stats->match_precompute_seconds += timeSeconds() - precompute_start;
+			}
+		}
+		candidates.push_back(candidate);
+		jobs.push_back(candidate);
+	}
+
+	output.print("%8d", data_length);
 	for (int i = 0 ; i < params->iterations ; i++) {
-		printf("  ");
+		// Skip iterations which would not complete before the deadline
+		double iteration_start = timeSeconds();
+		if (i > 0 && params->deadline > 0 && iteration_start + iteration_time > params->deadline) break;
+		output.print("  ");
 
-		// Parse data into LZ symbols
-		LZParseResult& result = results[1 - best_result];
-		Coder *measurer = new SizeMeasuringCoder(counting_coder);
-		measurer->setNumberContexts(LZEncoder::NUMBER_CONTEXT_OFFSET, LZEncoder::NUM_NUMBER_CONTEXTS, data_length);
-		finder.reset();
-		result = parser.parse(LZEncoder(measurer, params->parity_context), progress, trace_file);
-		delete measurer;
+		// Parse data with all candidates
+		long rehashes_before = cuckoo_hash_rehashes.value();
+		for (int c = 0 ; c < n_candidates ; c++) {
+			candidates[c]->counting_coder = counting_coder;
+		}
+		runJobs(jobs, n_threads);
+		long rehashes = cuckoo_hash_rehashes.value() - rehashes_before;
+		// Loaded counts only estimate the first iteration
+		if (i == 0 && params->initial_counts) {
+			counting_coder->reset();
+		}
 
-		// Encode result using adaptive range coding
-		vector<unsigned char> dummy_result;
-		RangeCoder *range_coder = new RangeCoder(LZEncoder::NUM_CONTEXTS, dummy_result);
-		real_size = result.encode(LZEncoder(range_coder, params->parity_context));
-		range_coder->finish();
-		delete range_coder;
+		// Pick the smallest candidate, the earliest one if several are equal.
+		// Candidates which completed before a stop are preferred.
+		ParseCandidate *candidate = candidates[0];
+		for (int c = 1 ; c < n_candidates ; c++) {
+			bool stopped = candidates[c]->result.isStopped();
+			if (stopped == candidate->result.isStopped() ? candidates[c]->real_size < candidate->real_size : !stopped) {
+				candidate = candidates[c];
+			}
+		}
+		LZParseResult& result = candidate->result;
+		if (result.isStopped() && i > 0) {
+			output.print("%14s", "stopped");
+			break;
+		}
+		real_size = candidate->real_size;
+		if (stats) {
+			PackIterationStats iteration_stats = candidate->stats;
+			iteration_stats.size = real_size / (double) (8 << Coder::BIT_PRECISION);
+			iteration_stats.cuckoo_rehashes = rehashes;
+			stats->iterations.push_back(iteration_stats);
+		}
 
 		// Choose if best
 		if (real_size < best_size) {
-			best_result = 1 - best_result;
+			best_result = result;
 			best_size = real_size;
 		}
 
 		// Print size
-		printf("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
+		output.print("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
 
 		// Count symbol frequencies
-		CountingCoder *new_counting_coder = new CountingCoder(LZEncoder::NUM_CONTEXTS);
-		result.encode(LZEncoder(counting_coder, params->parity_context));
-	
+		counting_coder->add(candidate->symbol_counts);
+
 		// New size measurer based on frequencies
-		CountingCoder *old_counting_coder = counting_coder;
-		counting_coder = new CountingCoder(old_counting_coder, new_counting_coder);
-		delete old_counting_coder;
-		delete new_counting_coder;
+		counting_coder->mix(&new_counts);
+
+		if (stop.isSet()) break;
+		if (i > 0 && converged(params, previous_size, real_size)) break;
+		previous_size = real_size;
+		iteration_time = timeSeconds() - iteration_start;
 	}
-	delete progress;
+	if (progress != params->progress) {
+		delete progress;
+	}
+	if (params->final_counts) params->final_counts->add(counting_coder);
+	if (params->incremental) params->incremental->record(block, data, data_length, best_result, counting_coder);
 	delete counting_coder;
+	for (int c = 0 ; c < n_candidates ; c++) {
+		delete candidates[c];
+		delete candidate_progresses[c];
+	}
+	delete finder;
+	for (int f = 0 ; f < edge_factories.size() ; f++) {
+		edge_factory->max_edge_count = max(edge_factory->max_edge_count, edge_factories[f]->max_edge_count);
+		edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, edge_factories[f]->max_cleaned_edges);
+		delete edge_factories[f];
+	}
 
-	results[best_result].encode(LZEncoder(result_coder, params->parity_context));
-	
 	// Close trace file
-	if (trace_file) {
-		fprintf(trace_file, "=== C++ VERSION TRACE END ===\n");
-		fclose(trace_file);
+	delete trace;
+
+	if (stats) {
+		finishBlockStats(stats, edge_factory, earlier_max_edge_count, earlier_max_cleaned_edges);
+	}
+	return best_result;
+}
+
+// Parse of one block of data, such as a hunk, which can run concurrently with
+// the parses of other blocks. Status output is collected for printing later.
+// Progress is reported to the given block progress, if any.
+class ParseJob : public Job {
+	unsigned char *data;
+	int data_length;
+	int zero_padding;
+	PackParams *params;
+	int edge_capacity;
+	PackBlockStats *stats;
+	int block;
+	BlockProgress *progress;
+public:
+	PackOutput output;
+	LZParseResult result;
+	int max_edge_count;
+	int max_cleaned_edges;
+
+	ParseJob(unsigned char *data, int data_length, int zero_padding, PackParams *params, int edge_capacity, PackBlockStats *stats, int block,
+	         BlockProgress *progress = NULL)
+		: data(data), data_length(data_length), zero_padding(zero_padding), params(params), edge_capacity(edge_capacity), stats(stats), block(block),
+		  progress(progress), output(true), max_edge_count(0), max_cleaned_edges(0)
+	{}
+
+	virtual void run() {
+		RefEdgeFactory edge_factory(edge_capacity);
+		// The threads run one job each, so each job is a single parse
+		PackParams job_params = *params;
+		job_params.threads = 1;
+		if (progress) {
+			job_params.progress = progress;
+		}
+		result = parseData(data, data_length, zero_padding, &job_params, &edge_factory, 1, false, output, false, stats, block);
+		if (progress) {
+			progress->finish();
+		}
+		max_edge_count = edge_factory.max_edge_count;
+		max_cleaned_edges = edge_factory.max_cleaned_edges;
 	}
+};
+
+void packData(unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, bool show_progress, bool enable_trace = false, PackBlockStats *stats = NULL, int block = 0) {
+	PackOutput output(false);
+	LZParseResult result = parseData(data, data_length, zero_padding, params, edge_factory, params->threads, show_progress, output, enable_trace, stats, block);
+	result.encode(LZEncoder(result_coder, params->parity_context));
+}
+
+// Estimated memory use of a parse: the suffix array, reverse suffix array and
+// LCP array of the match finder while they are constructed, and the literal
+// sizes of the parser, per byte of data, and each reference edge with its
+// slots in the root heap and the maps of the parser.
+static const size_t PARSE_BYTES_PER_BYTE = 4 * sizeof(int);
+static const size_t PARSE_BYTES_PER_REFERENCE = sizeof(RefEdge) + 6 * sizeof(void*);
+
+// Fit the parses of blocks of up to max_length bytes (including any
+// dictionary) within memory_limit bytes, of which other_bytes are used
+// elsewhere. Up to one parse per thread runs at a time, each with its own
+// reference edges. If a whole block does not fit, windowed parsing is used,
+// and the match cache is shrunk to leave room for references. Returns the
+// number of references which fit in the rest, or 0 if too few fit.
+int fitMemoryLimit(PackParams *params, int max_length, size_t memory_limit, size_t other_bytes) {
+	size_t n_parses = max(1, params->threads);
+	size_t available = memory_limit > other_bytes ? (memory_limit - other_bytes) / n_parses : 0;
+
+	// Keep the data of each parse within half of its share
+	size_t parse_length = max_length;
+	if (params->window_size > 0 && params->window_size < max_length) {
+		parse_length = 2 * (size_t) params->window_size;
+	}
+	if (parse_length * PARSE_BYTES_PER_BYTE > available / 2) {
+		int window_size = (int) (available / 2 / PARSE_BYTES_PER_BYTE / 2) & ~1023;
+		if (window_size < 1024) return 0;
+		params->window_size = params->window_size > 0 ? min(params->window_size, window_size) : window_size;
+		parse_length = 2 * (size_t) params->window_size;
+	}
+	available -= parse_length * PARSE_BYTES_PER_BYTE;
+
+	// The match cache gets at most a quarter of the rest
+	if (params->window_size > 0 && params->window_size < max_length) {
+		params->match_cache_size = 0;
+	}
+	params->match_cache_size = min(params->match_cache_size, available / 4);
+	available -= params->match_cache_size;
+
+	size_t references = min(available / PARSE_BYTES_PER_REFERENCE, (size_t) 100000000);
+	return references < 1000 ? 0 : (int) references;
 }
@@ -0,0 +1,162 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Timing and memory statistics of a crunch, written as JSON.
+
+Statistics are collected for each packed block of data (each hunk of an
+executable, or the whole data file) and for each iteration within the block.
+The times of an iteration are those of the chosen parse candidate, summed
+over all windows for windowed parsing. Rehash counts are shared by all parses
+running at the same time, and the peak resident memory is that of the whole
+process up to the end of the block.
+
+When profiling, each iteration also holds the parse profile of its chosen
+candidate, which is written separately as CSV.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+using std::vector;
+
+#include "Threads.h"
+#include "ParseProfile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PACK_STATS_RUSAGE
+#include <sys/resource.h>
+#endif
+
+// Peak resident memory of the process in kilobytes, or -1 if unknown
+inline long peakMemoryKB() {
+#ifdef PACK_STATS_RUSAGE
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+struct PackIterationStats {
+	double setup_seconds;
+	double parse_seconds;
+	double measure_seconds;
+	double size;
+	int max_root_edges;
+	long cuckoo_rehashes;
+	bool stopped;
+	ParseProfile profile;
+
+	PackIterationStats() : setup_seconds(0), parse_seconds(0), measure_seconds(0), size(0),
+		max_root_edges(0), cuckoo_rehashes(0), stopped(false) {}
+};
+
+struct PackBlockStats {
+	int index;
+	int size;
+	double suffix_array_seconds;
+	double lcp_seconds;
+	double match_precompute_seconds;
+	int max_edge_count;
+	int max_cleaned_edges;
+	long peak_memory_kb;
+	vector<PackIterationStats> iterations;
+
+	PackBlockStats(int index, int size) : index(index), size(size), suffix_array_seconds(0), lcp_seconds(0), match_precompute_seconds(0),
+		max_edge_count(0), max_cleaned_edges(0), peak_memory_kb(0) {}
+};
+
+class PackStats {
+	vector<PackBlockStats*> blocks;
+	Mutex mutex;
+
+public:
+	// Whether to record a parse profile for each iteration
+	bool profiling;
+
+	PackStats() : profiling(false) {}
+
+	~PackStats() {
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			delete blocks[b];
+		}
+	}
+
+	// Statistics for the block with the given index. Can be called concurrently.
+	PackBlockStats* block(int index, int size) {
+		MutexLock lock(mutex);
+		PackBlockStats *block = new PackBlockStats(index, size);
+		int b = blocks.size();
+		blocks.push_back(block);
+		while (b > 0 && blocks[b - 1]->index > index) {
+			blocks[b] = blocks[b - 1];
+			blocks[--b] = block;
+		}
+		return block;
+	}
+
+	// Write statistics as JSON. Returns false on error.
+	bool write(const char *filename, double seconds) {
+		FILE *file = fopen(filename, "w");
+		if (!file) return false;
+		fprintf(file, "{\n");
+		fprintf(file, "  \"seconds\": %.6f,\n", seconds);
+		fprintf(file, "  \"peak_memory_kb\": %ld,\n", peakMemoryKB());
+		fprintf(file, "  \"blocks\": [");
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			PackBlockStats *block = blocks[b];
+			fprintf(file, "%s\n    {\n", b > 0 ? "," : "");
+			fprintf(file, "      \"index\": %d,\n", block->index);
+			fprintf(file, "      \"size\": %d,\n", block->size);
+			fprintf(file, "      \"suffix_array_seconds\": %.6f,\n", block->suffix_array_seconds);
+			fprintf(file, "      \"lcp_seconds\": %.6f,\n", block->lcp_seconds);
+			fprintf(file, "      \"match_precompute_seconds\": %.6f,\n", block->match_precompute_seconds);
+			fprintf(file, "      \"max_edge_count\": %d,\n", block->max_edge_count);
+			fprintf(file, "      \"max_cleaned_edges\": %d,\n", block->max_cleaned_edges);
+			fprintf(file, "      \"peak_memory_kb\": %ld,\n", block->peak_memory_kb);
+			fprintf(file, "      \"iterations\": [");
+			for (int i = 0 ; i < block->iterations.size() ; i++) {
+				PackIterationStats& it = block->iterations[i];
+				fprintf(file, "%s\n        {", i > 0 ? "," : "");
+				fprintf(file, " \"setup_seconds\": %.6f, \"parse_seconds\": %.6f, \"measure_seconds\": %.6f,",
+					it.setup_seconds, it.parse_seconds, it.measure_seconds);
+				fprintf(file, " \"size\": %.3f, \"max_root_edges\": %d, \"cuckoo_rehashes\": %ld, \"stopped\": %s }",
+					it.size, it.max_root_edges, it.cuckoo_rehashes, it.stopped ? "true" : "false");
+			}
+			fprintf(file, "\n      ]\n    }");
+		}
+		fprintf(file, "\n  ]\n}\n");
+		return fclose(file) == 0;
+	}
+
+	// Write the parse profiles as CSV, with a line for each window of each
+	// iteration of each block. Returns false on error.
+	bool writeProfile(const char *filename) {
+		FILE *file = fopen(filename, "w");
+		if (!file) return false;
+		fprintf(file, "block,iteration,start,end,matches,edges,evictions,skips,skipped,seconds\n");
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			PackBlockStats *block = blocks[b];
+			for (int i = 0 ; i < block->iterations.size() ; i++) {
+				vector<ParseProfileWindow>& windows = block->iterations[i].profile.windows;
+				for (int w = 0 ; w < windows.size() ; w++) {
+					int start = w * ParseProfile::WINDOW_SIZE;
+					int end = start + ParseProfile::WINDOW_SIZE < block->size ? start + ParseProfile::WINDOW_SIZE : block->size;
+					ParseProfileWindow& counts = windows[w];
+					fprintf(file, "%d,%d,%d,%d,%lld,%lld,%lld,%lld,%lld,%.6f\n", block->index, i, start, end,
+						counts.matches, counts.edges, counts.evictions, counts.skips, counts.skipped, counts.seconds);
+				}
+			}
+		}
+		return fclose(file) == 0;
+	}
+};
@@ -0,0 +1,51 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Profile of the work done by the LZ parser in each window of the input, for
+finding the regions of the data which make a crunch slow.
+
+For each window of WINDOW_SIZE bytes, the profile counts the matches
+reported by the match finder, the edges created, the edges evicted to make
+room for new ones, and the skips over long matches or runs along with the
+number of positions skipped. It also records the time spent parsing the
+positions of the window. Positions are counted from the start of the data
+being parsed, excluding any dictionary or history before it.
+
+*/
+
+#pragma once
+
+#include <vector>
+
+using std::vector;
+
+struct ParseProfileWindow {
+	long long matches;
+	long long edges;
+	long long evictions;
+	long long skips;
+	long long skipped;
+	double seconds;
+
+	ParseProfileWindow() : matches(0), edges(0), evictions(0), skips(0), skipped(0), seconds(0) {}
+};
+
+class ParseProfile {
+public:
+	static const int WINDOW_SIZE = 4096;
+
+	vector<ParseProfileWindow> windows;
+
+	// Counts for the window holding the given position. References to
+	// earlier windows are invalidated when a later window is first used.
+	ParseProfileWindow& window(int pos) {
+		int w = pos / WINDOW_SIZE;
+		if (w >= windows.size()) windows.resize(w + 1);
+		return windows[w];
+	}
+
+	void clear() {
+		windows.clear();
+	}
+};
@@ -4,6 +4,10 @@
 
 An entropy coder based on range coding.
 
+A coder constructed without an output buffer only measures the size of the
+encoded data. Since carries never change the size, the measured size is
+exactly that of the encoded data, and no output buffer is touched.
+
 */
 
 #pragma once
@@ -13,6 +17,7 @@ An entropy coder based on range coding.
 #include <algorithm>
 #include <vector>
 
+using std::copy;
 using std::fill;
 using std::vector;
 
@@ -22,10 +27,11 @@ using std::vector;
 #define ADJUST_SHIFT 4
 #endif
 
-class RangeCoder : public Coder {
+class RangeCoder final : public Coder {
 	vector<unsigned short> contexts;
-	vector<unsigned char>& out;
-	int dest_bit;
+	vector<unsigned char> *out;
+	// Bit positions exceed 32 bits for outputs beyond 256 MB
+	long long dest_bit;
 	unsigned intervalsize;
 	unsigned intervalmin;
 
@@ -40,35 +46,53 @@ class RangeCoder : public Coder {
 		return true;
 	}
 
+	// Make room in the output for all bytes up to and including bytepos.
+	// The carry in addBit only moves towards the start of the output, so
+	// this is the only bounds check needed.
+	void ensure(long long bytepos) {
+		if (bytepos >= (long long) out->size()) {
+			out->resize(bytepos + 1, 0);
+		}
+	}
+
 	void addBit() {
-		int pos = dest_bit;
-		int bytepos;
+		long long pos = dest_bit - 1;
+		if (pos < 0 || out == NULL) return;
+		ensure(pos >> 3);
+		unsigned char *bytes = &(*out)[0];
+		long long bytepos;
 		int bitmask;
 		do {
-			pos--;
-			if (pos < 0) return;
 			bytepos = pos >> 3;
 			bitmask = 0x80 >> (pos & 7);
-			while (bytepos >= out.size()) {
-				out.push_back(0);
-			}
-			out[bytepos] ^= bitmask;
-		} while ((out[bytepos] & bitmask) == 0);
+			bytes[bytepos] ^= bitmask;
+		} while ((bytes[bytepos] & bitmask) == 0 && --pos >= 0);
 	}
 
-public:
-	RangeCoder(int n_contexts, vector<unsigned char>& out) : out(out) {
+	void init(int n_contexts) {
 		contexts.resize(n_contexts, 0x8000);
 		dest_bit = -1;
 		intervalsize = 0x8000;
 		intervalmin = 0;
+	}
+
+public:
+	// Encode into the given buffer, which is cleared first
+	RangeCoder(int n_contexts, vector<unsigned char>& out) : out(&out) {
+		init(n_contexts);
 		out.clear();
 	}
 
+	// Only measure the size of the encoded data
+	RangeCoder(int n_contexts) : out(NULL) {
+		init(n_contexts);
+	}
+
 	virtual int code(int context_index, int bit) {
 		assert(context_index < contexts.size());
 		assert(bit == 0 || bit == 1);
-		int size_before = (dest_bit << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
+		long long bit_before = dest_bit;
+		int size_before = sizetable[(intervalsize - 0x8000) >> 8];
 		unsigned prob = contexts[context_index];
 		unsigned threshold = (intervalsize * prob) >> 16;
 		unsigned new_prob;
@@ -98,7 +122,7 @@ public:
 		}
 		intervalmin &= 0xffff;
 
-		int size_after = (dest_bit << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
+		int size_after = ((int) (dest_bit - bit_before) << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
 		return size_after - size_before;
 	}
 
@@ -106,6 +130,27 @@ public:
 		fill(contexts.begin(), contexts.end(), 0x8000);
 	}
 
+	// Start coding from the beginning again, keeping the allocated contexts
+	// and output buffer
+	void restart() {
+		reset();
+		dest_bit = -1;
+		intervalsize = 0x8000;
+		intervalmin = 0;
+		if (out != NULL) out->clear();
+	}
+
+	const vector<unsigned short>& getContexts() {
+		return contexts;
+	}
+
+	// Start from the given probabilities for the first contexts, such as
+	// those of a coder primed with a dictionary
+	void setContexts(const vector<unsigned short>& primed) {
+		assert(primed.size() <= contexts.size());
+		copy(primed.begin(), primed.end(), contexts.begin());
+	}
+
 	void finish() {
 		int intervalmax = intervalmin + intervalsize;
 		int final_min = 0;
@@ -119,15 +164,35 @@ public:
 			final_size >>= 1;
 		}
 
-		while ((dest_bit - 1) >> 3 >= out.size()) {
-			out.push_back(0);
+		if (out != NULL) {
+			ensure((dest_bit - 1) >> 3);
 		}
 	}
 
-	int sizeInBits() {
+	long long sizeInBits() {
 		return dest_bit + 1;
 	}
 
+	// Number of bytes at the start of the output which can no longer be
+	// changed. All further coding stays within the current interval, which
+	// adds at most one carry to the output. That carry stops at the last
+	// zero bit, so the bytes before that bit are settled.
+	int settledBytes() {
+		if (out == NULL) return 0;
+		for (long long pos = dest_bit - 1 ; pos >= 0 ; pos--) {
+			long long bytepos = pos >> 3;
+			if (bytepos >= (long long) out->size() || ((*out)[bytepos] & (0x80 >> (pos & 7))) == 0) {
+				return (int) std::min(bytepos, (long long) out->size());
+			}
+		}
+		return 0;
+	}
+
+	// Size of the output after finish
+	int sizeInBytes() {
+		return (int) (((dest_bit - 1) >> 3) + 1);
+	}
+
 };
 
 
@@ -4,6 +4,10 @@
 
 A decoder for the range coder.
 
+The compressed data can be supplied through a pipe while it is being
+decoded, such as when it is verified while the rest is still being
+compressed. Decoding then waits for data as needed.
+
 */
 
 #pragma once
@@ -12,42 +16,36 @@ A decoder for the range coder.
 #include <algorithm>
 #include <vector>
 
+using std::copy;
 using std::fill;
 using std::vector;
 
 #include "Decoder.h"
+#include "Threads.h"
 #include "assert.h"
 
 #ifndef ADJUST_SHIFT
 #define ADJUST_SHIFT 4
 #endif
 
-class CompressedDataReadListener {
-public:
-	virtual void read(int index) = 0;
-
-	virtual ~CompressedDataReadListener() {}
-};
-
-class RangeDecoder : public Decoder {
+class RangeDecoder final : public Decoder {
 	vector<unsigned short> contexts;
 	vector<unsigned char>& data;
-	CompressedDataReadListener* listener;
-	int bit_index;
+	BytePipe* pipe;
+	long long bit_index;
 	unsigned intervalsize;
 	unsigned intervalvalue;
 	unsigned uncertainty;
 
 	int getBit() {
-		int byte_index = bit_index >> 3;
+		long long byte_index = bit_index >> 3;
 		int bit_in_byte = (~bit_index) & 7;
-		if (bit_in_byte == 7) {
-			if (listener) listener->read(byte_index);
-		}
-		if (bit_index++ >= data.size() * 8) {
+		if (bit_index >= data.size() * 8 && !(pipe && pipe->read(data))) {
+			bit_index++;
 			uncertainty <<= 1;
 			return 0;
 		}
+		bit_index++;
 		int bit = (data[byte_index] >> bit_in_byte) & 1;
 		return bit;
 	}
@@ -59,7 +57,7 @@ public:
 		intervalsize = 1;
 		intervalvalue = 0;
 		uncertainty = 1;
-		listener = NULL;
+		pipe = NULL;
 	}
 
 	virtual int decode(int context_index) {
@@ -97,7 +95,21 @@ public:
 		fill(contexts.begin(), contexts.end(), 0x8000);
 	}
 
-	void setListener(CompressedDataReadListener* listener) {
-		this->listener = listener;
+	// Start from the given probabilities for the first contexts, as set
+	// for the range coder that encoded the data
+	void setContexts(const vector<unsigned short>& primed) {
+		assert(primed.size() <= contexts.size());
+		copy(primed.begin(), primed.end(), contexts.begin());
+	}
+
+	// Read the data from the pipe, after any data already in the buffer
+	void setPipe(BytePipe* pipe) {
+		this->pipe = pipe;
+	}
+
+	// Number of bytes of the compressed data read so far, including the
+	// byte currently being read
+	int bytesRead() const {
+		return (int) ((bit_index + 7) >> 3);
 	}
 };
@@ -12,15 +12,32 @@ Main file for the cruncher.
 #define SHRINKLER_TITLE ("Shrinkler executable file compressor by Blueberry - development version (built " __DATE__ " " __TIME__ ")\n\n")
 #endif
 
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
 #include <sys/stat.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define STANDARD_STREAMS
+#elif defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#define STANDARD_STREAMS
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#endif
+
 using std::string;
 
 #include "HunkFile.h"
 #include "DataFile.h"
+#include "CrunchServer.h"
+#include "OutputCache.h"
+#include "Timer.h"
 
 void usage() {
 	printf("Usage: Shrinkler <options> <input executable> <output executable>\n");
@@ -34,18 +51,75 @@ void usage() {
 	printf(" -o, --overlap        Overlap compressed and decompressed data to save memory\n");
 	printf(" -m, --mini           Use a smaller, but more restricted decrunch header\n");
 	printf(" -c, --commandline    Support passing commandline arguments to the program\n");
+	printf(" --cpu                Oldest CPU to run the decrunch header on: 000 or 020\n");
+	printf("                      (also 010, 030, 040, 060). 020 decrunches faster. (000)\n");
+	printf(" -0                   Fast single-pass parse for quick development builds\n");
 	printf(" -1, ..., -9          Presets for all compression options (-3)\n");
 	printf(" -i, --iterations     Number of iterations for the compression (3)\n");
 	printf(" -l, --length-margin  Number of shorter matches considered for each match (3)\n");
 	printf(" -a, --same-length    Number of matches of the same length to consider (30)\n");
 	printf(" -e, --effort         Perseverance in finding multiple matches (300)\n");
 	printf(" -s, --skip-length    Minimum match length to accept greedily (3000)\n");
+	printf(" --run-length         Minimum length of a run of a repeated byte or short\n");
+	printf("                      pattern to accept without matching inside it. Takes\n");
+	printf("                      runs greedily, so it may compress worse. (off)\n");
+	printf(" --speed-weight       Bits of size to give up per 10000 cycles of decrunch time\n");
+	printf("                      saved on a 68000, favoring longer references (0)\n");
 	printf(" -r, --references     Number of reference edges to keep in memory (100000)\n");
+	printf(" --evict              Percentage of the references to free at once when all\n");
+	printf("                      are in use. Faster, but may compress worse. (0)\n");
+	printf(" -j, --threads        Number of parse candidates to try in parallel (1)\n");
+	printf(" --memory-limit       Choose the reference buffer size to crunch within this\n");
+	printf("                      much memory (e.g. 2G), parsing in windows if needed\n");
+	printf(" --sweep              Crunch with the smallest of a list of parameter sets,\n");
+	printf("                      each a preset or iterations:margin:same:effort:skip\n");
+	printf(" --batch              Crunch all data files in a list, one per thread (-j),\n");
+	printf("                      sharing the reference edges (-r) between threads\n");
 	printf(" -t, --text           Print a text, followed by a newline, before decrunching\n");
 	printf(" -T, --textfile       Print the contents of the given file before decrunching\n");
 	printf(" -f, --flash          Poke into a register (e.g. DFF180) during decrunching\n");
 	printf(" -p, --no-progress    Do not print progress info: no ANSI codes in output\n");
-	printf(" --trace              Enable detailed tracing to trace.log\n");
+	printf(" --window             Parse in blocks of this many KB, to bound memory (off)\n");
+	printf(" --hybrid             Parse lazily first and parse again optimally only the\n");
+	printf("                      segments of this many KB where that is likely to gain.\n");
+	printf("                      Faster on large, mixed data. (off)\n");
+	printf(" --match-cache        MB of memory for reusing matches between iterations (256)\n");
+	printf(" --hash-chain         Find matches with hash chains within this many KB instead\n");
+	printf("                      of a suffix array. Less memory, but may compress worse.\n");
+	printf(" --blocks             Crunch data in independent blocks of this many KB, which\n");
+	printf("                      can be decrunched in parallel. Requires --header. (off)\n");
+	printf(" --seekable           Index the blocks by offset, so that any range of the\n");
+	printf("                      data can be decrunched alone. Requires --blocks.\n");
+	printf(" --dictionary         Crunch data against the contents of the given file, which\n");
+	printf("                      must also be given for decrunching. Requires --header.\n");
+	printf(" --prime              Adapt the literal contexts to the dictionary up front\n");
+	printf(" --time-limit         Stop parsing after this many seconds, keeping the best\n");
+	printf("                      iteration completed so far (off)\n");
+	printf(" --converge           Stop iterating when an iteration gains fewer than this\n");
+	printf("                      many bytes over the previous one (off)\n");
+	printf(" --sa-cache           Directory for caching suffix arrays between runs\n");
+	printf(" --load-counts        Estimate the first iteration from symbol counts saved\n");
+	printf("                      by --save-counts when crunching similar files\n");
+	printf(" --save-counts        Save the final symbol counts of the crunch to a file\n");
+	printf(" --incremental        Reuse the parse of unchanged data recorded in this file\n");
+	printf("                      by an earlier crunch, and record the new parse in it\n");
+	printf(" --stats-json         Write timing and memory statistics of the crunch as JSON\n");
+	printf(" --parse-profile      Write the matches, references, evictions, skips and time\n");
+	printf("                      of the parser for each 4096 byte window of the input to\n");
+	printf("                      a CSV file (not with the -0 preset)\n");
+	printf(" --cache              Directory for caching crunched output between runs\n");
+	printf(" --trace              Write a binary trace of the parse to trace_cpp.bin\n");
+	printf("                      (only in builds made with TRACE=1)\n");
+	printf(" --server             Serve crunch jobs on a Unix socket at the given path,\n");
+	printf("                      running up to -j jobs at a time\n");
+	printf(" --client             Run the crunch in the server on the given socket, or\n");
+	printf("                      locally if no server is running. Must come first.\n");
+	printf("\n");
+	printf("In data mode, - can be given as input or output file to use standard\n");
+	printf("input or output. Messages are then printed to standard error.\n");
+	printf("\n");
+	printf("Each line of a batch list holds an input and an output file name,\n");
+	printf("separated by a tab. No files are given on the command line.\n");
 	printf("\n");
 	exit(0);
 }
@@ -152,6 +226,34 @@ protected:
 	}
 };
 
+class SizeParameter : public Parameter {
+public:
+	size_t value;
+
+	SizeParameter(const char *form1, const char *form2, int argc, const char *argv[], vector<bool>& consumed)
+		: value(0)
+    {
+		parse(form1, form2, "size", argc, argv, consumed);
+    }
+
+protected:
+	// A number of bytes, optionally followed by K, M or G
+	virtual bool parseArg(const char *param, const char *arg) {
+		char *endptr;
+		unsigned long long size = strtoull(arg, &endptr, 10);
+		if (endptr == arg) return false;
+		int shift = 0;
+		switch (*endptr) {
+		case 'K': case 'k': shift = 10; endptr++; break;
+		case 'M': case 'm': shift = 20; endptr++; break;
+		case 'G': case 'g': shift = 30; endptr++; break;
+		}
+		if (*endptr != '\0') return false;
+		value = (size_t) (size << shift);
+		return true;
+	}
+};
+
 class FlagParameter : public Parameter {
 public:
 	FlagParameter(const char *form1, const char *form2, int argc, const char *argv[], vector<bool>& consumed)
@@ -195,13 +297,403 @@ protected:
 	}
 };
 
+// Parse the parameter sets of the sweep option, separated by commas
+vector<PackParams> parseSweep(const char *spec, const PackParams& base) {
+	vector<PackParams> sets;
+	string list = spec;
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		if (end == string::npos) end = list.size();
+		string item = list.substr(start, end - start);
+		start = end + 1;
+
+		int i, l, a, e, s, n = 0;
+		if (item.size() == 1 && item[0] >= '1' && item[0] <= '9') {
+			int p = item[0] - '0';
+			i = 1*p; l = 1*p; a = 10*p; e = 100*p; s = 1000*p;
+		} else if (sscanf(item.c_str(), "%d:%d:%d:%d:%d%n", &i, &l, &a, &e, &s, &n) != 5 || n != item.size()) {
+			printf("Error: Invalid parameter set '%s' for sweep option.\n\n", item.c_str());
+			usage();
+		}
+		if (i < 1 || i > 9 || l < 0 || l > 100 || a < 1 || a > 100000 || e < 0 || e > 100000 || s < 2 || s > 100000) {
+			printf("Error: Parameter set '%s' for sweep option out of range.\n\n", item.c_str());
+			usage();
+		}
+
+		PackParams params = base;
+		params.iterations = i;
+		params.length_margin = l;
+		params.max_same_length = a;
+		params.match_patience = e;
+		params.skip_length = s;
+		sets.push_back(params);
+	}
+	return sets;
+}
+
+// Evaluation of one parameter set of a sweep
+class SweepJob : public Job {
+	DataFile *data_file;
+	HunkFile *hunk_file;
+	bool mini;
+	int edge_capacity;
+public:
+	PackParams params;
+	int size;
+	double seconds;
+
+	SweepJob(const PackParams& params, DataFile *data_file, HunkFile *hunk_file, bool mini, int edge_capacity)
+		: data_file(data_file), hunk_file(hunk_file), mini(mini), edge_capacity(edge_capacity),
+		  params(params), size(0), seconds(0)
+	{}
+
+	virtual void run() {
+		double start = timeSeconds();
+		if (data_file) {
+			size = data_file->packed_size(&params, edge_capacity);
+		} else {
+			size = hunk_file->packed_size(&params, mini, edge_capacity);
+		}
+		seconds = timeSeconds() - start;
+	}
+};
+
+// Evaluate all parameter sets of a sweep, using up to n_threads threads,
+// print the size and time of each, and return the set giving the smallest size.
+PackParams runSweep(const vector<PackParams>& sets, DataFile *data_file, HunkFile *hunk_file, bool mini, int edge_capacity, int n_threads) {
+	printf("Sweeping %d parameter sets...\n\n", (int) sets.size());
+	fflush(stdout);
+	vector<SweepJob*> sweep_jobs;
+	vector<Job*> jobs;
+	for (int j = 0 ; j < sets.size() ; j++) {
+		SweepJob *job = new SweepJob(sets[j], data_file, hunk_file, mini, edge_capacity);
+		sweep_jobs.push_back(job);
+		jobs.push_back(job);
+	}
+	runJobs(jobs, n_threads);
+
+	int best = 0;
+	for (int j = 1 ; j < sweep_jobs.size() ; j++) {
+		if (sweep_jobs[j]->size < sweep_jobs[best]->size) {
+			best = j;
+		}
+	}
+	printf(" Set  Iterations  Margin    Same  Effort    Skip       Size     Time\n");
+	for (int j = 0 ; j < sweep_jobs.size() ; j++) {
+		SweepJob *job = sweep_jobs[j];
+		printf("%4d%c %10d  %6d  %6d  %6d  %6d  %9d  %7.2f\n", j + 1, j == best ? '*' : ' ',
+			job->params.iterations, job->params.length_margin, job->params.max_same_length,
+			job->params.match_patience, job->params.skip_length, job->size, job->seconds);
+	}
+	PackParams result = sweep_jobs[best]->params;
+	printf("\nBest parameters: -i %d -l %d -a %d -e %d -s %d\n\n",
+		result.iterations, result.length_margin, result.max_same_length, result.match_patience, result.skip_length);
+	for (int j = 0 ; j < sweep_jobs.size() ; j++) {
+		delete sweep_jobs[j];
+	}
+	return result;
+}
+
+// A file to crunch in batch mode
+struct BatchItem {
+	string infile;
+	string outfile;
+	DataFile *file;
+	int size;
+};
+
+bool batchItemLarger(const BatchItem *a, const BatchItem *b) {
+	return a->size > b->size;
+}
+
+// Read the file names of a batch list
+vector<BatchItem*> readBatchList(const char *filename) {
+	FILE *list = fopen(filename, "r");
+	if (!list) {
+		printf("Error: Could not open batch list %s\n\n", filename);
+		exit(1);
+	}
+	vector<BatchItem*> items;
+	string line;
+	int line_number = 1;
+	int c;
+	do {
+		c = fgetc(list);
+		if (c != '\n' && c != EOF) {
+			if (c != '\r') line.push_back(c);
+			continue;
+		}
+		if (!line.empty()) {
+			size_t tab = line.find('\t');
+			if (tab == string::npos || tab == 0 || tab == line.size() - 1) {
+				printf("Error: Line %d of batch list %s does not contain an input and\n", line_number, filename);
+				printf("an output file name separated by a tab.\n\n");
+				exit(1);
+			}
+			BatchItem *item = new BatchItem;
+			item->infile = line.substr(0, tab);
+			item->outfile = line.substr(tab + 1);
+			item->file = NULL;
+			item->size = 0;
+			items.push_back(item);
+		}
+		line.clear();
+		line_number++;
+	} while (c != EOF);
+	fclose(list);
+	return items;
+}
+
+// Files of a batch, handed out to the workers one at a time
+struct BatchQueue {
+	vector<BatchItem*> items;
+	int next_item;
+	bool write_header;
+	int final_size;
+	Mutex mutex;
+	Mutex output_mutex;
+};
+
+// Worker thread of a batch. Crunches files from the queue until it is
+// empty, reusing its reference edges between files. The status output of
+// each file is collected and printed together with its saving.
+class BatchWorker : public Job {
+	BatchQueue& queue;
+	PackParams params;
+public:
+	RefEdgeFactory edge_factory;
+
+	BatchWorker(BatchQueue& queue, const PackParams& params, int edge_capacity)
+		: queue(queue), params(params), edge_factory(edge_capacity)
+	{}
+
+	virtual void run() {
+		while (true) {
+			BatchItem *item;
+			{
+				MutexLock lock(queue.mutex);
+				if (queue.next_item == queue.items.size()) break;
+				item = queue.items[queue.next_item++];
+			}
+
+			PackOutput output(true);
+			output.print("Crunching file %s...\n\n", item->infile.c_str());
+			DataFile *crunched = item->file->crunch(&params, &edge_factory, false, false, output);
+			delete item->file;
+			item->file = NULL;
+
+			MutexLock lock(queue.output_mutex);
+			output.flush();
+			printf("Saving file %s...\n\n", item->outfile.c_str());
+			crunched->save(item->outfile.c_str(), queue.write_header);
+			printf("Final file size: %d\n\n", crunched->size(queue.write_header));
+			fflush(stdout);
+			queue.final_size += crunched->size(queue.write_header);
+			delete crunched;
+		}
+	}
+};
+
+// Crunch all files of a batch list using up to n_threads threads. Each
+// thread gets an equal share of the reference edges.
+void runBatch(const char *list_filename, const PackParams& params, bool write_header, int references, int n_threads) {
+	BatchQueue queue;
+	queue.items = readBatchList(list_filename);
+	queue.next_item = 0;
+	queue.write_header = write_header;
+	queue.final_size = 0;
+	if (queue.items.empty()) {
+		printf("Error: Batch list %s contains no files.\n\n", list_filename);
+		exit(1);
+	}
+
+	// Load all files up front, so that any errors are reported before crunching
+	printf("Loading %d files...\n\n", (int) queue.items.size());
+	int original_size = 0;
+	for (int i = 0 ; i < queue.items.size() ; i++) {
+		BatchItem *item = queue.items[i];
+		item->file = new DataFile;
+		item->file->load(item->infile.c_str());
+		item->size = item->file->size(false);
+		original_size += item->size;
+	}
+
+	// Crunch the largest files first to balance the threads
+	std::stable_sort(queue.items.begin(), queue.items.end(), batchItemLarger);
+
+	int n_workers = min(n_threads, (int) queue.items.size());
+	int edge_capacity = references / n_workers;
+	printf("Crunching on %d thread%s with %d references each...\n\n", n_workers, n_workers == 1 ? "" : "s", edge_capacity);
+	fflush(stdout);
+	vector<BatchWorker*> workers;
+	vector<Job*> jobs;
+	for (int w = 0 ; w < n_workers ; w++) {
+		BatchWorker *worker = new BatchWorker(queue, params, edge_capacity);
+		workers.push_back(worker);
+		jobs.push_back(worker);
+	}
+	runJobs(jobs, n_workers);
+
+	int max_edge_count = 0;
+	int max_cleaned_edges = 0;
+	for (int w = 0 ; w < n_workers ; w++) {
+		max_edge_count = max(max_edge_count, workers[w]->edge_factory.max_edge_count);
+		max_cleaned_edges = max(max_cleaned_edges, workers[w]->edge_factory.max_cleaned_edges);
+		delete workers[w];
+	}
+	printf("References considered:%8d\n",  max_edge_count);
+	printf("References discarded:%9d\n\n", max_cleaned_edges);
+
+	printf("Crunched %d files from %d to %d bytes.\n\n", (int) queue.items.size(), original_size, queue.final_size);
+	for (int i = 0 ; i < queue.items.size() ; i++) {
+		delete queue.items[i];
+	}
+
+	if (max_edge_count > edge_capacity) {
+		printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+	}
+}
+
+// Write the statistics of a crunch to the file given by the stats-json option
+void writeStats(PackStats& stats, const char *filename, double seconds) {
+	printf("Writing statistics to %s...\n\n", filename);
+	if (!stats.write(filename, seconds)) {
+		printf("Error while writing file %s\n\n", filename);
+		exit(1);
+	}
+}
+
+// Write the parse profiles of a crunch to the file given by the
+// parse-profile option
+void writeProfile(PackStats& stats, const char *filename) {
+	printf("Writing parse profile to %s...\n\n", filename);
+	if (!stats.writeProfile(filename)) {
+		printf("Error while writing file %s\n\n", filename);
+		exit(1);
+	}
+}
+
+// Write the final symbol counts of a crunch to the file given by the
+// save-counts option
+void writeCounts(CountCollector& counts, const char *filename) {
+	printf("Writing symbol counts to %s...\n\n", filename);
+	if (!counts.save(filename)) {
+		printf("Error while writing file %s\n\n", filename);
+		exit(1);
+	}
+}
+
+// Write the parses of a crunch to the file given by the incremental option
+void writeIncremental(IncrementalFile& incremental, const char *filename) {
+	printf("Writing incremental crunch record to %s...\n\n", filename);
+	if (!incremental.save(filename)) {
+		printf("Error while writing file %s\n\n", filename);
+		exit(1);
+	}
+}
+
+// Print a message and append it to the text recorded for the output cache
+void report(string& text, const char *format, ...) {
+	char message[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	printf("%s", message);
+	text += message;
+}
+
+// Save the output of the crunch from the cache given by the cache option,
+// printing what the crunch printed. Returns whether it was in the cache.
+bool useCachedOutput(const OutputCache& cache, const char *dir, const char *infile, const char *outfile, bool executable) {
+	string report_text;
+	vector<unsigned char> output;
+	string note;
+	if (!cache.load(dir, report_text, output, note)) return false;
+	printf("Loading file %s...\n\n", infile);
+	printf("Using crunched output from cache %s\n\n", dir);
+	printf("%s", report_text.c_str());
+	printf("Saving file %s...\n\n", outfile);
+	FILE *file = fopen(outfile, "wb");
+	bool ok = file && (output.empty() || fwrite(&output[0], 1, output.size(), file) == output.size());
+	if (file) ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		printf("Error while writing file %s\n\n", outfile);
+		exit(1);
+	}
+#ifdef S_IRWXU // Is the POSIX file permission API available?
+	if (executable) chmod(outfile, 0755); // Mark file executable
+#endif
+	printf("Final file size: %d\n\n", (int) output.size());
+	printf("%s", note.c_str());
+	return true;
+}
+
+// Store the saved output file of a crunch in the cache given by the cache
+// option, along with what the crunch printed
+void cacheOutput(const OutputCache& cache, const char *dir, const string& report_text, const char *outfile, const string& note) {
+	FILE *file = fopen(outfile, "rb");
+	if (!file) return;
+	vector<unsigned char> output;
+	int c;
+	while ((c = fgetc(file)) != EOF) {
+		output.push_back(c);
+	}
+	bool ok = !ferror(file);
+	fclose(file);
+	if (ok) cache.save(dir, report_text, output, note);
+}
+
+// Fit a crunch of blocks of up to max_length bytes, keeping other_bytes of
+// data around, within the memory limit. Returns the number of references.
+int fitMemory(PackParams& params, int max_length, size_t memory_limit, size_t other_bytes) {
+	int window_size = params.window_size;
+	int references = fitMemoryLimit(&params, max_length, memory_limit, other_bytes);
+	if (references == 0) {
+		printf("Error: The memory limit is too small to crunch this file.\n\n");
+		exit(1);
+	}
+	if (params.window_size != window_size) {
+		printf("Parsing in windows of %d KB with %d references to fit the memory limit.\n\n", params.window_size / 1024, references);
+	} else {
+		printf("Using %d references to fit the memory limit.\n\n", references);
+	}
+	return references;
+}
+
+// Stream for data written to standard output. If a standard stream is used
+// for data, messages printed to standard output go to standard error instead.
+FILE *standard_output = stdout;
+
+void useStandardStreams() {
+#ifdef STANDARD_STREAMS
+	fflush(stdout);
+	standard_output = fdopen(dup(fileno(stdout)), "wb");
+	dup2(fileno(stderr), fileno(stdout));
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(standard_output), _O_BINARY);
+#endif
+#endif
+}
+
 int main2(int argc, const char *argv[]) {
+	for (int i = 1 ; i < argc ; i++) {
+		if (strcmp(argv[i], "-") == 0) {
+			useStandardStreams();
+			break;
+		}
+	}
+
 	printf(SHRINKLER_TITLE);
 
 	vector<bool> consumed(argc);
 
 	DigitParameter  preset        (                                             3, argc, argv, consumed);
-	int p = preset.value;
+	// -0 is a fast parse, with the other options of -1
+	bool fast = preset.value == 0;
+	int p = fast ? 1 : preset.value;
 
 	FlagParameter   data          ("-d", "--data",                                 argc, argv, consumed);
 	FlagParameter   bytes         ("-b", "--bytes",                                argc, argv, consumed);
@@ -211,23 +703,48 @@ int main2(int argc, const char *argv[]) {
 	FlagParameter   overlap       ("-o", "--overlap",                              argc, argv, consumed);
 	FlagParameter   mini          ("-m", "--mini",                                 argc, argv, consumed);
 	FlagParameter   commandline   ("-c", "--commandline",                          argc, argv, consumed);
+	IntParameter    cpu           ("--cpu", "--cpu",          0,       60,      0, argc, argv, consumed);
 	IntParameter    iterations    ("-i", "--iterations",      1,        9,    1*p, argc, argv, consumed);
 	IntParameter    length_margin ("-l", "--length-margin",   0,      100,    1*p, argc, argv, consumed);
 	IntParameter    same_length   ("-a", "--same-length",     1,   100000,   10*p, argc, argv, consumed);
 	IntParameter    effort        ("-e", "--effort",          0,   100000,  100*p, argc, argv, consumed);
 	IntParameter    skip_length   ("-s", "--skip-length",     2,   100000, 1000*p, argc, argv, consumed);
+	IntParameter    run_length    ("--run-length", "--run-length", 0, 100000,      0, argc, argv, consumed);
+	IntParameter    speed_weight  ("--speed-weight", "--speed-weight", 0,  100,      0, argc, argv, consumed);
 	IntParameter    references    ("-r", "--references",   1000,100000000, 100000, argc, argv, consumed);
+	SizeParameter   memory_limit  ("--memory-limit", "--memory-limit",             argc, argv, consumed);
+	IntParameter    evict         ("--evict", "--evict",      0,       50,      0, argc, argv, consumed);
+	IntParameter    threads       ("-j", "--threads",         1,       64,      1, argc, argv, consumed);
 	StringParameter text          ("-t", "--text",                                 argc, argv, consumed);
 	StringParameter textfile      ("-T", "--textfile",                             argc, argv, consumed);
 	HexParameter    flash         ("-f", "--flash",                             0, argc, argv, consumed);
 	FlagParameter   no_progress   ("-p", "--no-progress",                          argc, argv, consumed);
+	IntParameter    window        ("--window", "--window",    1,  1000000,      0, argc, argv, consumed);
+	IntParameter    hybrid        ("--hybrid", "--hybrid",    1,  1000000,      0, argc, argv, consumed);
+	IntParameter    match_cache   ("--match-cache", "--match-cache", 0, 100000, 256, argc, argv, consumed);
+	IntParameter    hash_chain    ("--hash-chain", "--hash-chain", 1, 1000000, fast ? 64 : 0, argc, argv, consumed);
+	IntParameter    blocks        ("--blocks", "--blocks",    1,  1000000,      0, argc, argv, consumed);
+	FlagParameter   seekable      ("--seekable", "--seekable",                     argc, argv, consumed);
+	StringParameter dictionary    ("--dictionary", "--dictionary",                 argc, argv, consumed);
+	FlagParameter   prime         ("--prime", "--prime",                           argc, argv, consumed);
+	IntParameter    time_limit    ("--time-limit", "--time-limit", 1, 1000000,  0, argc, argv, consumed);
+	IntParameter    converge      ("--converge", "--converge",  1,  1000000,      0, argc, argv, consumed);
+	StringParameter sa_cache      ("--sa-cache", "--sa-cache",                     argc, argv, consumed);
+	StringParameter load_counts   ("--load-counts", "--load-counts",               argc, argv, consumed);
+	StringParameter save_counts   ("--save-counts", "--save-counts",               argc, argv, consumed);
+	StringParameter incremental   ("--incremental", "--incremental",               argc, argv, consumed);
+	StringParameter sweep         ("--sweep", "--sweep",                           argc, argv, consumed);
+	StringParameter batch         ("--batch", "--batch",                           argc, argv, consumed);
+	StringParameter stats_json    ("--stats-json", "--stats-json",                 argc, argv, consumed);
+	StringParameter parse_profile ("--parse-profile", "--parse-profile",           argc, argv, consumed);
+	StringParameter cache         ("--cache", "--cache",                           argc, argv, consumed);
 	FlagParameter   trace         ("--trace", "--trace",                           argc, argv, consumed);
 
 	vector<const char*> files;
 
 	for (int i = 1 ; i < argc ; i++) {
 		if (!consumed[i]) {
-			if (argv[i][0] == '-') {
+			if (argv[i][0] == '-' && argv[i][1] != '\0') {
 				printf("Error: Unknown option %s\n\n", argv[i]);
 				usage();
 			}
@@ -235,9 +752,9 @@ int main2(int argc, const char *argv[]) {
 		}
 	}
 
-	if (data.seen && (commandline.seen || hunkmerge.seen || overlap.seen || mini.seen || text.seen || textfile.seen || flash.seen)) {
+	if (data.seen && (commandline.seen || cpu.seen || hunkmerge.seen || overlap.seen || mini.seen || text.seen || textfile.seen || flash.seen)) {
 		printf("Error: The data option cannot be used together with any of the\n");
-		printf("commandline, hunkmerge, overlap, mini, text, textfile or flash options.\n\n");
+		printf("commandline, cpu, hunkmerge, overlap, mini, text, textfile or flash options.\n\n");
 		usage();
 	}
 
@@ -251,12 +768,79 @@ int main2(int argc, const char *argv[]) {
 		usage();
 	}
 
-	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || references.seen || text.seen || textfile.seen || flash.seen)) {
+	if (blocks.seen && !header.seen) {
+		printf("Error: The blocks option can only be used together with the header option.\n\n");
+		usage();
+	}
+
+	if (seekable.seen && !blocks.seen) {
+		printf("Error: The seekable option can only be used together with the blocks option.\n\n");
+		usage();
+	}
+
+	if (dictionary.seen && (!header.seen || blocks.seen)) {
+		printf("Error: The dictionary option can only be used together with the header option,\n");
+		printf("and not together with the blocks option.\n\n");
+		usage();
+	}
+
+	if (prime.seen && !dictionary.seen) {
+		printf("Error: The prime option can only be used together with the dictionary option.\n\n");
+		usage();
+	}
+
+	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || run_length.seen || speed_weight.seen || cpu.seen || references.seen || memory_limit.seen || evict.seen || threads.seen || window.seen || hybrid.seen || match_cache.seen || hash_chain.seen || blocks.seen || dictionary.seen || time_limit.seen || converge.seen || sa_cache.seen || load_counts.seen || save_counts.seen || incremental.seen || stats_json.seen || parse_profile.seen || sweep.seen || text.seen || textfile.seen || flash.seen)) {
 		printf("Error: The no-crunch option cannot be used together with any of the\n");
 		printf("crunching options.\n\n");
 		usage();
 	}
 
+	if (sweep.seen && (preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen)) {
+		printf("Error: The sweep option cannot be used together with presets or the\n");
+		printf("iterations, length-margin, same-length, effort or skip-length options.\n\n");
+		usage();
+	}
+
+	if (batch.seen && (!data.seen || sweep.seen || trace.seen || stats_json.seen || parse_profile.seen)) {
+		printf("Error: The batch option can only be used together with the data option,\n");
+		printf("and not with the sweep, trace, stats-json or parse-profile options.\n\n");
+		usage();
+	}
+
+	if (cache.seen && (no_crunch.seen || batch.seen || time_limit.seen || load_counts.seen || save_counts.seen || incremental.seen || stats_json.seen || parse_profile.seen || trace.seen)) {
+		printf("Error: The cache option cannot be used together with the no-crunch, batch,\n");
+		printf("time-limit, load-counts, save-counts, incremental, stats-json, parse-profile\n");
+		printf("or trace options.\n\n");
+		usage();
+	}
+
+	if (trace.seen && !TRACE_COMPILED) {
+		printf("Error: The trace option needs a build made with TRACE=1.\n\n");
+		usage();
+	}
+
+	if (memory_limit.seen && (references.seen || batch.seen || sweep.seen)) {
+		printf("Error: The memory-limit option cannot be used together with the\n");
+		printf("references, batch or sweep options.\n\n");
+		usage();
+	}
+
+	if (incremental.seen && (window.seen || hybrid.seen || dictionary.seen || memory_limit.seen || batch.seen || sweep.seen)) {
+		printf("Error: The incremental option cannot be used together with the window,\n");
+		printf("hybrid, dictionary, memory-limit, batch or sweep options.\n\n");
+		usage();
+	}
+
+	if (hybrid.seen && fast) {
+		printf("Error: The hybrid option cannot be used together with the -0 preset.\n\n");
+		usage();
+	}
+
+	if (batch.seen && files.size() > 0) {
+		printf("Error: No files can be specified together with the batch option.\n\n");
+		usage();
+	}
+
 	if (overlap.seen && mini.seen) {
 		printf("Error: The overlap and mini options cannot be used together.\n\n");
 		usage();
@@ -272,6 +856,99 @@ int main2(int argc, const char *argv[]) {
 		usage();
 	}
 
+	if (cpu.value % 10 != 0 || cpu.value == 50) {
+		printf("Error: Argument of --cpu must be one of 000, 010, 020, 030, 040 or 060.\n\n");
+		usage();
+	}
+
+	if (mini.seen && cpu.value >= 20) {
+		printf("Error: The mini decrunch header has no 020 variant.\n\n");
+		usage();
+	}
+
+	PackParams params;
+	params.parity_context = !bytes.seen;
+	params.iterations = iterations.value;
+	params.length_margin = length_margin.value;
+	params.skip_length = skip_length.value;
+	params.run_length = run_length.value;
+	params.speed_weight = speed_weight.value;
+	params.match_patience = effort.value;
+	params.max_same_length = same_length.value;
+	params.evict_percent = evict.value;
+	params.threads = threads.value;
+	params.suffix_array_cache = sa_cache.value;
+	params.fast = fast;
+	params.finder_pool = NULL;
+	params.context_pool = NULL;
+	params.progress = NULL;
+	params.window_size = window.value * 1024;
+	params.hybrid_size = hybrid.value * 1024;
+	params.chain_window = hash_chain.value * 1024;
+	params.match_cache_size = (size_t) match_cache.value << 20;
+	params.block_size = blocks.value * 1024;
+	params.seekable = seekable.seen;
+	params.dictionary = NULL;
+	params.dictionary_length = 0;
+	params.prime_contexts = prime.seen;
+	params.deadline = time_limit.seen ? timeSeconds() + time_limit.value : 0;
+	params.converge_bytes = converge.value;
+	params.stats = NULL;
+	params.initial_counts = NULL;
+	params.final_counts = NULL;
+	params.incremental = NULL;
+
+	CountingCoder initial_counts(LZEncoder::NUM_CONTEXTS);
+	if (load_counts.seen) {
+		if (!initial_counts.load(load_counts.value)) {
+			printf("Error: Could not read symbol counts from %s\n\n", load_counts.value);
+			exit(1);
+		}
+		params.initial_counts = &initial_counts;
+	}
+	// Coders and buffers are reused by all parses of the run
+	PackContextPool context_pool;
+	params.context_pool = &context_pool;
+
+	CountCollector final_counts(LZEncoder::NUM_CONTEXTS);
+	IncrementalFile incremental_file;
+	if (incremental.seen) {
+		if (!incremental_file.load(incremental.value)) {
+			printf("Error: Could not read incremental crunch record from %s\n\n", incremental.value);
+			exit(1);
+		}
+		params.incremental = &incremental_file;
+	}
+
+	// The dictionary is used at an even length, dropping any odd first byte
+	vector<unsigned char> dictionary_data;
+	if (dictionary.seen) {
+		FILE *dictionary_file = fopen(dictionary.value, "rb");
+		if (!dictionary_file) {
+			printf("Error: Could not open dictionary file %s\n\n", dictionary.value);
+			exit(1);
+		}
+		int c;
+		while ((c = fgetc(dictionary_file)) != EOF) {
+			dictionary_data.push_back(c);
+		}
+		fclose(dictionary_file);
+		int skip = dictionary_data.size() & 1;
+		params.dictionary_length = dictionary_data.size() - skip;
+		params.dictionary = params.dictionary_length > 0 ? &dictionary_data[skip] : NULL;
+	}
+
+	// In batch mode, each file is crunched on one thread
+	if (batch.seen) {
+		params.threads = 1;
+		params.final_counts = save_counts.seen ? &final_counts : NULL;
+		runBatch(batch.value, params, header.seen, references.value, threads.value);
+		if (save_counts.seen) {
+			writeCounts(final_counts, save_counts.value);
+		}
+		return 0;
+	}
+
 	if (files.size() == 0) {
 		printf("Error: No input file specified.\n\n");
 		usage();
@@ -287,14 +964,35 @@ int main2(int argc, const char *argv[]) {
 
 	const char *infile = files[0];
 	const char *outfile = files[1];
+	bool infile_standard = strcmp(infile, "-") == 0;
+	bool outfile_standard = strcmp(outfile, "-") == 0;
 
-	PackParams params;
-	params.parity_context = !bytes.seen;
-	params.iterations = iterations.value;
-	params.length_margin = length_margin.value;
-	params.skip_length = skip_length.value;
-	params.match_patience = effort.value;
-	params.max_same_length = same_length.value;
+	if ((infile_standard || outfile_standard) && !data.seen) {
+		printf("Error: Standard input and output can only be used in data mode.\n\n");
+		usage();
+	}
+	if ((infile_standard || outfile_standard) && cache.seen) {
+		printf("Error: Standard input and output cannot be used with the cache option.\n\n");
+		usage();
+	}
+#ifndef STANDARD_STREAMS
+	if (infile_standard || outfile_standard) {
+		printf("Error: Standard input and output are not supported on this platform.\n\n");
+		exit(1);
+	}
+#endif
+
+	// In sweep mode, the parameter sets are evaluated in parallel, each on
+	// one thread, sharing suffix arrays. The best one is then crunched again.
+	MatchFinderPool finder_pool;
+	vector<PackParams> sweep_sets;
+	PackStats stats;
+	stats.profiling = parse_profile.seen;
+	if (sweep.seen) {
+		params.threads = 1;
+		params.finder_pool = &finder_pool;
+		sweep_sets = parseSweep(sweep.value, params);
+	}
 
 	string *decrunch_text_ptr = NULL;
 	string decrunch_text;
@@ -316,27 +1014,110 @@ int main2(int argc, const char *argv[]) {
 		decrunch_text_ptr = &decrunch_text;
 	}
 
+	// The output depends on the version, the options and the files read
+	OutputCache output_cache;
+	string crunch_report;
+	string crunch_note;
+	if (cache.seen) {
+		output_cache.add("version", SHRINKLER_TITLE);
+		output_cache.add("data", data.seen);
+		output_cache.add("header", header.seen);
+		output_cache.add("hunkmerge", hunkmerge.seen);
+		output_cache.add("overlap", overlap.seen);
+		output_cache.add("mini", mini.seen);
+		output_cache.add("commandline", commandline.seen);
+		output_cache.add("cpu", cpu.value);
+		output_cache.add("text", text.seen || textfile.seen ? decrunch_text : string());
+		output_cache.add("flash", flash.value);
+		output_cache.add("references", references.value);
+		output_cache.add("memory_limit", memory_limit.value);
+		output_cache.add("sweep", sweep.seen ? sweep.value : "");
+		output_cache.add("parity_context", params.parity_context);
+		output_cache.add("iterations", params.iterations);
+		output_cache.add("length_margin", params.length_margin);
+		output_cache.add("skip_length", params.skip_length);
+		output_cache.add("match_patience", params.match_patience);
+		output_cache.add("max_same_length", params.max_same_length);
+		output_cache.add("evict_percent", params.evict_percent);
+		output_cache.add("run_length", params.run_length);
+		output_cache.add("speed_weight", params.speed_weight);
+		output_cache.add("threads", params.threads);
+		output_cache.add("fast", params.fast);
+		output_cache.add("chain_window", params.chain_window);
+		output_cache.add("window_size", params.window_size);
+		output_cache.add("hybrid_size", params.hybrid_size);
+		output_cache.add("match_cache_size", params.match_cache_size);
+		output_cache.add("block_size", params.block_size);
+		output_cache.add("seekable", params.seekable);
+		output_cache.add("dictionary", string(dictionary_data.begin(), dictionary_data.end()));
+		output_cache.add("prime_contexts", params.prime_contexts);
+		output_cache.add("converge_bytes", params.converge_bytes);
+		if (!output_cache.addFile("input", infile)) {
+			printf("Error while reading file %s\n\n", infile);
+			exit(1);
+		}
+		if (useCachedOutput(output_cache, cache.value, infile, outfile, !data.seen)) {
+			return 0;
+		}
+	}
+
 	if (data.seen) {
 		// Data file compression
 		printf("Loading file %s...\n\n", infile);
 		DataFile *orig = new DataFile;
-		orig->load(infile);
+		if (infile_standard) {
+			orig->load(stdin);
+		} else {
+			orig->load(infile);
+		}
+
+		if (sweep.seen) {
+			params = runSweep(sweep_sets, orig, NULL, false, references.value, threads.value);
+		}
+
+		int n_references = references.value;
+		if (memory_limit.seen) {
+			n_references = fitMemory(params, orig->max_parse_length(&params), memory_limit.value, 2 * (size_t) orig->size(false));
+		}
 
 		printf("Crunching...\n\n");
-		RefEdgeFactory edge_factory(references.value);
+		RefEdgeFactory edge_factory(n_references);
+		double crunch_start = timeSeconds();
+		params.stats = stats_json.seen || parse_profile.seen ? &stats : NULL;
+		params.final_counts = save_counts.seen ? &final_counts : NULL;
 		DataFile *crunched = orig->crunch(&params, &edge_factory, !no_progress.seen, trace.seen);
+		double crunch_seconds = timeSeconds() - crunch_start;
 		delete orig;
-		printf("References considered:%8d\n",  edge_factory.max_edge_count);
-		printf("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+		report(crunch_report, "References considered:%8d\n",  edge_factory.max_edge_count);
+		report(crunch_report, "References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+		if (stats_json.seen) {
+			writeStats(stats, stats_json.value, crunch_seconds);
+		}
+		if (parse_profile.seen) {
+			writeProfile(stats, parse_profile.value);
+		}
+		if (save_counts.seen) {
+			writeCounts(final_counts, save_counts.value);
+		}
+		if (incremental.seen) {
+			writeIncremental(incremental_file, incremental.value);
+		}
 
 		printf("Saving file %s...\n\n", outfile);
-		crunched->save(outfile, header.seen);
+		if (outfile_standard) {
+			crunched->save(standard_output, header.seen);
+		} else {
+			crunched->save(outfile, header.seen);
+		}
 
 		printf("Final file size: %d\n\n", crunched->size(header.seen));
 		delete crunched;
 
-		if (edge_factory.max_edge_count > references.value) {
-			printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+		if (edge_factory.max_edge_count > n_references) {
+			report(crunch_note, "Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+		}
+		if (cache.seen) {
+			cacheOutput(output_cache, cache.value, crunch_report, outfile, crunch_note);
 		}
 
 		return 0;
@@ -393,12 +1174,35 @@ int main2(int argc, const char *argv[]) {
 		exit(1);
 	}
 	int orig_mem = orig->memory_usage(true);
+	if (sweep.seen) {
+		params = runSweep(sweep_sets, NULL, orig, mini.seen, references.value, threads.value);
+	}
+	int n_references = references.value;
+	if (memory_limit.seen) {
+		n_references = fitMemory(params, orig->max_parse_length(mini.seen), memory_limit.value, 2 * (size_t) orig->size());
+	}
 	printf("Crunching...\n\n");
-	RefEdgeFactory edge_factory(references.value);
-	HunkFile *crunched = orig->crunch(&params, overlap.seen, mini.seen, commandline.seen, decrunch_text_ptr, flash.value, &edge_factory, !no_progress.seen);
+	RefEdgeFactory edge_factory(n_references);
+	double crunch_start = timeSeconds();
+	params.stats = stats_json.seen || parse_profile.seen ? &stats : NULL;
+	params.final_counts = save_counts.seen ? &final_counts : NULL;
+	HunkFile *crunched = orig->crunch(&params, overlap.seen, mini.seen, commandline.seen, cpu.value >= 20, decrunch_text_ptr, flash.value, &edge_factory, !no_progress.seen);
+	double crunch_seconds = timeSeconds() - crunch_start;
 	delete orig;
-	printf("References considered:%8d\n",  edge_factory.max_edge_count);
-	printf("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+	report(crunch_report, "References considered:%8d\n",  edge_factory.max_edge_count);
+	report(crunch_report, "References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+	if (stats_json.seen) {
+		writeStats(stats, stats_json.value, crunch_seconds);
+	}
+	if (parse_profile.seen) {
+		writeProfile(stats, parse_profile.value);
+	}
+	if (save_counts.seen) {
+		writeCounts(final_counts, save_counts.value);
+	}
+	if (incremental.seen) {
+		writeIncremental(incremental_file, incremental.value);
+	}
 	if (!crunched->analyze()) {
 		printf("\nError while analyzing crunched file!\n\n");
 		delete crunched;
@@ -407,8 +1211,8 @@ int main2(int argc, const char *argv[]) {
 	int crunched_mem_during = crunched->memory_usage(true);
 	int crunched_mem_after = crunched->memory_usage(mini.seen || overlap.seen);
 
-	printf("Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
-	printf("Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
+	report(crunch_report, "Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
+	report(crunch_report, "Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
 
 	printf("Saving file %s...\n\n", outfile);
 	crunched->save(outfile);
@@ -418,14 +1222,17 @@ int main2(int argc, const char *argv[]) {
 	printf("Final file size: %d\n\n", crunched->size());
 	delete crunched;
 
-	if (edge_factory.max_edge_count > references.value) {
-		printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+	if (edge_factory.max_edge_count > n_references) {
+		report(crunch_note, "Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+	}
+	if (cache.seen) {
+		cacheOutput(output_cache, cache.value, crunch_report, outfile, crunch_note);
 	}
 
 	return 0;
 }
 
-int main(int argc, const char *argv[]) {
+int runMain(int argc, const char *argv[]) {
 	try {
 		return main2(argc, argv);
 	} catch (std::bad_alloc& e) {
@@ -436,8 +1243,63 @@ int main(int argc, const char *argv[]) {
 			" - Free up some memory\n"
 			" - Run it on a machine with more memory\n"
 			" - Reduce the size of the reference buffer (-r option)\n"
+			" - Limit the memory used (--memory-limit option)\n"
 			" - Split up your biggest hunk into smaller ones\n\n");
 		fflush(stderr);
 		return 1;
 	}
 }
+
+int serverMain(int argc, const char *argv[]) {
+	printf(SHRINKLER_TITLE);
+	const char *path = argv[2];
+	int n_workers = 1;
+	if (argc == 5 && (strcmp(argv[3], "-j") == 0 || strcmp(argv[3], "--threads") == 0)) {
+		char *end;
+		n_workers = strtol(argv[4], &end, 10);
+		if (*end != 0 || n_workers < 1 || n_workers > 64) {
+			printf("Error: Argument of %s must be an integer between 1 and 64.\n\n", argv[3]);
+			usage();
+		}
+	} else if (argc != 3) {
+		printf("Error: Only the threads option can be given together with the server option.\n\n");
+		usage();
+	}
+#ifdef CRUNCH_SERVER
+	return runServer(path, n_workers, runMain);
+#else
+	printf("Error: The server option is not supported on this platform.\n\n");
+	return 1;
+#endif
+}
+
+int clientMain(int argc, const char *argv[]) {
+	// Skip the client option and its argument
+	vector<const char*> job_argv;
+	job_argv.push_back(argv[0]);
+	bool standard_streams = false;
+	for (int i = 3 ; i < argc ; i++) {
+		job_argv.push_back(argv[i]);
+		standard_streams = standard_streams || strcmp(argv[i], "-") == 0;
+	}
+	job_argv.push_back(NULL);
+	int job_argc = job_argv.size() - 1;
+#ifdef CRUNCH_SERVER
+	// Standard streams cannot be passed to the server
+	if (!standard_streams) {
+		int status = runClient(argv[2], job_argc, &job_argv[0]);
+		if (status != -1) return status;
+	}
+#endif
+	return runMain(job_argc, &job_argv[0]);
+}
+
+int main(int argc, const char *argv[]) {
+	if (argc >= 3 && strcmp(argv[1], "--server") == 0) {
+		return serverMain(argc, argv);
+	}
+	if (argc >= 3 && strcmp(argv[1], "--client") == 0) {
+		return clientMain(argc, argv);
+	}
+	return runMain(argc, argv);
+}
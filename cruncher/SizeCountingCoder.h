@@ -0,0 +1,40 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+A dummy entropy coder which measures the exact size of the symbols when
+range coded, while counting their occurrences into a CountingCoder.
+
+This lets a single pass over a parse result yield both the real size of
+the result and the symbol frequencies for the next compression pass.
+
+*/
+
+#pragma once
+
+#include "RangeCoder.h"
+#include "CountingCoder.h"
+
+class SizeCountingCoder final : public Coder {
+	RangeCoder range_coder;
+	CountingCoder *counting_coder;
+
+public:
+	SizeCountingCoder(int n_contexts, CountingCoder *counting_coder)
+		: range_coder(n_contexts), counting_coder(counting_coder) {}
+
+	virtual int code(int context_index, int bit) {
+		counting_coder->code(context_index, bit);
+		return range_coder.code(context_index, bit);
+	}
+
+	void setContexts(const vector<unsigned short>& primed) {
+		range_coder.setContexts(primed);
+	}
+
+	// Measure from the beginning again, counting into the given coder
+	void restart(CountingCoder *counting_coder) {
+		range_coder.restart();
+		this->counting_coder = counting_coder;
+	}
+};
@@ -19,7 +19,7 @@ struct ContextSizes {
 	unsigned short sizes[2];
 };
 
-class SizeMeasuringCoder : public Coder {
+class SizeMeasuringCoder final : public Coder {
 	static const int MIN_SIZE = 2;
 	static const int MAX_SIZE = 12 << BIT_PRECISION;
 
@@ -40,6 +40,12 @@ public:
 	}
 
 	SizeMeasuringCoder(CountingCoder *counting_coder) {
+		setCounts(counting_coder);
+		setCacheable(true);
+	}
+
+	// Estimate sizes from new counts, reusing the size table
+	void setCounts(const CountingCoder *counting_coder) {
 		context_sizes.resize(counting_coder->context_counts.size());
 		for (int i = 0 ; i < counting_coder->context_counts.size() ; i++) {
 			struct ContextSizes s;
@@ -51,7 +57,6 @@ public:
 			s.sizes[1] = sizeForCount(count1, sum);
 			context_sizes[i] = s;
 		}
-		setCacheable(true);
 	}
 
 	virtual int code(int context_index, int bit) {
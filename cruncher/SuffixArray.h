@@ -4,20 +4,199 @@
 
 Suffix array construction based on the SA-IS algorithm.
 
+For long strings, the construction can use several threads. Symbol counting
+and suffix classification are split into chunks, and the induction scans
+run in blocks: for each block of suffix array entries, the bucket each entry
+induces into is computed in parallel, and the sequential scan then only
+needs to do the stores. This gives exactly the same result as the
+sequential construction.
+
 */
 
 #pragma once
 
 #include <vector>
 #include <algorithm>
+#include <stdint.h>
 
 using std::vector;
 using std::fill;
+using std::min;
+using std::max;
+
+#include "Threads.h"
 
 #define UNINITIALIZED (-1)
 #define IS_LMS(i) ((i) > 0 && stype[(i)] && !stype[(i) - 1])
 
-void induce(const int *data, int *suffix_array, int length, int alphabet_size, const vector<bool>& stype, const int *buckets, int *bucket_index) {
+// Minimum string length for parallel construction
+#define SUFFIX_ARRAY_PARALLEL_THRESHOLD (1 << 20)
+// Number of suffix array entries per parallel induction block
+#define SUFFIX_ARRAY_INDUCE_BLOCK (1 << 18)
+
+// Count symbols and compute suffix types for a chunk of the string.
+// Types at the end of the chunk which depend on the next chunk are marked 2.
+class ClassifyJob : public Job {
+	const int *data;
+	int begin, end, length;
+	uint8_t *stype;
+public:
+	vector<int> counts;
+	int undetermined;
+
+	ClassifyJob(const int *data, int begin, int end, int length, int alphabet_size, uint8_t *stype)
+		: data(data), begin(begin), end(end), length(length), stype(stype), counts(alphabet_size + 1, 0), undetermined(0) {}
+
+	virtual void run() {
+		uint8_t is_s = 2;
+		for (int i = end - 1 ; i >= begin ; i--) {
+			counts[data[i]]++;
+			if (i == length - 1 || data[i] < data[i + 1]) {
+				is_s = 1;
+			} else if (data[i] > data[i + 1]) {
+				is_s = 0;
+			}
+			stype[i] = is_s;
+			if (is_s == 2) undetermined++;
+		}
+	}
+};
+
+// Count LMS suffixes in a chunk of the string
+class CountLMSJob : public Job {
+	const uint8_t *stype;
+	int begin, end;
+public:
+	int lms_count;
+
+	CountLMSJob(const uint8_t *stype, int begin, int end) : stype(stype), begin(begin), end(end), lms_count(0) {}
+
+	virtual void run() {
+		for (int i = begin ; i < end ; i++) {
+			if (IS_LMS(i)) lms_count++;
+		}
+	}
+};
+
+// Compute the induction targets for a range of suffix array entries
+class InducePrefetchJob : public Job {
+	const int *data;
+	const int *suffix_array;
+	const uint8_t *stype;
+	int begin, end;
+	uint8_t type;
+	int *pre_index;
+	int *pre_symbol;
+public:
+	InducePrefetchJob(const int *data, const int *suffix_array, const uint8_t *stype, int begin, int end, uint8_t type, int *pre_index, int *pre_symbol)
+		: data(data), suffix_array(suffix_array), stype(stype), begin(begin), end(end), type(type), pre_index(pre_index), pre_symbol(pre_symbol) {}
+
+	virtual void run() {
+		for (int s = begin ; s < end ; s++) {
+			int index = suffix_array[s];
+			pre_index[s - begin] = index;
+			pre_symbol[s - begin] = index > 0 && stype[index - 1] == type ? data[index - 1] : UNINITIALIZED;
+		}
+	}
+};
+
+// Split the range [begin, end) into one job per thread
+template <class J>
+class ChunkedJobs {
+	vector<J*> jobs;
+	vector<Job*> job_list;
+	int n_threads;
+public:
+	ChunkedJobs(int n_threads) : n_threads(n_threads) {}
+
+	~ChunkedJobs() {
+		for (int j = 0 ; j < jobs.size() ; j++) {
+			delete jobs[j];
+		}
+	}
+
+	int count() {
+		return n_threads;
+	}
+
+	int chunkStart(int begin, int end, int j) {
+		return begin + (int) ((long long) (end - begin) * j / n_threads);
+	}
+
+	void add(J* job) {
+		jobs.push_back(job);
+		job_list.push_back(job);
+	}
+
+	J* operator[](int j) {
+		return jobs[j];
+	}
+
+	void run() {
+		runJobs(job_list, n_threads);
+	}
+};
+
+// Induction where the targets of each block of entries are computed in parallel.
+// The stores can land inside the current block, so entries that changed after
+// the prefetch are recomputed.
+void induce_parallel(const int *data, int *suffix_array, int length, int alphabet_size, const vector<uint8_t>& stype, const int *buckets, int *bucket_index, int n_threads) {
+	int block_size = min(length, SUFFIX_ARRAY_INDUCE_BLOCK);
+	vector<int> pre_index(block_size);
+	vector<int> pre_symbol(block_size);
+
+	// Induce L suffixes
+	for (int b = 0 ; b < alphabet_size ; b++) {
+		bucket_index[b] = buckets[b];
+	}
+	for (int block = 0 ; block < length ; block += block_size) {
+		int block_end = min(length, block + block_size);
+		ChunkedJobs<InducePrefetchJob> jobs(n_threads);
+		for (int j = 0 ; j < jobs.count() ; j++) {
+			int begin = jobs.chunkStart(block, block_end, j);
+			int end = jobs.chunkStart(block, block_end, j + 1);
+			jobs.add(new InducePrefetchJob(data, suffix_array, &stype[0], begin, end, 0, &pre_index[begin - block], &pre_symbol[begin - block]));
+		}
+		jobs.run();
+		for (int s = block ; s < block_end ; s++) {
+			int index = suffix_array[s];
+			int symbol = pre_symbol[s - block];
+			if (index != pre_index[s - block]) {
+				symbol = index > 0 && !stype[index - 1] ? data[index - 1] : UNINITIALIZED;
+			}
+			if (symbol != UNINITIALIZED) {
+				suffix_array[bucket_index[symbol]++] = index - 1;
+			}
+		}
+	}
+	// Induce S suffixes
+	for (int b = 0 ; b < alphabet_size ; b++) {
+		bucket_index[b] = buckets[b + 1];
+	}
+	for (int block_end = length ; block_end > 0 ; block_end -= block_size) {
+		int block = max(0, block_end - block_size);
+		ChunkedJobs<InducePrefetchJob> jobs(n_threads);
+		for (int j = 0 ; j < jobs.count() ; j++) {
+			int begin = jobs.chunkStart(block, block_end, j);
+			int end = jobs.chunkStart(block, block_end, j + 1);
+			jobs.add(new InducePrefetchJob(data, suffix_array, &stype[0], begin, end, 1, &pre_index[begin - block], &pre_symbol[begin - block]));
+		}
+		jobs.run();
+		for (int s = block_end - 1 ; s >= block ; s--) {
+			int index = suffix_array[s];
+			assert(index != UNINITIALIZED);
+			int symbol = pre_symbol[s - block];
+			if (index != pre_index[s - block]) {
+				symbol = index > 0 && stype[index - 1] ? data[index - 1] : UNINITIALIZED;
+			}
+			if (symbol != UNINITIALIZED) {
+				suffix_array[--bucket_index[symbol]] = index - 1;
+			}
+		}
+	}
+}
+
+void induce(const int *data, int *suffix_array, int length, int alphabet_size, const vector<uint8_t>& stype, const int *buckets, int *bucket_index) {
 	// Induce L suffixes
 	for (int b = 0 ; b < alphabet_size ; b++) {
 		bucket_index[b] = buckets[b];
@@ -41,41 +220,79 @@ void induce(const int *data, int *suffix_array, int length, int alphabet_size, c
 	}
 }
 
-bool substrings_equal(const int *data, int i1, int i2, const vector<bool>& stype) {
+bool substrings_equal(const int *data, int i1, int i2, const vector<uint8_t>& stype) {
 	while (data[i1++] == data[i2++]) {
 		if (IS_LMS(i1) && IS_LMS(i2)) return true;
 	}
 	return false;
 }
 
+// Compute suffix types and count symbols using several threads
+int classify_parallel(const int *data, int length, int alphabet_size, vector<uint8_t>& stype, vector<int>& buckets, int n_threads) {
+	ChunkedJobs<ClassifyJob> classify_jobs(n_threads);
+	for (int j = 0 ; j < classify_jobs.count() ; j++) {
+		int begin = classify_jobs.chunkStart(0, length, j);
+		int end = classify_jobs.chunkStart(0, length, j + 1);
+		classify_jobs.add(new ClassifyJob(data, begin, end, length, alphabet_size, &stype[0]));
+	}
+	classify_jobs.run();
+
+	// Resolve types at chunk ends from the start of the following chunk
+	for (int j = classify_jobs.count() - 1 ; j >= 0 ; j--) {
+		int end = classify_jobs.chunkStart(0, length, j + 1);
+		for (int i = end - classify_jobs[j]->undetermined ; i < end ; i++) {
+			stype[i] = stype[end];
+		}
+		for (int b = 0 ; b <= alphabet_size ; b++) {
+			buckets[b] += classify_jobs[j]->counts[b];
+		}
+	}
+
+	ChunkedJobs<CountLMSJob> count_jobs(n_threads);
+	for (int j = 0 ; j < count_jobs.count() ; j++) {
+		count_jobs.add(new CountLMSJob(&stype[0], count_jobs.chunkStart(0, length, j), count_jobs.chunkStart(0, length, j + 1)));
+	}
+	count_jobs.run();
+	int lms_count = 0;
+	for (int j = 0 ; j < count_jobs.count() ; j++) {
+		lms_count += count_jobs[j]->lms_count;
+	}
+	return lms_count;
+}
+
 // Compute the suffix array of a string over an integer alphabet.
 // The last character in the string (the sentinel) must be uniquely smallest in the string.
-void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size) {
+void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size, int n_threads = 1) {
 	// Handle empty string
 	assert(length >= 1);
 	if (length == 1) {
 		suffix_array[0] = 0;
 		return;
 	}
+	bool parallel = n_threads > 1 && length >= SUFFIX_ARRAY_PARALLEL_THRESHOLD;
 
-	vector<bool> stype(length);
+	vector<uint8_t> stype(length);
 	vector<int> buckets(alphabet_size + 1, 0);
 	vector<int> bucket_index(alphabet_size);
 
 	// Compute suffix types and count symbols
-	stype[length - 1] = true;
-	buckets[data[length - 1]] = 1;
-	bool is_s = true;
 	int lms_count = 0;
-	for (int i = length - 2; i >= 0; i--) {
-		buckets[data[i]]++;
-		if (data[i] > data[i + 1]) {
-			if (is_s) lms_count++;
-			is_s = false;
-		} else if (data[i] < data[i + 1]) {
-			is_s = true;
+	if (parallel) {
+		lms_count = classify_parallel(data, length, alphabet_size, stype, buckets, n_threads);
+	} else {
+		stype[length - 1] = true;
+		buckets[data[length - 1]] = 1;
+		bool is_s = true;
+		for (int i = length - 2; i >= 0; i--) {
+			buckets[data[i]]++;
+			if (data[i] > data[i + 1]) {
+				if (is_s) lms_count++;
+				is_s = false;
+			} else if (data[i] < data[i + 1]) {
+				is_s = true;
+			}
+			stype[i] = is_s;
 		}
-		stype[i] = is_s;
 	}
 
 	// Accumulate bucket sizes
@@ -99,7 +316,11 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce to sort LMS strings
-	induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	if (parallel) {
+		induce_parallel(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0], n_threads);
+	} else {
+		induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	}
 
 	// Compact LMS indices at the beginning of the suffix array
 	int j = 0;
@@ -143,7 +364,7 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 		assert(j == lms_count);
 
 		// Sort named LMS symbols recursively
-		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size);
+		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size, n_threads);
 
 		// Map named LMS symbol indices to LMS string indices in input string
 		j = 0;
@@ -173,5 +394,9 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce from sorted LMS strings to sort all suffixes
-	induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	if (parallel) {
+		induce_parallel(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0], n_threads);
+	} else {
+		induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	}
 }
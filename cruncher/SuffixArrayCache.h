@@ -0,0 +1,174 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the suffix array data of the match finder.
+
+Constructing the suffix array, its inverse and the LCP array dominates the
+startup time for each block of data. When running the cruncher repeatedly
+on the same data (for instance to try different parameters), the arrays can
+be stored in a cache directory and loaded from there on subsequent runs.
+
+Cache files are named after a hash of the data and contain the data itself,
+so a file is only used if the data matches exactly. The arrays are stored
+in native byte order, and files written on a machine with a different
+layout are ignored. Where available, files are memory mapped on load.
+
+File layout:
+  char magic[8]                     "ShrSAC1"
+  int int_size, length              sizeof(int), data length
+  unsigned long long hash           hash of data
+  int suffix_array[length + 1]
+  int rev_suffix_array[length + 1]
+  int longest_common_prefix[length + 1]
+  unsigned char data[length]
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SUFFIX_ARRAY_CACHE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct SuffixArrayCacheHeader {
+	char magic[8];
+	int int_size;
+	int length;
+	unsigned long long hash;
+};
+
+class SuffixArrayCacheFile {
+	vector<int> contents;
+	void *mapping;
+	size_t mapping_size;
+
+	static unsigned long long hash(const unsigned char *data, int length) {
+		// 64-bit FNV-1a
+		unsigned long long h = 0xcbf29ce484222325ULL;
+		for (int i = 0 ; i < length ; i++) {
+			h = (h ^ data[i]) * 0x100000001b3ULL;
+		}
+		return h;
+	}
+
+	static string filename(const char *dir, unsigned long long h) {
+		char name[32];
+		sprintf(name, "%016llx.sa", h);
+		string path = dir;
+		if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') {
+			path += '/';
+		}
+		return path + name;
+	}
+
+	static size_t fileSize(int length) {
+		return sizeof(SuffixArrayCacheHeader) + 3 * (size_t) (length + 1) * sizeof(int) + length;
+	}
+
+	static void makeHeader(SuffixArrayCacheHeader *header, const unsigned char *data, int length) {
+		memset(header, 0, sizeof(SuffixArrayCacheHeader));
+		strcpy(header->magic, "ShrSAC1");
+		header->int_size = sizeof(int);
+		header->length = length;
+		header->hash = hash(data, length);
+	}
+
+	// Check the header and data of a loaded file, and set up the array pointers
+	bool accept(const char *file_data, const unsigned char *data, int length) {
+		SuffixArrayCacheHeader header;
+		makeHeader(&header, data, length);
+		if (memcmp(file_data, &header, sizeof(SuffixArrayCacheHeader)) != 0) return false;
+		const int *arrays = (const int *) (file_data + sizeof(SuffixArrayCacheHeader));
+		if (memcmp(&arrays[3 * (length + 1)], data, length) != 0) return false;
+		suffix_array = &arrays[0];
+		rev_suffix_array = &arrays[length + 1];
+		longest_common_prefix = &arrays[2 * (length + 1)];
+		return true;
+	}
+
+public:
+	const int *suffix_array;
+	const int *rev_suffix_array;
+	const int *longest_common_prefix;
+
+	SuffixArrayCacheFile() : mapping(NULL), mapping_size(0),
+		suffix_array(NULL), rev_suffix_array(NULL), longest_common_prefix(NULL) {}
+
+	~SuffixArrayCacheFile() {
+#ifdef SUFFIX_ARRAY_CACHE_MMAP
+		if (mapping != NULL) {
+			munmap(mapping, mapping_size);
+		}
+#endif
+	}
+
+	// Load cached arrays for the given data. Returns whether a valid file was found.
+	bool load(const char *dir, const unsigned char *data, int length) {
+		string path = filename(dir, hash(data, length));
+		size_t size = fileSize(length);
+#ifdef SUFFIX_ARRAY_CACHE_MMAP
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t) st.st_size != size) {
+			close(fd);
+			return false;
+		}
+		void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) return false;
+		if (!accept((const char *) m, data, length)) {
+			munmap(m, size);
+			return false;
+		}
+		mapping = m;
+		mapping_size = size;
+		return true;
+#else
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file) return false;
+		contents.resize((size + sizeof(int) - 1) / sizeof(int));
+		bool ok = fread(&contents[0], 1, size, file) == size && fgetc(file) == EOF;
+		fclose(file);
+		if (!ok || !accept((const char *) &contents[0], data, length)) {
+			contents.clear();
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	// Store arrays for the given data. Failure to write the cache is not an error.
+	static void save(const char *dir, const unsigned char *data, int length,
+	                 const int *suffix_array, const int *rev_suffix_array, const int *longest_common_prefix) {
+		SuffixArrayCacheHeader header;
+		makeHeader(&header, data, length);
+		string path = filename(dir, header.hash);
+		string temp_path = path + ".tmp";
+		FILE *file = fopen(temp_path.c_str(), "wb");
+		if (!file) return;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		          fwrite(suffix_array, sizeof(int), length + 1, file) == length + 1 &&
+		          fwrite(rev_suffix_array, sizeof(int), length + 1, file) == length + 1 &&
+		          fwrite(longest_common_prefix, sizeof(int), length + 1, file) == length + 1 &&
+		          fwrite(data, 1, length, file) == length;
+		ok = fclose(file) == 0 && ok;
+		remove(path.c_str());
+		if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+			remove(temp_path.c_str());
+		}
+	}
+};
@@ -0,0 +1,400 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Minimal support for running independent jobs on several threads.
+
+A job is an object with a run method. runJobs runs a list of jobs on at most
+the given number of threads, handing out jobs in list order, and returns
+when all jobs have completed. Jobs must not share mutable state, except
+through objects protected by a Mutex. An exception thrown by a job is
+passed on to the thread waiting for the jobs, once they have completed.
+
+If the platform has no thread support, define SHRINKLER_NO_THREADS to run
+all jobs sequentially on the calling thread.
+
+A JobQueue runs jobs on a background thread while the thread adding them
+continues, and a BytePipe passes data to such a job as it is produced.
+
+A Gauge holds a value written by one thread and sampled by others, such as
+the position of a parse, and a JobTimer runs a job at a fixed interval, such
+as printing samples of it.
+
+*/
+
+#pragma once
+
+#include <vector>
+
+using std::vector;
+
+#ifndef SHRINKLER_NO_THREADS
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#endif
+
+class Job {
+public:
+	virtual void run() = 0;
+
+	virtual ~Job() {}
+};
+
+#ifndef SHRINKLER_NO_THREADS
+class JobRunner {
+	vector<Job*>& jobs;
+	std::atomic<int> next_job;
+	std::mutex mutex;
+	std::exception_ptr error;
+
+	void work() {
+		int j;
+		while ((j = next_job++) < (int) jobs.size()) {
+			try {
+				jobs[j]->run();
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) error = std::current_exception();
+			}
+		}
+	}
+
+public:
+	JobRunner(vector<Job*>& jobs) : jobs(jobs), next_job(0) {}
+
+	void run(int n_threads) {
+		vector<std::thread> threads;
+		for (int t = 1 ; t < n_threads && t < (int) jobs.size() ; t++) {
+			threads.push_back(std::thread(&JobRunner::work, this));
+		}
+		work();
+		for (int t = 0 ; t < (int) threads.size() ; t++) {
+			threads[t].join();
+		}
+		if (error) std::rethrow_exception(error);
+	}
+};
+#endif
+
+class Mutex {
+#ifndef SHRINKLER_NO_THREADS
+	std::mutex mutex;
+#endif
+public:
+	void lock() {
+#ifndef SHRINKLER_NO_THREADS
+		mutex.lock();
+#endif
+	}
+
+	void unlock() {
+#ifndef SHRINKLER_NO_THREADS
+		mutex.unlock();
+#endif
+	}
+};
+
+// A flag which is set by one thread and read by other threads
+class Flag {
+#ifndef SHRINKLER_NO_THREADS
+	std::atomic<bool> value;
+#else
+	bool value;
+#endif
+public:
+	Flag() : value(false) {}
+
+	void set() {
+		value = true;
+	}
+
+	bool isSet() {
+		return value;
+	}
+};
+
+// A counter which can be incremented by several threads
+class Counter {
+#ifndef SHRINKLER_NO_THREADS
+	std::atomic<long> count;
+#else
+	long count;
+#endif
+public:
+	Counter() : count(0) {}
+
+	void increment() {
+		count++;
+	}
+
+	void add(long n) {
+		count += n;
+	}
+
+	long value() {
+		return count;
+	}
+};
+
+// A value written by one thread and read by others without synchronizing
+// anything else, so access costs no more than for a plain variable.
+class Gauge {
+#ifndef SHRINKLER_NO_THREADS
+	std::atomic<long> current;
+#else
+	long current;
+#endif
+public:
+	Gauge() : current(0) {}
+
+	void set(long value) {
+#ifndef SHRINKLER_NO_THREADS
+		current.store(value, std::memory_order_relaxed);
+#else
+		current = value;
+#endif
+	}
+
+	long value() const {
+#ifndef SHRINKLER_NO_THREADS
+		return current.load(std::memory_order_relaxed);
+#else
+		return current;
+#endif
+	}
+};
+
+// Holds a mutex locked for the lifetime of the object
+class MutexLock {
+	Mutex& mutex;
+public:
+	MutexLock(Mutex& mutex) : mutex(mutex) {
+		mutex.lock();
+	}
+
+	~MutexLock() {
+		mutex.unlock();
+	}
+};
+
+inline void runJobs(vector<Job*>& jobs, int n_threads) {
+#ifndef SHRINKLER_NO_THREADS
+	if (n_threads > 1 && jobs.size() > 1) {
+		JobRunner runner(jobs);
+		runner.run(n_threads);
+		return;
+	}
+#endif
+	for (int j = 0 ; j < (int) jobs.size() ; j++) {
+		jobs[j]->run();
+	}
+}
+
+// Runs a job repeatedly on a background thread, at a fixed interval, from
+// start until stop. Without thread support, the job is never run, and
+// whoever needs it must run it instead.
+class JobTimer {
+	Job *job;
+	int milliseconds;
+#ifndef SHRINKLER_NO_THREADS
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable stopped;
+	std::thread thread;
+
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopped.wait_for(lock, std::chrono::milliseconds(milliseconds), [this] { return stopping; })) {
+			job->run();
+		}
+	}
+#endif
+
+public:
+#ifndef SHRINKLER_NO_THREADS
+	static const bool AVAILABLE = true;
+#else
+	static const bool AVAILABLE = false;
+#endif
+
+	JobTimer(Job *job, int milliseconds) : job(job), milliseconds(milliseconds) {}
+
+	void start() {
+#ifndef SHRINKLER_NO_THREADS
+		stopping = false;
+		thread = std::thread(&JobTimer::work, this);
+#endif
+	}
+
+	// Returns once the job is no longer running
+	void stop() {
+#ifndef SHRINKLER_NO_THREADS
+		if (!thread.joinable()) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		stopped.notify_one();
+		thread.join();
+#endif
+	}
+
+	~JobTimer() {
+		stop();
+	}
+};
+
+// Runs jobs on a background thread, in the order they are added. Without
+// thread support, the jobs are run when the queue is finished.
+class JobQueue {
+	vector<Job*> jobs;
+	int next_job;
+	bool finished;
+#ifndef SHRINKLER_NO_THREADS
+	std::mutex mutex;
+	std::condition_variable added;
+	std::thread thread;
+	std::exception_ptr error;
+
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			added.wait(lock, [this] { return next_job < (int) jobs.size() || finished; });
+			if (next_job == (int) jobs.size()) return;
+			Job *job = jobs[next_job++];
+			lock.unlock();
+			try {
+				job->run();
+			} catch (...) {
+				if (!error) error = std::current_exception();
+			}
+			lock.lock();
+		}
+	}
+
+	void join() {
+		if (!thread.joinable()) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+			added.notify_one();
+		}
+		thread.join();
+	}
+#endif
+
+public:
+#ifndef SHRINKLER_NO_THREADS
+	JobQueue() : next_job(0), finished(false), thread(&JobQueue::work, this) {}
+#else
+	JobQueue() : next_job(0), finished(false) {}
+#endif
+
+	void add(Job *job) {
+#ifndef SHRINKLER_NO_THREADS
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+		added.notify_one();
+#else
+		jobs.push_back(job);
+#endif
+	}
+
+	// Wait until all added jobs have completed. No jobs can be added after.
+	void finish() {
+#ifndef SHRINKLER_NO_THREADS
+		join();
+		if (error) {
+			std::exception_ptr e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+#else
+		while (next_job < (int) jobs.size()) {
+			jobs[next_job++]->run();
+		}
+		finished = true;
+#endif
+	}
+
+	// Exceptions of the jobs are dropped if the queue was not finished
+	~JobQueue() {
+#ifndef SHRINKLER_NO_THREADS
+		join();
+#else
+		finish();
+#endif
+	}
+};
+
+// Bytes written by one thread and read by another as they arrive
+class BytePipe {
+	vector<unsigned char> bytes;
+	bool closed;
+	bool cancelled;
+#ifndef SHRINKLER_NO_THREADS
+	std::mutex mutex;
+	std::condition_variable written;
+#endif
+
+public:
+	// Thrown to the reader when the writer gave up
+	struct Cancelled {};
+
+	BytePipe() : closed(false), cancelled(false) {}
+
+	void write(const unsigned char *data, int length) {
+		if (length <= 0) return;
+#ifndef SHRINKLER_NO_THREADS
+		std::lock_guard<std::mutex> lock(mutex);
+#endif
+		bytes.insert(bytes.end(), data, data + length);
+#ifndef SHRINKLER_NO_THREADS
+		written.notify_one();
+#endif
+	}
+
+	// No more bytes will be written
+	void close() {
+#ifndef SHRINKLER_NO_THREADS
+		std::lock_guard<std::mutex> lock(mutex);
+#endif
+		closed = true;
+#ifndef SHRINKLER_NO_THREADS
+		written.notify_one();
+#endif
+	}
+
+	// The writer gave up, so the bytes end early. A read which runs out
+	// of bytes throws Cancelled.
+	void cancel() {
+#ifndef SHRINKLER_NO_THREADS
+		std::lock_guard<std::mutex> lock(mutex);
+#endif
+		closed = true;
+		cancelled = true;
+#ifndef SHRINKLER_NO_THREADS
+		written.notify_one();
+#endif
+	}
+
+	// Append the bytes following the ones already in the buffer, waiting
+	// until there are some. Returns false if the pipe is closed and has no
+	// more bytes.
+	bool read(vector<unsigned char>& buffer) {
+#ifndef SHRINKLER_NO_THREADS
+		std::unique_lock<std::mutex> lock(mutex);
+		written.wait(lock, [&] { return bytes.size() > buffer.size() || closed; });
+#endif
+		if (bytes.size() <= buffer.size()) {
+			if (cancelled) throw Cancelled();
+			return false;
+		}
+		buffer.insert(buffer.end(), bytes.begin() + buffer.size(), bytes.end());
+		return true;
+	}
+};
@@ -0,0 +1,27 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Wall clock time measurement.
+
+Where threads are not available, processor time is used instead, which is
+the same as wall clock time for a single-threaded, non-waiting process.
+
+*/
+
+#pragma once
+
+#ifndef SHRINKLER_NO_THREADS
+#include <chrono>
+#else
+#include <ctime>
+#endif
+
+// Time in seconds since some fixed point
+inline double timeSeconds() {
+#ifndef SHRINKLER_NO_THREADS
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	return clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
@@ -0,0 +1,227 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Binary trace of the decisions of the parser, for debugging and for driving
+the microbenchmarks.
+
+Tracing is only compiled in when SHRINKLER_TRACE is defined (make TRACE=1).
+Otherwise, the TRACE macro expands to nothing and its arguments are never
+evaluated, so the parser carries no trace checks at all.
+
+Each event is a fixed-size record of its type and up to seven values. The
+producing thread puts records into a ring buffer of its own, and a flusher
+thread writes them to the trace file in the background. If the ring is full,
+the producer waits for the flusher to catch up, so no records are lost.
+
+The file starts with an identifying header, followed by the records in the
+native byte order. bench/tracedump prints a trace file as text.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(SHRINKLER_TRACE) && !defined(SHRINKLER_NO_THREADS)
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+using std::vector;
+
+enum TraceRecordType {
+	TRACE_ASSIMILATE_START,
+	TRACE_ASSIMILATE_EDGE,
+	TRACE_BEST_UPDATED,
+	TRACE_MATCH,
+	TRACE_EDGE_ATTEMPT,
+	TRACE_CONDITION_EVAL,
+	TRACE_SECOND_EDGE,
+	TRACE_EDGE_CREATED,
+	NUM_TRACE_RECORD_TYPES
+};
+
+const int TRACE_MAX_VALUES = 7;
+
+struct TraceRecord {
+	int type;
+	int values[TRACE_MAX_VALUES];
+};
+
+// Names of the record types and their values, as printed by tracedump
+struct TraceRecordFormat {
+	const char *name;
+	int n_values;
+	const char *value_names[TRACE_MAX_VALUES];
+};
+
+static const TraceRecordFormat trace_formats[NUM_TRACE_RECORD_TYPES] = {
+	{ "ASSIMILATE_START", 4, { "pos", "best_offset", "best_total", "edges_count" } },
+	{ "ASSIMILATE_EDGE",  5, { "pos", "edge_offset", "edge_total", "best_total", "will_update" } },
+	{ "BEST_UPDATED",     3, { "pos", "new_best_offset", "new_best_total" } },
+	{ "MATCH",            4, { "pos", "match_pos", "match_length", "offset" } },
+	{ "EDGE_ATTEMPT",     4, { "pos", "offset", "length", "best_offset" } },
+	{ "CONDITION_EVAL",   6, { "pos", "offset", "length", "best_offset", "count", "condition" } },
+	{ "SECOND_EDGE",      4, { "pos", "offset", "length", "existing_offset" } },
+	{ "EDGE_CREATED",     6, { "pos", "offset", "length", "total_cost", "source_offset", "source_pos" } },
+};
+
+static const char TRACE_FILE_ID[8] = { 'S', 'H', 'R', 'T', 'R', 'A', 'C', 'E' };
+static const int TRACE_FILE_VERSION = 1;
+
+// Check the header of a trace file
+inline bool readTraceHeader(FILE *file) {
+	char id[sizeof(TRACE_FILE_ID)];
+	int version;
+	return fread(id, sizeof(id), 1, file) == 1 && memcmp(id, TRACE_FILE_ID, sizeof(id)) == 0 &&
+		fread(&version, sizeof(version), 1, file) == 1 && version == TRACE_FILE_VERSION;
+}
+
+// Read the next record of a trace file. Returns false at the end.
+inline bool readTraceRecord(FILE *file, TraceRecord *record) {
+	return fread(record, sizeof(TraceRecord), 1, file) == 1 &&
+		record->type >= 0 && record->type < NUM_TRACE_RECORD_TYPES;
+}
+
+#ifdef SHRINKLER_TRACE
+
+const bool TRACE_COMPILED = true;
+
+#define TRACE(buffer, ...) do { if (buffer) (buffer)->record(__VA_ARGS__); } while (0)
+
+class TraceBuffer {
+	static const size_t RING_SIZE = 1 << 16;
+	static const size_t CHUNK_SIZE = 1 << 12;
+
+	FILE *file;
+	vector<TraceRecord> ring;
+#ifndef SHRINKLER_NO_THREADS
+	// Records before head have been written by the producer, records
+	// before tail have been written to the file by the flusher.
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	bool done;
+	std::mutex mutex;
+	std::condition_variable filled;
+	std::condition_variable emptied;
+	std::thread flusher;
+#else
+	size_t head;
+	size_t tail;
+#endif
+
+	// Write the records in the range from-end of the ring to the file
+	void write(size_t from, size_t end) {
+		while (from < end) {
+			size_t index = from & (RING_SIZE - 1);
+			size_t count = std::min(end - from, RING_SIZE - index);
+			fwrite(&ring[index], sizeof(TraceRecord), count, file);
+			from += count;
+		}
+	}
+
+#ifndef SHRINKLER_NO_THREADS
+	void flush() {
+		bool finished = false;
+		while (!finished) {
+			size_t end;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				filled.wait(lock, [&] { return head.load() - tail.load() >= CHUNK_SIZE || done; });
+				end = head.load();
+				finished = done;
+			}
+			write(tail.load(), end);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				tail.store(end);
+			}
+			emptied.notify_one();
+		}
+	}
+#endif
+
+public:
+	explicit TraceBuffer(const char *filename) : ring(RING_SIZE), head(0), tail(0) {
+		file = fopen(filename, "wb");
+		if (file) {
+			fwrite(TRACE_FILE_ID, sizeof(TRACE_FILE_ID), 1, file);
+			fwrite(&TRACE_FILE_VERSION, sizeof(TRACE_FILE_VERSION), 1, file);
+		}
+#ifndef SHRINKLER_NO_THREADS
+		done = false;
+		if (file) {
+			flusher = std::thread(&TraceBuffer::flush, this);
+		}
+#endif
+	}
+
+	~TraceBuffer() {
+		if (!file) return;
+#ifndef SHRINKLER_NO_THREADS
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = true;
+		}
+		filled.notify_one();
+		flusher.join();
+#else
+		write(tail, head);
+#endif
+		fclose(file);
+	}
+
+	// Only called from the thread owning the buffer
+	void record(TraceRecordType type, int v0 = 0, int v1 = 0, int v2 = 0, int v3 = 0, int v4 = 0, int v5 = 0, int v6 = 0) {
+		if (!file) return;
+		size_t h = head;
+		if (h - tail == RING_SIZE) {
+#ifndef SHRINKLER_NO_THREADS
+			std::unique_lock<std::mutex> lock(mutex);
+			emptied.wait(lock, [&] { return h - tail.load() < RING_SIZE; });
+#else
+			write(tail, h);
+			tail = h;
+#endif
+		}
+		TraceRecord& r = ring[h & (RING_SIZE - 1)];
+		r.type = type;
+		r.values[0] = v0;
+		r.values[1] = v1;
+		r.values[2] = v2;
+		r.values[3] = v3;
+		r.values[4] = v4;
+		r.values[5] = v5;
+		r.values[6] = v6;
+#ifndef SHRINKLER_NO_THREADS
+		if (((h + 1) & (CHUNK_SIZE - 1)) == 0) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				head.store(h + 1);
+			}
+			filled.notify_one();
+			return;
+		}
+#endif
+		head = h + 1;
+	}
+};
+
+#else
+
+const bool TRACE_COMPILED = false;
+
+#define TRACE(buffer, ...) do {} while (0)
+
+class TraceBuffer {
+public:
+	explicit TraceBuffer(const char *filename) {}
+};
+
+#endif
@@ -8,30 +8,39 @@ Verifying the correctness of crunched data and computing safety margin.
 
 #pragma once
 
+#include <algorithm>
+
 #include "RangeDecoder.h"
 #include "LZDecoder.h"
+#include "MatchLength.h"
 
 
-class LZVerifier : public LZReceiver, public CompressedDataReadListener {
+class LZVerifier final : public LZReceiver {
 	int hunk;
 	unsigned char *data;
 	int data_length;
+	int history_length;
 	int hunk_mem;
 	int read_size;
 	int pos;
+	const RangeDecoder& decoder;
+	int read_start;
 
+	// Negative positions are in the history preceding the data
 	unsigned char getData(int i) {
 		if (data == NULL || i >= data_length) return 0;
 		return data[i];
 	}
 
 public:
-	int compressed_read_count;
 	int front_overlap_margin;
 
-	LZVerifier(int hunk, unsigned char *data, int data_length, int hunk_mem, int read_size)
-		: hunk(hunk), data(data), data_length(data_length), hunk_mem(hunk_mem), read_size(read_size), pos(0) {
-		compressed_read_count = 0;
+	// The data may be preceded in memory by a history, such as a dictionary,
+	// which references can reach into. The compressed data is read from the
+	// decoder, starting at its current position.
+	LZVerifier(int hunk, unsigned char *data, int data_length, int hunk_mem, int read_size, const RangeDecoder& decoder, int history_length = 0)
+		: hunk(hunk), data(data), data_length(data_length), history_length(history_length), hunk_mem(hunk_mem), read_size(read_size), pos(0),
+		  decoder(decoder), read_start(decoder.bytesRead()) {
 		front_overlap_margin = 0;
 	}
 
@@ -52,7 +61,7 @@ public:
 	}
 
 	bool receiveReference(int offset, int length) {
-		if (offset < 1 || offset > pos) {
+		if (offset < 1 || offset > pos + history_length) {
 			printf("Verify error: reference at position %d in hunk %d has invalid offset (%d)!\n",
 				pos, hunk, offset);
 			return false;
@@ -62,7 +71,13 @@ public:
 				pos, hunk, length, pos + length - hunk_mem);
 			return false;
 		}
-		for (int i = 0 ; i < length ; i++) {
+		// Compare the part within the data quickly, then check the rest
+		// (including any zero padding) byte by byte.
+		int i = 0;
+		if (data != NULL && pos < data_length) {
+			i = matchLength(&data[pos - offset], &data[pos], std::min(length, data_length - pos));
+		}
+		for (; i < length ; i++) {
 			if (getData(pos - offset + i) != getData(pos + i)) {
 				printf("Verify error: reference at position %d in hunk %d has incorrect value for byte %d of %d (0x%02X, should be 0x%02X)!\n",
 					pos, hunk, i, length, getData(pos - offset + i), getData(pos + i));
@@ -78,18 +93,17 @@ public:
 		return pos;
 	}
 
-	void read(int index) {
-		// Another byte of compresed data read
-		if ((index & (read_size - 1)) == 0) {
-			compressed_read_count += read_size;
-			if (compressed_read_count > data_length)
-				compressed_read_count = data_length;
-			updateMargin();
-		}
+	// Compressed data read so far, in whole units of the read size, each
+	// counted from when its first byte is read. At most the data length.
+	int compressedReadCount() {
+		int units = (decoder.bytesRead() + read_size - 1) / read_size - (read_start + read_size - 1) / read_size;
+		return std::min(units * read_size, data_length);
 	}
 
+	// The margin can only grow when data is output, as reading only
+	// increases the read count.
 	void updateMargin(void) {
-		int margin = pos - compressed_read_count;
+		int margin = pos - compressedReadCount();
 		if (margin > front_overlap_margin) {
 			front_overlap_margin = margin;
 		}
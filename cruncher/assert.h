@@ -4,10 +4,20 @@
 
 An assert function which contains a breakpoint, for ease of debugging.
 
+In the library (SHRINKLER_LIBRARY), an internal error throws InternalError
+to the caller instead of exiting the program.
+
 */
 
 #pragma once
 
+#ifdef SHRINKLER_LIBRARY
+struct InternalError {};
+
+void internal_error() {
+	throw InternalError();
+}
+#else
 void internal_error() {
 	fflush(stdout);
 	fprintf(stderr,
@@ -19,15 +29,18 @@ void internal_error() {
 	fflush(stderr);
 	exit(1);
 }
+#endif
 
 #ifndef NDEBUG
 #include <stdio.h>
 static void _assert_func(const char *file, int line, const char *exp) {
+#ifndef SHRINKLER_LIBRARY
 	fflush(stdout);
 	fprintf(stderr, "\n\nassertion \"%s\" failed: file \"%s\", line %d\n", exp, file, line);
 	fflush(stderr);
 #ifdef DEBUG
 	__asm volatile ("int3;");
+#endif
 #endif
 	internal_error();
 }
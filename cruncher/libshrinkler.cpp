@@ -0,0 +1,198 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Main file for the cruncher library.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Internal errors are thrown rather than exiting the program
+#define SHRINKLER_LIBRARY
+
+#include "HunkFile.h"
+#include "DataFile.h"
+#include "libshrinkler.h"
+
+struct ShrinklerContext {
+	RefEdgeFactory *edge_factory;
+	PackContextPool context_pool;
+	vector<unsigned char> result;
+	bool has_result;
+};
+
+// Progress reported to a progress function, at most 1000 times per iteration.
+// A nonzero return from the function during an iteration stops the parse.
+class CallbackProgress : public LZProgress {
+	ShrinklerProgressFunc func;
+	void *user_data;
+	int iteration;
+	int size;
+public:
+	CallbackProgress(ShrinklerProgressFunc func, void *user_data) : func(func), user_data(user_data), iteration(0) {}
+
+	virtual void begin(int size) {
+		this->size = size;
+		iteration++;
+		next_check = size / 1000;
+		func(user_data, iteration, 0, size);
+	}
+
+	virtual bool check(int pos) {
+		next_check = pos + size / 1000 + 1;
+		return func(user_data, iteration, pos, size) == 0;
+	}
+
+	virtual void end() {
+		func(user_data, iteration, size, size);
+	}
+};
+
+static bool validParams(const ShrinklerParams *params) {
+	return params->iterations >= 1 && params->iterations <= 9 &&
+	       params->length_margin >= 0 && params->length_margin <= 100 &&
+	       params->same_length >= 1 && params->same_length <= 100000 &&
+	       params->effort >= 0 && params->effort <= 100000 &&
+	       params->skip_length >= 2 && params->skip_length <= 100000 &&
+	       params->run_length >= 0 && params->run_length <= 100000 &&
+	       params->speed_weight >= 0 && params->speed_weight <= 100 &&
+	       params->references >= 1000 && params->references <= 100000000 &&
+	       params->evict >= 0 && params->evict <= 50 &&
+	       params->threads >= 1 && params->threads <= 64 &&
+	       params->window_size >= 0 && params->match_cache >= 0 && params->chain_window >= 0 && params->converge >= 0 && params->hybrid_size >= 0 &&
+	       params->block_size >= 0 && params->block_size % 2 == 0 &&
+	       (params->block_size == 0 || params->write_header) &&
+	       (!params->seekable || params->block_size > 0) &&
+	       params->dictionary_size >= 0 && params->dictionary_size <= DataFile::MAX_DATA_LENGTH &&
+	       (params->dictionary_size == 0 || params->dictionary) &&
+	       (params->dictionary_size < 2 || (params->write_header && params->block_size == 0));
+}
+
+extern "C" void shrinkler_default_params(ShrinklerParams *params, int preset) {
+	int p = preset < 1 ? 1 : preset > 9 ? 9 : preset;
+	params->parity_context = 1;
+	params->iterations = 1*p;
+	params->length_margin = 1*p;
+	params->same_length = 10*p;
+	params->effort = 100*p;
+	params->skip_length = 1000*p;
+	params->run_length = 0;
+	params->speed_weight = 0;
+	params->references = 100000;
+	params->evict = 0;
+	params->threads = 1;
+	params->window_size = 0;
+	params->fast = preset == 0;
+	params->match_cache = 256;
+	params->chain_window = params->fast ? 64 << 10 : 0;
+	params->write_header = 0;
+	params->block_size = 0;
+	params->seekable = 0;
+	params->dictionary = NULL;
+	params->dictionary_size = 0;
+	params->prime = 0;
+	params->converge = 0;
+	params->hybrid_size = 0;
+}
+
+extern "C" ShrinklerContext* shrinkler_context_new(void) {
+	ShrinklerContext *context = new (std::nothrow) ShrinklerContext;
+	if (context) {
+		context->edge_factory = NULL;
+		context->has_result = false;
+	}
+	return context;
+}
+
+extern "C" void shrinkler_context_free(ShrinklerContext *context) {
+	if (context) {
+		delete context->edge_factory;
+		delete context;
+	}
+}
+
+extern "C" int shrinkler_crunch(ShrinklerContext *context, const unsigned char *src, int src_size,
+                                unsigned char *dst, int dst_capacity, const ShrinklerParams *sparams,
+                                ShrinklerProgressFunc progress_func, void *user_data) {
+	if (!context || !sparams || !validParams(sparams) || src_size < 0 || src_size > DataFile::MAX_DATA_LENGTH || (src_size > 0 && !src) ||
+	    dst_capacity < 0 || (dst_capacity > 0 && !dst)) {
+		return SHRINKLER_ERROR_INVALID_PARAMS;
+	}
+	context->has_result = false;
+
+	try {
+		CallbackProgress progress(progress_func, user_data);
+		PackParams params;
+		params.parity_context = sparams->parity_context != 0;
+		params.iterations = sparams->iterations;
+		params.length_margin = sparams->length_margin;
+		params.skip_length = sparams->skip_length;
+		params.run_length = sparams->run_length;
+		params.speed_weight = sparams->speed_weight;
+		params.match_patience = sparams->effort;
+		params.max_same_length = sparams->same_length;
+		params.evict_percent = sparams->evict;
+		params.threads = sparams->threads;
+		params.suffix_array_cache = NULL;
+		params.fast = sparams->fast != 0;
+		params.finder_pool = NULL;
+		params.context_pool = &context->context_pool;
+		params.window_size = sparams->window_size;
+		params.chain_window = sparams->chain_window;
+		params.match_cache_size = (size_t) sparams->match_cache << 20;
+		params.block_size = sparams->block_size;
+		params.seekable = sparams->seekable != 0;
+		params.dictionary_length = sparams->dictionary_size & ~1;
+		params.dictionary = params.dictionary_length > 0 ? sparams->dictionary + (sparams->dictionary_size & 1) : NULL;
+		params.prime_contexts = sparams->prime != 0;
+		params.progress = progress_func ? &progress : NULL;
+		params.deadline = 0;
+		params.converge_bytes = sparams->converge;
+		params.hybrid_size = sparams->hybrid_size;
+		params.stats = NULL;
+		params.initial_counts = NULL;
+		params.final_counts = NULL;
+		params.incremental = NULL;
+
+		// Reuse the reference edges of the context if they have the right size
+		if (context->edge_factory == NULL || context->edge_factory->capacity() != sparams->references) {
+			delete context->edge_factory;
+			context->edge_factory = NULL;
+			context->edge_factory = new RefEdgeFactory(sparams->references);
+		}
+
+		// Status output is collected and discarded
+		PackOutput output(true);
+		DataFile file;
+		file.load(src, src_size);
+		DataFile *crunched = file.crunch(&params, context->edge_factory, false, false, output);
+		crunched->save(context->result, sparams->write_header != 0);
+		delete crunched;
+	} catch (std::bad_alloc& e) {
+		return SHRINKLER_ERROR_OUT_OF_MEMORY;
+	} catch (InternalError& e) {
+		return SHRINKLER_ERROR_INTERNAL;
+	}
+	context->has_result = true;
+
+	int size = context->result.size();
+	if (size > dst_capacity) {
+		return SHRINKLER_ERROR_OUTPUT_TOO_SMALL;
+	}
+	if (size > 0) {
+		memcpy(dst, &context->result[0], size);
+	}
+	return size;
+}
+
+extern "C" const unsigned char* shrinkler_result(ShrinklerContext *context, int *size_out) {
+	if (!context || !context->has_result) {
+		*size_out = 0;
+		return NULL;
+	}
+	*size_out = context->result.size();
+	return context->result.empty() ? NULL : &context->result[0];
+}
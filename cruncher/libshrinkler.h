@@ -0,0 +1,94 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Library interface to the Shrinkler data cruncher.
+
+Crunches a buffer in memory into the same format as the data mode of the
+Shrinkler executable (-d), optionally with the data file header (-w). The
+compression is the full one of the executable, and the result is verified.
+
+All working memory of a crunch, such as the reference edges and the
+crunched data, is kept in a context owned by the caller. Contexts can be
+reused for any number of crunches. Crunches using different contexts can
+run concurrently on different threads.
+
+The interface is plain C, so the library can be used from C as well as C++.
+
+*/
+
+#pragma once
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#define SHRINKLER_API __attribute__((visibility("default")))
+#else
+#define SHRINKLER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHRINKLER_ERROR_OUTPUT_TOO_SMALL (-1)
+#define SHRINKLER_ERROR_INVALID_PARAMS   (-2)
+#define SHRINKLER_ERROR_OUT_OF_MEMORY    (-3)
+#define SHRINKLER_ERROR_INTERNAL         (-4) // A bug, such as a failed verify
+
+typedef struct {
+	int parity_context;   // Nonzero to use the parity context (not -b)
+	int iterations;       // -i, 1 to 9
+	int length_margin;    // -l, 0 to 100
+	int same_length;      // -a, 1 to 100000
+	int effort;           // -e, 0 to 100000
+	int skip_length;      // -s, 2 to 100000
+	int run_length;       // --run-length, 0 to 100000
+	int speed_weight;     // --speed-weight, 0 to 100
+	int references;       // -r, 1000 to 100000000
+	int evict;            // --evict, 0 to 50
+	int threads;          // -j, 1 to 64
+	int window_size;      // --window in bytes, or 0 for none
+	int fast;             // -0, nonzero for a fast single-pass parse
+	int match_cache;      // --match-cache in MB, or 0 for none
+	int chain_window;     // --hash-chain in bytes, or 0 for the suffix array
+	int write_header;     // -w, nonzero to write the data file header
+	int block_size;       // --blocks in bytes (even), or 0 for a single stream.
+	                      // Requires write_header.
+	int seekable;         // --seekable, nonzero to index blocks by offset.
+	                      // Requires block_size.
+	const unsigned char *dictionary; // --dictionary contents, or NULL. Used at an
+	int dictionary_size;  // even size, dropping any odd first byte. Requires
+	                      // write_header and no block_size.
+	int prime;            // --prime, nonzero to adapt contexts to the dictionary.
+	int converge;         // --converge in bytes, or 0 to run all iterations
+	int hybrid_size;      // --hybrid in bytes, or 0 to parse all data optimally
+} ShrinklerParams;
+
+typedef struct ShrinklerContext ShrinklerContext;
+
+// Called regularly during each iteration with the number of bytes parsed so
+// far of the total size. Iterations are numbered from 1. Returning nonzero
+// stops the crunch, which then uses the best iteration completed so far (or
+// the stopped one, finished with literals, if it was the first).
+typedef int (*ShrinklerProgressFunc)(void *user_data, int iteration, int pos, int size);
+
+// Parameters of the given preset (0 to 9, as the -0 to -9 options)
+SHRINKLER_API void shrinkler_default_params(ShrinklerParams *params, int preset);
+
+SHRINKLER_API ShrinklerContext* shrinkler_context_new(void);
+SHRINKLER_API void shrinkler_context_free(ShrinklerContext *context);
+
+// Crunch src_size bytes at src into dst, at most 1 GB. Returns the size of
+// the crunched data, or a negative error code. If the output buffer is too small, the
+// crunched data can still be obtained by shrinkler_result. The progress
+// function can be NULL.
+SHRINKLER_API int shrinkler_crunch(ShrinklerContext *context, const unsigned char *src, int src_size,
+                                   unsigned char *dst, int dst_capacity, const ShrinklerParams *params,
+                                   ShrinklerProgressFunc progress, void *user_data);
+
+// Data crunched by the latest successful crunch using the context. Valid
+// until the next crunch or until the context is freed.
+SHRINKLER_API const unsigned char* shrinkler_result(ShrinklerContext *context, int *size_out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,116 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Arena allocator for the work memory of a crunch.
+
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arena.h"
+
+#define ARENA_ALIGN 16
+// Marks a freed block in the size field of its header, which is aligned
+#define ARENA_FREED 1
+
+// Precedes each block. Blocks are linked backwards, so that freeing the most
+// recent block also releases any freed blocks just before it.
+typedef struct {
+	size_t size;
+	size_t prev;
+} ArenaHeader;
+
+static size_t align_up(size_t n) {
+	return (n + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+static ArenaHeader* header_at(Arena *arena, size_t offset) {
+	return (ArenaHeader *) (arena->memory + offset);
+}
+
+static size_t header_offset(Arena *arena, void *ptr) {
+	return (unsigned char *) ptr - arena->memory - align_up(sizeof(ArenaHeader));
+}
+
+void arena_init(Arena *arena, void *memory, size_t size) {
+	size_t skip = align_up((uintptr_t) memory) - (uintptr_t) memory;
+	arena->memory = (unsigned char *) memory + skip;
+	arena->size = size > skip ? size - skip : 0;
+	arena->peak = 0;
+	arena_reset(arena);
+}
+
+void arena_reset(Arena *arena) {
+	arena->used = 0;
+	arena->last = ARENA_NONE;
+	arena->failed = 0;
+}
+
+void* arena_malloc(Arena *arena, size_t size) {
+	if (!arena) return malloc(size);
+	size_t offset = arena->used;
+	size_t data_size = align_up(size);
+	if (data_size < size || arena->size - offset < align_up(sizeof(ArenaHeader)) + data_size) {
+		arena->failed = 1;
+		return NULL;
+	}
+	ArenaHeader *header = header_at(arena, offset);
+	header->size = data_size;
+	header->prev = arena->last;
+	arena->last = offset;
+	arena->used = offset + align_up(sizeof(ArenaHeader)) + data_size;
+	if (arena->used > arena->peak) arena->peak = arena->used;
+	return arena->memory + offset + align_up(sizeof(ArenaHeader));
+}
+
+void* arena_calloc(Arena *arena, size_t count, size_t size) {
+	if (!arena) return calloc(count, size);
+	if (size != 0 && count > (size_t) -1 / size) {
+		arena->failed = 1;
+		return NULL;
+	}
+	void *ptr = arena_malloc(arena, count * size);
+	if (ptr) memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void* arena_realloc(Arena *arena, void *ptr, size_t size) {
+	if (!arena) return realloc(ptr, size);
+	if (!ptr) return arena_malloc(arena, size);
+	size_t offset = header_offset(arena, ptr);
+	ArenaHeader *header = header_at(arena, offset);
+	size_t data_size = align_up(size);
+	if (data_size <= header->size && offset != arena->last) return ptr;
+
+	// The most recent block grows or shrinks in place
+	if (offset == arena->last && data_size >= size &&
+	    arena->size - offset - align_up(sizeof(ArenaHeader)) >= data_size) {
+		header->size = data_size;
+		arena->used = offset + align_up(sizeof(ArenaHeader)) + data_size;
+		if (arena->used > arena->peak) arena->peak = arena->used;
+		return ptr;
+	}
+
+	void *moved = arena_malloc(arena, size);
+	if (moved) {
+		memcpy(moved, ptr, header->size < size ? header->size : size);
+		arena_free(arena, ptr);
+	}
+	return moved;
+}
+
+void arena_free(Arena *arena, void *ptr) {
+	if (!arena) {
+		free(ptr);
+		return;
+	}
+	if (!ptr) return;
+	size_t offset = header_offset(arena, ptr);
+	header_at(arena, offset)->size |= ARENA_FREED;
+	while (arena->last != ARENA_NONE && (header_at(arena, arena->last)->size & ARENA_FREED)) {
+		arena->used = arena->last;
+		arena->last = header_at(arena, arena->last)->prev;
+	}
+}
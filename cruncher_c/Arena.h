@@ -0,0 +1,51 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Arena allocator for the work memory of a crunch.
+
+An arena hands out memory from a single region provided by the caller, so
+the cruncher can run without touching the heap. Allocations are carved off
+the end of the used part of the region. The most recent allocation can grow
+or shrink in place. A freed block is reclaimed once every block allocated
+after it has been freed as well, and resetting the arena reclaims everything
+in constant time.
+
+All the allocation functions take a possibly NULL arena. With no arena, they
+use malloc, calloc, realloc and free as usual.
+
+An arena is not thread safe. The cruncher only allocates from the thread
+which called packData.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+	unsigned char *memory;
+	size_t size;
+	size_t used;
+	// Offset of the header of the most recent live block, or ARENA_NONE
+	size_t last;
+	// Largest amount of memory used since the last reset
+	size_t peak;
+	// Set if an allocation did not fit
+	int failed;
+} Arena;
+
+#define ARENA_NONE ((size_t) -1)
+
+// Overhead of each allocation, including alignment
+#define ARENA_BLOCK_OVERHEAD 32
+
+// Use the given region for allocations
+void arena_init(Arena *arena, void *memory, size_t size);
+// Release all allocations at once
+void arena_reset(Arena *arena);
+
+void* arena_malloc(Arena *arena, size_t size);
+void* arena_calloc(Arena *arena, size_t count, size_t size);
+void* arena_realloc(Arena *arena, void *ptr, size_t size);
+void arena_free(Arena *arena, void *ptr);
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "BucketQueue.h"
+#include "Coder.h"
+
+#define WINDOW_MASK (BUCKET_QUEUE_WINDOW_SIZE - 1)
+
+static int edge_key(RefEdge *edge) {
+    return edge->total_size >> BIT_PRECISION;
+}
+
+static void list_add(Arena *arena, EdgeList *list, RefEdge *edge) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity * 2 + 4;
+        list->data = arena_realloc(arena, list->data, list->capacity * sizeof(RefEdge*));
+        assert(list->data);
+    }
+    edge->_heap_index = list->size;
+    list->data[list->size++] = edge;
+}
+
+static RefEdge* list_remove_index(EdgeList *list, int index) {
+    RefEdge *removed = list->data[index];
+    list->size--;
+    if (index < list->size) {
+        list->data[index] = list->data[list->size];
+        list->data[index]->_heap_index = index;
+    }
+    removed->_heap_index = -1; // Mark as removed
+    return removed;
+}
+
+static EdgeList* container(BucketQueue *queue, int key) {
+    return key >= queue->base ? &queue->buckets[key & WINDOW_MASK] : &queue->below;
+}
+
+// Move the window up to end at new_top. Buckets falling out of the window
+// are moved to the list below it.
+static void slide(BucketQueue *queue, int new_top) {
+    int new_base = new_top - BUCKET_QUEUE_WINDOW_SIZE + 1;
+    for (int k = queue->base; k < new_base && k <= queue->top; k++) {
+        EdgeList *bucket = &queue->buckets[k & WINDOW_MASK];
+        for (int i = 0; i < bucket->size; i++) {
+            list_add(queue->arena, &queue->below, bucket->data[i]);
+        }
+        queue->window_count -= bucket->size;
+        bucket->size = 0;
+    }
+    queue->base = new_base;
+}
+
+// Move the empty window down to end at the largest key below it
+static void refill(BucketQueue *queue) {
+    EdgeList *below = &queue->below;
+    int max_key = edge_key(below->data[0]);
+    for (int i = 1; i < below->size; i++) {
+        int key = edge_key(below->data[i]);
+        if (key > max_key) max_key = key;
+    }
+    queue->base = max_key - BUCKET_QUEUE_WINDOW_SIZE + 1;
+    queue->top = max_key;
+    int i = 0;
+    while (i < below->size) {
+        int key = edge_key(below->data[i]);
+        if (key >= queue->base) {
+            list_add(queue->arena, &queue->buckets[key & WINDOW_MASK], list_remove_index(below, i));
+            queue->window_count++;
+        } else {
+            i++;
+        }
+    }
+}
+
+BucketQueue* bucketqueue_new(Arena *arena) {
+    BucketQueue *queue = arena_malloc(arena, sizeof(BucketQueue));
+    if (!queue) return NULL;
+
+    queue->buckets = arena_calloc(arena, BUCKET_QUEUE_WINDOW_SIZE, sizeof(EdgeList));
+    if (!queue->buckets) {
+        arena_free(arena, queue);
+        return NULL;
+    }
+
+    queue->below.data = NULL;
+    queue->below.size = 0;
+    queue->below.capacity = 0;
+    queue->base = 0;
+    queue->top = 0;
+    queue->window_count = 0;
+    queue->arena = arena;
+
+    return queue;
+}
+
+void bucketqueue_free(BucketQueue *queue) {
+    if (queue) {
+        for (int i = 0; i < BUCKET_QUEUE_WINDOW_SIZE; i++) {
+            arena_free(queue->arena, queue->buckets[i].data);
+        }
+        arena_free(queue->arena, queue->buckets);
+        arena_free(queue->arena, queue->below.data);
+        arena_free(queue->arena, queue);
+    }
+}
+
+void bucketqueue_insert(BucketQueue *queue, RefEdge *edge) {
+    int key = edge_key(edge);
+    if (bucketqueue_empty(queue)) {
+        queue->base = key - BUCKET_QUEUE_WINDOW_SIZE / 2;
+        queue->top = key;
+    }
+    if (key >= queue->base + BUCKET_QUEUE_WINDOW_SIZE) {
+        slide(queue, key);
+    }
+    if (key >= queue->base) {
+        list_add(queue->arena, &queue->buckets[key & WINDOW_MASK], edge);
+        queue->window_count++;
+        if (key > queue->top) queue->top = key;
+    } else {
+        list_add(queue->arena, &queue->below, edge);
+    }
+}
+
+RefEdge* bucketqueue_remove_largest(BucketQueue *queue) {
+    if (bucketqueue_empty(queue)) return NULL;
+
+    if (queue->window_count == 0) refill(queue);
+    while (queue->buckets[queue->top & WINDOW_MASK].size == 0) {
+        queue->top--;
+    }
+    EdgeList *bucket = &queue->buckets[queue->top & WINDOW_MASK];
+    queue->window_count--;
+    return list_remove_index(bucket, bucket->size - 1);
+}
+
+RefEdge* bucketqueue_remove(BucketQueue *queue, RefEdge *edge) {
+    if (!bucketqueue_contains(queue, edge)) {
+        return NULL; // Edge not found
+    }
+
+    int key = edge_key(edge);
+    if (key >= queue->base) queue->window_count--;
+    return list_remove_index(container(queue, key), edge->_heap_index);
+}
+
+int bucketqueue_contains(BucketQueue *queue, RefEdge *edge) {
+    EdgeList *list = container(queue, edge_key(edge));
+    if (edge->_heap_index < 0 || edge->_heap_index >= list->size) {
+        return 0;
+    }
+    return list->data[edge->_heap_index] == edge;
+}
+
+int bucketqueue_empty(BucketQueue *queue) {
+    return queue->window_count == 0 && queue->below.size == 0;
+}
+
+void bucketqueue_clear(BucketQueue *queue) {
+    if (queue->window_count > 0) {
+        int k = queue->top - BUCKET_QUEUE_WINDOW_SIZE + 1;
+        if (k < queue->base) k = queue->base;
+        for (; k <= queue->top; k++) {
+            queue->buckets[k & WINDOW_MASK].size = 0;
+        }
+    }
+    queue->below.size = 0;
+    queue->window_count = 0;
+}
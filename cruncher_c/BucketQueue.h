@@ -0,0 +1,41 @@
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include "Arena.h"
+#include "RefEdge.h"
+
+// Bucket-based priority queue of edges by whole bits of total size, with the
+// same operations as Heap. Used in place of Heap when built with
+// SHRINKLER_BUCKET_QUEUE. Insertion and removal take constant time, and the
+// largest edge is taken from the highest nonempty bucket. The buckets cover
+// a window of sizes which moves up with the largest edge inserted, and edges
+// below the window are kept in a single unordered list.
+
+#define BUCKET_QUEUE_WINDOW_SIZE (1 << 12)
+
+typedef struct EdgeList {
+    RefEdge **data;
+    int size;
+    int capacity;
+} EdgeList;
+
+typedef struct BucketQueue {
+    EdgeList *buckets;     // Ring indexed by key modulo the window size
+    EdgeList below;
+    int base;              // Lowest key in the window
+    int top;               // Highest key with a nonempty bucket, or higher
+    int window_count;
+    Arena *arena;
+} BucketQueue;
+
+// Function declarations
+BucketQueue* bucketqueue_new(Arena *arena);
+void bucketqueue_free(BucketQueue *queue);
+void bucketqueue_insert(BucketQueue *queue, RefEdge *edge);
+RefEdge* bucketqueue_remove_largest(BucketQueue *queue);
+RefEdge* bucketqueue_remove(BucketQueue *queue, RefEdge *edge);
+int bucketqueue_contains(BucketQueue *queue, RefEdge *edge);
+int bucketqueue_empty(BucketQueue *queue);
+void bucketqueue_clear(BucketQueue *queue);
+
+#endif // BUCKET_QUEUE_H
@@ -11,8 +11,8 @@ Abstract interface for entropy coding.
 #include <string.h>
 #include "Coder.h"
 
-Coder* coder_new(void) {
-	Coder *coder = malloc(sizeof(Coder));
+Coder* coder_new(Arena *arena) {
+	Coder *coder = arena_malloc(arena, sizeof(Coder));
 	if (!coder) return NULL;
 	
 	coder->cacheable = 0;
@@ -21,6 +21,7 @@ Coder* coder_new(void) {
 	coder->n_number_contexts = 0;
 	coder->cache = NULL;
 	coder->cache_sizes = NULL;
+	coder->arena = arena;
 	coder->code = NULL; // Virtual function - must be set by derived class
 	
 	return coder;
@@ -30,12 +31,12 @@ void coder_free(Coder *coder) {
 	if (coder) {
 		if (coder->cache) {
 			for (int i = 0; i < coder->n_number_contexts; i++) {
-				free(coder->cache[i]);
+				arena_free(coder->arena, coder->cache[i]);
 			}
-			free(coder->cache);
+			arena_free(coder->arena, coder->cache);
 		}
-		free(coder->cache_sizes);
-		free(coder);
+		arena_free(coder->arena, coder->cache_sizes);
+		arena_free(coder->arena, coder);
 	}
 }
 
@@ -85,18 +86,18 @@ void coder_set_number_contexts(Coder *coder, int number_context_offset, int n_nu
 	// Free existing cache
 	if (coder->cache) {
 		for (int i = 0; i < coder->n_number_contexts; i++) {
-			free(coder->cache[i]);
+			arena_free(coder->arena, coder->cache[i]);
 		}
-		free(coder->cache);
+		arena_free(coder->arena, coder->cache);
 	}
-	free(coder->cache_sizes);
+	arena_free(coder->arena, coder->cache_sizes);
 	
 	// Allocate new cache
-	coder->cache = malloc(n_number_contexts * sizeof(unsigned short*));
-	coder->cache_sizes = malloc(n_number_contexts * sizeof(int));
+	coder->cache = arena_malloc(coder->arena, n_number_contexts * sizeof(unsigned short*));
+	coder->cache_sizes = arena_malloc(coder->arena, n_number_contexts * sizeof(int));
 	if (!coder->cache || !coder->cache_sizes) {
-		free(coder->cache);
-		free(coder->cache_sizes);
+		arena_free(coder->arena, coder->cache);
+		arena_free(coder->arena, coder->cache_sizes);
 		coder->cache = NULL;
 		coder->cache_sizes = NULL;
 		return;
@@ -104,7 +105,7 @@ void coder_set_number_contexts(Coder *coder, int number_context_offset, int n_nu
 	
 	for (int context_index = 0 ; context_index < n_number_contexts ; context_index++) {
 		int base_context = number_context_offset + (context_index << 8);
-		coder->cache[context_index] = malloc(4 * sizeof(unsigned short));
+		coder->cache[context_index] = arena_malloc(coder->arena, 4 * sizeof(unsigned short));
 		coder->cache_sizes[context_index] = 4;
 		
 		unsigned short *c = coder->cache[context_index];
@@ -122,7 +123,7 @@ void coder_set_number_contexts(Coder *coder, int number_context_offset, int n_nu
 			int new_size = base + (1 << data_bits);
 			if (new_size > max_number) new_size = max_number;
 			
-			unsigned short *new_cache = realloc(coder->cache[context_index], new_size * sizeof(unsigned short));
+			unsigned short *new_cache = arena_realloc(coder->arena, coder->cache[context_index], new_size * sizeof(unsigned short));
 			if (!new_cache) break;
 			coder->cache[context_index] = new_cache;
 			c = new_cache;
@@ -10,6 +10,7 @@ Abstract interface for entropy coding.
 
 #include "assert.h"
 #include <stdlib.h>
+#include "Arena.h"
 
 // Number of fractional bits in the bit sizes returned by coding functions.
 #define BIT_PRECISION 6
@@ -21,6 +22,8 @@ typedef struct Coder {
 	int n_number_contexts;
 	unsigned short **cache;
 	int *cache_sizes;
+	// Arena holding the coder and its cache, or NULL for the heap
+	Arena *arena;
 	
 	// Virtual function pointer
 	int (*code)(void *self, int context, int bit);
@@ -38,5 +41,5 @@ int coder_encode_number(Coder *coder, int base_context, int number);
 void coder_set_number_contexts(Coder *coder, int number_context_offset, int n_number_contexts, int max_number);
 
 // Constructor and destructor
-Coder* coder_new(void);
+Coder* coder_new(Arena *arena);
 void coder_free(Coder *coder);
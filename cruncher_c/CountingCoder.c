@@ -18,13 +18,13 @@ static int countingcoder_code(void *self, int context, int bit) {
 	return 0; // Counting coder doesn't actually encode
 }
 
-CountingCoder* countingcoder_new(int num_contexts) {
-	CountingCoder *coder = malloc(sizeof(CountingCoder));
+CountingCoder* countingcoder_new(int num_contexts, Arena *arena) {
+	CountingCoder *coder = arena_malloc(arena, sizeof(CountingCoder));
 	if (!coder) return NULL;
 	
-	coder->context_counts = calloc(num_contexts, sizeof(ContextCounts));
+	coder->context_counts = arena_calloc(arena, num_contexts, sizeof(ContextCounts));
 	if (!coder->context_counts) {
-		free(coder);
+		arena_free(arena, coder);
 		return NULL;
 	}
 	
@@ -34,14 +34,15 @@ CountingCoder* countingcoder_new(int num_contexts) {
 	coder->base.has_cache = 0;
 	coder->base.cache = NULL;
 	coder->base.cache_sizes = NULL;
+	coder->base.arena = arena;
 	
 	return coder;
 }
 
 void countingcoder_free(CountingCoder *coder) {
 	if (coder) {
-		free(coder->context_counts);
-		free(coder);
+		arena_free(coder->base.arena, coder->context_counts);
+		arena_free(coder->base.arena, coder);
 	}
 }
 
@@ -56,7 +57,7 @@ CountingCoder* countingcoder_merge(CountingCoder *old_coder, CountingCoder *new_
 		return NULL;
 	}
 	
-	CountingCoder *merged = countingcoder_new(old_coder->num_contexts);
+	CountingCoder *merged = countingcoder_new(old_coder->num_contexts, old_coder->base.arena);
 	if (!merged) return NULL;
 	
 	// Merge counts using weighted average (75% old + 25% new) like C++ version
@@ -21,7 +21,7 @@ typedef struct {
 } CountingCoder;
 
 // Function declarations
-CountingCoder* countingcoder_new(int num_contexts);
+CountingCoder* countingcoder_new(int num_contexts, Arena *arena);
 void countingcoder_free(CountingCoder *coder);
 void countingcoder_reset(CountingCoder *coder);
 CountingCoder* countingcoder_merge(CountingCoder *old_coder, CountingCoder *new_coder);
@@ -24,7 +24,7 @@ static int get_array_size(int hash_shift) {
 // Initialize array with unused entries
 static void init_array(CuckooHash *hash) {
     int size = get_array_size(hash->hash_shift);
-    hash->data = malloc(size * sizeof(CuckooHashEntry));
+    hash->data = arena_malloc(hash->arena, size * sizeof(CuckooHashEntry));
     if (!hash->data) return;
     
     for (int i = 0; i < size; i++) {
@@ -53,7 +53,7 @@ static void rehash(CuckooHash *hash) {
         }
     }
     
-    free(old_data);
+    arena_free(hash->arena, old_data);
 }
 
 // Insert with cuckoo hashing (same as C++ version)
@@ -85,26 +85,34 @@ static void cuckoo_insert(CuckooHash *hash, unsigned int hash_val, int key, RefE
     hash->size++;
 }
 
-CuckooHash* cuckoohash_new(int capacity) {
-    CuckooHash *hash = malloc(sizeof(CuckooHash));
-    if (!hash) return NULL;
-    
-    // Optimization: Initialize with a larger size to reduce reallocations
-    int initial_size_log = INITIAL_SIZE_LOG;
+// Optimization: Initialize with a larger size to reduce reallocations
+static int initial_size_log(int capacity) {
+    int size_log = INITIAL_SIZE_LOG;
     if (capacity > 0) {
         // Calculate a more appropriate initial size based on the requested capacity
-        while ((1 << initial_size_log) < capacity * 2) {
-            initial_size_log++;
+        while ((1 << size_log) < capacity * 2) {
+            size_log++;
         }
     }
+    return size_log;
+}
+
+size_t cuckoohash_memory(int capacity) {
+    return sizeof(CuckooHash) + ((size_t) sizeof(CuckooHashEntry) << initial_size_log(capacity)) + 2 * ARENA_BLOCK_OVERHEAD;
+}
+
+CuckooHash* cuckoohash_new(int capacity, Arena *arena) {
+    CuckooHash *hash = arena_malloc(arena, sizeof(CuckooHash));
+    if (!hash) return NULL;
     
-    hash->hash_shift = sizeof(unsigned int) * 8 - initial_size_log;
+    hash->hash_shift = sizeof(unsigned int) * 8 - initial_size_log(capacity);
     hash->size = 0;
     hash->data = NULL;
+    hash->arena = arena;
     
     init_array(hash);
     if (!hash->data) {
-        free(hash);
+        arena_free(arena, hash);
         return NULL;
     }
     
@@ -113,8 +121,8 @@ CuckooHash* cuckoohash_new(int capacity) {
 
 void cuckoohash_free(CuckooHash *hash) {
     if (hash) {
-        free(hash->data);
-        free(hash);
+        arena_free(hash->arena, hash->data);
+        arena_free(hash->arena, hash);
     }
 }
 
@@ -1,6 +1,7 @@
 #ifndef CUCKOO_HASH_H
 #define CUCKOO_HASH_H
 
+#include "Arena.h"
 #include "RefEdge.h"
 
 // Special value to mark unused entries
@@ -16,11 +17,14 @@ typedef struct CuckooHash {
     int size;
     int capacity;
     int hash_shift;  // For power-of-2 sizing
+    Arena *arena;
 } CuckooHash;
 
 // Function declarations
-CuckooHash* cuckoohash_new(int capacity);
+CuckooHash* cuckoohash_new(int capacity, Arena *arena);
 void cuckoohash_free(CuckooHash *hash);
+// Memory taken in an arena by a new table of the given capacity
+size_t cuckoohash_memory(int capacity);
 void cuckoohash_clear(CuckooHash *hash);
 void cuckoohash_insert(CuckooHash *hash, int key, RefEdge *value);
 RefEdge* cuckoohash_get(CuckooHash *hash, int key);
@@ -10,6 +10,7 @@ Operations on raw data files, including loading, crunching and saving.
 #include <stdlib.h>
 #include <string.h>
 #include "DataFile.h"
+#include "MappedFile.h"
 
 DataFile* datafile_new(void) {
 	DataFile *file = malloc(sizeof(DataFile));
@@ -17,6 +18,7 @@ DataFile* datafile_new(void) {
 	
 	file->data = NULL;
 	file->data_size = 0;
+	file->mapped_size = 0;
 	memset(&file->header, 0, sizeof(DataHeader));
 	
 	return file;
@@ -24,12 +26,25 @@ DataFile* datafile_new(void) {
 
 void datafile_free(DataFile *file) {
 	if (file) {
-		free(file->data);
+		if (file->mapped_size) {
+			mapped_file_unmap(file->data, file->mapped_size);
+		} else {
+			free(file->data);
+		}
 		free(file);
 	}
 }
 
 void datafile_load(DataFile *file, const char *filename) {
+	size_t mapped_size;
+	unsigned char *mapped = mapped_file_map(filename, &mapped_size);
+	if (mapped) {
+		file->data = mapped;
+		file->data_size = mapped_size;
+		file->mapped_size = mapped_size;
+		return;
+	}
+
 	FILE *f = fopen(filename, "rb");
 	if (!f) {
 		printf("Error while reading file %s\n\n", filename);
@@ -95,7 +110,7 @@ DataFile* datafile_crunch(DataFile *file, PackParams *params, RefEdgeFactory *ed
 	int output_size = 0;
 	
 	// Create range coder for output
-	RangeCoder *range_coder = rangecoder_new(NUM_CONTEXTS + 256, &output_buffer, &output_size);
+	RangeCoder *range_coder = rangecoder_new(NUM_CONTEXTS + 256, &output_buffer, &output_size, NULL);
 	if (!range_coder) {
 		fprintf(stderr, "Failed to create range coder\n");
 		return NULL;
@@ -33,6 +33,7 @@ typedef struct {
 	DataHeader header;
 	unsigned char *data;
 	int data_size;
+	size_t mapped_size; // Nonzero if data is a mapping of the loaded file
 } DataFile;
 
 // Constructor and destructor
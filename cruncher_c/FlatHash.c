@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include "FlatHash.h"
+
+// Hash multiplier (same as C++ version)
+#define HASH_MUL 0x9E3779B1
+#define EMPTY_SLOT (-1)
+
+static int table_mask(FlatHash *hash) {
+    return (1 << (sizeof(unsigned int) * 8 - hash->hash_shift)) - 1;
+}
+
+static int home(FlatHash *hash, int key) {
+    return (int)(((unsigned int)key * HASH_MUL) >> hash->hash_shift);
+}
+
+// Slot holding the key, or the empty slot where it would go
+static int probe(FlatHash *hash, int key) {
+    int mask = table_mask(hash);
+    int s = home(hash, key);
+    while (hash->table[s].index != EMPTY_SLOT && hash->table[s].key != key) {
+        s = (s + 1) & mask;
+    }
+    return s;
+}
+
+// Keep the table at most half full
+static int table_size_log(int capacity) {
+    int size_log = 4;
+    while ((1 << size_log) < capacity * 2) {
+        size_log++;
+    }
+    return size_log;
+}
+
+static int alloc_arrays(FlatHash *hash, int capacity) {
+    int size_log = table_size_log(capacity);
+    hash->table = arena_malloc(hash->arena, ((size_t)1 << size_log) * sizeof(FlatHashSlot));
+    hash->entries = arena_malloc(hash->arena, (size_t)capacity * sizeof(FlatHashEntry));
+    hash->entry_slot = arena_malloc(hash->arena, (size_t)capacity * sizeof(int));
+    if (!hash->table || !hash->entries || !hash->entry_slot) return 0;
+    hash->capacity = capacity;
+    hash->hash_shift = sizeof(unsigned int) * 8 - size_log;
+    for (int s = 0; s < (1 << size_log); s++) {
+        hash->table[s].index = EMPTY_SLOT;
+    }
+    return 1;
+}
+
+static void free_arrays(FlatHash *hash) {
+    arena_free(hash->arena, hash->entry_slot);
+    arena_free(hash->arena, hash->entries);
+    arena_free(hash->arena, hash->table);
+}
+
+static void place(FlatHash *hash, int key, int index) {
+    int s = probe(hash, key);
+    hash->table[s].key = key;
+    hash->table[s].index = index;
+    hash->entry_slot[index] = s;
+}
+
+// Double the capacity, moving the entries over
+static int grow(FlatHash *hash) {
+    FlatHash old = *hash;
+    if (!alloc_arrays(hash, old.capacity * 2)) {
+        free_arrays(hash);
+        *hash = old;
+        return 0;
+    }
+    for (int i = 0; i < old.size; i++) {
+        hash->entries[i] = old.entries[i];
+        place(hash, old.entries[i].key, i);
+    }
+    free_arrays(&old);
+    return 1;
+}
+
+// Empty the slot and move later keys of the probe sequence back into it
+static void remove_slot(FlatHash *hash, int hole) {
+    int mask = table_mask(hash);
+    int s = hole;
+    while (1) {
+        s = (s + 1) & mask;
+        if (hash->table[s].index == EMPTY_SLOT) break;
+        int h = home(hash, hash->table[s].key);
+        // Keys whose home lies cyclically in (hole, s] stay put
+        if (((s - h) & mask) < ((s - hole) & mask)) continue;
+        hash->table[hole] = hash->table[s];
+        hash->entry_slot[hash->table[hole].index] = hole;
+        hole = s;
+    }
+    hash->table[hole].index = EMPTY_SLOT;
+}
+
+size_t flathash_memory(int capacity) {
+    return sizeof(FlatHash) + ((size_t)sizeof(FlatHashSlot) << table_size_log(capacity)) +
+           (size_t)capacity * (sizeof(FlatHashEntry) + sizeof(int)) + 4 * ARENA_BLOCK_OVERHEAD;
+}
+
+FlatHash* flathash_new(int capacity, Arena *arena) {
+    FlatHash *hash = arena_malloc(arena, sizeof(FlatHash));
+    if (!hash) return NULL;
+
+    hash->size = 0;
+    hash->arena = arena;
+    if (!alloc_arrays(hash, capacity > 0 ? capacity : 1)) {
+        free_arrays(hash);
+        arena_free(arena, hash);
+        return NULL;
+    }
+
+    return hash;
+}
+
+void flathash_free(FlatHash *hash) {
+    if (hash) {
+        free_arrays(hash);
+        arena_free(hash->arena, hash);
+    }
+}
+
+void flathash_clear(FlatHash *hash) {
+    for (int i = 0; i < hash->size; i++) {
+        hash->table[hash->entry_slot[i]].index = EMPTY_SLOT;
+    }
+    hash->size = 0;
+}
+
+RefEdge* flathash_get(FlatHash *hash, int key) {
+    int index = hash->table[probe(hash, key)].index;
+    return index != EMPTY_SLOT ? hash->entries[index].value : NULL;
+}
+
+RefEdge** flathash_find_or_insert(FlatHash *hash, int key) {
+    int s = probe(hash, key);
+    if (hash->table[s].index != EMPTY_SLOT) return &hash->entries[hash->table[s].index].value;
+
+    if (hash->size == hash->capacity) {
+        if (!grow(hash)) return NULL;
+        s = probe(hash, key);
+    }
+    int index = hash->size++;
+    hash->table[s].key = key;
+    hash->table[s].index = index;
+    hash->entry_slot[index] = s;
+    hash->entries[index].key = key;
+    hash->entries[index].value = NULL;
+    return &hash->entries[index].value;
+}
+
+int flathash_erase(FlatHash *hash, int key) {
+    int s = probe(hash, key);
+    int index = hash->table[s].index;
+    if (index == EMPTY_SLOT) return 0;
+
+    remove_slot(hash, s);
+    int last = --hash->size;
+    if (index != last) {
+        hash->entries[index] = hash->entries[last];
+        hash->entry_slot[index] = hash->entry_slot[last];
+        hash->table[hash->entry_slot[index]].index = index;
+    }
+    return 1;
+}
+
+int flathash_empty(FlatHash *hash) {
+    return hash->size == 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FLAT_HASH_H
+#define FLAT_HASH_H
+
+#include "Arena.h"
+#include "RefEdge.h"
+
+/*
+
+Flat hash map from offsets to edges, as in the C++ cruncher (see
+cruncher/FlatHash.h). The entries live in a dense array, so iterating over
+the map and clearing it take time proportional to the number of entries
+rather than the size of the table.
+
+*/
+
+typedef struct FlatHashEntry {
+    int key;
+    RefEdge *value;
+} FlatHashEntry;
+
+typedef struct FlatHashSlot {
+    int key;
+    int index;      // Index of the entry, or -1 if the slot is empty
+} FlatHashSlot;
+
+typedef struct FlatHash {
+    FlatHashEntry *entries;
+    int *entry_slot;     // For each entry, the slot referring to it
+    int size;
+    int capacity;        // Entries which fit before the table grows
+    FlatHashSlot *table;
+    int hash_shift;
+    Arena *arena;
+} FlatHash;
+
+// Function declarations
+FlatHash* flathash_new(int capacity, Arena *arena);
+void flathash_free(FlatHash *hash);
+// Memory taken in an arena by a new map of the given capacity
+size_t flathash_memory(int capacity);
+void flathash_clear(FlatHash *hash);
+// Value for the key, or NULL if absent
+RefEdge* flathash_get(FlatHash *hash, int key);
+// Slot for the value of the key, inserting NULL if absent. Hashes the key
+// once. Returns NULL if memory ran out.
+RefEdge** flathash_find_or_insert(FlatHash *hash, int key);
+// Returns whether the key was present
+int flathash_erase(FlatHash *hash, int key);
+int flathash_empty(FlatHash *hash);
+
+// The entries in no particular order, valid until the map is changed
+#define flathash_size(hash) ((hash)->size)
+#define flathash_value(hash, i) ((hash)->entries[i].value)
+
+#endif // FLAT_HASH_H
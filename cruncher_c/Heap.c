@@ -2,26 +2,27 @@
 #include <assert.h>
 #include "Heap.h"
 
-Heap* heap_new(int capacity) {
-    Heap *heap = malloc(sizeof(Heap));
+Heap* heap_new(int capacity, Arena *arena) {
+    Heap *heap = arena_malloc(arena, sizeof(Heap));
     if (!heap) return NULL;
     
-    heap->data = malloc(capacity * sizeof(RefEdge*));
+    heap->data = arena_malloc(arena, capacity * sizeof(RefEdge*));
     if (!heap->data) {
-        free(heap);
+        arena_free(arena, heap);
         return NULL;
     }
     
     heap->size = 0;
     heap->capacity = capacity;
+    heap->arena = arena;
     
     return heap;
 }
 
 void heap_free(Heap *heap) {
     if (heap) {
-        free(heap->data);
-        free(heap);
+        arena_free(heap->arena, heap->data);
+        arena_free(heap->arena, heap);
     }
 }
 
@@ -1,16 +1,18 @@
 #ifndef HEAP_H
 #define HEAP_H
 
+#include "Arena.h"
 #include "RefEdge.h"
 
 typedef struct Heap {
     RefEdge **data;
     int size;
     int capacity;
+    Arena *arena;
 } Heap;
 
 // Function declarations
-Heap* heap_new(int capacity);
+Heap* heap_new(int capacity, Arena *arena);
 void heap_free(Heap *heap);
 void heap_insert(Heap *heap, RefEdge *edge);
 RefEdge* heap_remove_largest(Heap *heap);
@@ -11,6 +11,7 @@ hunk merging, crunching and saving.
 #include <stdlib.h>
 #include <string.h>
 #include "HunkFile.h"
+#include "MappedFile.h"
 
 const char *hunktype[] = {
 	"UNIT","NAME","CODE","DATA","BSS ","RELOC32","RELOC16","RELOC8",
@@ -25,6 +26,7 @@ HunkFile* hunkfile_new(void) {
 	
 	file->data = NULL;
 	file->data_size = 0;
+	file->mapped_size = 0;
 	file->hunks = NULL;
 	file->hunks_size = 0;
 	file->relocshort_total_size = 0;
@@ -34,13 +36,30 @@ HunkFile* hunkfile_new(void) {
 
 void hunkfile_free(HunkFile *file) {
 	if (file) {
-		free(file->data);
+		if (file->mapped_size) {
+			mapped_file_unmap((unsigned char *) file->data, file->mapped_size);
+		} else {
+			free(file->data);
+		}
 		free(file->hunks);
 		free(file);
 	}
 }
 
 void hunkfile_load(HunkFile *file, const char *filename) {
+	size_t mapped_size;
+	unsigned char *mapped = mapped_file_map(filename, &mapped_size);
+	if (mapped) {
+		file->data = (Longword *) mapped;
+		file->data_size = mapped_size / 4;
+		file->mapped_size = mapped_size;
+		if (mapped_size & 3) {
+			printf("File %s has an illegal size!\n\n", filename);
+			exit(1);
+		}
+		return;
+	}
+
 	FILE *f = fopen(filename, "rb");
 	if (!f) {
 		printf("Error while reading file %s\n\n", filename);
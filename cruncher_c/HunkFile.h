@@ -33,6 +33,7 @@ typedef struct {
 typedef struct {
 	Longword *data;
 	int data_size;
+	size_t mapped_size; // Nonzero if data is a mapping of the loaded file
 	HunkInfo *hunks;
 	int hunks_size;
 	int relocshort_total_size;
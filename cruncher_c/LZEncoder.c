@@ -10,20 +10,21 @@ The LZ encoder defines the encoding of LZ symbols (literal bytes and references)
 #include <stdlib.h>
 #include "LZEncoder.h"
 
-LZEncoder* lzencoder_new(Coder *coder, int parity_context) {
-	LZEncoder *encoder = malloc(sizeof(LZEncoder));
+LZEncoder* lzencoder_new(Coder *coder, int parity_context, Arena *arena) {
+	LZEncoder *encoder = arena_malloc(arena, sizeof(LZEncoder));
 	if (!encoder) return NULL;
 	
 	encoder->coder = coder;
 	encoder->parity_mask = parity_context ? 1 : 0;
 	encoder->trace_file = NULL;  // Initialize trace file to NULL
+	encoder->arena = arena;
 	
 	return encoder;
 }
 
 void lzencoder_free(LZEncoder *encoder) {
 	if (encoder) {
-		free(encoder);
+		arena_free(encoder->arena, encoder);
 	}
 }
 
@@ -61,7 +62,7 @@ int lzencoder_encode_literal(LZEncoder *encoder, unsigned char value, const LZSt
 		int bit_size = coder_code(encoder->coder, actual_context, bit);
 		
 		// Add detailed function call tracing
-		if (encoder->trace_file && (parity_offset | context) == 257) {
+		if (TRACING(encoder->trace_file) && (parity_offset | context) == 257) {
 			fprintf(encoder->trace_file, 
 				"LZENCODER: FUNCTION_CALL context=0x%04x actual_context=%d bit=%d\n",
 				parity_offset | context, actual_context, bit);
@@ -70,14 +71,14 @@ int lzencoder_encode_literal(LZEncoder *encoder, unsigned char value, const LZSt
 		lzencoder_trace_decision(encoder, "LITERAL_BIT", state_before->parity, parity_offset | context, bit, bit_size);
 		
 		// Add detailed context tracing
-		if (encoder->trace_file && (parity_offset | context) == 257) {
+		if (TRACING(encoder->trace_file) && (parity_offset | context) == 257) {
 			fprintf(encoder->trace_file, 
 				"LZENCODER: CONTEXT_DETAIL pos=%d value=%d bit_pos=%d context=0x%04x actual_context=%d bit=%d\n",
 				state_before->parity, value, i, parity_offset | context, 1 + (parity_offset | context), bit);
 		}
 		
 		// Add detailed bit extraction tracing
-		if (encoder->trace_file && (parity_offset | context) == 257) {
+		if (TRACING(encoder->trace_file) && (parity_offset | context) == 257) {
 			unsigned char value_uchar = value;
 			int bit_extracted = ((value_uchar >> i) & 1);
 			fprintf(encoder->trace_file, 
@@ -171,7 +172,7 @@ void lzencoder_set_trace(LZEncoder *encoder, FILE *trace_file) {
 }
 
 void lzencoder_trace_state(LZEncoder *encoder, const char *operation, int pos, int value, int size) {
-	if (encoder->trace_file) {
+	if (TRACING(encoder->trace_file)) {
 		fprintf(encoder->trace_file, 
 			"LZENCODER: %s pos=%d value=%d size=%d\n",
 			operation, pos, value, size);
@@ -179,7 +180,7 @@ void lzencoder_trace_state(LZEncoder *encoder, const char *operation, int pos, i
 }
 
 void lzencoder_trace_decision(LZEncoder *encoder, const char *operation, int pos, int context, int bit, int size) {
-	if (encoder->trace_file) {
+	if (TRACING(encoder->trace_file)) {
 		fprintf(encoder->trace_file, 
 			"LZENCODER: %s pos=%d context=%d bit=%d size=%d\n",
 			operation, pos, context, bit, size);
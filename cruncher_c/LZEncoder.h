@@ -9,6 +9,7 @@ LZ encoder for compression.
 #pragma once
 
 #include "Coder.h"
+#include "Trace.h"
 
 #define NUM_CONTEXTS 1025
 #define NUM_NUMBER_CONTEXTS 16
@@ -25,6 +26,7 @@ typedef struct {
 	Coder *coder;
 	int parity_mask;
 	FILE *trace_file;  // Add tracing capability
+	Arena *arena;
 } LZEncoder;
 
 // Constants
@@ -36,7 +38,7 @@ typedef struct {
 #define CONTEXT_GROUP_LENGTH 3
 
 // Function declarations
-LZEncoder* lzencoder_new(Coder *coder, int parity_context);
+LZEncoder* lzencoder_new(Coder *coder, int parity_context, Arena *arena);
 void lzencoder_free(LZEncoder *encoder);
 void lzencoder_set_initial_state(LZEncoder *encoder, LZState *state);
 void lzencoder_construct_state(LZEncoder *encoder, LZState *state, int pos, int prev_was_ref, int last_offset);
@@ -13,8 +13,29 @@ Parse a data block into LZ symbols (literal bytes and references).
 #include "LZParser.h"
 #include "LZProgress.h"
 
-LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, MatchFinder *finder, int length_margin, int skip_length, RefEdgeFactory *edge_factory) {
-	LZParser *parser = malloc(sizeof(LZParser));
+// Root edges are kept in a heap, or in a bucket queue if so configured
+#ifdef SHRINKLER_BUCKET_QUEUE
+#define root_edges_new(a)               bucketqueue_new(a)
+#define root_edges_free(q)              bucketqueue_free(q)
+#define root_edges_insert(q, e)         bucketqueue_insert(q, e)
+#define root_edges_remove(q, e)         bucketqueue_remove(q, e)
+#define root_edges_remove_largest(q)    bucketqueue_remove_largest(q)
+#define root_edges_contains(q, e)       bucketqueue_contains(q, e)
+#define root_edges_empty(q)             bucketqueue_empty(q)
+#define root_edges_clear(q)             bucketqueue_clear(q)
+#else
+#define root_edges_new(a)               heap_new(LZPARSER_ROOT_EDGES, a)
+#define root_edges_free(q)              heap_free(q)
+#define root_edges_insert(q, e)         heap_insert(q, e)
+#define root_edges_remove(q, e)         heap_remove(q, e)
+#define root_edges_remove_largest(q)    heap_remove_largest(q)
+#define root_edges_contains(q, e)       heap_contains(q, e)
+#define root_edges_empty(q)             heap_empty(q)
+#define root_edges_clear(q)             heap_clear(q)
+#endif
+
+LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, MatchFinder *finder, int length_margin, int skip_length, RefEdgeFactory *edge_factory, Arena *arena) {
+	LZParser *parser = arena_malloc(arena, sizeof(LZParser));
 	if (!parser) return NULL;
 	
 	parser->data = data;
@@ -24,52 +45,53 @@ LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, M
 	parser->length_margin = length_margin;
 	parser->skip_length = skip_length;
 	parser->edge_factory = edge_factory;
+	parser->arena = arena;
 	parser->encoder = NULL;
 	parser->trace_file = NULL;  // Initialize trace file to NULL
 	
 	// Allocate literal size array
-	parser->literal_size = malloc((data_length + 1) * sizeof(int));
+	parser->literal_size = arena_malloc(arena, (data_length + 1) * sizeof(int));
 	if (!parser->literal_size) {
-		free(parser);
+		arena_free(parser->arena, parser);
 		return NULL;
 	}
 	
 	// Initialize dynamic programming structures
-	parser->edges_to_pos = malloc((data_length + 1) * sizeof(CuckooHash*));
+	parser->edges_to_pos = arena_malloc(arena, (data_length + 1) * sizeof(CuckooHash*));
 	if (!parser->edges_to_pos) {
-		free(parser->literal_size);
-		free(parser);
+		arena_free(parser->arena, parser->literal_size);
+		arena_free(parser->arena, parser);
 		return NULL;
 	}
 	
 	for (int i = 0; i <= data_length; i++) {
-		parser->edges_to_pos[i] = cuckoohash_new(1000); // Larger capacity for each position
+		parser->edges_to_pos[i] = cuckoohash_new(LZPARSER_POSITION_EDGES, arena); // Larger capacity for each position
 		if (!parser->edges_to_pos[i]) {
 			// Clean up on failure
 			for (int j = 0; j < i; j++) {
 				cuckoohash_free(parser->edges_to_pos[j]);
 			}
-			free(parser->edges_to_pos);
-			free(parser->literal_size);
-			free(parser);
+			arena_free(parser->arena, parser->edges_to_pos);
+			arena_free(parser->arena, parser->literal_size);
+			arena_free(parser->arena, parser);
 			return NULL;
 		}
 	}
 	
 	parser->best = NULL;
-	parser->best_for_offset = cuckoohash_new(50000); // Larger capacity for best edges
-	parser->root_edges = heap_new(200000); // Increase capacity for larger files
+	parser->best_for_offset = flathash_new(LZPARSER_OFFSET_EDGES, arena); // Larger capacity for best edges
+	parser->root_edges = root_edges_new(arena);
 	
 	if (!parser->best_for_offset || !parser->root_edges) {
 		// Clean up on failure
 		for (int i = 0; i <= data_length; i++) {
 			cuckoohash_free(parser->edges_to_pos[i]);
 		}
-		free(parser->edges_to_pos);
-		free(parser->literal_size);
-		cuckoohash_free(parser->best_for_offset);
-		heap_free(parser->root_edges);
-		free(parser);
+		arena_free(parser->arena, parser->edges_to_pos);
+		arena_free(parser->arena, parser->literal_size);
+		flathash_free(parser->best_for_offset);
+		root_edges_free(parser->root_edges);
+		arena_free(parser->arena, parser);
 		return NULL;
 	}
 	
@@ -78,32 +100,32 @@ LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, M
 
 void lzparser_free(LZParser *parser) {
 	if (parser) {
-		free(parser->literal_size);
+		arena_free(parser->arena, parser->literal_size);
 		
 		if (parser->edges_to_pos) {
 			for (int i = 0; i <= parser->data_length; i++) {
 				cuckoohash_free(parser->edges_to_pos[i]);
 			}
-			free(parser->edges_to_pos);
+			arena_free(parser->arena, parser->edges_to_pos);
 		}
 		
-		cuckoohash_free(parser->best_for_offset);
-		heap_free(parser->root_edges);
-		free(parser);
+		flathash_free(parser->best_for_offset);
+		root_edges_free(parser->root_edges);
+		arena_free(parser->arena, parser);
 	}
 }
 
 static int is_root(LZParser *parser, RefEdge *edge) {
-	return heap_contains(parser->root_edges, edge);
+	return root_edges_contains(parser->root_edges, edge);
 }
 
 static void remove_root(LZParser *parser, RefEdge *edge) {
-	heap_remove(parser->root_edges, edge);
+	root_edges_remove(parser->root_edges, edge);
 }
 
 static void release_edge(LZParser *parser, RefEdge *edge, int clean) {
 	while (edge != NULL) {
-		RefEdge *source = edge->source;
+		RefEdge *source = refedgefactory_source(parser->edge_factory, edge);
 		if (--edge->refcount == 0) {
 			assert(!is_root(parser, edge));
 			refedgefactory_destroy(parser->edge_factory, edge, clean);
@@ -115,39 +137,60 @@ static void release_edge(LZParser *parser, RefEdge *edge, int clean) {
 }
 
 static int clean_worst_edge(LZParser *parser, int pos, RefEdge *exclude) {
-	if (heap_empty(parser->root_edges)) return 0;
+	if (root_edges_empty(parser->root_edges)) return 0;
 	
-	RefEdge *worst_edge = heap_remove_largest(parser->root_edges);
+	RefEdge *worst_edge = root_edges_remove_largest(parser->root_edges);
 	if (worst_edge == parser->best || worst_edge == exclude) return 1;
 	
-	CuckooHash *container = (refedge_target(worst_edge) > pos) ? 
-		parser->edges_to_pos[refedge_target(worst_edge)] : parser->best_for_offset;
-	
-	if (cuckoohash_count(container, worst_edge->offset) > 0) {
-		cuckoohash_erase(container, worst_edge->offset);
+	if (refedge_target(worst_edge) > pos) {
+		CuckooHash *container = parser->edges_to_pos[refedge_target(worst_edge)];
+		if (cuckoohash_count(container, worst_edge->offset) > 0) {
+			cuckoohash_erase(container, worst_edge->offset);
+			release_edge(parser, worst_edge, 1);
+		}
+	} else if (flathash_erase(parser->best_for_offset, worst_edge->offset)) {
 		release_edge(parser, worst_edge, 1);
 	}
 	
 	return 1;
 }
 
-static void put_by_offset(LZParser *parser, CuckooHash *by_offset, RefEdge *edge) {
+// Of the edge kept for an offset, if any, and a new edge with that offset,
+// keep the best as a root and release the other. Returns the kept edge.
+static RefEdge* keep_best(LZParser *parser, RefEdge *old_edge, RefEdge *edge) {
 	assert(!is_root(parser, edge));
 	
-	int count = cuckoohash_count(by_offset, edge->offset);
-	
-	if (count == 0) {
-		cuckoohash_insert(by_offset, edge->offset, edge);
-		heap_insert(parser->root_edges, edge);
-	} else if (edge->total_size < cuckoohash_get(by_offset, edge->offset)->total_size) {
-		RefEdge *old_edge = cuckoohash_get(by_offset, edge->offset);
+	if (old_edge == NULL) {
+		root_edges_insert(parser->root_edges, edge);
+		return edge;
+	} else if (edge->total_size < old_edge->total_size) {
 		remove_root(parser, old_edge);
 		release_edge(parser, old_edge, 0);
-		cuckoohash_insert(by_offset, edge->offset, edge);
-		heap_insert(parser->root_edges, edge);
+		root_edges_insert(parser->root_edges, edge);
+		return edge;
 	} else {
 		release_edge(parser, edge, 0);
+		return old_edge;
+	}
+}
+
+static void put_by_offset(LZParser *parser, CuckooHash *by_offset, RefEdge *edge) {
+	RefEdge *old_edge = cuckoohash_get(by_offset, edge->offset);
+	RefEdge *kept = keep_best(parser, old_edge, edge);
+	if (kept != old_edge) {
+		cuckoohash_insert(by_offset, edge->offset, kept);
+	}
+}
+
+// As put_by_offset, finding or inserting the entry with a single lookup
+static void put_best_for_offset(LZParser *parser, RefEdge *edge) {
+	RefEdge **slot = flathash_find_or_insert(parser->best_for_offset, edge->offset);
+	if (!slot) {
+		// Out of memory. Drop the edge as if a better one was known.
+		release_edge(parser, edge, 0);
+		return;
 	}
+	*slot = keep_best(parser, *slot, edge);
 }
 
 static void new_edge(LZParser *parser, RefEdge *source, int pos, int offset, int length) {
@@ -179,7 +222,7 @@ static void new_edge(LZParser *parser, RefEdge *source, int pos, int offset, int
 	lzparser_trace_decision(parser, pos, offset, length, size_before + edge_size + size_after, "NEW_EDGE");
 	
 	// Enhanced default tracing: log edge creation with source info
-	if (parser->trace_file) {
+	if (TRACING(parser->trace_file)) {
 		fprintf(parser->trace_file,
 			"LZPARSER: EDGE_CREATED pos=%d offset=%d length=%d total_cost=%d source_offset=%d source_pos=%d\n",
 			pos, offset, length, size_before + edge_size + size_after,
@@ -196,8 +239,8 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 	parser->encoder = encoder;
 	
 	// Reset state
-	cuckoohash_clear(parser->best_for_offset);
-	heap_clear(parser->root_edges);
+	flathash_clear(parser->best_for_offset);
+	root_edges_clear(parser->root_edges);
 	refedgefactory_reset(parser->edge_factory);
 	
 	// Accumulate literal sizes
@@ -218,7 +261,7 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 	
 	for (int pos = 1; pos <= parser->data_length; pos++) {
 		// Assimilate edges ending here
-		if (parser->trace_file) {
+		if (TRACING(parser->trace_file)) {
 			fprintf(parser->trace_file,
 				"LZPARSER: ASSIMILATE_START pos=%d best_offset=%d best_total=%d edges_count=%d\n",
 				pos, parser->best->offset, parser->best->total_size, parser->edges_to_pos[pos]->size);
@@ -226,7 +269,7 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 		CuckooHashIterator it = cuckoohash_begin(parser->edges_to_pos[pos]);
 		while (cuckoohash_iterator_valid(&it)) {
 			RefEdge *edge = cuckoohash_iterator_value(&it);
-			if (parser->trace_file) {
+			if (TRACING(parser->trace_file)) {
 				fprintf(parser->trace_file,
 					"LZPARSER: ASSIMILATE_EDGE pos=%d edge_offset=%d edge_total=%d best_total=%d will_update=%d\n",
 					pos, edge->offset, edge->total_size, parser->best->total_size, 
@@ -235,14 +278,14 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 			if (edge->total_size < parser->best->total_size || 
 				(edge->total_size == parser->best->total_size && edge->offset < parser->best->offset)) {
 				parser->best = edge;
-				if (parser->trace_file) {
+				if (TRACING(parser->trace_file)) {
 					fprintf(parser->trace_file,
 						"LZPARSER: BEST_UPDATED pos=%d new_best_offset=%d new_best_total=%d\n",
 						pos, parser->best->offset, parser->best->total_size);
 				}
 			}
 			remove_root(parser, edge);
-			put_by_offset(parser, parser->best_for_offset, edge);
+			put_best_for_offset(parser, edge);
 			cuckoohash_iterator_next(&it);
 		}
 		cuckoohash_clear(parser->edges_to_pos[pos]);
@@ -264,28 +307,29 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 			
 							for (int length = min_length; length <= match_length; length++) {
 					// Enhanced default tracing: log edge creation attempts
-					if (parser->trace_file) {
+					if (TRACING(parser->trace_file)) {
 						fprintf(parser->trace_file,
 							"LZPARSER: EDGE_ATTEMPT pos=%d offset=%d length=%d best_offset=%d\n",
 							pos, offset, length, parser->best->offset);
 					}
 					new_edge(parser, parser->best, pos, offset, length);
 					// Enhanced default tracing: log condition evaluation
-					if (parser->trace_file) {
+					RefEdge *best_here = flathash_get(parser->best_for_offset, offset);
+					if (TRACING(parser->trace_file)) {
 						fprintf(parser->trace_file,
 							"LZPARSER: CONDITION_EVAL pos=%d offset=%d length=%d best_offset=%d count=%d condition=%d\n",
-							pos, offset, length, parser->best->offset, cuckoohash_count(parser->best_for_offset, offset),
-							(parser->best->offset != offset && cuckoohash_count(parser->best_for_offset, offset)));
+							pos, offset, length, parser->best->offset, best_here != NULL,
+							(parser->best->offset != offset && best_here != NULL));
 					}
-					if (parser->best->offset != offset && cuckoohash_count(parser->best_for_offset, offset)) {
+					if (parser->best->offset != offset && best_here != NULL) {
 						// Enhanced default tracing: log second edge creation
-						if (parser->trace_file) {
+						if (TRACING(parser->trace_file)) {
 							fprintf(parser->trace_file,
 								"LZPARSER: SECOND_EDGE pos=%d offset=%d length=%d existing_offset=%d\n",
-								pos, offset, length, cuckoohash_get(parser->best_for_offset, offset)->offset);
+								pos, offset, length, best_here->offset);
 						}
-						assert(cuckoohash_get(parser->best_for_offset, offset)->pos <= pos);
-						new_edge(parser, cuckoohash_get(parser->best_for_offset, offset), pos, offset, length);
+						assert(best_here->pos <= pos);
+						new_edge(parser, best_here, pos, offset, length);
 					}
 				}
 			max_match_length = (match_length > max_match_length) ? match_length : max_match_length;
@@ -294,14 +338,12 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 		
 		// If we have a very long match, skip ahead
 		if (max_match_length >= parser->skip_length && !cuckoohash_empty(parser->edges_to_pos[pos + max_match_length])) {
-			heap_clear(parser->root_edges);
+			root_edges_clear(parser->root_edges);
 			
-			CuckooHashIterator it = cuckoohash_begin(parser->best_for_offset);
-			while (cuckoohash_iterator_valid(&it)) {
-				release_edge(parser, cuckoohash_iterator_value(&it), 0);
-				cuckoohash_iterator_next(&it);
+			for (int i = 0; i < flathash_size(parser->best_for_offset); i++) {
+				release_edge(parser, flathash_value(parser->best_for_offset, i), 0);
 			}
-			cuckoohash_clear(parser->best_for_offset);
+			flathash_clear(parser->best_for_offset);
 			
 			int target_pos = pos + max_match_length;
 			while (pos < target_pos - 1) {
@@ -324,15 +366,13 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 	}
 	
 	// Clean unused paths
-	heap_clear(parser->root_edges);
+	root_edges_clear(parser->root_edges);
 	
-	CuckooHashIterator it = cuckoohash_begin(parser->best_for_offset);
-	while (cuckoohash_iterator_valid(&it)) {
-		RefEdge *edge = cuckoohash_iterator_value(&it);
+	for (int i = 0; i < flathash_size(parser->best_for_offset); i++) {
+		RefEdge *edge = flathash_value(parser->best_for_offset, i);
 		if (edge != parser->best) {
 			release_edge(parser, edge, 0);
 		}
-		cuckoohash_iterator_next(&it);
 	}
 	
 	// Find best path
@@ -352,7 +392,7 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 	RefEdge *edge = parser->best;
 	while (edge->length > 0) {
 		// Allocate more space for edges
-		result.edges = realloc(result.edges, (result.edges_count + 1) * sizeof(LZResultEdge));
+		result.edges = arena_realloc(parser->arena, result.edges, (result.edges_count + 1) * sizeof(LZResultEdge));
 		if (!result.edges) {
 			// Handle allocation failure
 			return result;
@@ -366,7 +406,7 @@ LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progres
 
 		result.edges_count++;
 		
-		edge = edge->source;
+		edge = refedgefactory_source(parser->edge_factory, edge);
 	}
 
 	
@@ -419,7 +459,7 @@ void lzparser_set_trace(LZParser *parser, FILE *trace_file) {
 }
 
 void lzparser_trace_decision(LZParser *parser, int pos, int offset, int length, int total_size, const char *reason) {
-	if (parser->trace_file) {
+	if (TRACING(parser->trace_file)) {
 		fprintf(parser->trace_file, 
 			"LZPARSER: DECISION pos=%d offset=%d length=%d total_size=%d reason=%s\n",
 			pos, offset, length, total_size, reason);
@@ -427,7 +467,7 @@ void lzparser_trace_decision(LZParser *parser, int pos, int offset, int length,
 }
 
 void lzparser_trace_match(LZParser *parser, int pos, int match_pos, int match_length) {
-	if (parser->trace_file) {
+	if (TRACING(parser->trace_file)) {
 		fprintf(parser->trace_file, 
 			"LZPARSER: MATCH pos=%d match_pos=%d match_length=%d offset=%d\n",
 			pos, match_pos, match_length, pos - match_pos);
@@ -435,7 +475,7 @@ void lzparser_trace_match(LZParser *parser, int pos, int match_pos, int match_le
 }
 
 void lzparser_trace_literal(LZParser *parser, int pos, unsigned char value, int size) {
-	if (parser->trace_file) {
+	if (TRACING(parser->trace_file)) {
 		fprintf(parser->trace_file, 
 			"LZPARSER: LITERAL pos=%d value=%d size=%d\n",
 			pos, value, size);
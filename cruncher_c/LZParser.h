@@ -12,7 +12,14 @@ LZ parser for compression.
 #include "MatchFinder.h"
 #include "RefEdge.h"
 #include "Heap.h"
+#include "BucketQueue.h"
 #include "CuckooHash.h"
+#include "FlatHash.h"
+
+// Initial capacities of the edge tables and of the root edge heap
+#define LZPARSER_POSITION_EDGES 1000
+#define LZPARSER_OFFSET_EDGES 50000
+#define LZPARSER_ROOT_EDGES 200000
 
 typedef struct {
 	int pos;
@@ -36,6 +43,7 @@ typedef struct {
 	int length_margin;
 	int skip_length;
 	RefEdgeFactory *edge_factory;
+	Arena *arena;
 	LZEncoder *encoder;
 	int *literal_size;
 	FILE *trace_file;  // Add tracing capability
@@ -43,13 +51,18 @@ typedef struct {
 	// Dynamic programming structures
 	CuckooHash **edges_to_pos;
 	RefEdge *best;
-	CuckooHash *best_for_offset;
+	FlatHash *best_for_offset;
+#ifdef SHRINKLER_BUCKET_QUEUE
+	BucketQueue *root_edges;
+#else
 	Heap *root_edges;
+#endif
 } LZParser;
 
 // Function declarations
-LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, MatchFinder *finder, int length_margin, int skip_length, RefEdgeFactory *edge_factory);
+LZParser* lzparser_new(unsigned char *data, int data_length, int zero_padding, MatchFinder *finder, int length_margin, int skip_length, RefEdgeFactory *edge_factory, Arena *arena);
 void lzparser_free(LZParser *parser);
+// The edges of the result are allocated in the arena of the parser
 LZParseResult lzparser_parse(LZParser *parser, LZEncoder *encoder, void *progress);
 unsigned long long lzparseresult_encode(LZParseResult *result, LZEncoder *encoder);
 
@@ -46,8 +46,8 @@ static void packprogress_rewind(PackProgress *progress) {
 	printf("\033[%dD", progress->textlength);
 }
 
-PackProgress* packprogress_new(void) {
-	PackProgress *progress = malloc(sizeof(PackProgress));
+PackProgress* packprogress_new(Arena *arena) {
+	PackProgress *progress = arena_malloc(arena, sizeof(PackProgress));
 	if (!progress) return NULL;
 	
 	progress->vtable.begin = (void (*)(void*, int))packprogress_begin;
@@ -55,13 +55,14 @@ PackProgress* packprogress_new(void) {
 	progress->vtable.end = (void (*)(void*))packprogress_end;
 	progress->vtable.print = (void (*)(void*))packprogress_print;
 	progress->vtable.rewind = (void (*)(void*))packprogress_rewind;
+	progress->arena = arena;
 	
 	return progress;
 }
 
 void packprogress_free(PackProgress *progress) {
 	if (progress) {
-		free(progress);
+		arena_free(progress->arena, progress);
 	}
 }
 
@@ -78,19 +79,20 @@ static void noprogress_end(void *self) {
 	// Do nothing
 }
 
-NoProgress* noprogress_new(void) {
-	NoProgress *progress = malloc(sizeof(NoProgress));
+NoProgress* noprogress_new(Arena *arena) {
+	NoProgress *progress = arena_malloc(arena, sizeof(NoProgress));
 	if (!progress) return NULL;
 	
 	progress->vtable.begin = (void (*)(void*, int))noprogress_begin;
 	progress->vtable.update = (void (*)(void*, int))noprogress_update;
 	progress->vtable.end = (void (*)(void*))noprogress_end;
+	progress->arena = arena;
 	
 	return progress;
 }
 
 void noprogress_free(NoProgress *progress) {
 	if (progress) {
-		free(progress);
+		arena_free(progress->arena, progress);
 	}
 }
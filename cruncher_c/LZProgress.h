@@ -8,6 +8,8 @@ Progress reporting interface for LZ parsing.
 
 #pragma once
 
+#include "Arena.h"
+
 typedef struct {
 	void (*begin)(void *self, int size);
 	void (*update)(void *self, int pos);
@@ -23,14 +25,16 @@ typedef struct {
 	int steps;
 	int next_step_threshold;
 	int textlength;
+	Arena *arena;
 } PackProgress;
 
 typedef struct {
 	LZProgress vtable;
+	Arena *arena;
 } NoProgress;
 
 // Function declarations
-PackProgress* packprogress_new(void);
+PackProgress* packprogress_new(Arena *arena);
 void packprogress_free(PackProgress *progress);
-NoProgress* noprogress_new(void);
+NoProgress* noprogress_new(Arena *arena);
 void noprogress_free(NoProgress *progress);
@@ -0,0 +1,49 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Memory mapped input files.
+
+*/
+
+#include "MappedFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+unsigned char* mapped_file_map(const char *filename, size_t *size_out) {
+#ifdef MAPPED_FILE_MMAP
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	void *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return NULL;
+	*size_out = st.st_size;
+	return m;
+#else
+	(void) filename;
+	(void) size_out;
+	return NULL;
+#endif
+}
+
+void mapped_file_unmap(unsigned char *data, size_t size) {
+#ifdef MAPPED_FILE_MMAP
+	if (data) {
+		munmap(data, size);
+	}
+#else
+	(void) data;
+	(void) size;
+#endif
+}
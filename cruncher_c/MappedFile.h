@@ -0,0 +1,20 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Memory mapped input files.
+
+The mapping is private, so the contents can be modified in memory without
+affecting the file. Mapping is only supported on POSIX systems. Elsewhere
+(such as on the Amiga), mapping fails and the caller reads the file as usual.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+// Map the whole file. Returns NULL if the file could not be mapped, in which
+// case it should be read normally. Empty files are never mapped.
+unsigned char* mapped_file_map(const char *filename, size_t *size_out);
+void mapped_file_unmap(unsigned char *data, size_t size);
@@ -11,13 +11,14 @@ Find repeated strings in a data block.
 #include <assert.h>
 #include "MatchFinder.h"
 #include "SuffixArray.h"
+#include "Threads.h"
 
 // Simple heap implementation for match buffer
 
 static void heap_push(IntHeap *heap, int value) {
 	if (heap->size >= heap->capacity) {
 		heap->capacity = heap->capacity * 2 + 1;
-		heap->data = realloc(heap->data, heap->capacity * sizeof(int));
+		heap->data = arena_realloc(heap->arena, heap->data, heap->capacity * sizeof(int));
 	}
 	
 	int pos = heap->size++;
@@ -76,7 +77,7 @@ static void heap_clear(IntHeap *heap) {
 }
 
 static void heap_free(IntHeap *heap) {
-	free(heap->data);
+	arena_free(heap->arena, heap->data);
 	heap->data = NULL;
 	heap->size = 0;
 	heap->capacity = 0;
@@ -92,8 +93,15 @@ static int max(int a, int b) {
 	return a > b ? a : b;
 }
 
-MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, int match_patience, int max_same_length) {
-	MatchFinder *finder = malloc(sizeof(MatchFinder));
+static void query_init(MatchQuery *query, Arena *arena) {
+	query->match_buffer.data = NULL;
+	query->match_buffer.size = 0;
+	query->match_buffer.capacity = 0;
+	query->match_buffer.arena = arena;
+}
+
+MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, int match_patience, int max_same_length, const char *cache_dir, int n_threads, Arena *arena) {
+	MatchFinder *finder = arena_malloc(arena, sizeof(MatchFinder));
 	if (!finder) return NULL;
 	
 	finder->data = data;
@@ -101,33 +109,44 @@ MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, in
 	finder->min_length = min_length;
 	finder->match_patience = match_patience;
 	finder->max_same_length = max_same_length;
+	finder->arena = arena;
+	
+	// Initialize match buffer and cache
+	query_init(&finder->query, arena);
+	finder->cache = NULL;
+	finder->cache_index = NULL;
+	finder->cache_end = NULL;
+	finder->replaying = 0;
+	
+	// Use cached arrays if available
+	finder->cache_file = cache_dir ? sacache_load(cache_dir, data, length) : NULL;
+	if (finder->cache_file) {
+		finder->suffix_array = (int *)finder->cache_file->suffix_array;
+		finder->rev_suffix_array = (int *)finder->cache_file->rev_suffix_array;
+		finder->longest_common_prefix = (int *)finder->cache_file->longest_common_prefix;
+		return finder;
+	}
 	
 	// Allocate arrays
-	finder->suffix_array = malloc((length + 1) * sizeof(int));
-	finder->rev_suffix_array = malloc((length + 1) * sizeof(int));
-	finder->longest_common_prefix = malloc((length + 1) * sizeof(int));
+	finder->suffix_array = arena_malloc(arena, (length + 1) * sizeof(int));
+	finder->rev_suffix_array = arena_malloc(arena, (length + 1) * sizeof(int));
+	finder->longest_common_prefix = arena_malloc(arena, (length + 1) * sizeof(int));
 	
 	if (!finder->suffix_array || !finder->rev_suffix_array || !finder->longest_common_prefix) {
-		free(finder->suffix_array);
-		free(finder->rev_suffix_array);
-		free(finder->longest_common_prefix);
-		free(finder);
+		arena_free(arena, finder->longest_common_prefix);
+		arena_free(arena, finder->rev_suffix_array);
+		arena_free(arena, finder->suffix_array);
+		arena_free(arena, finder);
 		return NULL;
 	}
 	
-	// Initialize match buffer
-	finder->match_buffer.data = NULL;
-	finder->match_buffer.size = 0;
-	finder->match_buffer.capacity = 0;
-	
 	// Compute suffix array
 	for (int i = 0; i < length; i++) {
 		finder->rev_suffix_array[i] = data[i] + 1;
 	}
 	finder->rev_suffix_array[length] = 0;
 	
-	computeSuffixArray(finder->rev_suffix_array, finder->suffix_array, length + 1, 257);
-	
+	computeSuffixArray(finder->rev_suffix_array, finder->suffix_array, length + 1, 257, n_threads, arena);
 	// Compute reverse suffix array
 	for (int i = 0; i <= length; i++) {
 		finder->rev_suffix_array[finder->suffix_array[i]] = i;
@@ -150,98 +169,214 @@ MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, in
 		}
 	}
 	
+	if (cache_dir) {
+		sacache_save(cache_dir, data, length, finder->suffix_array, finder->rev_suffix_array, finder->longest_common_prefix);
+	}
+	
 	return finder;
 }
 
 void matchfinder_free(MatchFinder *finder) {
 	if (finder) {
-		free(finder->suffix_array);
-		free(finder->rev_suffix_array);
-		free(finder->longest_common_prefix);
-		heap_free(&finder->match_buffer);
-		free(finder);
+		if (finder->cache_file) {
+			sacache_free(finder->cache_file);
+		} else {
+			arena_free(finder->arena, finder->suffix_array);
+			arena_free(finder->arena, finder->rev_suffix_array);
+			arena_free(finder->arena, finder->longest_common_prefix);
+		}
+		arena_free(finder->arena, finder->cache_end);
+		arena_free(finder->arena, finder->cache_index);
+		arena_free(finder->arena, finder->cache);
+		heap_free(&finder->query.match_buffer);
+		arena_free(finder->arena, finder);
 	}
 }
 
 void matchfinder_reset(MatchFinder *finder) {
-	heap_clear(&finder->match_buffer);
+	heap_clear(&finder->query.match_buffer);
+	finder->replaying = 0;
 }
 
-static void extend_left(MatchFinder *finder) {
+static void extend_left(const MatchFinder *finder, MatchQuery *query) {
 	int iter = 0;
-	while (finder->left_length >= finder->min_length) {
-		finder->left_length = min(finder->left_length, finder->longest_common_prefix[--finder->left_index]);
-		int pos = finder->suffix_array[finder->left_index];
-		if (pos < finder->current_pos && pos >= finder->min_pos) break;
+	while (query->left_length >= finder->min_length) {
+		query->left_length = min(query->left_length, finder->longest_common_prefix[--query->left_index]);
+		int pos = finder->suffix_array[query->left_index];
+		if (pos < query->current_pos && pos >= query->min_pos) break;
 		if (++iter > finder->match_patience) {
-			finder->left_length = 0;
+			query->left_length = 0;
 			break;
 		}
 	}
 }
 
-static void extend_right(MatchFinder *finder) {
+static void extend_right(const MatchFinder *finder, MatchQuery *query) {
 	int iter = 0;
 	while (1) {
-		finder->right_length = min(finder->right_length, finder->longest_common_prefix[finder->right_index]);
-		if (finder->right_length < finder->min_length) break;
-		int pos = finder->suffix_array[++finder->right_index];
-		if (pos < finder->current_pos && pos >= finder->min_pos) break;
+		query->right_length = min(query->right_length, finder->longest_common_prefix[query->right_index]);
+		if (query->right_length < finder->min_length) break;
+		int pos = finder->suffix_array[++query->right_index];
+		if (pos < query->current_pos && pos >= query->min_pos) break;
 		if (++iter > finder->match_patience) {
-			finder->right_length = 0;
+			query->right_length = 0;
 			break;
 		}
 	}
 }
 
-static int next_length(MatchFinder *finder) {
-	return max(finder->left_length, finder->right_length);
+static int next_length(MatchQuery *query) {
+	return max(query->left_length, query->right_length);
 }
 
-void matchfinder_begin_matching(MatchFinder *finder, int pos) {
-	finder->current_pos = pos;
-	finder->min_pos = 0;
+static void query_begin(const MatchFinder *finder, MatchQuery *query, int pos) {
+	query->current_pos = pos;
+	query->min_pos = 0;
 
-	finder->left_index = finder->rev_suffix_array[pos];
-	finder->left_length = finder->length - pos;
-	extend_left(finder);
-	finder->right_index = finder->rev_suffix_array[pos];
-	finder->right_length = finder->length - pos;
-	extend_right(finder);
+	query->left_index = finder->rev_suffix_array[pos];
+	query->left_length = finder->length - pos;
+	extend_left(finder, query);
+	query->right_index = finder->rev_suffix_array[pos];
+	query->right_length = finder->length - pos;
+	extend_right(finder, query);
 }
 
-int matchfinder_next_match(MatchFinder *finder, int *match_pos_out, int *match_length_out) {
-	if (heap_empty(&finder->match_buffer)) {
+static int query_next(const MatchFinder *finder, MatchQuery *query, int *match_pos_out, int *match_length_out) {
+	if (heap_empty(&query->match_buffer)) {
 		// Fill match buffer
-		finder->current_length = next_length(finder);
-		if (finder->current_length < finder->min_length) return 0;
-		int new_min_pos = finder->min_pos;
+		query->current_length = next_length(query);
+		if (query->current_length < finder->min_length) return 0;
+		int new_min_pos = query->min_pos;
 		do {
 			int match_pos;
-			if (finder->left_length > finder->right_length) {
-				match_pos = finder->suffix_array[finder->left_index];
-				extend_left(finder);
+			if (query->left_length > query->right_length) {
+				match_pos = finder->suffix_array[query->left_index];
+				extend_left(finder, query);
 			} else {
-				match_pos = finder->suffix_array[finder->right_index];
-				extend_right(finder);
+				match_pos = finder->suffix_array[query->right_index];
+				extend_right(finder, query);
 			}
 			new_min_pos = max(new_min_pos, match_pos);
-			if (finder->match_buffer.size < finder->max_same_length) {
-				heap_push(&finder->match_buffer, match_pos);
+			if (query->match_buffer.size < finder->max_same_length) {
+				heap_push(&query->match_buffer, match_pos);
 			} else {
-				if (match_pos > heap_top(&finder->match_buffer)) {
-					heap_pop(&finder->match_buffer);
-					heap_push(&finder->match_buffer, match_pos);
+				if (match_pos > heap_top(&query->match_buffer)) {
+					heap_pop(&query->match_buffer);
+					heap_push(&query->match_buffer, match_pos);
 				}
-				finder->min_pos = heap_top(&finder->match_buffer);
+				query->min_pos = heap_top(&query->match_buffer);
 			}
-		} while (next_length(finder) == finder->current_length);
-		assert(!heap_empty(&finder->match_buffer));
-		finder->min_pos = new_min_pos;
+		} while (next_length(query) == query->current_length);
+		assert(!heap_empty(&query->match_buffer));
+		query->min_pos = new_min_pos;
 	}
 
-	*match_length_out = finder->current_length;
-	*match_pos_out = heap_pop(&finder->match_buffer);
-	assert(*match_pos_out < finder->current_pos);
+	*match_length_out = query->current_length;
+	*match_pos_out = heap_pop(&query->match_buffer);
+	assert(*match_pos_out < query->current_pos);
 	return 1;
 }
+
+// Finds the matches of a chunk of positions with its own query, storing
+// them in its own part of the cache until that is full
+typedef struct {
+	MatchFinder *finder;
+	MatchQuery query;
+	int start;
+	int end;
+	unsigned cache_start;
+	unsigned cache_limit;
+} PrecomputeJob;
+
+static void precompute_job(void *arg) {
+	PrecomputeJob *job = arg;
+	MatchFinder *finder = job->finder;
+	unsigned index = job->cache_start;
+	for (int pos = job->start; pos < job->end; pos++) {
+		unsigned pos_start = index;
+		CachedMatch match;
+		query_begin(finder, &job->query, pos);
+		while (query_next(finder, &job->query, &match.pos, &match.length)) {
+			if (index == job->cache_limit) return;
+			finder->cache[index++] = match;
+		}
+		finder->cache_index[pos] = pos_start;
+		finder->cache_end[pos] = index;
+	}
+}
+
+void matchfinder_precompute(MatchFinder *finder, size_t max_bytes, int n_threads) {
+	size_t index_bytes = (size_t) (finder->length + 1) * 2 * sizeof(unsigned);
+	if (finder->cache || finder->length == 0 || max_bytes <= index_bytes) return;
+	size_t max_matches = (max_bytes - index_bytes) / sizeof(CachedMatch);
+	if (max_matches > NOT_CACHED - 1) max_matches = NOT_CACHED - 1;
+	int n_chunks = n_threads * 8 < finder->length ? n_threads * 8 : finder->length;
+
+	finder->cache = arena_malloc(finder->arena, max_matches * sizeof(CachedMatch));
+	finder->cache_index = arena_malloc(finder->arena, (finder->length + 1) * sizeof(unsigned));
+	finder->cache_end = arena_malloc(finder->arena, (finder->length + 1) * sizeof(unsigned));
+	PrecomputeJob *jobs = arena_malloc(finder->arena, n_chunks * sizeof(PrecomputeJob));
+	if (!finder->cache || !finder->cache_index || !finder->cache_end || !jobs) {
+		arena_free(finder->arena, jobs);
+		arena_free(finder->arena, finder->cache_end);
+		arena_free(finder->arena, finder->cache_index);
+		arena_free(finder->arena, finder->cache);
+		finder->cache = NULL;
+		finder->cache_index = NULL;
+		finder->cache_end = NULL;
+		return;
+	}
+	for (int pos = 0; pos <= finder->length; pos++) {
+		finder->cache_index[pos] = NOT_CACHED;
+	}
+
+	// The match buffer of a query never holds more than max_same_length
+	// matches, so the jobs need not allocate.
+	int n_jobs = 0;
+	for (int c = 0; c < n_chunks; c++) {
+		PrecomputeJob *job = &jobs[c];
+		job->finder = finder;
+		query_init(&job->query, finder->arena);
+		job->query.match_buffer.data = arena_malloc(finder->arena, finder->max_same_length * sizeof(int));
+		if (!job->query.match_buffer.data) break;
+		job->query.match_buffer.capacity = finder->max_same_length;
+		job->start = (int) ((long long) finder->length * c / n_chunks);
+		job->end = (int) ((long long) finder->length * (c + 1) / n_chunks);
+		job->cache_start = (unsigned) (max_matches * c / n_chunks);
+		job->cache_limit = (unsigned) (max_matches * (c + 1) / n_chunks);
+		n_jobs++;
+	}
+	run_jobs(precompute_job, jobs, sizeof(PrecomputeJob), n_jobs, n_threads);
+
+	for (int c = n_jobs - 1; c >= 0; c--) {
+		arena_free(finder->arena, jobs[c].query.match_buffer.data);
+	}
+	arena_free(finder->arena, jobs);
+}
+
+size_t matchfinder_precompute_memory(int length, int max_same_length, size_t max_bytes, int n_threads) {
+	int n_chunks = n_threads * 8 < length ? n_threads * 8 : length;
+	return max_bytes + 4 * ARENA_BLOCK_OVERHEAD + n_chunks * (sizeof(PrecomputeJob) + max_same_length * sizeof(int) + ARENA_BLOCK_OVERHEAD);
+}
+
+void matchfinder_begin_matching(MatchFinder *finder, int pos) {
+	finder->replaying = 0;
+	if (finder->cache && finder->cache_index[pos] != NOT_CACHED) {
+		finder->replaying = 1;
+		finder->replay_index = finder->cache_index[pos];
+		finder->replay_end = finder->cache_end[pos];
+		return;
+	}
+	query_begin(finder, &finder->query, pos);
+}
+
+int matchfinder_next_match(MatchFinder *finder, int *match_pos_out, int *match_length_out) {
+	if (finder->replaying) {
+		if (finder->replay_index == finder->replay_end) return 0;
+		const CachedMatch *match = &finder->cache[finder->replay_index++];
+		*match_pos_out = match->pos;
+		*match_length_out = match->length;
+		return 1;
+	}
+	return query_next(finder, &finder->query, match_pos_out, match_length_out);
+}
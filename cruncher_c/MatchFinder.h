@@ -4,17 +4,49 @@
 
 Match finder for LZ compression.
 
+The matches of each position are found by a MatchQuery, which only reads the
+suffix array, so several queries on the same finder can run concurrently.
+The matches do not depend on the parse, so they can be found up front for
+all positions by several threads, each matching a chunk of positions with
+its own query, and replayed from a cache during each parse. Positions which
+do not fit in the cache are matched during the parse.
+
 */
 
 #pragma once
 
+#include "Arena.h"
+#include "SuffixArrayCache.h"
+
 // Simple heap for match buffer
 typedef struct {
 	int *data;
 	int size;
 	int capacity;
+	Arena *arena;
 } IntHeap;
 
+// The state of finding the matches of one position
+typedef struct {
+	int current_pos;
+	int min_pos;
+	int left_index;
+	int left_length;
+	int right_index;
+	int right_length;
+	int current_length;
+	
+	// Best matches seen with current length
+	IntHeap match_buffer;
+} MatchQuery;
+
+typedef struct {
+	int pos;
+	int length;
+} CachedMatch;
+
+#define NOT_CACHED ((unsigned) -1)
+
 typedef struct {
 	// Inputs
 	unsigned char *data;
@@ -23,29 +55,37 @@ typedef struct {
 	int match_patience;
 	int max_same_length;
 	
-	// Suffix array
+	// Suffix array, either owned by this finder or pointing into a cache
+	// file, in which case it is read-only.
+	SuffixArrayCacheFile *cache_file;
 	int *suffix_array;
 	int *rev_suffix_array;
 	int *longest_common_prefix;
 	
-	// Matcher parameters
-	int current_pos;
-	int min_pos;
+	MatchQuery query;
 	
-	// Matcher state
-	int left_index;
-	int left_length;
-	int right_index;
-	int right_length;
-	int current_length;
+	// Matches found up front, with the range of each position in the cache
+	CachedMatch *cache;
+	unsigned *cache_index;
+	unsigned *cache_end;
+	int replaying;
+	unsigned replay_index;
+	unsigned replay_end;
 	
-	// Best matches seen with current length
-	IntHeap match_buffer;
+	Arena *arena;
 } MatchFinder;
 
 // Function declarations
-MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, int match_patience, int max_same_length);
+// If cache_dir is not NULL, the suffix array data is loaded from or stored to the cache in that directory.
+// A cached suffix array is mapped from its file rather than allocated in the arena.
+// The suffix array is constructed using up to n_threads threads.
+MatchFinder* matchfinder_new(unsigned char *data, int length, int min_length, int match_patience, int max_same_length, const char *cache_dir, int n_threads, Arena *arena);
 void matchfinder_free(MatchFinder *finder);
 void matchfinder_reset(MatchFinder *finder);
+// Find the matches of all positions up front on the given number of threads,
+// caching as many as fit in about the given number of bytes
+void matchfinder_precompute(MatchFinder *finder, size_t max_bytes, int n_threads);
+// Work memory taken in an arena by matchfinder_precompute
+size_t matchfinder_precompute_memory(int length, int max_same_length, size_t max_bytes, int n_threads);
 void matchfinder_begin_matching(MatchFinder *finder, int pos);
 int matchfinder_next_match(MatchFinder *finder, int *match_pos_out, int *match_length_out);
@@ -0,0 +1,182 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the output of complete crunches.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutputCache.h"
+
+typedef struct {
+	char magic[8];
+	int key_length;
+	int report_length;
+	int output_length;
+	int note_length;
+} OutputCacheHeader;
+
+static unsigned long long outputcache_hash(const OutputCache *cache) {
+	// 64-bit FNV-1a
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < cache->key_length; i++) {
+		h = (h ^ (unsigned char)cache->key[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static char* outputcache_filename(const OutputCache *cache, const char *dir, const char *suffix) {
+	size_t dir_len = strlen(dir);
+	char *path = malloc(dir_len + 32);
+	if (!path) return NULL;
+	int sep = dir_len > 0 && dir[dir_len - 1] != '/' && dir[dir_len - 1] != '\\';
+	sprintf(path, "%s%s%016llx.out%s", dir, sep ? "/" : "", outputcache_hash(cache), suffix);
+	return path;
+}
+
+static void outputcache_append(OutputCache *cache, const void *data, size_t length) {
+	if (cache->failed) return;
+	char *key = realloc(cache->key, cache->key_length + length);
+	if (!key) {
+		cache->failed = 1;
+		return;
+	}
+	memcpy(key + cache->key_length, data, length);
+	cache->key = key;
+	cache->key_length += length;
+}
+
+// Read a NUL-terminated string of the given length
+static char* outputcache_read_string(FILE *f, int length) {
+	char *s = malloc(length + 1);
+	if (!s) return NULL;
+	if (fread(s, 1, length, f) != (size_t)length) {
+		free(s);
+		return NULL;
+	}
+	s[length] = '\0';
+	return s;
+}
+
+void outputcache_init(OutputCache *cache) {
+	cache->key = NULL;
+	cache->key_length = 0;
+	cache->failed = 0;
+}
+
+void outputcache_free(OutputCache *cache) {
+	free(cache->key);
+	outputcache_init(cache);
+}
+
+void outputcache_add_int(OutputCache *cache, const char *name, long long value) {
+	char line[64];
+	sprintf(line, "=%lld\n", value);
+	outputcache_append(cache, name, strlen(name));
+	outputcache_append(cache, line, strlen(line));
+}
+
+void outputcache_add_bytes(OutputCache *cache, const char *name, const void *data, size_t length) {
+	char line[32];
+	sprintf(line, ":%d\n", (int)length);
+	outputcache_append(cache, name, strlen(name));
+	outputcache_append(cache, line, strlen(line));
+	outputcache_append(cache, data, length);
+}
+
+int outputcache_add_file(OutputCache *cache, const char *name, const char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) return 0;
+	unsigned char *contents = NULL;
+	size_t length = 0;
+	size_t capacity = 0;
+	int c;
+	while ((c = fgetc(f)) != EOF) {
+		if (length == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			unsigned char *grown = realloc(contents, capacity);
+			if (!grown) {
+				cache->failed = 1;
+				break;
+			}
+			contents = grown;
+		}
+		contents[length++] = c;
+	}
+	int ok = !ferror(f);
+	fclose(f);
+	if (ok) outputcache_add_bytes(cache, name, contents, length);
+	free(contents);
+	return ok;
+}
+
+OutputCacheEntry* outputcache_load(const OutputCache *cache, const char *dir) {
+	if (cache->failed) return NULL;
+	char *path = outputcache_filename(cache, dir, "");
+	if (!path) return NULL;
+	FILE *f = fopen(path, "rb");
+	free(path);
+	if (!f) return NULL;
+	OutputCacheEntry *entry = calloc(1, sizeof(OutputCacheEntry));
+	OutputCacheHeader header;
+	char *file_key = NULL;
+	int ok = entry && fread(&header, sizeof(header), 1, f) == 1 &&
+	         memcmp(header.magic, "ShrOC1", sizeof("ShrOC1")) == 0 && (size_t)header.key_length == cache->key_length &&
+	         header.report_length >= 0 && header.output_length >= 0 && header.note_length >= 0 &&
+	         (file_key = outputcache_read_string(f, header.key_length)) != NULL &&
+	         memcmp(file_key, cache->key, cache->key_length) == 0 &&
+	         (entry->report = outputcache_read_string(f, header.report_length)) != NULL &&
+	         (entry->output = malloc(header.output_length + 1)) != NULL &&
+	         fread(entry->output, 1, header.output_length, f) == (size_t)header.output_length &&
+	         (entry->note = outputcache_read_string(f, header.note_length)) != NULL &&
+	         fgetc(f) == EOF;
+	fclose(f);
+	free(file_key);
+	if (!ok) {
+		outputcache_free_entry(entry);
+		return NULL;
+	}
+	entry->output_length = header.output_length;
+	return entry;
+}
+
+void outputcache_free_entry(OutputCacheEntry *entry) {
+	if (entry) {
+		free(entry->report);
+		free(entry->output);
+		free(entry->note);
+		free(entry);
+	}
+}
+
+void outputcache_save(const OutputCache *cache, const char *dir, const char *report,
+                      const unsigned char *output, int output_length, const char *note) {
+	if (cache->failed) return;
+	OutputCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, "ShrOC1");
+	header.key_length = cache->key_length;
+	header.report_length = strlen(report);
+	header.output_length = output_length;
+	header.note_length = strlen(note);
+	char *path = outputcache_filename(cache, dir, "");
+	char *temp_path = outputcache_filename(cache, dir, ".tmp");
+	FILE *f = path && temp_path ? fopen(temp_path, "wb") : NULL;
+	if (f) {
+		int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		         fwrite(cache->key, 1, cache->key_length, f) == cache->key_length &&
+		         fwrite(report, 1, header.report_length, f) == (size_t)header.report_length &&
+		         fwrite(output, 1, output_length, f) == (size_t)output_length &&
+		         fwrite(note, 1, header.note_length, f) == (size_t)header.note_length;
+		ok = fclose(f) == 0 && ok;
+		remove(path);
+		if (!ok || rename(temp_path, path) != 0) {
+			remove(temp_path);
+		}
+	}
+	free(path);
+	free(temp_path);
+}
@@ -0,0 +1,49 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the output of complete crunches.
+
+The key of an entry describes everything the output depends on, and cache
+files are named after a hash of the key and contain the key itself, so a
+file is only used if the key matches exactly. The file format is the same
+as for the C++ cruncher (see cruncher/OutputCache.h). The keys of the two
+crunchers differ, so they never use each other's entries.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+	char *key;
+	size_t key_length;
+	// Set if memory for the key ran out, disabling the cache
+	int failed;
+} OutputCache;
+
+typedef struct {
+	char *report;            // Printed before saving the output, NUL-terminated
+	unsigned char *output;
+	int output_length;
+	char *note;              // Printed after saving the output, NUL-terminated
+} OutputCacheEntry;
+
+void outputcache_init(OutputCache *cache);
+void outputcache_free(OutputCache *cache);
+
+// Add a named value to the key
+void outputcache_add_int(OutputCache *cache, const char *name, long long value);
+// Add a named string or block of bytes to the key
+void outputcache_add_bytes(OutputCache *cache, const char *name, const void *data, size_t length);
+// Add the contents of a file to the key. Returns whether it could be read.
+int outputcache_add_file(OutputCache *cache, const char *name, const char *filename);
+
+// Look up the entry for the key. Returns NULL if no valid file was found.
+OutputCacheEntry* outputcache_load(const OutputCache *cache, const char *dir);
+void outputcache_free_entry(OutputCacheEntry *entry);
+
+// Store the entry for the key. Failure to write the cache is not an error.
+void outputcache_save(const OutputCache *cache, const char *dir, const char *report,
+                      const unsigned char *output, int output_length, const char *note);
@@ -14,18 +14,60 @@ Pack a data block in multiple iterations, reporting progress along the way.
 #include "SizeMeasuringCoder.h"
 #include "LZProgress.h"
 
+// Size of an allocation in an arena
+#define ARENA_BLOCK(size) ((size_t) (size) + ARENA_BLOCK_OVERHEAD)
+
+size_t packdata_work_memory(int data_length, PackParams *params, int edge_capacity) {
+	size_t n = (size_t) data_length + 1;
+	size_t memory = ARENA_BLOCK(sizeof(RefEdgeFactory)) + ARENA_BLOCK((edge_capacity + 1) * sizeof(RefEdge));
+	
+	// Match finder. Temporary arrays of the suffix array construction take
+	// at most 6 bytes per position over all levels of recursion, and the
+	// match buffer may be copied once as it grows. Matches found up front
+	// take the match cache on top of this.
+	memory += ARENA_BLOCK(sizeof(MatchFinder)) + 3 * ARENA_BLOCK(n * sizeof(int));
+	memory += 6 * n + (2 * 257 + 1) * sizeof(int) + 32 * ARENA_BLOCK(sizeof(int));
+	memory += 2 * ARENA_BLOCK((2 * params->max_same_length + 1) * sizeof(int));
+	if (params->threads > 1 && params->match_cache_size > 0) {
+		memory += matchfinder_precompute_memory(data_length, params->max_same_length, params->match_cache_size, params->threads);
+	}
+	
+	// LZ parser
+	memory += ARENA_BLOCK(sizeof(LZParser)) + ARENA_BLOCK(n * sizeof(int)) + ARENA_BLOCK(n * sizeof(CuckooHash*));
+	memory += n * cuckoohash_memory(LZPARSER_POSITION_EDGES) + flathash_memory(LZPARSER_OFFSET_EDGES);
+#ifdef SHRINKLER_BUCKET_QUEUE
+	memory += ARENA_BLOCK(sizeof(BucketQueue)) + ARENA_BLOCK(BUCKET_QUEUE_WINDOW_SIZE * sizeof(EdgeList));
+#else
+	memory += ARENA_BLOCK(sizeof(Heap)) + ARENA_BLOCK(LZPARSER_ROOT_EDGES * sizeof(RefEdge*));
+#endif
+	memory += ARENA_BLOCK(sizeof(PackProgress)) + ARENA_BLOCK(sizeof(LZEncoder));
+	
+	// Each iteration keeps its parse result, size measurer, encoders and
+	// counting coders until the end. The range coder measuring the result
+	// and its output, of at most 12 bits per coded bit, are released again.
+	size_t counting_coder = ARENA_BLOCK(sizeof(CountingCoder)) + ARENA_BLOCK(NUM_CONTEXTS * sizeof(ContextCounts));
+	size_t iteration = ARENA_BLOCK(n * sizeof(LZResultEdge)) + 3 * counting_coder + 3 * ARENA_BLOCK(sizeof(LZEncoder)) +
+	                   ARENA_BLOCK(sizeof(SizeMeasuringCoder)) + ARENA_BLOCK(NUM_CONTEXTS * 2 * sizeof(unsigned short));
+	memory += counting_coder + params->iterations * iteration;
+	memory += ARENA_BLOCK(sizeof(RangeCoder)) + ARENA_BLOCK(NUM_CONTEXTS * sizeof(unsigned short)) + ARENA_BLOCK(14 * n);
+	return memory;
+}
+
 void packData(unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, int show_progress, FILE *trace_file) {
 	printf("%8d", data_length);
 	
 	// Create match finder
-	MatchFinder *finder = matchfinder_new(data, data_length, 2, params->match_patience, params->max_same_length);
+	MatchFinder *finder = matchfinder_new(data, data_length, 2, params->match_patience, params->max_same_length, params->suffix_array_cache, params->threads, params->arena);
 	if (!finder) {
 		fprintf(stderr, "Failed to create match finder\n");
 		return;
 	}
+	if (params->threads > 1 && params->match_cache_size > 0) {
+		matchfinder_precompute(finder, params->match_cache_size, params->threads);
+	}
 	
 	// Create LZ parser
-	LZParser *parser = lzparser_new(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, edge_factory);
+	LZParser *parser = lzparser_new(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, edge_factory, params->arena);
 	if (!parser) {
 		fprintf(stderr, "Failed to create LZ parser\n");
 		matchfinder_free(finder);
@@ -43,7 +85,7 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 	results[1].edges_count = 0;
 	
 	// Create counting coder
-	CountingCoder *counting_coder = countingcoder_new(NUM_CONTEXTS);
+	CountingCoder *counting_coder = countingcoder_new(NUM_CONTEXTS, params->arena);
 	if (!counting_coder) {
 		fprintf(stderr, "Failed to create counting coder\n");
 		lzparser_free(parser);
@@ -54,9 +96,9 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 	// Create progress indicator
 	void *progress;
 	if (show_progress) {
-		progress = packprogress_new();
+		progress = packprogress_new(params->arena);
 	} else {
-		progress = noprogress_new();
+		progress = noprogress_new(params->arena);
 	}
 	
 	// Main iteration loop
@@ -68,12 +110,12 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		
 		// Free previous result edges
 		if (result->edges) {
-			free(result->edges);
+			arena_free(params->arena, result->edges);
 			result->edges = NULL;
 			result->edges_count = 0;
 		}
 		
-		SizeMeasuringCoder *measurer = sizemeasuringcoder_new(counting_coder);
+		SizeMeasuringCoder *measurer = sizemeasuringcoder_new(counting_coder, params->arena);
 		if (!measurer) {
 			fprintf(stderr, "Failed to create size measuring coder\n");
 			break;
@@ -86,7 +128,7 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		matchfinder_reset(finder);
 		
 		// Parse with progress
-		LZEncoder *parse_encoder = lzencoder_new((Coder*)measurer, params->parity_context);
+		LZEncoder *parse_encoder = lzencoder_new((Coder*)measurer, params->parity_context, params->arena);
 		if (trace_file) {
 			lzparser_set_trace(parser, trace_file);
 		}
@@ -99,14 +141,14 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		// Encode result using adaptive range coding to measure size
 		unsigned char *dummy_result = NULL;
 		int dummy_size = 0;
-		RangeCoder *range_coder = rangecoder_new(NUM_CONTEXTS, &dummy_result, &dummy_size);
+		RangeCoder *range_coder = rangecoder_new(NUM_CONTEXTS, &dummy_result, &dummy_size, params->arena);
 		if (range_coder) {
-			LZEncoder *range_encoder = lzencoder_new((Coder*)range_coder, params->parity_context);
+			LZEncoder *range_encoder = lzencoder_new((Coder*)range_coder, params->parity_context, params->arena);
 			real_size = lzparseresult_encode(result, range_encoder);
-			lzencoder_free(range_encoder);
 			rangecoder_finish(range_coder);
+			arena_free(params->arena, dummy_result);
+			lzencoder_free(range_encoder);
 			rangecoder_free(range_coder);
-			free(dummy_result);
 		}
 		
 		// Choose if best
@@ -119,9 +161,9 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		printf("%14.3f", real_size / (double)(8 << BIT_PRECISION));
 		
 		// Count symbol frequencies for next iteration
-		CountingCoder *new_counting_coder = countingcoder_new(NUM_CONTEXTS);
+		CountingCoder *new_counting_coder = countingcoder_new(NUM_CONTEXTS, params->arena);
 		if (new_counting_coder) {
-			LZEncoder *counting_encoder = lzencoder_new((Coder*)counting_coder, params->parity_context);
+			LZEncoder *counting_encoder = lzencoder_new((Coder*)counting_coder, params->parity_context, params->arena);
 			lzparseresult_encode(result, counting_encoder);
 			lzencoder_free(counting_encoder);
 			
@@ -142,7 +184,7 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 	countingcoder_free(counting_coder);
 	
 	// Encode best result to output
-	LZEncoder *final_encoder = lzencoder_new(result_coder, params->parity_context);
+	LZEncoder *final_encoder = lzencoder_new(result_coder, params->parity_context, params->arena);
 	if (trace_file) {
 		lzencoder_set_trace(final_encoder, trace_file);
 	}
@@ -151,11 +193,11 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 	
 	// Cleanup results
 	if (results[0].edges) {
-		free(results[0].edges);
+		arena_free(params->arena, results[0].edges);
 		results[0].edges = NULL;
 	}
 	if (results[1].edges) {
-		free(results[1].edges);
+		arena_free(params->arena, results[1].edges);
 		results[1].edges = NULL;
 	}
 	
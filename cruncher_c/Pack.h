@@ -22,8 +22,24 @@ typedef struct {
 	int skip_length;
 	int match_patience;
 	int max_same_length;
+	
+	// Threads for building the suffix array and for finding matches up front
+	int threads;
+	// Bytes of memory for the matches found up front
+	size_t match_cache_size;
+	
+	// Directory for caching suffix arrays between runs, or NULL
+	const char *suffix_array_cache;
+	
+	// Arena for all work memory, or NULL to use the heap
+	Arena *arena;
 } PackParams;
 
 
 
 void packData(unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, int show_progress, FILE *trace_file);
+
+// Work memory needed in an arena by packData and by an edge factory of the
+// given capacity. Edge tables which outgrow their initial capacity during
+// parsing, and edges beyond the capacity of the factory, come on top of this.
+size_t packdata_work_memory(int data_length, PackParams *params, int edge_capacity);
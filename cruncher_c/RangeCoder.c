@@ -37,7 +37,7 @@ static void add_bit(RangeCoder *coder) {
 		bitmask = 0x80 >> (pos & 7);
 		
 		while (bytepos >= *coder->out_size) {
-			*coder->out = realloc(*coder->out, (*coder->out_size + 1) * sizeof(unsigned char));
+			*coder->out = arena_realloc(coder->base.arena, *coder->out, (*coder->out_size + 1) * sizeof(unsigned char));
 			(*coder->out)[*coder->out_size] = 0;
 			(*coder->out_size)++;
 		}
@@ -45,17 +45,17 @@ static void add_bit(RangeCoder *coder) {
 	} while (((*coder->out)[bytepos] & bitmask) == 0);
 }
 
-RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size) {
+RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size, Arena *arena) {
 	if (!sizetable_init) {
 		sizetable_init = init_sizetable();
 	}
 	
-	RangeCoder *coder = malloc(sizeof(RangeCoder));
+	RangeCoder *coder = arena_malloc(arena, sizeof(RangeCoder));
 	if (!coder) return NULL;
 	
-	coder->contexts = calloc(n_contexts, sizeof(unsigned short));
+	coder->contexts = arena_calloc(arena, n_contexts, sizeof(unsigned short));
 	if (!coder->contexts) {
-		free(coder);
+		arena_free(arena, coder);
 		return NULL;
 	}
 	
@@ -75,6 +75,7 @@ RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size) {
 	coder->base.has_cache = 0;
 	coder->base.cache = NULL;
 	coder->base.cache_sizes = NULL;
+	coder->base.arena = arena;
 	
 	set_rangecoder_function(coder);
 	return coder;
@@ -82,8 +83,8 @@ RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size) {
 
 void rangecoder_free(RangeCoder *coder) {
 	if (coder) {
-		free(coder->contexts);
-		free(coder);
+		arena_free(coder->base.arena, coder->contexts);
+		arena_free(coder->base.arena, coder);
 	}
 }
 
@@ -173,14 +174,14 @@ void rangecoder_reset(RangeCoder *coder) {
 
 void rangecoder_finish(RangeCoder *coder) {
 	// Trace the finish start
-	if (coder->trace_file) {
+	if (TRACING(coder->trace_file)) {
 		fprintf(coder->trace_file, 
 			"RANGECODER: FINISH_START intervalmin=0x%04x intervalsize=0x%04x dest_bit=%d\n",
 			coder->intervalmin, coder->intervalsize, coder->dest_bit);
 	}
 	
 	// Add detailed tracing for the finish process
-	if (coder->trace_file) {
+	if (TRACING(coder->trace_file)) {
 		fprintf(coder->trace_file, 
 			"RANGECODER: FINISH_DETAILED_START intervalmin=0x%04x intervalsize=0x%04x dest_bit=%d out_size=%d\n",
 			coder->intervalmin, coder->intervalsize, coder->dest_bit, *coder->out_size);
@@ -200,7 +201,7 @@ void rangecoder_finish(RangeCoder *coder) {
 
 	int required_bytes = ((coder->dest_bit - 1) >> 3) + 1;
 	if (required_bytes > *coder->out_size) {
-		*coder->out = realloc(*coder->out, required_bytes * sizeof(unsigned char));
+		*coder->out = arena_realloc(coder->base.arena, *coder->out, required_bytes * sizeof(unsigned char));
 		// Initialize new bytes to 0
 		for (int i = *coder->out_size; i < required_bytes; i++) {
 			(*coder->out)[i] = 0;
@@ -212,7 +213,7 @@ void rangecoder_finish(RangeCoder *coder) {
 	}
 	
 	// Trace the finish end
-	if (coder->trace_file) {
+	if (TRACING(coder->trace_file)) {
 		fprintf(coder->trace_file, 
 			"RANGECODER: FINISH_END final dest_bit=%d out_size=%d\n",
 			coder->dest_bit, *coder->out_size);
@@ -229,7 +230,7 @@ void rangecoder_set_trace(RangeCoder *coder, FILE *trace_file) {
 }
 
 void rangecoder_trace_state(RangeCoder *coder, const char *operation, int context, int bit, int size) {
-	if (coder->trace_file) {
+	if (TRACING(coder->trace_file)) {
 		fprintf(coder->trace_file, 
 			"RANGECODER: %s context=%d bit=%d size=%d intervalmin=0x%04x intervalsize=0x%04x dest_bit=%d\n",
 			operation, context, bit, size, coder->intervalmin, coder->intervalsize, coder->dest_bit);
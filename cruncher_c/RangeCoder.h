@@ -13,6 +13,7 @@ An entropy coder based on range coding.
 #include <string.h>
 #include <stdlib.h>
 #include "Coder.h"
+#include "Trace.h"
 
 #ifndef ADJUST_SHIFT
 #define ADJUST_SHIFT 4
@@ -29,8 +30,8 @@ typedef struct {
 	FILE *trace_file;  // Add tracing capability
 } RangeCoder;
 
-// Constructor and destructor
-RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size);
+// Constructor and destructor. The output buffer is grown in the arena too.
+RangeCoder* rangecoder_new(int n_contexts, unsigned char **out, int *out_size, Arena *arena);
 void rangecoder_free(RangeCoder *coder);
 
 // Methods
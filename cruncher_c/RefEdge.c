@@ -2,8 +2,8 @@
 #include <stdlib.h>
 #include "RefEdge.h"
 
-RefEdgeFactory* refedgefactory_new(int edge_capacity) {
-    RefEdgeFactory *factory = malloc(sizeof(RefEdgeFactory));
+RefEdgeFactory* refedgefactory_new(int edge_capacity, Arena *arena) {
+    RefEdgeFactory *factory = arena_malloc(arena, sizeof(RefEdgeFactory));
     if (!factory) return NULL;
     
     factory->edge_capacity = edge_capacity;
@@ -11,7 +11,20 @@ RefEdgeFactory* refedgefactory_new(int edge_capacity) {
     factory->cleaned_edges = 0;
     factory->max_edge_count = 0;
     factory->max_cleaned_edges = 0;
-    factory->buffer = NULL;
+    
+    // Slot 0 is reserved as the null index. Pages of the slab are
+    // not touched until the parse actually reaches them.
+    factory->slab_size = edge_capacity + 1;
+    factory->slab = arena_malloc(arena, factory->slab_size * sizeof(RefEdge));
+    if (!factory->slab) {
+        arena_free(arena, factory);
+        return NULL;
+    }
+    factory->overflow = NULL;
+    factory->overflow_count = 0;
+    factory->next_unused = 1;
+    factory->free_list = 0;
+    factory->arena = arena;
     
     return factory;
 }
@@ -19,14 +32,12 @@ RefEdgeFactory* refedgefactory_new(int edge_capacity) {
 void refedgefactory_free(RefEdgeFactory *factory) {
     if (!factory) return;
     
-    // Free all edges in the buffer
-    while (factory->buffer != NULL) {
-        RefEdge *edge = factory->buffer;
-        factory->buffer = edge->source;
-        free(edge);
+    for (unsigned c = 0; c < factory->overflow_count; c++) {
+        arena_free(factory->arena, factory->overflow[c]);
     }
-    
-    free(factory);
+    arena_free(factory->arena, factory->overflow);
+    arena_free(factory->arena, factory->slab);
+    arena_free(factory->arena, factory);
 }
 
 void refedgefactory_reset(RefEdgeFactory *factory) {
@@ -34,27 +45,69 @@ void refedgefactory_reset(RefEdgeFactory *factory) {
     factory->cleaned_edges = 0;
 }
 
+RefEdge* refedgefactory_get(RefEdgeFactory *factory, unsigned index) {
+    if (index < factory->slab_size) {
+        return index == 0 ? NULL : &factory->slab[index];
+    }
+    index -= factory->slab_size;
+    return &factory->overflow[index >> REFEDGE_OVERFLOW_CHUNK_BITS][index & (REFEDGE_OVERFLOW_CHUNK_SIZE - 1)];
+}
+
+RefEdge* refedgefactory_source(RefEdgeFactory *factory, RefEdge *edge) {
+    return refedgefactory_get(factory, edge->source);
+}
+
+static unsigned refedgefactory_index_of(RefEdgeFactory *factory, RefEdge *edge) {
+    if (edge == NULL) return 0;
+    if (edge >= factory->slab && edge < factory->slab + factory->slab_size) {
+        return edge - factory->slab;
+    }
+    for (unsigned c = 0; c < factory->overflow_count; c++) {
+        RefEdge *chunk = factory->overflow[c];
+        if (edge >= chunk && edge < chunk + REFEDGE_OVERFLOW_CHUNK_SIZE) {
+            return factory->slab_size + (c << REFEDGE_OVERFLOW_CHUNK_BITS) + (edge - chunk);
+        }
+    }
+    assert(0);
+    return 0;
+}
+
+static int refedgefactory_grow(RefEdgeFactory *factory) {
+    RefEdge **overflow = arena_realloc(factory->arena, factory->overflow, (factory->overflow_count + 1) * sizeof(RefEdge *));
+    if (!overflow) return 0;
+    factory->overflow = overflow;
+    
+    RefEdge *chunk = arena_malloc(factory->arena, REFEDGE_OVERFLOW_CHUNK_SIZE * sizeof(RefEdge));
+    if (!chunk) return 0;
+    factory->overflow[factory->overflow_count++] = chunk;
+    return 1;
+}
+
 RefEdge* refedgefactory_create(RefEdgeFactory *factory, int pos, int offset, int length, int total_size, RefEdge *source) {
-	// Remove the problematic assertion - it's not needed for correctness
+    unsigned index;
+    if (factory->free_list != 0) {
+        index = factory->free_list;
+        factory->free_list = refedgefactory_get(factory, index)->source;
+    } else {
+        index = factory->next_unused;
+        if (index >= factory->slab_size &&
+            ((index - factory->slab_size) & (REFEDGE_OVERFLOW_CHUNK_SIZE - 1)) == 0 &&
+            !refedgefactory_grow(factory)) {
+            return NULL;
+        }
+        factory->next_unused++;
+    }
     
     factory->max_edge_count = (factory->edge_count + 1 > factory->max_edge_count) ? 
                               factory->edge_count + 1 : factory->max_edge_count;
     factory->edge_count++;
     
-    RefEdge *edge;
-    if (factory->buffer == NULL) {
-        edge = malloc(sizeof(RefEdge));
-        if (!edge) return NULL;
-    } else {
-        edge = factory->buffer;
-        factory->buffer = edge->source;
-    }
-    
+    RefEdge *edge = refedgefactory_get(factory, index);
     edge->pos = pos;
     edge->offset = offset;
     edge->length = length;
     edge->total_size = total_size;
-    edge->source = source;
+    edge->source = refedgefactory_index_of(factory, source);
     edge->refcount = 1;
     edge->_heap_index = 0;
     
@@ -68,8 +121,8 @@ RefEdge* refedgefactory_create(RefEdgeFactory *factory, int pos, int offset, int
 void refedgefactory_destroy(RefEdgeFactory *factory, RefEdge *edge, int clean) {
     if (!edge) return;
     
-    edge->source = factory->buffer;
-    factory->buffer = edge;
+    edge->source = factory->free_list;
+    factory->free_list = refedgefactory_index_of(factory, edge);
     factory->edge_count--;
     
     if (clean) {
@@ -2,35 +2,52 @@
 #define REFEDGE_H
 
 #include <stdlib.h>
+#include "Arena.h"
 
 // For each offset: Best total size with last ref having that offset
+// Edges live in the slab of a RefEdgeFactory and refer to their source edge
+// by 32-bit slab index (0 meaning none), which keeps the struct small.
 typedef struct RefEdge {
     int pos;
     int offset;
     int length;
     int total_size;
     int refcount;
-    struct RefEdge *source;
+    unsigned source;
     int _heap_index;
 } RefEdge;
 
-// Factory for RefEdge objects which recycles destroyed objects for efficiency
+#define REFEDGE_OVERFLOW_CHUNK_BITS 16
+#define REFEDGE_OVERFLOW_CHUNK_SIZE (1u << REFEDGE_OVERFLOW_CHUNK_BITS)
+
+// Factory for RefEdge objects which recycles destroyed objects for efficiency.
+// All edges up to the capacity are carved out of a single slab and linked by
+// index. Should the parser exceed the capacity (when no edge can be cleaned),
+// further edges are taken from overflow chunks, which never move either.
 typedef struct RefEdgeFactory {
     int edge_capacity;
     int edge_count;
     int cleaned_edges;
     int max_edge_count;
     int max_cleaned_edges;
-    RefEdge *buffer;
+    RefEdge *slab;
+    unsigned slab_size;
+    RefEdge **overflow;
+    unsigned overflow_count;
+    unsigned next_unused;
+    unsigned free_list;
+    Arena *arena;
 } RefEdgeFactory;
 
 // Function declarations
-RefEdgeFactory* refedgefactory_new(int edge_capacity);
+RefEdgeFactory* refedgefactory_new(int edge_capacity, Arena *arena);
 void refedgefactory_free(RefEdgeFactory *factory);
 void refedgefactory_reset(RefEdgeFactory *factory);
 RefEdge* refedgefactory_create(RefEdgeFactory *factory, int pos, int offset, int length, int total_size, RefEdge *source);
 void refedgefactory_destroy(RefEdgeFactory *factory, RefEdge *edge, int clean);
 int refedgefactory_full(RefEdgeFactory *factory);
+RefEdge* refedgefactory_get(RefEdgeFactory *factory, unsigned index);
+RefEdge* refedgefactory_source(RefEdgeFactory *factory, RefEdge *edge);
 
 // Helper functions
 int refedge_target(RefEdge *edge);
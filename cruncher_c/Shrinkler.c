@@ -12,6 +12,7 @@ Main file for the cruncher.
 #define SHRINKLER_TITLE ("Shrinkler executable file compressor by Blueberry - development version (built " __DATE__ " " __TIME__ ")\n\n")
 #endif
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,7 @@ Main file for the cruncher.
 
 #include "HunkFile.h"
 #include "DataFile.h"
+#include "OutputCache.h"
 
 void usage() {
 	printf("Usage: Shrinkler <options> <input executable> <output executable>\n");
@@ -39,11 +41,17 @@ void usage() {
 	printf(" -e, --effort         Perseverance in finding multiple matches (300)\n");
 	printf(" -s, --skip-length    Minimum match length to accept greedily (3000)\n");
 	printf(" -r, --references     Number of reference edges to keep in memory (100000)\n");
+	printf(" -j, --threads        Number of threads for finding matches (1)\n");
 	printf(" -t, --text           Print a text, followed by a newline, before decrunching\n");
 	printf(" -T, --textfile       Print the contents of the given file before decrunching\n");
 	printf(" -f, --flash          Poke into a register (e.g. DFF180) during decrunching\n");
 	printf(" -p, --no-progress    Do not print progress info: no ANSI codes in output\n");
-	printf(" --trace              Enable detailed tracing to trace.log\n");
+	printf(" --match-cache        MB of memory for matches found by several threads (256)\n");
+	printf(" --sa-cache           Directory for caching suffix arrays between runs\n");
+	printf(" --work-memory        Crunch in a single block of work memory of this many MB\n");
+	printf(" --cache              Directory for caching crunched output between runs\n");
+	printf(" --trace              Enable detailed tracing to trace_c.log\n");
+	printf("                      (only in builds made with TRACE=1)\n");
 	printf("\n");
 	exit(0);
 }
@@ -193,6 +201,67 @@ void init_digit_parameter(DigitParameter *param, int default_value, int argc, co
 	}
 }
 
+// Print a message and append it to the text recorded for the output cache
+void report(char *text, size_t size, const char *format, ...) {
+	size_t length = strlen(text);
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text + length, size - length, format, args);
+	va_end(args);
+	printf("%s", text + length);
+}
+
+// Save the output of the crunch from the cache given by the cache option,
+// printing what the crunch printed. Returns whether it was in the cache.
+int use_cached_output(const OutputCache *cache, const char *dir, const char *infile, const char *outfile, int executable) {
+	OutputCacheEntry *entry = outputcache_load(cache, dir);
+	if (!entry) return 0;
+	printf("Loading file %s...\n\n", infile);
+	printf("Using crunched output from cache %s\n\n", dir);
+	printf("%s", entry->report);
+	printf("Saving file %s...\n\n", outfile);
+	FILE *f = fopen(outfile, "wb");
+	int ok = f && fwrite(entry->output, 1, entry->output_length, f) == (size_t)entry->output_length;
+	if (f) ok = fclose(f) == 0 && ok;
+	if (!ok) {
+		printf("Error while writing file %s\n\n", outfile);
+		exit(1);
+	}
+#ifdef S_IRWXU // Is the POSIX file permission API available?
+	if (executable) chmod(outfile, 0755); // Mark file executable
+#endif
+	printf("Final file size: %d\n\n", entry->output_length);
+	printf("%s", entry->note);
+	outputcache_free_entry(entry);
+	return 1;
+}
+
+// Store the saved output file of a crunch in the cache given by the cache
+// option, along with what the crunch printed
+void cache_output(const OutputCache *cache, const char *dir, const char *report_text, const char *outfile, const char *note) {
+	FILE *f = fopen(outfile, "rb");
+	if (!f) return;
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char *output = length >= 0 ? malloc(length + 1) : NULL;
+	int ok = output && fread(output, 1, length, f) == (size_t)length;
+	fclose(f);
+	if (ok) outputcache_save(cache, dir, report_text, output, length, note);
+	free(output);
+}
+
+// Report how much of the block given by the work-memory option the crunch
+// used. Running out of it is fatal, as running out of heap memory would be.
+void report_work_memory(const Arena *arena) {
+	if (!arena) return;
+	if (arena->failed) {
+		printf("Error: Not enough work memory for crunching.\n\n");
+		exit(1);
+	}
+	printf("Work memory used: %lu bytes\n\n", (unsigned long) arena->peak);
+}
+
 int main2(int argc, const char *argv[]) {
 	printf(SHRINKLER_TITLE);
 
@@ -248,6 +317,12 @@ int main2(int argc, const char *argv[]) {
 	IntParameter references;
 	init_int_parameter(&references, "-r", "--references", 1000, 100000000, 100000, argc, argv, consumed);
 	
+	IntParameter threads;
+	init_int_parameter(&threads, "-j", "--threads", 1, 64, 1, argc, argv, consumed);
+	
+	IntParameter match_cache;
+	init_int_parameter(&match_cache, "--match-cache", "--match-cache", 0, 100000, 256, argc, argv, consumed);
+	
 	StringParameter text;
 	init_string_parameter(&text, "-t", "--text", argc, argv, consumed);
 	
@@ -260,6 +335,15 @@ int main2(int argc, const char *argv[]) {
 	FlagParameter no_progress;
 	init_flag_parameter(&no_progress, "-p", "--no-progress", argc, argv, consumed);
 	
+	StringParameter sa_cache;
+	init_string_parameter(&sa_cache, "--sa-cache", "--sa-cache", argc, argv, consumed);
+	
+	StringParameter cache;
+	init_string_parameter(&cache, "--cache", "--cache", argc, argv, consumed);
+	
+	IntParameter work_memory;
+	init_int_parameter(&work_memory, "--work-memory", "--work-memory", 1, 2047, 0, argc, argv, consumed);
+	
 	FlagParameter trace;
 	init_flag_parameter(&trace, "--trace", "--trace", argc, argv, consumed);
 
@@ -293,12 +377,23 @@ int main2(int argc, const char *argv[]) {
 		usage();
 	}
 
-	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || references.seen || text.seen || textfile.seen || flash.seen)) {
+	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || references.seen || threads.seen || match_cache.seen || sa_cache.seen || work_memory.seen || text.seen || textfile.seen || flash.seen)) {
 		printf("Error: The no-crunch option cannot be used together with any of the\n");
 		printf("crunching options.\n\n");
 		usage();
 	}
 
+	if (cache.seen && (no_crunch.seen || trace.seen)) {
+		printf("Error: The cache option cannot be used together with the no-crunch\n");
+		printf("or trace options.\n\n");
+		usage();
+	}
+
+	if (trace.seen && !TRACE_COMPILED) {
+		printf("Error: The trace option needs a build made with TRACE=1.\n\n");
+		usage();
+	}
+
 	if (overlap.seen && mini.seen) {
 		printf("Error: The overlap and mini options cannot be used together.\n\n");
 		usage();
@@ -337,6 +432,26 @@ int main2(int argc, const char *argv[]) {
 	params.skip_length = skip_length.value;
 	params.match_patience = effort.value;
 	params.max_same_length = same_length.value;
+	params.suffix_array_cache = sa_cache.value;
+	params.threads = threads.value;
+	params.match_cache_size = (size_t) match_cache.value << 20;
+
+	// All work memory of the crunch is taken from one block if requested
+	Arena arena;
+	void *work_memory_block = NULL;
+	params.arena = NULL;
+	if (work_memory.seen) {
+		size_t work_memory_size = (size_t) work_memory.value << 20;
+		work_memory_block = malloc(work_memory_size);
+		if (!work_memory_block) {
+			printf("Error: Could not allocate %d MB of work memory\n\n", work_memory.value);
+			free(consumed);
+			free(files);
+			return 1;
+		}
+		arena_init(&arena, work_memory_block, work_memory_size);
+		params.arena = &arena;
+	}
 
 	char *decrunch_text = NULL;
 	int decrunch_text_len = 0;
@@ -376,6 +491,42 @@ int main2(int argc, const char *argv[]) {
 		fclose(decrunch_text_file);
 	}
 
+	// The output depends on the version, the options and the files read
+	OutputCache output_cache;
+	outputcache_init(&output_cache);
+	char crunch_report[512] = "";
+	char crunch_note[256] = "";
+	if (cache.seen) {
+		outputcache_add_bytes(&output_cache, "version", SHRINKLER_TITLE, strlen(SHRINKLER_TITLE));
+		outputcache_add_int(&output_cache, "data", data.seen);
+		outputcache_add_int(&output_cache, "header", header.seen);
+		outputcache_add_int(&output_cache, "hunkmerge", hunkmerge.seen);
+		outputcache_add_int(&output_cache, "overlap", overlap.seen);
+		outputcache_add_int(&output_cache, "mini", mini.seen);
+		outputcache_add_int(&output_cache, "commandline", commandline.seen);
+		outputcache_add_bytes(&output_cache, "text", decrunch_text, decrunch_text_len);
+		outputcache_add_int(&output_cache, "flash", flash.value);
+		outputcache_add_int(&output_cache, "references", references.value);
+		outputcache_add_int(&output_cache, "parity_context", params.parity_context);
+		outputcache_add_int(&output_cache, "iterations", params.iterations);
+		outputcache_add_int(&output_cache, "length_margin", params.length_margin);
+		outputcache_add_int(&output_cache, "skip_length", params.skip_length);
+		outputcache_add_int(&output_cache, "match_patience", params.match_patience);
+		outputcache_add_int(&output_cache, "max_same_length", params.max_same_length);
+		if (!outputcache_add_file(&output_cache, "input", infile)) {
+			printf("Error while reading file %s\n\n", infile);
+			exit(1);
+		}
+		if (use_cached_output(&output_cache, cache.value, infile, outfile, !data.seen)) {
+			outputcache_free(&output_cache);
+			free(consumed);
+			free(files);
+			free(decrunch_text);
+			free(work_memory_block);
+			return 0;
+		}
+	}
+
 	if (data.seen) {
 		// Data file compression
 		printf("Loading file %s...\n\n", infile);
@@ -383,15 +534,26 @@ int main2(int argc, const char *argv[]) {
 		datafile_load(orig, infile);
 
 		printf("Crunching...\n\n");
-			RefEdgeFactory *edge_factory = refedgefactory_new(references.value);
+		size_t needed_memory = packdata_work_memory(orig->data_size, &params, references.value);
+		if (params.arena && needed_memory > arena.size) {
+			printf("Error: Crunching this file needs at least %lu bytes of work memory.\n\n", (unsigned long) needed_memory);
+			datafile_free(orig);
+			free(consumed);
+			free(files);
+			free(decrunch_text);
+			free(work_memory_block);
+			return 1;
+		}
+			RefEdgeFactory *edge_factory = refedgefactory_new(references.value, params.arena);
 	if (!edge_factory) {
 		printf("Error: Failed to create edge factory\n");
 		return 1;
 	}
 		DataFile *crunched = datafile_crunch(orig, &params, edge_factory, !no_progress.seen, trace.seen);
 		datafile_free(orig);
-		printf("References considered:%8d\n",  edge_factory->max_edge_count);
-		printf("References discarded:%9d\n\n", edge_factory->max_cleaned_edges);
+		report_work_memory(params.arena);
+		report(crunch_report, sizeof(crunch_report), "References considered:%8d\n",  edge_factory->max_edge_count);
+		report(crunch_report, sizeof(crunch_report), "References discarded:%9d\n\n", edge_factory->max_cleaned_edges);
 
 		printf("Saving file %s...\n\n", outfile);
 		datafile_save(crunched, outfile, header.seen);
@@ -399,15 +561,20 @@ int main2(int argc, const char *argv[]) {
 		printf("Final file size: %d\n\n", datafile_size(crunched, header.seen));
 		
 		if (edge_factory->max_edge_count > references.value) {
-			printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+			report(crunch_note, sizeof(crunch_note), "Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+		}
+		if (cache.seen) {
+			cache_output(&output_cache, cache.value, crunch_report, outfile, crunch_note);
 		}
 		
 		datafile_free(crunched);
 		refedgefactory_free(edge_factory);
+		outputcache_free(&output_cache);
 
 		free(consumed);
 		free(files);
 		free(decrunch_text);
+		free(work_memory_block);
 		return 0;
 	}
 
@@ -421,6 +588,7 @@ int main2(int argc, const char *argv[]) {
 		free(consumed);
 		free(files);
 		free(decrunch_text);
+		free(work_memory_block);
 		return 1;
 	}
 
@@ -457,6 +625,7 @@ int main2(int argc, const char *argv[]) {
 		free(consumed);
 		free(files);
 		free(decrunch_text);
+		free(work_memory_block);
 		return 0;
 	}
 
@@ -468,19 +637,21 @@ int main2(int argc, const char *argv[]) {
 		free(consumed);
 		free(files);
 		free(decrunch_text);
+		free(work_memory_block);
 		return 1;
 	}
 	int orig_mem = hunkfile_memory_usage(orig, 1);
 	printf("Crunching...\n\n");
-	RefEdgeFactory *edge_factory = refedgefactory_new(references.value);
+	RefEdgeFactory *edge_factory = refedgefactory_new(references.value, params.arena);
 	if (!edge_factory) {
 		printf("Error: Failed to create edge factory\n");
 		return 1;
 	}
 	HunkFile *crunched = hunkfile_crunch(orig, &params, overlap.seen, mini.seen, commandline.seen, decrunch_text, flash.value, edge_factory, !no_progress.seen, trace.seen);
 	hunkfile_free(orig);
-			printf("References considered:%8d\n",  edge_factory->max_edge_count);
-		printf("References discarded:%9d\n\n", edge_factory->max_cleaned_edges);
+	report_work_memory(params.arena);
+	report(crunch_report, sizeof(crunch_report), "References considered:%8d\n",  edge_factory->max_edge_count);
+	report(crunch_report, sizeof(crunch_report), "References discarded:%9d\n\n", edge_factory->max_cleaned_edges);
 	if (!hunkfile_analyze(crunched)) {
 		printf("\nError while analyzing crunched file!\n\n");
 		hunkfile_free(crunched);
@@ -489,8 +660,8 @@ int main2(int argc, const char *argv[]) {
 	int crunched_mem_during = hunkfile_memory_usage(crunched, 1);
 	int crunched_mem_after = hunkfile_memory_usage(crunched, mini.seen || overlap.seen);
 
-	printf("Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
-	printf("Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
+	report(crunch_report, sizeof(crunch_report), "Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
+	report(crunch_report, sizeof(crunch_report), "Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
 
 	printf("Saving file %s...\n\n", outfile);
 	hunkfile_save(crunched, outfile);
@@ -500,15 +671,20 @@ int main2(int argc, const char *argv[]) {
 	printf("Final file size: %d\n\n", hunkfile_size(crunched));
 	
 	if (edge_factory->max_edge_count > references.value) {
-		printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+		report(crunch_note, sizeof(crunch_note), "Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+	}
+	if (cache.seen) {
+		cache_output(&output_cache, cache.value, crunch_report, outfile, crunch_note);
 	}
 	
 	hunkfile_free(crunched);
 	refedgefactory_free(edge_factory);
+	outputcache_free(&output_cache);
 
 	free(consumed);
 	free(files);
 	free(decrunch_text);
+	free(work_memory_block);
 	return 0;
 }
 
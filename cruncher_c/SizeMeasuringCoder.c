@@ -25,15 +25,15 @@ static int size_for_count(int count, int total) {
 	return size;
 }
 
-SizeMeasuringCoder* sizemeasuringcoder_new(CountingCoder *counting_coder) {
-	SizeMeasuringCoder *coder = malloc(sizeof(SizeMeasuringCoder));
+SizeMeasuringCoder* sizemeasuringcoder_new(CountingCoder *counting_coder, Arena *arena) {
+	SizeMeasuringCoder *coder = arena_malloc(arena, sizeof(SizeMeasuringCoder));
 	if (!coder) return NULL;
 	
 	coder->counting_coder = counting_coder;
 	coder->num_contexts = counting_coder->num_contexts;
-	coder->context_sizes = malloc(coder->num_contexts * 2 * sizeof(unsigned short));
+	coder->context_sizes = arena_malloc(arena, coder->num_contexts * 2 * sizeof(unsigned short));
 	if (!coder->context_sizes) {
-		free(coder);
+		arena_free(arena, coder);
 		return NULL;
 	}
 	
@@ -51,14 +51,15 @@ SizeMeasuringCoder* sizemeasuringcoder_new(CountingCoder *counting_coder) {
 	coder->base.has_cache = 0;
 	coder->base.cache = NULL;
 	coder->base.cache_sizes = NULL;
+	coder->base.arena = arena;
 	
 	return coder;
 }
 
 void sizemeasuringcoder_free(SizeMeasuringCoder *coder) {
 	if (coder) {
-		free(coder->context_sizes);
-		free(coder);
+		arena_free(coder->base.arena, coder->context_sizes);
+		arena_free(coder->base.arena, coder);
 	}
 }
 
@@ -19,6 +19,6 @@ typedef struct {
 } SizeMeasuringCoder;
 
 // Function declarations
-SizeMeasuringCoder* sizemeasuringcoder_new(CountingCoder *counting_coder);
+SizeMeasuringCoder* sizemeasuringcoder_new(CountingCoder *counting_coder, Arena *arena);
 void sizemeasuringcoder_free(SizeMeasuringCoder *coder);
 void sizemeasuringcoder_set_number_contexts(SizeMeasuringCoder *coder, int number_context_offset, int n_number_contexts, int max_number);
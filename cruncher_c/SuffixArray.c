@@ -4,14 +4,190 @@
 
 Suffix array construction based on the SA-IS algorithm.
 
+For long strings, symbol counting and suffix classification are split into
+chunks handled by separate threads, and the induction scans run in blocks:
+for each block of suffix array entries, the bucket each entry induces into
+is computed in parallel, and the sequential scan then only does the stores.
+Entries changed by stores into the current block are recomputed, so the
+result is the same as with the sequential construction.
+
 */
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include "SuffixArray.h"
+#include "Threads.h"
+
+// Run n_tasks tasks, each on its own thread
+static void run_tasks(JobFunc fn, void *tasks, size_t task_size, int n_tasks) {
+	run_jobs(fn, tasks, task_size, n_tasks, n_tasks);
+}
+
+static int chunk_start(int begin, int end, int j, int n_chunks) {
+	return begin + (int) ((long long) (end - begin) * j / n_chunks);
+}
+
+// Count symbols and compute suffix types for a chunk of the string.
+// Types at the end of the chunk which depend on the next chunk are marked 2.
+typedef struct {
+	const int *data;
+	int begin, end, length;
+	unsigned char *stype;
+	int *counts;
+	int undetermined;
+	int lms_count;
+} ClassifyTask;
+
+static void classify_task(void *arg) {
+	ClassifyTask *task = arg;
+	unsigned char is_s = 2;
+	for (int i = task->end - 1; i >= task->begin; i--) {
+		task->counts[task->data[i]]++;
+		if (i == task->length - 1 || task->data[i] < task->data[i + 1]) {
+			is_s = 1;
+		} else if (task->data[i] > task->data[i + 1]) {
+			is_s = 0;
+		}
+		task->stype[i] = is_s;
+		if (is_s == 2) task->undetermined++;
+	}
+}
+
+static void count_lms_task(void *arg) {
+	ClassifyTask *task = arg;
+	for (int i = task->begin; i < task->end; i++) {
+		if (IS_LMS(i, task->stype)) task->lms_count++;
+	}
+}
+
+// Compute suffix types and count symbols using several threads.
+// Returns the number of LMS suffixes, or -1 if out of memory.
+static int classify_parallel(const int *data, int length, int alphabet_size, unsigned char *stype, int *buckets, int n_threads, Arena *arena) {
+	ClassifyTask tasks[SUFFIX_ARRAY_MAX_THREADS];
+	int *counts = arena_calloc(arena, (size_t) n_threads * (alphabet_size + 1), sizeof(int));
+	if (!counts) return -1;
+	for (int j = 0; j < n_threads; j++) {
+		tasks[j].data = data;
+		tasks[j].begin = chunk_start(0, length, j, n_threads);
+		tasks[j].end = chunk_start(0, length, j + 1, n_threads);
+		tasks[j].length = length;
+		tasks[j].stype = stype;
+		tasks[j].counts = counts + j * (alphabet_size + 1);
+		tasks[j].undetermined = 0;
+		tasks[j].lms_count = 0;
+	}
+	run_tasks(classify_task, tasks, sizeof(ClassifyTask), n_threads);
+
+	// Resolve types at chunk ends from the start of the following chunk
+	memset(buckets, 0, (alphabet_size + 1) * sizeof(int));
+	for (int j = n_threads - 1; j >= 0; j--) {
+		for (int i = tasks[j].end - tasks[j].undetermined; i < tasks[j].end; i++) {
+			stype[i] = stype[tasks[j].end];
+		}
+		for (int b = 0; b <= alphabet_size; b++) {
+			buckets[b] += tasks[j].counts[b];
+		}
+	}
+	arena_free(arena, counts);
+
+	run_tasks(count_lms_task, tasks, sizeof(ClassifyTask), n_threads);
+	int lms_count = 0;
+	for (int j = 0; j < n_threads; j++) {
+		lms_count += tasks[j].lms_count;
+	}
+	return lms_count;
+}
+
+// Compute the induction targets for a range of suffix array entries
+typedef struct {
+	const int *data;
+	const int *suffix_array;
+	const unsigned char *stype;
+	int begin, end;
+	unsigned char type;
+	int *pre_index;
+	int *pre_symbol;
+} PrefetchTask;
+
+static void prefetch_task(void *arg) {
+	PrefetchTask *task = arg;
+	for (int s = task->begin; s < task->end; s++) {
+		int index = task->suffix_array[s];
+		task->pre_index[s - task->begin] = index;
+		task->pre_symbol[s - task->begin] = index > 0 && task->stype[index - 1] == task->type ? task->data[index - 1] : UNINITIALIZED;
+	}
+}
 
-static void induce(const int *data, int *suffix_array, int length, int alphabet_size, const int *stype, const int *buckets, int *bucket_index) {
+static void prefetch_block(const int *data, const int *suffix_array, const unsigned char *stype, int block, int block_end,
+                           unsigned char type, int *pre_index, int *pre_symbol, int n_threads) {
+	assert(n_threads >= 1);
+	PrefetchTask tasks[SUFFIX_ARRAY_MAX_THREADS];
+	for (int j = 0; j < n_threads; j++) {
+		int begin = chunk_start(block, block_end, j, n_threads);
+		tasks[j].data = data;
+		tasks[j].suffix_array = suffix_array;
+		tasks[j].stype = stype;
+		tasks[j].begin = begin;
+		tasks[j].end = chunk_start(block, block_end, j + 1, n_threads);
+		tasks[j].type = type;
+		tasks[j].pre_index = pre_index + (begin - block);
+		tasks[j].pre_symbol = pre_symbol + (begin - block);
+	}
+	run_tasks(prefetch_task, tasks, sizeof(PrefetchTask), n_threads);
+}
+
+// Induction where the targets of each block of entries are computed in parallel.
+// Returns 0 if out of memory.
+static int induce_parallel(const int *data, int *suffix_array, int length, int alphabet_size, const unsigned char *stype, const int *buckets, int *bucket_index, int n_threads, Arena *arena) {
+	int block_size = length < SUFFIX_ARRAY_INDUCE_BLOCK ? length : SUFFIX_ARRAY_INDUCE_BLOCK;
+	int *pre_index = arena_malloc(arena, 2 * block_size * sizeof(int));
+	if (!pre_index) return 0;
+	int *pre_symbol = pre_index + block_size;
+
+	// Induce L suffixes
+	for (int b = 0; b < alphabet_size; b++) {
+		bucket_index[b] = buckets[b];
+	}
+	for (int block = 0; block < length; block += block_size) {
+		int block_end = block + block_size < length ? block + block_size : length;
+		prefetch_block(data, suffix_array, stype, block, block_end, 0, pre_index, pre_symbol, n_threads);
+		for (int s = block; s < block_end; s++) {
+			int index = suffix_array[s];
+			int symbol = pre_symbol[s - block];
+			if (index != pre_index[s - block]) {
+				symbol = index > 0 && !stype[index - 1] ? data[index - 1] : UNINITIALIZED;
+			}
+			if (symbol != UNINITIALIZED) {
+				suffix_array[bucket_index[symbol]++] = index - 1;
+			}
+		}
+	}
+	// Induce S suffixes
+	for (int b = 0; b < alphabet_size; b++) {
+		bucket_index[b] = buckets[b + 1];
+	}
+	for (int block_end = length; block_end > 0; block_end -= block_size) {
+		int block = block_end - block_size > 0 ? block_end - block_size : 0;
+		prefetch_block(data, suffix_array, stype, block, block_end, 1, pre_index, pre_symbol, n_threads);
+		for (int s = block_end - 1; s >= block; s--) {
+			int index = suffix_array[s];
+			assert(index != UNINITIALIZED);
+			int symbol = pre_symbol[s - block];
+			if (index != pre_index[s - block]) {
+				symbol = index > 0 && stype[index - 1] ? data[index - 1] : UNINITIALIZED;
+			}
+			if (symbol != UNINITIALIZED) {
+				suffix_array[--bucket_index[symbol]] = index - 1;
+			}
+		}
+	}
+
+	arena_free(arena, pre_index);
+	return 1;
+}
+
+static void induce(const int *data, int *suffix_array, int length, int alphabet_size, const unsigned char *stype, const int *buckets, int *bucket_index) {
 	// Induce L suffixes
 	for (int b = 0; b < alphabet_size; b++) {
 		bucket_index[b] = buckets[b];
@@ -35,7 +211,7 @@ static void induce(const int *data, int *suffix_array, int length, int alphabet_
 	}
 }
 
-static int substrings_equal(const int *data, int i1, int i2, const int *stype) {
+static int substrings_equal(const int *data, int i1, int i2, const unsigned char *stype) {
 	while (data[i1++] == data[i2++]) {
 		if (IS_LMS(i1, stype) && IS_LMS(i2, stype)) return 1;
 	}
@@ -44,41 +220,51 @@ static int substrings_equal(const int *data, int i1, int i2, const int *stype) {
 
 // Compute the suffix array of a string over an integer alphabet.
 // The last character in the string (the sentinel) must be uniquely smallest in the string.
-void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size) {
+void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size, int n_threads, Arena *arena) {
 	// Handle empty string
 	assert(length >= 1);
 	if (length == 1) {
 		suffix_array[0] = 0;
 		return;
 	}
+	if (n_threads > SUFFIX_ARRAY_MAX_THREADS) n_threads = SUFFIX_ARRAY_MAX_THREADS;
+	int parallel = n_threads > 1 && length >= SUFFIX_ARRAY_PARALLEL_THRESHOLD;
 
 	// Optimization: Allocate all arrays at once to reduce malloc calls
-	int total_size = length + (alphabet_size + 1) + alphabet_size;
-	int *all_arrays = malloc(total_size * sizeof(int));
+	int total_size = (alphabet_size + 1) + alphabet_size;
+	int *all_arrays = arena_malloc(arena, total_size * sizeof(int) + length);
 	if (!all_arrays) {
 		return;
 	}
 	
 	// Assign pointers to arrays
-	int *stype = all_arrays;
-	int *buckets = stype + length;
+	int *buckets = all_arrays;
 	int *bucket_index = buckets + (alphabet_size + 1);
+	unsigned char *stype = (unsigned char *) (bucket_index + alphabet_size);
 	
 	// Compute suffix types and count symbols
-	stype[length - 1] = 1;
-	memset(buckets, 0, (alphabet_size + 1) * sizeof(int));
-	buckets[data[length - 1]] = 1;
-	int is_s = 1;
 	int lms_count = 0;
-	for (int i = length - 2; i >= 0; i--) {
-		buckets[data[i]]++;
-		if (data[i] > data[i + 1]) {
-			if (is_s) lms_count++;
-			is_s = 0;
-		} else if (data[i] < data[i + 1]) {
-			is_s = 1;
+	if (parallel) {
+		lms_count = classify_parallel(data, length, alphabet_size, stype, buckets, n_threads, arena);
+		if (lms_count < 0) {
+			arena_free(arena, all_arrays);
+			return;
+		}
+	} else {
+		stype[length - 1] = 1;
+		memset(buckets, 0, (alphabet_size + 1) * sizeof(int));
+		buckets[data[length - 1]] = 1;
+		int is_s = 1;
+		for (int i = length - 2; i >= 0; i--) {
+			buckets[data[i]]++;
+			if (data[i] > data[i + 1]) {
+				if (is_s) lms_count++;
+				is_s = 0;
+			} else if (data[i] < data[i + 1]) {
+				is_s = 1;
+			}
+			stype[i] = is_s;
 		}
-		stype[i] = is_s;
 	}
 
 	// Accumulate bucket sizes
@@ -104,7 +290,9 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce to sort LMS strings
-	induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
+	if (!parallel || !induce_parallel(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index, n_threads, arena)) {
+		induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
+	}
 
 	// Compact LMS indices at the beginning of the suffix array
 	int j = 0;
@@ -150,7 +338,7 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 		assert(j == lms_count);
 
 		// Sort named LMS symbols recursively
-		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size);
+		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size, n_threads, arena);
 
 		// Map named LMS symbol indices to LMS string indices in input string
 		j = 0;
@@ -180,8 +368,10 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce from sorted LMS strings to sort all suffixes
-	induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
+	if (!parallel || !induce_parallel(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index, n_threads, arena)) {
+		induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
+	}
 
 	// Cleanup - now free only one array
-	free(all_arrays);
+	arena_free(arena, all_arrays);
 }
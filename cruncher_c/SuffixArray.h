@@ -4,13 +4,27 @@
 
 Suffix array construction based on the SA-IS algorithm.
 
+For long strings, the construction can use several threads, with exactly the
+same result as the sequential construction. See SuffixArray.c.
+
 */
 
 #pragma once
 
+#include "Arena.h"
+
 #define UNINITIALIZED (-1)
 #define IS_LMS(i, stype) ((i) > 0 && (stype)[(i)] && !(stype)[(i) - 1])
 
+// Minimum string length for parallel construction
+#define SUFFIX_ARRAY_PARALLEL_THRESHOLD (1 << 20)
+// Number of suffix array entries per parallel induction block
+#define SUFFIX_ARRAY_INDUCE_BLOCK (1 << 18)
+// Maximum number of threads used for construction
+#define SUFFIX_ARRAY_MAX_THREADS 64
+
 // Compute the suffix array of a string over an integer alphabet.
 // The last character in the string (the sentinel) must be uniquely smallest in the string.
-void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size);
+// Up to n_threads threads are used for strings of at least SUFFIX_ARRAY_PARALLEL_THRESHOLD.
+// Temporary arrays are allocated in the arena, from the calling thread only.
+void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size, int n_threads, Arena *arena);
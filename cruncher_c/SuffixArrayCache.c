@@ -0,0 +1,159 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the suffix array data of the match finder.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SuffixArrayCache.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SUFFIX_ARRAY_CACHE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+	char magic[8];
+	int int_size;
+	int length;
+	unsigned long long hash;
+} SuffixArrayCacheHeader;
+
+static unsigned long long sacache_hash(const unsigned char *data, int length) {
+	// 64-bit FNV-1a
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < length; i++) {
+		h = (h ^ data[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static char* sacache_filename(const char *dir, unsigned long long h, const char *suffix) {
+	size_t dir_len = strlen(dir);
+	char *path = malloc(dir_len + 32);
+	if (!path) return NULL;
+	int sep = dir_len > 0 && dir[dir_len - 1] != '/' && dir[dir_len - 1] != '\\';
+	sprintf(path, "%s%s%016llx.sa%s", dir, sep ? "/" : "", h, suffix);
+	return path;
+}
+
+static size_t sacache_file_size(int length) {
+	return sizeof(SuffixArrayCacheHeader) + 3 * (size_t)(length + 1) * sizeof(int) + length;
+}
+
+static void sacache_make_header(SuffixArrayCacheHeader *header, const unsigned char *data, int length) {
+	memset(header, 0, sizeof(SuffixArrayCacheHeader));
+	strcpy(header->magic, "ShrSAC1");
+	header->int_size = sizeof(int);
+	header->length = length;
+	header->hash = sacache_hash(data, length);
+}
+
+// Check the header and data of a loaded file, and set up the array pointers
+static int sacache_accept(SuffixArrayCacheFile *file, const char *file_data, const unsigned char *data, int length) {
+	SuffixArrayCacheHeader header;
+	sacache_make_header(&header, data, length);
+	if (memcmp(file_data, &header, sizeof(SuffixArrayCacheHeader)) != 0) return 0;
+	const int *arrays = (const int *)(file_data + sizeof(SuffixArrayCacheHeader));
+	if (memcmp(&arrays[3 * (length + 1)], data, length) != 0) return 0;
+	file->suffix_array = &arrays[0];
+	file->rev_suffix_array = &arrays[length + 1];
+	file->longest_common_prefix = &arrays[2 * (length + 1)];
+	return 1;
+}
+
+SuffixArrayCacheFile* sacache_load(const char *dir, const unsigned char *data, int length) {
+	char *path = sacache_filename(dir, sacache_hash(data, length), "");
+	if (!path) return NULL;
+	size_t size = sacache_file_size(length);
+	SuffixArrayCacheFile *file = calloc(1, sizeof(SuffixArrayCacheFile));
+	if (!file) {
+		free(path);
+		return NULL;
+	}
+
+#ifdef SUFFIX_ARRAY_CACHE_MMAP
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) {
+		free(file);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size != size) {
+		close(fd);
+		free(file);
+		return NULL;
+	}
+	void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		free(file);
+		return NULL;
+	}
+	file->mapping = m;
+	file->mapping_size = size;
+	if (!sacache_accept(file, m, data, length)) {
+		sacache_free(file);
+		return NULL;
+	}
+#else
+	FILE *f = fopen(path, "rb");
+	free(path);
+	if (!f) {
+		free(file);
+		return NULL;
+	}
+	file->contents = malloc(size);
+	int ok = file->contents && fread(file->contents, 1, size, f) == size && fgetc(f) == EOF;
+	fclose(f);
+	if (!ok || !sacache_accept(file, file->contents, data, length)) {
+		sacache_free(file);
+		return NULL;
+	}
+#endif
+	return file;
+}
+
+void sacache_free(SuffixArrayCacheFile *file) {
+	if (file) {
+#ifdef SUFFIX_ARRAY_CACHE_MMAP
+		if (file->mapping) {
+			munmap(file->mapping, file->mapping_size);
+		}
+#endif
+		free(file->contents);
+		free(file);
+	}
+}
+
+void sacache_save(const char *dir, const unsigned char *data, int length,
+                  const int *suffix_array, const int *rev_suffix_array, const int *longest_common_prefix) {
+	SuffixArrayCacheHeader header;
+	sacache_make_header(&header, data, length);
+	char *path = sacache_filename(dir, header.hash, "");
+	char *temp_path = sacache_filename(dir, header.hash, ".tmp");
+	FILE *f = path && temp_path ? fopen(temp_path, "wb") : NULL;
+	if (f) {
+		size_t n = length + 1;
+		int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		         fwrite(suffix_array, sizeof(int), n, f) == n &&
+		         fwrite(rev_suffix_array, sizeof(int), n, f) == n &&
+		         fwrite(longest_common_prefix, sizeof(int), n, f) == n &&
+		         fwrite(data, 1, length, f) == (size_t)length;
+		ok = fclose(f) == 0 && ok;
+		remove(path);
+		if (!ok || rename(temp_path, path) != 0) {
+			remove(temp_path);
+		}
+	}
+	free(path);
+	free(temp_path);
+}
@@ -0,0 +1,35 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache for the suffix array data of the match finder.
+
+Files are named after a hash of the data and contain the data itself, so a
+file is only used if the data matches exactly. The file format is the same
+as for the C++ cruncher (see cruncher/SuffixArrayCache.h), so both crunchers
+can share a cache directory. Where available, files are memory mapped on load.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+	void *mapping;
+	size_t mapping_size;
+	void *contents;
+
+	// Read-only, valid until the file is freed
+	const int *suffix_array;
+	const int *rev_suffix_array;
+	const int *longest_common_prefix;
+} SuffixArrayCacheFile;
+
+// Load cached arrays for the given data. Returns NULL if no valid file was found.
+SuffixArrayCacheFile* sacache_load(const char *dir, const unsigned char *data, int length);
+void sacache_free(SuffixArrayCacheFile *file);
+
+// Store arrays for the given data. Failure to write the cache is not an error.
+void sacache_save(const char *dir, const unsigned char *data, int length,
+                  const int *suffix_array, const int *rev_suffix_array, const int *longest_common_prefix);
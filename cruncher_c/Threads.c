@@ -0,0 +1,112 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Minimal support for running independent jobs on several threads.
+
+*/
+
+#include "Threads.h"
+
+#ifndef SHRINKLER_NO_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+typedef struct {
+	JobFunc func;
+	char *jobs;
+	size_t job_size;
+	int n_jobs;
+#ifndef SHRINKLER_NO_THREADS
+#ifdef _WIN32
+	volatile LONG next_job;
+#else
+	int next_job;
+	pthread_mutex_t mutex;
+#endif
+#else
+	int next_job;
+#endif
+} JobRunner;
+
+static int take_job(JobRunner *runner) {
+#ifndef SHRINKLER_NO_THREADS
+#ifdef _WIN32
+	return InterlockedIncrement(&runner->next_job) - 1;
+#else
+	pthread_mutex_lock(&runner->mutex);
+	int j = runner->next_job++;
+	pthread_mutex_unlock(&runner->mutex);
+	return j;
+#endif
+#else
+	return runner->next_job++;
+#endif
+}
+
+static void work(JobRunner *runner) {
+	int j;
+	while ((j = take_job(runner)) < runner->n_jobs) {
+		runner->func(runner->jobs + j * runner->job_size);
+	}
+}
+
+#ifndef SHRINKLER_NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI work_thread(LPVOID runner) {
+	work((JobRunner *) runner);
+	return 0;
+}
+#else
+static void* work_thread(void *runner) {
+	work((JobRunner *) runner);
+	return NULL;
+}
+#endif
+#endif
+
+void run_jobs(JobFunc func, void *jobs, size_t job_size, int n_jobs, int n_threads) {
+	JobRunner runner;
+	runner.func = func;
+	runner.jobs = (char *) jobs;
+	runner.job_size = job_size;
+	runner.n_jobs = n_jobs;
+	runner.next_job = 0;
+	if (n_threads > n_jobs) n_threads = n_jobs;
+	if (n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+
+	// Threads which cannot be started leave their jobs to the others
+#ifndef SHRINKLER_NO_THREADS
+#ifdef _WIN32
+	HANDLE threads[MAX_THREADS];
+	int n_started = 0;
+	for (int t = 1; t < n_threads; t++) {
+		HANDLE thread = CreateThread(NULL, 0, work_thread, &runner, 0, NULL);
+		if (thread) threads[n_started++] = thread;
+	}
+	work(&runner);
+	for (int t = 0; t < n_started; t++) {
+		WaitForSingleObject(threads[t], INFINITE);
+		CloseHandle(threads[t]);
+	}
+#else
+	pthread_t threads[MAX_THREADS];
+	int n_started = 0;
+	pthread_mutex_init(&runner.mutex, NULL);
+	for (int t = 1; t < n_threads; t++) {
+		if (pthread_create(&threads[n_started], NULL, work_thread, &runner) == 0) n_started++;
+	}
+	work(&runner);
+	for (int t = 0; t < n_started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	pthread_mutex_destroy(&runner.mutex);
+#endif
+#else
+	work(&runner);
+#endif
+}
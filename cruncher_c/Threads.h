@@ -0,0 +1,27 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Minimal support for running independent jobs on several threads.
+
+run_jobs runs a list of jobs on at most the given number of threads, handing
+out jobs in list order, and returns when all jobs have completed. Jobs must
+not share mutable state, and must not allocate from an arena.
+
+Threads are taken from pthreads, or from the Win32 API on Windows. If the
+platform has no thread support, define SHRINKLER_NO_THREADS to run all jobs
+sequentially on the calling thread.
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+// Maximum number of threads used by run_jobs
+#define MAX_THREADS 64
+
+typedef void (*JobFunc)(void *job);
+
+// Run func on each of the n_jobs jobs, which are job_size bytes apart
+void run_jobs(JobFunc func, void *jobs, size_t job_size, int n_jobs, int n_threads);
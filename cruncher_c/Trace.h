@@ -0,0 +1,21 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Tracing of the parser and coders to trace_c.log.
+
+Tracing is only compiled in when SHRINKLER_TRACE is defined (make TRACE=1).
+Otherwise, TRACING is constant 0, so the trace checks in the hot loops are
+removed by the compiler.
+
+*/
+
+#pragma once
+
+#ifdef SHRINKLER_TRACE
+#define TRACE_COMPILED 1
+#define TRACING(trace_file) ((trace_file) != NULL)
+#else
+#define TRACE_COMPILED 0
+#define TRACING(trace_file) 0
+#endif
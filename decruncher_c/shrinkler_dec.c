@@ -5,28 +5,76 @@
  */
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 
 /// @cond
+#if defined(__unix__) || defined(__APPLE__)
+#define SHRINKLER_DEC_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SHRINKLER_DEC_THREADS
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SHRINKLER_DEC_BATCH
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
+#define force_inline    inline __attribute__((always_inline))
 #else
 #define likely(x)       (x)
 #define unlikely(x)     (x)
+#define force_inline    inline
 #endif
 
-// Handle endianness - assume little endian for now
-#define read32be(ptr) __builtin_bswap32(*(uint32_t*)(ptr))
+// Big-endian loads from possibly unaligned addresses
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static force_inline uint32_t read32be(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+static force_inline uint64_t read64be(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+}
+#else
+static inline uint32_t read32be(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t read64be(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+}
+#endif
 /// @endcond
 
 // Global trace flag
 static bool g_trace = false;
 
+// Global number of threads for decoding blocks, or 0 for one per processor
+static int g_threads = 0;
+
 #define ADJUST_SHIFT 4             ///< Shift amount for context probability adjustment
 
 #define NUM_SINGLE_CONTEXTS 1      ///< Number of single contexts
@@ -41,6 +89,10 @@ static bool g_trace = false;
 #define CONTEXT_GROUP_OFFSET 2     ///< Context group for offsets
 #define CONTEXT_GROUP_LENGTH 3     ///< Context group for lengths
 
+#define NUMBER_MAX_BITS 30         ///< Maximum number of continuation bits of a number
+#define COPY_SLACK 8               ///< Bytes which a reference copy may write past its end
+#define MAX_OVERRUN 16             ///< Zero bytes which can be read past the end of the input
+
 /** @brief Decompressor state (for assembly) */
 typedef struct {
     uint16_t contexts[NUM_CONTEXTS];    ///< Probability contexts
@@ -52,12 +104,44 @@ typedef struct {
     unsigned intervalsize;              ///< Current interval size
     uint64_t intervalvalue;             ///< Current interval value
 
-    uint8_t *src;                       ///< Pointer to the input data
-    uint8_t *src_end;                   ///< End of input data
+    const uint8_t *src;                 ///< Pointer to the input data
+    const uint8_t *src_end;             ///< End of input data
     int bits_left;                      ///< Number of bits left in the interval
+    int overrun;                        ///< Number of zero bytes read past the end of the input
 } shrinkler_ctx_t;
 
-static void shr_decode_init(shrinkler_ctx_t *ctx, uint8_t *src, size_t src_size) {
+/**
+ * @brief Read the next 4 bytes of the input as a big-endian word
+ *
+ * Past the end of the input, zero bytes are read, so the input needs no
+ * padding. The decrunchers read whole words beyond the end of the data.
+ *
+ * @return 0 on success, or -1 if too much was read past the end
+ */
+static int shr_read_word(shrinkler_ctx_t *ctx, uint32_t *word) {
+    if (likely(ctx->src_end - ctx->src >= 4)) {
+        *word = read32be(ctx->src);
+        ctx->src += 4;
+        return 0;
+    }
+    *word = 0;
+    for (int i = 0; i < 4; i++) {
+        uint32_t byte = 0;
+        if (ctx->src < ctx->src_end) {
+            byte = *ctx->src++;
+        } else {
+            ctx->overrun++;
+        }
+        *word = (*word << 8) | byte;
+    }
+    if (ctx->overrun > MAX_OVERRUN) {
+        fprintf(stderr, "ERROR: Unexpected end of compressed data\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void shr_decode_init(shrinkler_ctx_t *ctx, const uint8_t *src, size_t src_size) {
     for (int i=0; i<NUM_CONTEXTS; i++)
         ctx->contexts[i] = 0x8000;
     
@@ -66,16 +150,12 @@ static void shr_decode_init(shrinkler_ctx_t *ctx, uint8_t *src, size_t src_size)
     ctx->src = src;
     ctx->src_end = src + src_size;
     ctx->bits_left = 0;
+    ctx->overrun = 0;
 
     // Adjust for 64-bit values
-    for (int i=0;i<4;i++) {
-        if (ctx->src >= ctx->src_end) {
-            fprintf(stderr, "ERROR: Not enough data for initialization\n");
-            return;
-        }
-        ctx->intervalvalue = (ctx->intervalvalue << 8) | *ctx->src++;
-    }
-    ctx->intervalvalue <<= 31;
+    uint32_t word;
+    shr_read_word(ctx, &word);
+    ctx->intervalvalue = (uint64_t)word << 31;
     ctx->bits_left = 1;
     ctx->intervalsize = 0x8000;
 }
@@ -93,13 +173,11 @@ static inline int shr_decode_bit(shrinkler_ctx_t *ctx, int context_index) {
     
     while ((ctx->intervalsize < 0x8000)) {
         if (unlikely(ctx->bits_left == 0)) {
-            // Check if we have enough data to read 4 bytes
-            if (ctx->src + 4 > ctx->src_end) {
-                fprintf(stderr, "ERROR: Unexpected end of compressed data\n");
+            uint32_t word;
+            if (shr_read_word(ctx, &word) != 0) {
                 return -1;
             }
-            ctx->intervalvalue |= read32be(ctx->src);
-            ctx->src += 4;
+            ctx->intervalvalue |= word;
             ctx->bits_left = 32;
             if (g_trace) {
                 fprintf(stderr, "      RENORM: read32be, bits_left=32\n");
@@ -150,7 +228,7 @@ static inline int shr_decode_number(shrinkler_ctx_t *ctx, int base_context) {
     }
     
     // First loop: find number of bits
-    for (i = 0 ; i < 16 ; i++) {  // Limit to 16 bits to prevent buffer overflow
+    for (i = 0 ; i < NUMBER_MAX_BITS ; i++) {  // Limit to keep the number within an int
         context = base_context + (i * 2 + 2);
         if (context >= NUM_CONTEXTS) {
             fprintf(stderr, "ERROR: Context index %d out of bounds (max %d)\n", context, NUM_CONTEXTS);
@@ -214,6 +292,108 @@ static inline int lzDecodeNumber(shrinkler_ctx_t *ctx, int context_group) {
     return shr_decode_number(ctx, NUM_SINGLE_CONTEXTS + (context_group << 8));
 }
 
+/**
+ * @brief Decompressor state for the release decode kernel
+ *
+ * The top 16 bits of @c value are the current interval value. Below them,
+ * the following bits of the stream are kept ready, refilled up to 8 bytes
+ * at a time, so the interval can be renormalized in a single shift.
+ */
+typedef struct {
+    uint16_t contexts[NUM_CONTEXTS];    ///< Probability contexts
+    uint64_t value;                     ///< Interval value followed by the next bits of the stream
+    unsigned intervalsize;              ///< Current interval size
+    int bits;                           ///< Number of valid bits in value, from the top
+
+    const uint8_t *src;                 ///< Pointer to the next input byte
+    const uint8_t *src_end;             ///< End of input data
+    int overrun;                        ///< Number of zero bytes read past the end of the input
+} shrinkler_fast_ctx_t;
+
+/// @cond
+#if defined(__GNUC__) || defined(__clang__)
+#define clz32(x) __builtin_clz(x)
+#else
+static inline int clz32(uint32_t x) {
+    int n = 0;
+    while (!(x & 0x80000000u)) { x <<= 1; n++; }
+    return n;
+}
+#endif
+/// @endcond
+
+/**
+ * @brief Refill the bits of the stream to at least 56
+ *
+ * Whole 8-byte words are loaded while they are within the input. Near the
+ * end, the input is read byte by byte, followed by zeros.
+ */
+static inline void shr_fast_refill(shrinkler_fast_ctx_t *ctx) {
+    if (likely(ctx->src_end - ctx->src >= 8)) {
+        ctx->value |= read64be(ctx->src) >> ctx->bits;
+        ctx->src += (63 - ctx->bits) >> 3;
+        ctx->bits |= 56;
+        return;
+    }
+    while (ctx->bits <= 56) {
+        uint64_t byte = 0;
+        if (ctx->src < ctx->src_end) {
+            byte = *ctx->src++;
+        } else {
+            ctx->overrun++;
+        }
+        ctx->value |= byte << (56 - ctx->bits);
+        ctx->bits += 8;
+    }
+}
+
+static void shr_fast_init(shrinkler_fast_ctx_t *ctx, const uint8_t *src, size_t src_size) {
+    for (int i = 0; i < NUM_CONTEXTS; i++)
+        ctx->contexts[i] = 0x8000;
+
+    // The interval value starts with a zero bit followed by the stream
+    ctx->value = 0;
+    ctx->bits = 1;
+    ctx->intervalsize = 0x8000;
+    ctx->src = src;
+    ctx->src_end = src + src_size;
+    ctx->overrun = 0;
+    shr_fast_refill(ctx);
+}
+
+static inline int shr_fast_decode_bit(shrinkler_fast_ctx_t *ctx, int context_index) {
+    // Renormalize
+    if (unlikely(ctx->bits < 32)) {
+        shr_fast_refill(ctx);
+    }
+    int shift = clz32(ctx->intervalsize) - 16;
+    ctx->intervalsize <<= shift;
+    ctx->value <<= shift;
+    ctx->bits -= shift;
+
+    // Decode, selecting the outcome with masks rather than branches
+    unsigned prob = ctx->contexts[context_index];
+    unsigned threshold = (ctx->intervalsize * prob) >> 16;
+    unsigned bit = (unsigned)(ctx->value >> 48) < threshold;
+    unsigned mask = 0u - bit;
+    ctx->value -= (uint64_t)(threshold & ~mask) << 48;
+    ctx->intervalsize = (threshold & mask) | ((ctx->intervalsize - threshold) & ~mask);
+    ctx->contexts[context_index] = prob - (prob >> ADJUST_SHIFT) + ((0xffff >> ADJUST_SHIFT) & mask);
+    return bit;
+}
+
+static inline int shr_fast_decode_number(shrinkler_fast_ctx_t *ctx, int base_context) {
+    int i;
+    for (i = 0; i < NUMBER_MAX_BITS; i++) {
+        if (!shr_fast_decode_bit(ctx, base_context + (i * 2 + 2))) break;
+    }
+    int number = 1;
+    for (; i >= 0; i--) {
+        number = (number << 1) | shr_fast_decode_bit(ctx, base_context + (i * 2 + 1));
+    }
+    return number;
+}
+
 /**
  * @brief Increase output buffer size by doubling it
  */
@@ -234,10 +414,195 @@ static int increase_buffer(uint8_t **dst, uint8_t **dst_start, uint8_t **dst_end
     return 0;
 }
 
-static int shr_unpack(uint8_t **dst_start, uint8_t *src, size_t src_size)
+/** @brief LZ state of the release decode kernel, kept between calls */
+typedef struct {
+    shrinkler_fast_ctx_t ctx;           ///< Range decoder state
+    int parity_mask;                    ///< 1 if the data uses the parity context, 0 if not
+    int ref;                            ///< Whether the next symbol is a reference
+    bool prev_was_ref;                  ///< Whether the previous symbol was a reference
+    int offset;                         ///< Offset of the current reference
+    int pending;                        ///< Bytes of the current reference still to be copied
+} shrinkler_lz_state_t;
+
+static void shr_lz_init(shrinkler_lz_state_t *lz, const uint8_t *src, size_t src_size, int parity_mask) {
+    shr_fast_init(&lz->ctx, src, src_size);
+    lz->parity_mask = parity_mask;
+    lz->ref = false;
+    lz->prev_was_ref = false;
+    lz->offset = 0;
+    lz->pending = 0;
+}
+
+/**
+ * @brief Release decode kernel, without per-bit checks and diagnostics
+ *
+ * Decodes into the output at @p *dst_ptr until the end of the data, or until
+ * the output reaches @p out_end. A reference reaching past out_end is split,
+ * and the rest of it is copied by the next call. The output from @p base is
+ * the history available to references. Parity is counted from base, so base
+ * may only move by an even number of bytes between calls.
+ *
+ * References with an offset of at least 8 are copied 8 bytes at a time, by
+ * copies which may write up to COPY_SLACK bytes past the end of the
+ * reference. They are only used where the slack is below @p buf_end.
+ *
+ * The input may lie within the output buffer, at its end, for in-place
+ * decoding. The output is then only written below the next unread input
+ * byte, and the decoding fails if it catches up with it.
+ *
+ * The kernel is inlined into one copy per parity mode, so the parity mask
+ * is a constant within the decoding loop.
+ *
+ * @return 1 at the end of the data, 0 when the output is full, or -1 on error
+ */
+static force_inline int shr_lz_run_kernel(shrinkler_lz_state_t *lz, uint8_t *base, uint8_t **dst_ptr,
+                                          uint8_t *out_end, uint8_t *buf_end, bool in_place, const int parity_mask)
+{
+    // Work on a local copy, which the output cannot alias
+    shrinkler_fast_ctx_t ctx = lz->ctx;
+    int ref = lz->ref;
+    bool prev_was_ref = lz->prev_was_ref;
+    int offset = lz->offset;
+    int length = lz->pending;
+    uint8_t *dst = *dst_ptr;
+    int result = 0;
+
+    while (1) {
+        if (ref) {
+            if (length == 0) {
+                int repeated = false;
+                if (!prev_was_ref) {
+                    repeated = shr_fast_decode_bit(&ctx, NUM_SINGLE_CONTEXTS + CONTEXT_REPEATED);
+                }
+                if (!repeated) {
+                    offset = shr_fast_decode_number(&ctx, NUM_SINGLE_CONTEXTS + (CONTEXT_GROUP_OFFSET << 8)) - 2;
+                    if (offset == 0) {
+                        result = 1;
+                        break;
+                    }
+                }
+                length = shr_fast_decode_number(&ctx, NUM_SINGLE_CONTEXTS + (CONTEXT_GROUP_LENGTH << 8));
+                prev_was_ref = true;
+            }
+
+            // Also checked when a split reference resumes, as the history
+            // before it may have been dropped since, as in streaming
+            if (unlikely(offset < 0 || offset > dst - base || ctx.overrun > MAX_OVERRUN)) {
+                result = -1;
+                break;
+            }
+
+            int n = length;
+            if (unlikely(n > out_end - dst)) {
+                n = (int)(out_end - dst);
+            }
+            const uint8_t *wide_end = in_place ? ctx.src : buf_end;
+            if (unlikely(in_place && n > wide_end - dst)) {
+                result = -1;
+                break;
+            }
+
+            // Copy data
+            uint8_t *copy_end = dst + n;
+            if (offset >= 8 && wide_end - copy_end >= COPY_SLACK) {
+                while (dst < copy_end) {
+                    memcpy(dst, dst - offset, 8);
+                    dst += 8;
+                }
+            } else {
+                while (dst < copy_end) {
+                    *dst = dst[-offset];
+                    dst++;
+                }
+            }
+            dst = copy_end;
+            length -= n;
+            if (length > 0) break;
+        } else {
+            if (unlikely(dst >= out_end)) break;
+            if (unlikely(in_place && dst >= ctx.src)) {
+                result = -1;
+                break;
+            }
+
+            int parity = (dst - base) & parity_mask;
+            int context = 1;
+            for (int i = 7; i >= 0; i--) {
+                context = (context << 1) | shr_fast_decode_bit(&ctx, NUM_SINGLE_CONTEXTS + ((parity << 8) | context));
+            }
+            *dst++ = (uint8_t)context;
+            prev_was_ref = false;
+        }
+        int parity = (dst - base) & parity_mask;
+        ref = shr_fast_decode_bit(&ctx, NUM_SINGLE_CONTEXTS + CONTEXT_KIND + (parity << 8));
+    }
+
+    if (result == 0 && ctx.overrun > MAX_OVERRUN) {
+        result = -1;
+    }
+    lz->ctx = ctx;
+    lz->ref = ref;
+    lz->prev_was_ref = prev_was_ref;
+    lz->offset = offset;
+    lz->pending = length;
+    *dst_ptr = dst;
+    return result;
+}
+
+static int shr_lz_run_parity(shrinkler_lz_state_t *lz, uint8_t *base, uint8_t **dst_ptr,
+                             uint8_t *out_end, uint8_t *buf_end, bool in_place)
+{
+    return shr_lz_run_kernel(lz, base, dst_ptr, out_end, buf_end, in_place, 1);
+}
+
+static int shr_lz_run_no_parity(shrinkler_lz_state_t *lz, uint8_t *base, uint8_t **dst_ptr,
+                                uint8_t *out_end, uint8_t *buf_end, bool in_place)
+{
+    return shr_lz_run_kernel(lz, base, dst_ptr, out_end, buf_end, in_place, 0);
+}
+
+/** @brief Run the release decode kernel for the parity mode of the data */
+static int shr_lz_run(shrinkler_lz_state_t *lz, uint8_t *base, uint8_t **dst_ptr,
+                      uint8_t *out_end, uint8_t *buf_end, bool in_place)
+{
+    if (lz->parity_mask) {
+        return shr_lz_run_parity(lz, base, dst_ptr, out_end, buf_end, in_place);
+    }
+    return shr_lz_run_no_parity(lz, base, dst_ptr, out_end, buf_end, in_place);
+}
+
+/**
+ * @brief Decode a whole stream with the release decode kernel
+ *
+ * A growable buffer is reallocated whenever it is full, and the decoding
+ * resumed. A fixed one fails the decoding when the output does not fit.
+ */
+static int shr_unpack_fast(uint8_t **dst_start, size_t *dst_size, bool growable,
+                           const uint8_t *src, size_t src_size, int parity_mask)
 {
-    const int parity_mask = 1;
+    uint8_t *dst = *dst_start;
+    uint8_t *dst_end = dst + *dst_size;
+    bool in_place = src >= dst && src < dst_end;
+
+    shrinkler_lz_state_t lz;
+    shr_lz_init(&lz, src, src_size, parity_mask);
+
+    while (1) {
+        int result = shr_lz_run(&lz, *dst_start, &dst, dst_end, dst_end, in_place);
+        if (result != 0) {
+            return result < 0 ? -1 : (int)(dst - *dst_start);
+        }
+        if (!growable || increase_buffer(&dst, dst_start, &dst_end, dst_size) != 0) {
+            return -1;
+        }
+    }
+}
 
+/**
+ * @brief Diagnostic decode kernel, with checks and optional trace of every bit
+ */
+static int shr_unpack(uint8_t **dst_start, const uint8_t *src, size_t src_size, int parity_mask)
+{
     // Allocate initial output buffer (same size as input)
     size_t dst_size = src_size;
     *dst_start = malloc(dst_size);
@@ -366,111 +731,1323 @@ static int shr_unpack(uint8_t **dst_start, uint8_t *src, size_t src_size)
     return (int)(dst - *dst_start);
 }
 
+#define SHRINKLER_HEADER_MIN_SIZE 24    ///< Minimum size of a data file header
+#define SHRINKLER_FLAG_PARITY_CONTEXT 1 ///< Header flag for data compressed with the parity context
+#define SHRINKLER_FLAG_BLOCKS 2         ///< Header flag for data in independently compressed blocks
+#define SHRINKLER_FLAG_SEEKABLE 4       ///< Header flag for blocks indexed by offset at the end
+#define SHRINKLER_SEEKABLE_HEADER_SIZE 32 ///< Size of the data file header of seekable data
+#define SHRINKLER_FLAG_DICTIONARY 8     ///< Header flag for data crunched against a dictionary
+#define SHRINKLER_FLAG_PRIMED 16        ///< Header flag for literal contexts adapted to the dictionary
+
+/** @brief Data file header, as written by the -w option of Shrinkler */
+typedef struct {
+    uint32_t compressed_size;           ///< Size of the compressed data following the header
+    uint32_t uncompressed_size;         ///< Size of the decompressed data
+    uint32_t safety_margin;             ///< Margin needed for in-place decompression
+    bool parity_context;                ///< Whether the data uses the parity context
+    bool blocks;                        ///< Whether the data is in independently compressed blocks
+    bool seekable;                      ///< Whether the blocks are indexed by offset at the end
+    uint32_t block_size;                ///< Decompressed size of each block of seekable data
+    uint32_t index_offset;              ///< Offset of the index of seekable data in the compressed data
+    bool dictionary;                    ///< Whether the data was crunched against a dictionary
+    bool primed;                        ///< Whether the literal contexts start adapted to the dictionary
+} shrinkler_header_t;
+
 /**
- * @brief Decompress a Shrinkler-compressed buffer.
+ * @brief Read the data file header at the start of compressed data
  *
- * @param src Source compressed data
+ * @param src Compressed data, possibly starting with a header
  * @param src_size Size of compressed data
- * @param dst_ptr Pointer to destination buffer (will be allocated dynamically)
- * @return Size of decompressed data, or -1 on error
+ * @param[out] header Contents of the header, if present
+ * @return Size of the header in bytes, or 0 if the data has no valid header
  */
-int shrinkler_decompress(const uint8_t *src, size_t src_size, uint8_t **dst_ptr) {
-    if (!src || !dst_ptr) {
-        return -1;
+size_t shrinkler_read_header(const uint8_t *src, size_t src_size, shrinkler_header_t *header) {
+    if (!src || src_size < SHRINKLER_HEADER_MIN_SIZE || memcmp(src, "Shri", 4) != 0) {
+        return 0;
     }
-    
-    // Create a copy of src since the algorithm modifies it
-    uint8_t *src_copy = malloc(src_size);
-    if (!src_copy) {
-        return -1;
+    size_t header_size = 8 + ((src[6] << 8) | src[7]);
+    if (header_size < SHRINKLER_HEADER_MIN_SIZE || header_size > src_size) {
+        return 0;
     }
-    
-    memcpy(src_copy, src, src_size);
-    int dec_size = shr_unpack(dst_ptr, src_copy, src_size);
-    free(src_copy);
-    
-    return dec_size;
+    uint32_t compressed_size = read32be(src + 8);
+    if (compressed_size > src_size - header_size) {
+        return 0;
+    }
+    // The margin is negative when the data can be decompressed onto itself
+    int32_t safety_margin = (int32_t)read32be(src + 16);
+    header->compressed_size = compressed_size;
+    header->uncompressed_size = read32be(src + 12);
+    header->safety_margin = safety_margin > 0 ? (uint32_t)safety_margin : 0;
+    header->parity_context = (read32be(src + 20) & SHRINKLER_FLAG_PARITY_CONTEXT) != 0;
+    header->seekable = (read32be(src + 20) & SHRINKLER_FLAG_SEEKABLE) != 0;
+    header->blocks = header->seekable || (read32be(src + 20) & SHRINKLER_FLAG_BLOCKS) != 0;
+    header->dictionary = (read32be(src + 20) & SHRINKLER_FLAG_DICTIONARY) != 0;
+    header->primed = (read32be(src + 20) & SHRINKLER_FLAG_PRIMED) != 0;
+    if (header->seekable) {
+        if (header_size < SHRINKLER_SEEKABLE_HEADER_SIZE) {
+            return 0;
+        }
+        header->block_size = read32be(src + 24);
+        header->index_offset = read32be(src + 28);
+    }
+    return header_size;
 }
 
+#define MAX_THREADS 64                 ///< Maximum number of threads for decoding blocks
+
 /**
- * @brief Read file into buffer
- * 
- * The decompressor reads data in 4-byte chunks, so the input file size
- * must be padded to a multiple of 4 bytes. Any padding bytes are set to 0.
+ * @brief Number of threads to decode blocks on
  */
-uint8_t* read_file(const char *filename, size_t *size) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot open file '%s': %s\n", filename, strerror(errno));
-        return NULL;
+static int shr_thread_count(void) {
+    int n = g_threads;
+#ifdef SHRINKLER_DEC_THREADS
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
     }
-    
-    fseek(f, 0, SEEK_END);
-    size_t original_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    // Round up to next multiple of 4 bytes for padding, plus add 4 bytes for the initial interval
-    size_t padded_size = ((original_size + 3) & ~3) + 4;
-    *size = padded_size;
-    
-    uint8_t *data = malloc(padded_size);
-    if (!data) {
-        fprintf(stderr, "Error: Cannot allocate memory for file\n");
-        fclose(f);
-        return NULL;
+#else
+    n = 1;
+#endif
+    return n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+/**
+ * @brief Block index of data in block mode or seekable data
+ *
+ * In block mode, the index gives the compressed size of each block. In
+ * seekable data, it gives the decompressed and compressed offset of each
+ * block, followed by the total sizes.
+ */
+typedef struct {
+    uint32_t block_size;                ///< Decompressed size of each block but the last
+    uint32_t block_count;               ///< Number of blocks
+    uint32_t uncompressed_size;         ///< Size of the decompressed data
+    const uint8_t *sizes;               ///< Compressed sizes as big-endian longwords, or NULL
+    const uint8_t *offsets;             ///< Offset pairs as big-endian longwords, or NULL
+    const uint8_t *data;                ///< Compressed data of the first block
+} shrinkler_blocks_t;
+
+/**
+ * @brief Size of the index of the blocks in bytes
+ */
+static size_t shr_blocks_index_size(const shrinkler_blocks_t *blocks) {
+    return blocks->sizes ? 4 * (size_t)blocks->block_count : 8 * ((size_t)blocks->block_count + 1);
+}
+
+/**
+ * @brief Compressed size of a block
+ */
+static size_t shr_block_src_size(const shrinkler_blocks_t *blocks, uint32_t b) {
+    if (blocks->sizes) {
+        return read32be(blocks->sizes + 4 * b);
     }
-    
-    // Initialize padding bytes to 0
-    memset(data, 0, padded_size);
-    
-    if (fread(data, 1, original_size, f) != original_size) {
-        fprintf(stderr, "Error: Cannot read file '%s'\n", filename);
-        free(data);
-        fclose(f);
-        return NULL;
+    return read32be(blocks->offsets + 8 * b + 12) - read32be(blocks->offsets + 8 * b + 4);
+}
+
+/**
+ * @brief Offset of a block within the compressed blocks
+ *
+ * Constant time for seekable data, and linear in the block number otherwise.
+ */
+static size_t shr_block_src_offset(const shrinkler_blocks_t *blocks, uint32_t b) {
+    if (blocks->sizes) {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < b; i++) {
+            offset += read32be(blocks->sizes + 4 * i);
+        }
+        return offset;
     }
-    
-    fclose(f);
-    return data;
+    return read32be(blocks->offsets + 8 * b + 4);
 }
 
 /**
- * @brief Write buffer to file
+ * @brief Decompressed offset of a block, or the total size for the block after the last
  */
-bool write_file(const char *filename, const uint8_t *data, size_t size) {
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot create file '%s': %s\n", filename, strerror(errno));
+static size_t shr_block_start(const shrinkler_blocks_t *blocks, uint32_t b) {
+    if (blocks->sizes) {
+        size_t start = (size_t)b * blocks->block_size;
+        return start < blocks->uncompressed_size ? start : blocks->uncompressed_size;
+    }
+    return read32be(blocks->offsets + 8 * b);
+}
+
+/**
+ * @brief Block containing the given decompressed offset
+ */
+static uint32_t shr_block_containing(const shrinkler_blocks_t *blocks, size_t offset) {
+    if (blocks->sizes) {
+        return (uint32_t)(offset / blocks->block_size);
+    }
+    uint32_t low = 0, high = blocks->block_count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (shr_block_start(blocks, mid) <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Read the block index of data in block mode or seekable data
+ *
+ * @param src Compressed data following the header
+ * @param src_size Size of compressed data
+ * @return Whether the index is valid for the given data
+ */
+static bool shr_read_blocks(const uint8_t *src, size_t src_size, const shrinkler_header_t *header, shrinkler_blocks_t *blocks) {
+    blocks->uncompressed_size = header->uncompressed_size;
+    if (header->seekable) {
+        // Index of offset pairs at the end
+        if (header->index_offset > src_size || (src_size - header->index_offset) % 8 != 0 ||
+            src_size - header->index_offset < 16) {
+            return false;
+        }
+        blocks->block_size = header->block_size;
+        blocks->block_count = (uint32_t)((src_size - header->index_offset) / 8 - 1);
+        blocks->sizes = NULL;
+        blocks->offsets = src + header->index_offset;
+        blocks->data = src;
+        if (shr_block_start(blocks, 0) != 0 || shr_block_src_offset(blocks, 0) != 0 ||
+            shr_block_start(blocks, blocks->block_count) != header->uncompressed_size ||
+            shr_block_src_offset(blocks, blocks->block_count) != header->index_offset) {
+            return false;
+        }
+        // Even block starts keep the parity of positions the same within blocks
+        for (uint32_t b = 0; b < blocks->block_count; b++) {
+            size_t start = shr_block_start(blocks, b);
+            if ((start & 1) || shr_block_start(blocks, b + 1) < start ||
+                shr_block_src_offset(blocks, b + 1) < shr_block_src_offset(blocks, b)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Index of sizes at the start
+    if (src_size < 8) {
         return false;
     }
-    
-    if (fwrite(data, 1, size, f) != size) {
-        fprintf(stderr, "Error: Cannot write file '%s'\n", filename);
-        fclose(f);
+    blocks->block_size = read32be(src);
+    blocks->block_count = read32be(src + 4);
+    if (blocks->block_size == 0 || (blocks->block_size & 1) ||
+        blocks->block_count != (header->uncompressed_size == 0 ? 1 :
+            (header->uncompressed_size - 1) / blocks->block_size + 1) ||
+        blocks->block_count > (src_size - 8) / 4) {
         return false;
     }
-    
-    fclose(f);
+    blocks->sizes = src + 8;
+    blocks->offsets = NULL;
+    blocks->data = blocks->sizes + 4 * (size_t)blocks->block_count;
+    size_t total = blocks->data - src;
+    for (uint32_t b = 0; b < blocks->block_count; b++) {
+        total += read32be(blocks->sizes + 4 * b);
+        if (total > src_size) {
+            return false;
+        }
+    }
     return true;
 }
 
-void print_usage(const char *progname) {
-    printf("Shrinkler Decompressor\n");
-    printf("Usage: %s [options] <input_file> [output_file]\n", progname);
-    printf("\nOptions:\n");
-    printf("  -h, --help     Show this help message\n");
-    printf("  -v, --verbose  Verbose output\n");
-    printf("  --trace        Enable decompression trace\n");
-    printf("\nIf output_file is not specified, output goes to stdout\n");
+/**
+ * @brief Decode one block into the given output
+ *
+ * @param dst Output for the block, with room for its decompressed size
+ * @param buf_end End of the buffer which wide copies may write into
+ * @return Whether the block decoded to exactly its decompressed size
+ */
+static bool shr_unpack_block(const shrinkler_blocks_t *blocks, uint32_t b, const uint8_t *src, int parity_mask,
+                             uint8_t *dst, uint8_t *buf_end, bool in_place) {
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + (shr_block_start(blocks, b + 1) - shr_block_start(blocks, b));
+    shrinkler_lz_state_t lz;
+    shr_lz_init(&lz, src, shr_block_src_size(blocks, b), parity_mask);
+    return shr_lz_run(&lz, dst, &out, out_end, buf_end, in_place) == 1 && out == out_end;
+}
+
+/** @brief Decoding of a range of the blocks of data in block mode */
+typedef struct {
+    const shrinkler_blocks_t *blocks;   ///< Block index
+    const shrinkler_header_t *header;   ///< Data file header
+    uint8_t *dst;                       ///< Destination buffer
+    uint8_t *dst_end;                   ///< End of destination buffer
+    uint32_t first;                     ///< First block to decode
+    uint32_t step;                      ///< Distance between blocks to decode
+    bool in_place;                      ///< Whether the input lies within the destination buffer
+    int result;                         ///< 0 if all blocks decoded correctly, -1 if not
+} shrinkler_block_job_t;
+
+static void* shr_block_job_run(void *arg) {
+    shrinkler_block_job_t *job = arg;
+    const shrinkler_blocks_t *blocks = job->blocks;
+    const uint8_t *src = blocks->data;
+    job->result = 0;
+    for (uint32_t b = 0; b < blocks->block_count; b++) {
+        if (b >= job->first && (b - job->first) % job->step == 0) {
+            uint8_t *dst = job->dst + shr_block_start(blocks, b);
+            // Wide copies may only write past the block into the buffer
+            // when no other thread writes there
+            uint8_t *buf_end = job->step == 1 || b + 1 == blocks->block_count
+                ? job->dst_end : job->dst + shr_block_start(blocks, b + 1);
+            if (!shr_unpack_block(blocks, b, src, job->header->parity_context, dst, buf_end, job->in_place)) {
+                job->result = -1;
+                return NULL;
+            }
+        }
+        src += shr_block_src_size(blocks, b);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Decode data in block mode or seekable data into a fixed buffer
+ *
+ * The blocks are decoded on several threads, except for in-place decoding,
+ * where they are decoded in order.
+ */
+static int shr_unpack_blocks(uint8_t *dst, size_t dst_cap, const uint8_t *src, size_t src_size, const shrinkler_header_t *header)
+{
+    shrinkler_blocks_t blocks;
+    if (header->uncompressed_size > dst_cap || !shr_read_blocks(src, src_size, header, &blocks)) {
+        return -1;
+    }
+
+    // In place, the index is overwritten by the blocks, so it is copied
+    bool in_place = src >= dst && src < dst + dst_cap;
+    uint8_t *index_copy = NULL;
+    if (in_place) {
+        size_t index_size = shr_blocks_index_size(&blocks);
+        index_copy = malloc(index_size);
+        if (!index_copy) {
+            return -1;
+        }
+        if (blocks.sizes) {
+            blocks.sizes = memcpy(index_copy, blocks.sizes, index_size);
+        } else {
+            blocks.offsets = memcpy(index_copy, blocks.offsets, index_size);
+        }
+    }
+    int n_threads = in_place ? 1 : shr_thread_count();
+    if ((uint32_t)n_threads > blocks.block_count) {
+        n_threads = (int)blocks.block_count;
+    }
+
+    shrinkler_block_job_t jobs[MAX_THREADS];
+    for (int t = 0; t < n_threads; t++) {
+        jobs[t].blocks = &blocks;
+        jobs[t].header = header;
+        jobs[t].dst = dst;
+        jobs[t].dst_end = dst + dst_cap;
+        jobs[t].first = (uint32_t)t;
+        jobs[t].step = (uint32_t)n_threads;
+        jobs[t].in_place = in_place;
+    }
+#ifdef SHRINKLER_DEC_THREADS
+    pthread_t threads[MAX_THREADS];
+    int started = 1;
+    while (started < n_threads && pthread_create(&threads[started], NULL, shr_block_job_run, &jobs[started]) == 0) {
+        started++;
+    }
+    // Blocks of threads which could not be started are decoded here
+    for (int t = started; t < n_threads; t++) {
+        shr_block_job_run(&jobs[t]);
+    }
+    shr_block_job_run(&jobs[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+#else
+    for (int t = 0; t < n_threads; t++) {
+        shr_block_job_run(&jobs[t]);
+    }
+#endif
+
+    free(index_copy);
+    for (int t = 0; t < n_threads; t++) {
+        if (jobs[t].result != 0) {
+            return -1;
+        }
+    }
+    return (int)header->uncompressed_size;
+}
+
+/**
+ * @brief Buffer size needed to decompress data in place
+ *
+ * @return Uncompressed size plus safety margin, or 0 if the data has no header
+ */
+size_t shrinkler_inplace_size(const uint8_t *src, size_t src_size) {
+    shrinkler_header_t header;
+    if (shrinkler_read_header(src, src_size, &header) == 0) {
+        return 0;
+    }
+    return (size_t)header.uncompressed_size + header.safety_margin;
+}
+
+/**
+ * @brief Decompress a Shrinkler-compressed buffer into a caller buffer.
+ *
+ * If the data starts with a data file header, the size of the compressed
+ * data and the use of the parity context are taken from it. Otherwise the
+ * data is taken to use the parity context, as is the default of Shrinkler.
+ * The buffers are not copied or reallocated. Data in block mode is decoded
+ * on several threads, except when decompressing in place. Data crunched
+ * against a dictionary is decoded by shrinkler_decompress_dictionary().
+ *
+ * For in-place decompression, place the compressed data, with or without its
+ * header, at the end of the destination buffer, and make the buffer at least
+ * shrinkler_inplace_size() bytes.
+ *
+ * @param src Source compressed data, possibly within the destination buffer
+ * @param src_size Size of compressed data
+ * @param dst Destination buffer
+ * @param dst_cap Size of destination buffer
+ * @return Size of decompressed data, or -1 on error or if it does not fit
+ */
+int shrinkler_decompress_into(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_cap) {
+    if (!src || !dst) {
+        return -1;
+    }
+
+    shrinkler_header_t header;
+    int parity_mask = 1;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    if (header_size > 0) {
+        if (header.uncompressed_size > dst_cap || header.dictionary) {
+            return -1;
+        }
+        src += header_size;
+        src_size = header.compressed_size;
+        parity_mask = header.parity_context;
+        if (header.blocks) {
+            return shr_unpack_blocks(dst, dst_cap, src, src_size, &header);
+        }
+    }
+
+    return shr_unpack_fast(&dst, &dst_cap, false, src, src_size, parity_mask);
+}
+
+/**
+ * @brief Decompress a Shrinkler-compressed buffer.
+ *
+ * If the data starts with a data file header, the output buffer is
+ * allocated at the uncompressed size from the header. Otherwise it grows
+ * as the data is decompressed. Data in block mode is decoded on several
+ * threads, and is not traced. Data crunched against a dictionary is decoded
+ * by shrinkler_decompress_dictionary().
+ *
+ * @param src Source compressed data
+ * @param src_size Size of compressed data
+ * @param dst_ptr Pointer to destination buffer (will be allocated dynamically)
+ * @return Size of decompressed data, or -1 on error
+ */
+int shrinkler_decompress(const uint8_t *src, size_t src_size, uint8_t **dst_ptr) {
+    if (!src || !dst_ptr) {
+        return -1;
+    }
+
+    shrinkler_header_t header;
+    int parity_mask = 1;
+    bool growable = true;
+    size_t dst_size = src_size + COPY_SLACK;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    if (header_size > 0) {
+        if (header.dictionary) {
+            return -1;
+        }
+        parity_mask = header.parity_context;
+        growable = false;
+        dst_size = (size_t)header.uncompressed_size + COPY_SLACK;
+    }
+
+    if (header_size > 0) {
+        src += header_size;
+        src_size = header.compressed_size;
+    }
+    if (g_trace && !(header_size > 0 && header.blocks)) {
+        return shr_unpack(dst_ptr, src, src_size, parity_mask);
+    }
+    *dst_ptr = malloc(dst_size);
+    if (!*dst_ptr) {
+        return -1;
+    }
+    if (header_size > 0 && header.blocks) {
+        return shr_unpack_blocks(*dst_ptr, dst_size, src, src_size, &header);
+    }
+    return shr_unpack_fast(dst_ptr, &dst_size, growable, src, src_size, parity_mask);
+}
+
+/**
+ * @brief Decompress part of a Shrinkler-compressed buffer.
+ *
+ * Only the blocks overlapping the range are decoded, for data in block mode
+ * or seekable data. The block holding the start of the range is found from
+ * the offsets at the end of seekable data, and from the sizes at the start
+ * of the data in block mode. Other data is decompressed in full.
+ *
+ * @param src Source compressed data, starting with a data file header
+ * @param src_size Size of compressed data
+ * @param offset Offset of the range in the decompressed data
+ * @param dst Destination buffer
+ * @param size Size of the range
+ * @return Number of bytes decompressed, which is less than size only at the
+ *         end of the data, or -1 on error
+ */
+int shrinkler_decompress_range(const uint8_t *src, size_t src_size, size_t offset, uint8_t *dst, size_t size) {
+    if (!src || (!dst && size > 0)) {
+        return -1;
+    }
+
+    shrinkler_header_t header;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    if (header_size == 0) {
+        return -1;
+    }
+    if (offset >= header.uncompressed_size) {
+        return 0;
+    }
+    if (size > header.uncompressed_size - offset) {
+        size = header.uncompressed_size - offset;
+    }
+    if (size > INT_MAX) {
+        size = INT_MAX;
+    }
+
+    if (!header.blocks) {
+        uint8_t *data = NULL;
+        int result = shrinkler_decompress(src, src_size, &data);
+        if (result >= 0) {
+            memcpy(dst, data + offset, size);
+        }
+        free(data);
+        return result < 0 ? -1 : (int)size;
+    }
+
+    shrinkler_blocks_t blocks;
+    if (!shr_read_blocks(src + header_size, header.compressed_size, &header, &blocks)) {
+        return -1;
+    }
+    uint32_t b = shr_block_containing(&blocks, offset);
+    const uint8_t *block_src = blocks.data + shr_block_src_offset(&blocks, b);
+    size_t done = 0;
+    for (; done < size; b++) {
+        size_t start = shr_block_start(&blocks, b);
+        size_t length = shr_block_start(&blocks, b + 1) - start;
+        size_t skip = offset + done - start;
+        size_t n = length - skip < size - done ? length - skip : size - done;
+        if (n == length) {
+            // Whole blocks are decoded directly into the range
+            if (!shr_unpack_block(&blocks, b, block_src, header.parity_context, dst + done, dst + size, false)) {
+                return -1;
+            }
+        } else {
+            uint8_t *scratch = malloc(length + COPY_SLACK);
+            if (!scratch) {
+                return -1;
+            }
+            bool ok = shr_unpack_block(&blocks, b, block_src, header.parity_context, scratch, scratch + length + COPY_SLACK, false);
+            if (ok) {
+                memcpy(dst + done, scratch + skip, n);
+            }
+            free(scratch);
+            if (!ok) {
+                return -1;
+            }
+        }
+        block_src += shr_block_src_size(&blocks, b);
+        done += n;
+    }
+    return (int)done;
+}
+
+/**
+ * @brief Adapt the literal contexts to a dictionary, as Shrinkler does when priming
+ */
+static void shr_fast_prime(shrinkler_fast_ctx_t *ctx, const uint8_t *dict, size_t dict_size, int parity_mask) {
+    for (size_t pos = 0; pos < dict_size; pos++) {
+        int parity = (int)(pos & parity_mask);
+        int context = 1;
+        for (int i = 7; i >= 0; i--) {
+            int bit = (dict[pos] >> i) & 1;
+            uint16_t *prob = &ctx->contexts[NUM_SINGLE_CONTEXTS + ((parity << 8) | context)];
+            *prob = bit ? *prob + (0xffff >> ADJUST_SHIFT) - (*prob >> ADJUST_SHIFT)
+                        : *prob - (*prob >> ADJUST_SHIFT);
+            context = (context << 1) | bit;
+        }
+    }
+}
+
+/**
+ * @brief Decompress data crunched against a dictionary.
+ *
+ * The data must start with a data file header, as written by the -w and
+ * --dictionary options of Shrinkler, and the dictionary must be the one it
+ * was crunched against. As in Shrinkler, a dictionary of odd size is used
+ * without its first byte. The output buffer is allocated at the uncompressed
+ * size from the header.
+ *
+ * @param src Source compressed data
+ * @param src_size Size of compressed data
+ * @param dict Dictionary
+ * @param dict_size Size of dictionary
+ * @param dst_ptr Pointer to destination buffer (will be allocated dynamically)
+ * @return Size of decompressed data, or -1 on error
+ */
+int shrinkler_decompress_dictionary(const uint8_t *src, size_t src_size, const uint8_t *dict, size_t dict_size,
+                                    uint8_t **dst_ptr) {
+    if (!src || (!dict && dict_size > 0) || !dst_ptr) {
+        return -1;
+    }
+
+    shrinkler_header_t header;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    if (header_size == 0 || !header.dictionary || header.blocks) {
+        return -1;
+    }
+    dict += dict_size & 1;
+    dict_size &= ~(size_t)1;
+
+    // The output follows the dictionary, which references can reach into
+    size_t buffer_size = dict_size + header.uncompressed_size + COPY_SLACK;
+    uint8_t *buffer = malloc(buffer_size);
+    if (!buffer) {
+        return -1;
+    }
+    memcpy(buffer, dict, dict_size);
+    shrinkler_lz_state_t lz;
+    shr_lz_init(&lz, src + header_size, header.compressed_size, header.parity_context);
+    if (header.primed) {
+        shr_fast_prime(&lz.ctx, dict, dict_size, header.parity_context);
+    }
+    // After a dictionary, the first symbol can be a reference
+    if (dict_size > 0) {
+        lz.ref = shr_fast_decode_bit(&lz.ctx, NUM_SINGLE_CONTEXTS + CONTEXT_KIND);
+    }
+    uint8_t *dst = buffer + dict_size;
+    uint8_t *out_end = dst + header.uncompressed_size;
+    if (shr_lz_run(&lz, buffer, &dst, out_end, buffer + buffer_size, false) != 1 || dst != out_end) {
+        free(buffer);
+        return -1;
+    }
+    memmove(buffer, buffer + dict_size, header.uncompressed_size);
+    *dst_ptr = buffer;
+    return (int)header.uncompressed_size;
+}
+
+#define STREAM_MIN_CHUNK 4096          ///< Minimum room for new output in a stream buffer
+
+/**
+ * @brief Streaming decompression state
+ *
+ * The output is decoded into a buffer holding the history window followed
+ * by room for new output. When the buffer is full, the window is moved to
+ * its start.
+ */
+typedef struct {
+    shrinkler_lz_state_t lz;            ///< Decoder state
+    uint8_t *buffer;                    ///< History window followed by room for new output
+    uint8_t *buffer_end;                ///< End of buffer
+    uint8_t *out;                       ///< End of the output decoded so far
+    size_t window_size;                 ///< Bytes of history kept for references
+    shrinkler_blocks_t blocks;          ///< Block index in block mode
+    uint32_t next_block;                ///< Next block to decode in block mode, if any
+    const uint8_t *next_src;            ///< Compressed data of the next block
+    int state;                          ///< 0 while decoding, 1 at the end, -1 after an error
+} shrinkler_stream_t;
+
+/**
+ * @brief Start a streaming decompression
+ *
+ * The compressed data must stay valid until shrinkler_stream_end(). If it
+ * starts with a data file header, the size of the compressed data and the
+ * use of the parity context are taken from it. Blocks of data in block mode
+ * are decoded one after the other.
+ *
+ * @param src Source compressed data
+ * @param src_size Size of compressed data
+ * @param window_size Bytes of history to keep, which must be at least the
+ *        largest reference offset in the data, such as the window size used
+ *        for crunching. If 0, the uncompressed size from the header is used,
+ *        or the block size in block mode.
+ * @return Stream, or NULL on error
+ */
+shrinkler_stream_t* shrinkler_stream_init(const uint8_t *src, size_t src_size, size_t window_size) {
+    if (!src) {
+        return NULL;
+    }
+
+    shrinkler_header_t header;
+    shrinkler_blocks_t blocks;
+    int parity_mask = 1;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    if (header_size > 0) {
+        if (header.dictionary) {
+            return NULL;
+        }
+        src += header_size;
+        src_size = header.compressed_size;
+        parity_mask = header.parity_context;
+        if (header.blocks) {
+            if (!shr_read_blocks(src, src_size, &header, &blocks)) {
+                return NULL;
+            }
+            src = blocks.data;
+            src_size = shr_block_src_size(&blocks, 0);
+        }
+        if (window_size == 0) {
+            window_size = header.blocks ? blocks.block_size : header.uncompressed_size;
+        }
+    } else if (window_size == 0) {
+        return NULL;
+    }
+
+    // The window is kept at an even size, to keep the parity of positions
+    window_size = (window_size + 1) & ~(size_t)1;
+    size_t chunk_size = window_size > STREAM_MIN_CHUNK ? window_size : STREAM_MIN_CHUNK;
+    shrinkler_stream_t *stream = malloc(sizeof(shrinkler_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->buffer = malloc(window_size + chunk_size);
+    if (!stream->buffer) {
+        free(stream);
+        return NULL;
+    }
+    stream->buffer_end = stream->buffer + window_size + chunk_size;
+    stream->out = stream->buffer;
+    stream->window_size = window_size;
+    stream->next_block = 0;
+    if (header_size > 0 && header.blocks) {
+        stream->blocks = blocks;
+        stream->next_block = 1;
+        stream->next_src = src + src_size;
+    }
+    stream->state = 0;
+    shr_lz_init(&stream->lz, src, src_size, parity_mask);
+    return stream;
+}
+
+/**
+ * @brief Decompress the next part of a stream
+ *
+ * @param stream Stream from shrinkler_stream_init()
+ * @param dst Destination buffer
+ * @param dst_cap Maximum number of bytes to decompress
+ * @return Number of bytes decompressed, which is less than dst_cap only at
+ *         the end of the data, or -1 on error
+ */
+int shrinkler_stream_decode(shrinkler_stream_t *stream, uint8_t *dst, size_t dst_cap) {
+    if (!stream || !dst || stream->state < 0) {
+        return -1;
+    }
+    if (dst_cap > INT_MAX) {
+        dst_cap = INT_MAX;
+    }
+
+    size_t produced = 0;
+    while (produced < dst_cap && stream->state == 0) {
+        if (stream->out == stream->buffer_end) {
+            // Keep the last window of output as history
+            size_t discard = (size_t)(stream->out - stream->buffer) - stream->window_size;
+            memmove(stream->buffer, stream->buffer + discard, stream->window_size);
+            stream->out -= discard;
+        }
+        uint8_t *start = stream->out;
+        uint8_t *out_end = stream->buffer_end;
+        if ((size_t)(out_end - start) > dst_cap - produced) {
+            out_end = start + (dst_cap - produced);
+        }
+        stream->state = shr_lz_run(&stream->lz, stream->buffer, &stream->out, out_end, stream->buffer_end, false);
+        if (stream->state < 0) {
+            return -1;
+        }
+        memcpy(dst + produced, start, stream->out - start);
+        produced += stream->out - start;
+        if (stream->state == 1 && stream->next_block > 0 && stream->next_block < stream->blocks.block_count) {
+            // Continue with the next block, with fresh contexts
+            size_t block_size = shr_block_src_size(&stream->blocks, stream->next_block);
+            shr_lz_init(&stream->lz, stream->next_src, block_size, stream->lz.parity_mask);
+            stream->next_src += block_size;
+            stream->next_block++;
+            stream->state = 0;
+        }
+    }
+    return (int)produced;
+}
+
+/**
+ * @brief Release a stream
+ */
+void shrinkler_stream_end(shrinkler_stream_t *stream) {
+    if (stream) {
+        free(stream->buffer);
+        free(stream);
+    }
+}
+
+#ifdef SHRINKLER_DEC_MMAP
+/**
+ * @brief Map file into memory for reading
+ * 
+ * @return Mapped data, or NULL if the file should be read normally
+ */
+static uint8_t* map_file(const char *filename, size_t size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || (size_t)st.st_size != size) {
+        close(fd);
+        return NULL;
+    }
+    
+    void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return m == MAP_FAILED ? NULL : m;
+}
+#endif
+
+/**
+ * @brief Read file into buffer
+ * 
+ * The file is not padded. The decompressor reads zeros past the end of the
+ * compressed data, as the decrunchers do.
+ * 
+ * Where supported, the file is memory mapped instead of read into an
+ * allocated buffer. Release the data with free_file().
+ * 
+ * @param[out] mapped Set to whether the data is a mapping
+ */
+uint8_t* read_file(const char *filename, size_t *size, bool *mapped) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    
+    fseek(f, 0, SEEK_END);
+    size_t original_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *size = original_size;
+    *mapped = false;
+    
+#ifdef SHRINKLER_DEC_MMAP
+    uint8_t *mapping = map_file(filename, original_size);
+    if (mapping) {
+        fclose(f);
+        *mapped = true;
+        return mapping;
+    }
+#endif
+    
+    uint8_t *data = malloc(original_size > 0 ? original_size : 1);
+    if (!data) {
+        fprintf(stderr, "Error: Cannot allocate memory for file\n");
+        fclose(f);
+        return NULL;
+    }
+    
+    if (fread(data, 1, original_size, f) != original_size) {
+        fprintf(stderr, "Error: Cannot read file '%s'\n", filename);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief Read a dictionary file into an allocated buffer, without padding
+ */
+static uint8_t* read_dictionary(const char *filename, size_t *size) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size > 0 ? *size : 1);
+    if (!data || fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "Error: Cannot read file '%s'\n", filename);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief Release data returned by read_file()
+ */
+void free_file(uint8_t *data, size_t size, bool mapped) {
+#ifdef SHRINKLER_DEC_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)mapped;
+#endif
+    free(data);
+}
+
+/**
+ * @brief Write buffer to file
+ */
+bool write_file(const char *filename, const uint8_t *data, size_t size) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create file '%s': %s\n", filename, strerror(errno));
+        return false;
+    }
+    
+    if (fwrite(data, 1, size, f) != size) {
+        fprintf(stderr, "Error: Cannot write file '%s'\n", filename);
+        fclose(f);
+        return false;
+    }
+    
+    fclose(f);
+    return true;
+}
+
+#ifdef SHRINKLER_DEC_MMAP
+/**
+ * @brief Decompress straight into a memory mapping of the output file
+ *
+ * The file is created at the uncompressed size from the data file header,
+ * and the data is decoded into its mapping, so the output is not copied
+ * through a buffer. The file is removed if the decompression fails.
+ *
+ * @param[out] dec_size Size of decompressed data, or -1 on error
+ * @return false if the output cannot be mapped and should be written normally
+ */
+static bool decompress_to_mapped_file(const uint8_t *src, size_t src_size, const char *filename, int *dec_size) {
+    shrinkler_header_t header;
+    if (shrinkler_read_header(src, src_size, &header) == 0 || header.dictionary ||
+        header.uncompressed_size == 0 || header.uncompressed_size > INT_MAX) {
+        return false;
+    }
+    size_t size = header.uncompressed_size;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return false;
+    }
+    void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    *dec_size = shrinkler_decompress_into(src, src_size, m, size);
+    munmap(m, size);
+    if (*dec_size >= 0 && (size_t)*dec_size != size && ftruncate(fd, (off_t)*dec_size) != 0) {
+        *dec_size = -1;
+    }
+    close(fd);
+    if (*dec_size < 0) {
+        unlink(filename);
+    }
+    return true;
+}
+#endif
+
+#define STREAM_OUTPUT_CHUNK 65536      ///< Size of output chunks in stream mode
+
+/**
+ * @brief Decompress in chunks through a stream, writing each to a file
+ *
+ * @return Decompressed size, or -1 on error
+ */
+static long stream_to_file(const uint8_t *src, size_t src_size, size_t window_size, FILE *out) {
+    shrinkler_stream_t *stream = shrinkler_stream_init(src, src_size, window_size);
+    if (!stream) {
+        fprintf(stderr, "Error: Cannot start stream (the window size is required without a data file header)\n");
+        return -1;
+    }
+
+    static uint8_t chunk[STREAM_OUTPUT_CHUNK];
+    long total = 0;
+    int size;
+    do {
+        size = shrinkler_stream_decode(stream, chunk, sizeof(chunk));
+        if (size < 0) {
+            fprintf(stderr, "Error: Decompression failed: corrupted or invalid bitstream, or a reference\n"
+                            "beyond the stream window (it must be at least the crunch window)\n");
+            break;
+        }
+        if (fwrite(chunk, 1, (size_t)size, out) != (size_t)size) {
+            fprintf(stderr, "Error: Cannot write output\n");
+            size = -1;
+            break;
+        }
+        total += size;
+    } while (size == (int)sizeof(chunk));
+
+    shrinkler_stream_end(stream);
+    return size < 0 ? -1 : total;
+}
+
+#ifdef SHRINKLER_DEC_BATCH
+/**
+ * @brief Decompress into a buffer which is kept between calls
+ *
+ * The buffer is grown as needed, to the uncompressed size from the data file
+ * header if there is one, and is otherwise left as it is for the next call.
+ *
+ * @return Size of decompressed data, or -1 on error
+ */
+static int decompress_reusing(const uint8_t *src, size_t src_size, uint8_t **buffer, size_t *buffer_size) {
+    shrinkler_header_t header;
+    size_t header_size = shrinkler_read_header(src, src_size, &header);
+    size_t needed = src_size + COPY_SLACK;
+    if (header_size > 0) {
+        if (header.dictionary) {
+            return -1;
+        }
+        needed = (size_t)header.uncompressed_size + COPY_SLACK;
+    }
+    if (*buffer_size < needed) {
+        uint8_t *grown = realloc(*buffer, needed);
+        if (!grown) {
+            return -1;
+        }
+        *buffer = grown;
+        *buffer_size = needed;
+    }
+    if (header_size > 0) {
+        return shrinkler_decompress_into(src, src_size, *buffer, *buffer_size);
+    }
+    return shr_unpack_fast(buffer, buffer_size, true, src, src_size, 1);
+}
+
+/** @brief A compressed file to decompress in batch mode */
+typedef struct {
+    char *input;                        ///< Path of the compressed file
+    char *output;                       ///< Path of the decompressed file
+    size_t src_size;                    ///< Size of the compressed file
+    int dec_size;                       ///< Size of decompressed data, or -1 on error
+} batch_file_t;
+
+/** @brief Files of a batch, taken in turn by the decoding threads */
+typedef struct {
+    batch_file_t *files;                ///< Files to decompress
+    int n_files;                        ///< Number of files
+    int capacity;                       ///< Allocated number of files
+    int next_file;                      ///< Next file to be taken by a thread
+    bool verbose;                       ///< Whether to report each file
+#ifdef SHRINKLER_DEC_THREADS
+    pthread_mutex_t mutex;              ///< Guards next_file and the report of each file
+#endif
+} batch_t;
+
+/**
+ * @brief Add a file to a batch, to be decompressed into the output directory
+ *
+ * The output takes the name of the input, without any .shr extension.
+ */
+static bool batch_add_file(batch_t *batch, const char *input, const char *output_dir) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    size_t name_length = strlen(name);
+    if (name_length > 4 && strcmp(name + name_length - 4, ".shr") == 0) {
+        name_length -= 4;
+    }
+
+    char *input_copy = malloc(strlen(input) + 1);
+    char *output = malloc(strlen(output_dir) + 1 + name_length + 1);
+    if (!input_copy || !output) {
+        fprintf(stderr, "Error: Cannot allocate memory for file list\n");
+        free(input_copy);
+        free(output);
+        return false;
+    }
+    strcpy(input_copy, input);
+    sprintf(output, "%s/%.*s", output_dir, (int)name_length, name);
+
+    // The input is read while the output is written
+    struct stat input_st, output_st;
+    if (stat(input, &input_st) == 0 && stat(output, &output_st) == 0 &&
+        input_st.st_dev == output_st.st_dev && input_st.st_ino == output_st.st_ino) {
+        fprintf(stderr, "Error: Output for '%s' would overwrite it\n", input);
+        free(input_copy);
+        free(output);
+        return false;
+    }
+
+    if (batch->n_files == batch->capacity) {
+        int capacity = batch->capacity > 0 ? batch->capacity * 2 : 64;
+        batch_file_t *files = realloc(batch->files, (size_t)capacity * sizeof(batch_file_t));
+        if (!files) {
+            fprintf(stderr, "Error: Cannot allocate memory for file list\n");
+            free(input_copy);
+            free(output);
+            return false;
+        }
+        batch->files = files;
+        batch->capacity = capacity;
+    }
+    batch_file_t *file = &batch->files[batch->n_files++];
+    file->input = input_copy;
+    file->output = output;
+    file->src_size = 0;
+    file->dec_size = -1;
+    return true;
+}
+
+/**
+ * @brief Add an input to a batch: a file, or each regular file in a directory
+ */
+static bool batch_add_input(batch_t *batch, const char *input, const char *output_dir) {
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open file '%s': %s\n", input, strerror(errno));
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return batch_add_file(batch, input, output_dir);
+    }
+
+    DIR *dir = opendir(input);
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory '%s': %s\n", input, strerror(errno));
+        return false;
+    }
+    bool success = true;
+    struct dirent *entry;
+    while (success && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char *path = malloc(strlen(input) + 1 + strlen(entry->d_name) + 1);
+        if (!path) {
+            fprintf(stderr, "Error: Cannot allocate memory for file list\n");
+            success = false;
+            break;
+        }
+        sprintf(path, "%s/%s", input, entry->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            success = batch_add_file(batch, path, output_dir);
+        }
+        free(path);
+    }
+    closedir(dir);
+    return success;
+}
+
+/**
+ * @brief Decompress one file of a batch
+ *
+ * Data with a data file header is decoded into a mapping of the output file
+ * where possible. Other data is decoded into the buffer of the thread.
+ *
+ * @return Size of decompressed data, or -1 on error
+ */
+static int batch_decompress_file(batch_file_t *file, uint8_t **buffer, size_t *buffer_size) {
+    bool src_mapped;
+    uint8_t *src_data = read_file(file->input, &file->src_size, &src_mapped);
+    if (!src_data) {
+        return -1;
+    }
+
+    int dec_size = -1;
+    bool written = false;
+#ifdef SHRINKLER_DEC_MMAP
+    written = decompress_to_mapped_file(src_data, file->src_size, file->output, &dec_size);
+#endif
+    if (!written) {
+        dec_size = decompress_reusing(src_data, file->src_size, buffer, buffer_size);
+        if (dec_size >= 0 && !write_file(file->output, *buffer, (size_t)dec_size)) {
+            dec_size = -2;
+        }
+    }
+    if (dec_size == -1) {
+        fprintf(stderr, "Error: Decompression of '%s' failed: corrupted or invalid bitstream\n", file->input);
+    }
+
+    free_file(src_data, file->src_size, src_mapped);
+    return dec_size < 0 ? -1 : dec_size;
+}
+
+static int batch_take_file(batch_t *batch) {
+#ifdef SHRINKLER_DEC_THREADS
+    pthread_mutex_lock(&batch->mutex);
+    int f = batch->next_file++;
+    pthread_mutex_unlock(&batch->mutex);
+    return f;
+#else
+    return batch->next_file++;
+#endif
+}
+
+/**
+ * @brief Decompress files of a batch until none are left
+ *
+ * Each thread takes the next file when done with the previous one, so the
+ * threads stay busy however the file sizes vary. The output buffer of the
+ * thread is reused for all the files it decodes.
+ */
+static void* batch_worker(void *arg) {
+    batch_t *batch = arg;
+    uint8_t *buffer = NULL;
+    size_t buffer_size = 0;
+    int f;
+    while ((f = batch_take_file(batch)) < batch->n_files) {
+        batch_file_t *file = &batch->files[f];
+        file->dec_size = batch_decompress_file(file, &buffer, &buffer_size);
+        if (batch->verbose && file->dec_size >= 0) {
+#ifdef SHRINKLER_DEC_THREADS
+            pthread_mutex_lock(&batch->mutex);
+#endif
+            printf("%s -> %s: %zu -> %d bytes\n", file->input, file->output, file->src_size, file->dec_size);
+#ifdef SHRINKLER_DEC_THREADS
+            pthread_mutex_unlock(&batch->mutex);
+#endif
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * @brief Decompress many files into a directory, on several threads
+ *
+ * The files are decoded concurrently, so blocks within each file are
+ * decoded on its thread. The total sizes and throughput are reported.
+ *
+ * @return 0 if all files were decompressed, 1 if not
+ */
+static int batch_decompress(const char **inputs, int n_inputs, const char *output_dir, bool verbose) {
+    batch_t batch;
+    batch.files = NULL;
+    batch.n_files = 0;
+    batch.capacity = 0;
+    batch.next_file = 0;
+    batch.verbose = verbose;
+
+    struct stat st;
+    if (stat(output_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: Output directory '%s' does not exist\n", output_dir);
+        return 1;
+    }
+    bool success = true;
+    for (int i = 0; success && i < n_inputs; i++) {
+        success = batch_add_input(&batch, inputs[i], output_dir);
+    }
+
+    if (success) {
+        int n_threads = shr_thread_count();
+        if (n_threads > batch.n_files) {
+            n_threads = batch.n_files;
+        }
+        g_threads = 1;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef SHRINKLER_DEC_THREADS
+        pthread_mutex_init(&batch.mutex, NULL);
+        pthread_t threads[MAX_THREADS];
+        int started = 1;
+        while (started < n_threads && pthread_create(&threads[started], NULL, batch_worker, &batch) == 0) {
+            started++;
+        }
+        batch_worker(&batch);
+        for (int t = 1; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_mutex_destroy(&batch.mutex);
+#else
+        batch_worker(&batch);
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+        int n_done = 0;
+        unsigned long long total_src = 0, total_dec = 0;
+        for (int f = 0; f < batch.n_files; f++) {
+            if (batch.files[f].dec_size >= 0) {
+                n_done++;
+                total_src += batch.files[f].src_size;
+                total_dec += (unsigned long long)batch.files[f].dec_size;
+            }
+        }
+        printf("Decompressed %d of %d files: %llu -> %llu bytes in %.3f s (%.1f MB/s)\n",
+               n_done, batch.n_files, total_src, total_dec, seconds,
+               seconds > 0 ? total_dec / seconds / 1e6 : 0.0);
+        success = n_done == batch.n_files;
+    }
+
+    for (int f = 0; f < batch.n_files; f++) {
+        free(batch.files[f].input);
+        free(batch.files[f].output);
+    }
+    free(batch.files);
+    return success ? 0 : 1;
+}
+#endif
+
+void print_usage(const char *progname) {
+    printf("Shrinkler Decompressor\n");
+    printf("Usage: %s [options] <input_file> [output_file]\n", progname);
+    printf("\nOptions:\n");
+    printf("  -h, --help     Show this help message\n");
+    printf("  -v, --verbose  Verbose output\n");
+    printf("  --trace        Enable decompression trace\n");
+    printf("  -j N           Threads for decompressing data in block mode, or files in batch\n");
+    printf("                 mode (one per processor)\n");
+    printf("  --in-place     Decompress within the input buffer, using the safety margin\n");
+    printf("                 of the data file header (written by the -w option of Shrinkler)\n");
+    printf("  --stream N     Decompress in chunks, keeping N bytes of history for references\n");
+    printf("                 (0 for the uncompressed size in the data file header)\n");
+    printf("  --dictionary F Decompress data crunched against the dictionary in file F\n");
+    printf("                 (written by the --dictionary option of Shrinkler)\n");
+    printf("  --range O:N    Decompress only the N bytes from offset O, decoding only the\n");
+    printf("                 blocks holding them (written by the --blocks option of Shrinkler)\n");
+#ifdef SHRINKLER_DEC_BATCH
+    printf("  --batch DIR    Decompress every input file, and every file in each input\n");
+    printf("                 directory, into DIR on several threads (-j), removing any .shr\n");
+    printf("                 extension. With -v, each file is reported\n");
+#endif
+    printf("\nIf output_file is not specified, output goes to stdout\n");
     printf("\nExample:\n");
     printf("  %s compressed.shr decompressed.bin\n", progname);
     printf("  %s compressed.shr > decompressed.bin\n", progname);
+#ifdef SHRINKLER_DEC_BATCH
+    printf("  %s --batch out/ assets/*.shr\n", progname);
+#endif
 }
 
 int main(int argc, char *argv[]) {
     bool verbose = false;
-    const char *input_file = NULL;
-    const char *output_file = NULL;
+    bool in_place = false;
+    long stream_window = -1;
+    bool range = false;
+    const char *dictionary_file = NULL;
+    size_t range_offset = 0, range_size = 0;
+#ifdef SHRINKLER_DEC_BATCH
+    const char *batch_dir = NULL;
+#endif
+    const char **inputs = malloc((size_t)argc * sizeof(const char *));
+    int n_inputs = 0;
+    if (!inputs) {
+        fprintf(stderr, "Error: Cannot allocate memory for arguments\n");
+        return 1;
+    }
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -481,16 +2058,55 @@ int main(int argc, char *argv[]) {
             verbose = true;
         } else if (strcmp(argv[i], "--trace") == 0) {
             g_trace = true;
-        } else if (!input_file) {
-            input_file = argv[i];
-        } else if (!output_file) {
-            output_file = argv[i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            g_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            in_place = true;
+        } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            stream_window = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--dictionary") == 0 && i + 1 < argc) {
+            dictionary_file = argv[++i];
+        } else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%zu:%zu", &range_offset, &range_size) != 2) {
+                fprintf(stderr, "Error: Range must be given as OFFSET:SIZE\n");
+                return 1;
+            }
+            range = true;
+#ifdef SHRINKLER_DEC_BATCH
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_dir = argv[++i];
+#endif
         } else {
-            fprintf(stderr, "Error: Too many arguments\n");
+            inputs[n_inputs++] = argv[i];
+        }
+    }
+    
+#ifdef SHRINKLER_DEC_BATCH
+    if (batch_dir) {
+        int result;
+        if (in_place || stream_window >= 0 || range || dictionary_file || g_trace) {
+            fprintf(stderr, "Error: Batch mode cannot be combined with other decompression modes\n");
+            result = 1;
+        } else if (n_inputs == 0) {
+            fprintf(stderr, "Error: Input files required\n");
             print_usage(argv[0]);
-            return 1;
+            result = 1;
+        } else {
+            result = batch_decompress(inputs, n_inputs, batch_dir, verbose);
         }
+        free(inputs);
+        return result;
+    }
+#endif
+    if (n_inputs > 2) {
+        fprintf(stderr, "Error: Too many arguments\n");
+        print_usage(argv[0]);
+        free(inputs);
+        return 1;
     }
+    const char *input_file = n_inputs > 0 ? inputs[0] : NULL;
+    const char *output_file = n_inputs > 1 ? inputs[1] : NULL;
+    free(inputs);
     
     if (!input_file) {
         fprintf(stderr, "Error: Input file required\n");
@@ -504,7 +2120,8 @@ int main(int argc, char *argv[]) {
     
     // Read input file
     size_t src_size;
-    uint8_t *src_data = read_file(input_file, &src_size);
+    bool src_mapped;
+    uint8_t *src_data = read_file(input_file, &src_size, &src_mapped);
     if (!src_data) {
         return 1;
     }
@@ -513,12 +2130,88 @@ int main(int argc, char *argv[]) {
         printf("Compressed size: %zu bytes\n", src_size);
     }
     
-    // Decompress (shr_unpack will allocate its own buffer dynamically)
+    if (stream_window >= 0) {
+        FILE *out = output_file ? fopen(output_file, "wb") : stdout;
+        if (!out) {
+            fprintf(stderr, "Error: Cannot create file '%s': %s\n", output_file, strerror(errno));
+            free_file(src_data, src_size, src_mapped);
+            return 1;
+        }
+        long total = stream_to_file(src_data, src_size, (size_t)stream_window, out);
+        bool success = total >= 0;
+        if (output_file && fclose(out) != 0) {
+            fprintf(stderr, "Error: Cannot write file '%s'\n", output_file);
+            success = false;
+        }
+        if (!success && output_file) {
+            unlink(output_file);
+        }
+        if (success && verbose) {
+            printf("Decompressed size: %ld bytes\n", total);
+        }
+        free_file(src_data, src_size, src_mapped);
+        return success ? 0 : 1;
+    }
+    
     uint8_t *dst_data = NULL;
-    int dec_size = shrinkler_decompress(src_data, src_size, &dst_data);
+    int dec_size;
+    bool output_written = false;
+    if (dictionary_file) {
+        size_t dict_size;
+        uint8_t *dict_data = read_dictionary(dictionary_file, &dict_size);
+        if (!dict_data) {
+            free_file(src_data, src_size, src_mapped);
+            return 1;
+        }
+        dec_size = shrinkler_decompress_dictionary(src_data, src_size, dict_data, dict_size, &dst_data);
+        free(dict_data);
+    } else if (range) {
+        dst_data = malloc(range_size > 0 ? range_size : 1);
+        if (!dst_data) {
+            fprintf(stderr, "Error: Cannot allocate memory for decompression\n");
+            free_file(src_data, src_size, src_mapped);
+            return 1;
+        }
+        dec_size = shrinkler_decompress_range(src_data, src_size, range_offset, dst_data, range_size);
+    } else if (in_place) {
+        // Place the compressed data at the end of the buffer and decompress onto it
+        shrinkler_header_t header;
+        size_t header_size = shrinkler_read_header(src_data, src_size, &header);
+        size_t buffer_size = shrinkler_inplace_size(src_data, src_size);
+        if (header_size == 0) {
+            fprintf(stderr, "Error: In-place decompression requires a data file header\n");
+            free_file(src_data, src_size, src_mapped);
+            return 1;
+        }
+        size_t packed_size = header_size + header.compressed_size;
+        if (buffer_size < packed_size) {
+            buffer_size = packed_size;
+        }
+        dst_data = malloc(buffer_size);
+        if (!dst_data) {
+            fprintf(stderr, "Error: Cannot allocate memory for decompression\n");
+            free_file(src_data, src_size, src_mapped);
+            return 1;
+        }
+        uint8_t *packed = dst_data + buffer_size - packed_size;
+        memcpy(packed, src_data, packed_size);
+        dec_size = shrinkler_decompress_into(packed, packed_size, dst_data, buffer_size);
+    } else {
+#ifdef SHRINKLER_DEC_MMAP
+        // Decompress into the output file when its size is known
+        if (output_file && !g_trace) {
+            output_written = decompress_to_mapped_file(src_data, src_size, output_file, &dec_size);
+        }
+#endif
+        if (!output_written) {
+            // Decompress (the output buffer is allocated dynamically)
+            dec_size = shrinkler_decompress(src_data, src_size, &dst_data);
+        }
+    }
     if (dec_size < 0) {
         fprintf(stderr, "Error: Decompression failed: corrupted or invalid bitstream\n");
-        free(src_data);
+        free_file(src_data, src_size, src_mapped);
+        free(dst_data);
         return 1;
     }
     
@@ -530,7 +2223,7 @@ int main(int argc, char *argv[]) {
     // Write output
     bool success;
     if (output_file) {
-        success = write_file(output_file, dst_data, dec_size);
+        success = output_written || write_file(output_file, dst_data, dec_size);
         if (success && verbose) {
             printf("Output written to '%s'\n", output_file);
         }
@@ -545,7 +2238,7 @@ int main(int argc, char *argv[]) {
     }
     
     // Cleanup
-    free(src_data);
+    free_file(src_data, src_size, src_mapped);
     free(dst_data);
     
     return success ? 0 : 1;
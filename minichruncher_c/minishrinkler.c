@@ -23,6 +23,17 @@
 #include <stdarg.h>
 #endif
 #include <stdbool.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define MINISHRINKLER_THREADS
+#include <pthread.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TAG_PROBE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TAG_PROBE_NEON 1
+#endif
 
 ///@cond
 
@@ -49,9 +60,9 @@ static void tracef(const char *fmt, ...) {
 // Configuration - Embedded optimized
 #define MAX_FILE_SIZE (1024*1024)  // 1MB max for embedded
 #define MAX_MATCH_LENGTH 65535
-#define MAX_OFFSET 65535
 #define MIN_MATCH_LENGTH 3
-#define WINDOW_SIZE 65536
+#define NARROW_WINDOW_SIZE 65536   // Largest window for 16-bit positions
+#define MAX_WINDOW_SIZE (1 << 20)  // Largest window for 32-bit positions
 
 // Context configuration (must match decompressor)
 #define ADJUST_SHIFT 4
@@ -69,8 +80,8 @@ static void tracef(const char *fmt, ...) {
 
 ///@endcond
 
-// Moving window: computed dynamically from work memory; keep max at 64K
-// (we will compute window_size and mask at runtime based on available memory)
+// Moving window: computed dynamically from work memory. Windows up to 64K
+// store 16-bit positions; larger ones need 32-bit positions.
 
 /** @brief Range coder context */
 typedef struct {
@@ -81,6 +92,10 @@ typedef struct {
     int32_t dest_bit;                           ///< Destination bit
     uint32_t intervalsize;                      ///< Interval size
     uint32_t intervalmin;                       ///< Interval minimum
+    uint32_t output_base;                       ///< Stream index of output[0]; earlier bytes were passed on (streaming only)
+    int32_t carry_byte;                         ///< Passed-on byte a carry can still reach, or -1 (streaming only)
+    uint32_t ff_run;                            ///< Number of 0xFF bytes passed on after carry_byte (streaming only)
+    bool carried;                               ///< A carry has run into carry_byte and the 0xFF run (streaming only)
 } shr_rangecoder_t;
 
 /** @brief LZ coder state */
@@ -88,7 +103,7 @@ typedef struct {
     bool after_first;                          ///< First symbol was done?
     bool prev_was_ref;                         ///< Previous symbols was a match?
     int parity;                                ///< Parity bit
-    uint16_t last_offsets[3];                  ///< Recent offsets LRU: [0]=last, [1]=prev, [2]=older
+    int last_offsets[3];                       ///< Recent offsets LRU: [0]=last, [1]=prev, [2]=older
 } shr_lzstate_t;
 
 /** @brief Size table for encoding numbers */
@@ -104,7 +119,7 @@ static const uint8_t size_table[128] = {
  *
  * The match finder uses a compact set-associative hash table carved from
  * the provided work memory. Each bucket keeps a small number (ways) of wrapped
- * 16-bit positions.
+ * positions, 16-bit for windows up to 64K and 32-bit for larger windows.
  */
 typedef struct {
     shr_rangecoder_t coder;        ///< Range coder context
@@ -115,11 +130,15 @@ typedef struct {
     int hash_mask;                ///< hash_size - 1
     int ways;                     ///< Associativity (entries per bucket)
     int window_bits;              ///< such that window_size == (1 << window_bits)
-    int window_size;              ///< sliding window size (<= 65536)
+    int window_size;              ///< sliding window size (<= MAX_WINDOW_SIZE)
     int window_mask;              ///< window_size - 1
+    int max_match_length;         ///< Longest match to consider
+    int effort;                   ///< MINISHRINKLER_EFFORT_GREEDY, _LAZY or _OPTIMAL
 
     // Pointers into the single malloc arena (immediately after this struct)
+    bool wide_positions;          ///< window_size > 65536, so positions are in wide_buckets
     uint16_t *buckets;            ///< size = hash_size * ways; each is wrapped pos (0..mask) or 0xFFFF if empty
+    uint32_t *wide_buckets;       ///< As buckets for wide positions, with 0xFFFFFFFF if empty
     uint8_t  *tags;               ///< size = hash_size * ways; 8-bit hash tag per entry (upper hash bits)
 } shr_work_buffer_t;
 
@@ -144,14 +163,6 @@ static unsigned int hash3(const unsigned char *data) {
     return v;
 }
 
-// Approximate cost of encode_number as used by the coder: number >= 2
-static int estimate_number_cost_int(int number) {
-    int i = 0;
-    while ((4 << i) <= number) i++;
-    // continuation bits (i), stop bit (1), payload bits (i+1)
-    return i + 1 + (i + 1);
-}
-
 // Update hash table with new position (set-associative, MRU insertion with 8-bit tag)
 static void update_hash(shr_work_buffer_t *mem, const unsigned char *data, int pos, int data_size) {
     if (pos + 2 >= data_size) return;
@@ -161,13 +172,21 @@ static void update_hash(shr_work_buffer_t *mem, const unsigned char *data, int p
     uint8_t tag = (uint8_t)(full_hash >> 24);
 
     // Store wrapped position and tag at MRU slot 0; shift older entries down
-    uint16_t wrapped = (uint16_t)(pos & mem->window_mask);
+    uint32_t wrapped = (uint32_t)(pos & mem->window_mask);
     int base = (int)(bucket * mem->ways);
-    for (int i = mem->ways - 1; i > 0; i--) {
-        mem->buckets[base + i] = mem->buckets[base + i - 1];
-        mem->tags[base + i] = mem->tags[base + i - 1];
+    if (mem->wide_positions) {
+        for (int i = mem->ways - 1; i > 0; i--) {
+            mem->wide_buckets[base + i] = mem->wide_buckets[base + i - 1];
+            mem->tags[base + i] = mem->tags[base + i - 1];
+        }
+        mem->wide_buckets[base + 0] = wrapped;
+    } else {
+        for (int i = mem->ways - 1; i > 0; i--) {
+            mem->buckets[base + i] = mem->buckets[base + i - 1];
+            mem->tags[base + i] = mem->tags[base + i - 1];
+        }
+        mem->buckets[base + 0] = (uint16_t)wrapped;
     }
-    mem->buckets[base + 0] = wrapped;
     mem->tags[base + 0] = tag;
 
     tracef("UPDATE_HASH: pos=%d, bucket=%u, tag=0x%02x stored_pos=%u (wrapped, mask=0x%04x)\n",
@@ -182,6 +201,10 @@ static void range_coder_init(shr_rangecoder_t *coder, uint8_t *output, int capac
     coder->dest_bit = -1; // Start at -1 like original
     coder->intervalsize = 0x8000;
     coder->intervalmin = 0;
+    coder->output_base = 0;
+    coder->carry_byte = -1;
+    coder->ff_run = 0;
+    coder->carried = false;
     
     // Initialize contexts (must match decompressor)
     for (int i = 0; i < NUM_CONTEXTS; i++) {
@@ -210,17 +233,26 @@ static void add_bit(shr_rangecoder_t *coder) {
         bytepos = pos >> 3;
         bitmask = 0x80 >> (pos & 7);
         
+        if (bytepos < (int)coder->output_base) {
+            // Streaming: the carry ran through all bytes still in the buffer,
+            // so it turns the 0xFF run into zeros and increments carry_byte
+            assert(!coder->carried);
+            if (coder->carry_byte >= 0) coder->carry_byte++;
+            coder->carried = true;
+            return;
+        }
+        
         // Initialize byte to 0 if not already done
         while (bytepos >= (int)coder->output_size) {
-            coder->output[coder->output_size++] = 0;
+            coder->output[coder->output_size++ - coder->output_base] = 0;
         }
         
-        assert(bytepos < (int)coder->output_capacity);
-        coder->output[bytepos] ^= bitmask;
+        assert(bytepos - (int)coder->output_base < (int)coder->output_capacity);
+        coder->output[bytepos - coder->output_base] ^= bitmask;
         
         // tracef("    ADD_BIT: pos=%d bytepos=%d bitmask=0x%02x old_byte=0x%02x new_byte=0x%02x\n", 
         //        pos, bytepos, bitmask, old_byte, new_byte);
-    } while ((coder->output[bytepos] & bitmask) == 0);
+    } while ((coder->output[bytepos - coder->output_base] & bitmask) == 0);
 }
 
 // Exact copy of original rangecoder_code function
@@ -340,7 +372,7 @@ static void range_coder_finish(shr_rangecoder_t *coder) {
     
     int required_bytes = ((coder->dest_bit - 1) >> 3) + 1;
     while (required_bytes > (int)coder->output_size) {
-        coder->output[coder->output_size++] = 0;
+        coder->output[coder->output_size++ - coder->output_base] = 0;
     }
     
     // Trace the finish end
@@ -454,7 +486,8 @@ static int encode_reference(shr_rangecoder_t *coder, int offset, int length, shr
         size++;
     }
     
-    if (offset != state->last_offsets[0]) {
+    // After a reference, the decoder always reads an offset
+    if (state->prev_was_ref || offset != state->last_offsets[0]) {
         tracef("ENCODE_OFFSET: offset=%d (encoded as %d)\n", offset, offset + 2);
         size += encode_number(coder, CONTEXT_GROUP_OFFSET, offset + 2);
     } else {
@@ -473,14 +506,13 @@ static int encode_reference(shr_rangecoder_t *coder, int offset, int length, shr
         // remove offset if present in [1] or [2]
         if (offset == state->last_offsets[1]) {
             state->last_offsets[1] = state->last_offsets[0];
-            state->last_offsets[0] = (uint16_t)offset;
+            state->last_offsets[0] = offset;
         } else {
             state->last_offsets[2] = state->last_offsets[1];
             state->last_offsets[1] = state->last_offsets[0];
-            state->last_offsets[0] = (uint16_t)offset;
+            state->last_offsets[0] = offset;
         }
     }
-    assert(offset == state->last_offsets[0] && "reference offset too large");
     
     tracef("=== ENCODE_REFERENCE END ===\n");
     tracef("STATE UPDATE: after_first=%d prev_was_ref=%d parity=%d last_offset=%d\n", 
@@ -490,6 +522,77 @@ static int encode_reference(shr_rangecoder_t *coder, int offset, int length, shr
     return size;
 }
 
+// Number of equal bytes at the start of a and b, at most max_length.
+// Compares eight bytes at a time on little-endian GCC/Clang targets.
+static inline int match_length(const unsigned char *a, const unsigned char *b, int max_length) {
+    int length = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (length + 8 <= max_length) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + length, 8);
+        memcpy(&wb, b + length, 8);
+        uint64_t diff = wa ^ wb;
+        if (diff != 0) {
+            return length + (__builtin_ctzll(diff) >> 3);
+        }
+        length += 8;
+    }
+#endif
+    while (length < max_length && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+// Bit mask of the entries among the first ways (at most 32) of a bucket's
+// tags which are equal to tag. Compares 16 tags at a time with SSE2 or NEON
+// when ways is a multiple of 16.
+static inline uint32_t tag_match_mask(const uint8_t *tags, uint8_t tag, int ways) {
+    uint32_t mask = 0;
+    int w = 0;
+#if TAG_PROBE_SSE2
+    if ((ways & 15) == 0) {
+        __m128i needle = _mm_set1_epi8((char)tag);
+        for (; w < ways; w += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)&tags[w]);
+            mask |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)) << w;
+        }
+    }
+#elif TAG_PROBE_NEON
+    if ((ways & 15) == 0) {
+        static const uint8_t bit_weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        uint8x16_t needle = vdupq_n_u8(tag);
+        uint8x16_t weights = vld1q_u8(bit_weights);
+        for (; w < ways; w += 16) {
+            // Keep one bit per matching lane, then add up each half into a byte
+            uint8x16_t bits = vandq_u8(vceqq_u8(vld1q_u8(&tags[w]), needle), weights);
+            uint8x8_t sums = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+            sums = vpadd_u8(sums, sums);
+            sums = vpadd_u8(sums, sums);
+            mask |= (uint32_t)vget_lane_u16(vreinterpret_u16_u8(sums), 0) << w;
+        }
+    }
+#endif
+    for (; w < ways; w++) {
+        if (tags[w] == tag) mask |= (uint32_t)1 << w;
+    }
+    return mask;
+}
+
+// Index of the lowest set bit of a non-zero mask
+static inline int lowest_bit(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
 // Intelligent Match Finder using enhanced hash table
 // Evaluate a candidate (absolute position and offset), and if valid, update best match according
 // to selection policy. prefilter_len controls the quick check length (e.g., 2 or MIN_MATCH_LENGTH).
@@ -512,18 +615,19 @@ static inline void evaluate_and_consider_candidate(
     }
 
     // Extend the match starting from prefilter_len
+    int limit = max_len;
+    if (limit > data_size - pos) limit = data_size - pos;
+    if (limit > data_size - absolute_candidate_pos) limit = data_size - absolute_candidate_pos;
     int match_len = MIN_MATCH_LENGTH;
-    while (match_len < max_len &&
-           pos + match_len < data_size &&
-           absolute_candidate_pos + match_len < data_size &&
-           data[pos + match_len] == data[absolute_candidate_pos + match_len]) {
-        match_len++;
+    if (match_len < limit) {
+        match_len += match_length(&data[pos + match_len], &data[absolute_candidate_pos + match_len], limit - match_len);
     }
 
     // Enforce minimum length requirements (always apply far-offset penalties)
     int min_len_req = MIN_MATCH_LENGTH;
     if (offset > 1024) min_len_req++;
     if (offset > 4096) min_len_req += 2;
+    if (offset > 65536) min_len_req++;
     if (match_len < min_len_req) return;
 
     // Greedy selection: keep the longest match; tie-break by smaller offset
@@ -540,9 +644,9 @@ static int find_match(shr_work_buffer_t *mem, const unsigned char *data, int dat
     
     if (pos + 2 >= data_size) return 0;
     
-    int max_len = min(MAX_MATCH_LENGTH, data_size - pos);
+    int max_len = min(mem->max_match_length, data_size - pos);
     int window_limit = mem->window_size - 1;
-    int max_offset = min(pos, min(MAX_OFFSET, window_limit));
+    int max_offset = min(pos, window_limit);
         
     // Probe recent offsets (cheap LRU of 2)
     for (int pi = 1; pi <= 2; ++pi) {
@@ -558,12 +662,21 @@ static int find_match(shr_work_buffer_t *mem, const unsigned char *data, int dat
     unsigned int full_hash = hash3(&data[pos]);
     unsigned int hash = full_hash & (unsigned int)mem->hash_mask;
 
-    // Iterate all ways in MRU order (index 0 is most recent)
-    for (int w = 0; w < mem->ways; w++) {
-        uint16_t wrapped_pos = mem->buckets[hash * mem->ways + w];
-        if (wrapped_pos == 0xFFFF) continue; // empty slot
-        uint8_t tag = mem->tags[hash * mem->ways + w];
-        if (tag != (uint8_t)(full_hash >> 24)) continue; // tag mismatch, skip
+    // Visit the ways with a matching tag in MRU order (index 0 is most recent)
+    int base = (int)(hash * mem->ways);
+    uint32_t matches = tag_match_mask(&mem->tags[base], (uint8_t)(full_hash >> 24), mem->ways);
+    for (; matches != 0; matches &= matches - 1) {
+        int w = lowest_bit(matches);
+        int wrapped_pos;
+        if (mem->wide_positions) {
+            uint32_t wide_pos = mem->wide_buckets[base + w];
+            if (wide_pos == 0xFFFFFFFF) continue; // empty slot
+            wrapped_pos = (int)wide_pos;
+        } else {
+            uint16_t narrow_pos = mem->buckets[base + w];
+            if (narrow_pos == 0xFFFF) continue; // empty slot
+            wrapped_pos = narrow_pos;
+        }
 
         // Reconstruct absolute candidate position within the current window span
         int absolute_candidate_pos = (pos & ~mem->window_mask) | wrapped_pos;
@@ -579,77 +692,77 @@ static int find_match(shr_work_buffer_t *mem, const unsigned char *data, int dat
     return *best_length >= MIN_MATCH_LENGTH;
 }
 
-// Main compression function
-static int compress_data(const unsigned char *input, int input_size, 
-                        unsigned char *output, int output_capacity,
-                        size_t work_memory_size) {
-    int pos = 0;
-    
-    // Derive match-finder sizes from provided work memory (single malloc arena)
-    // We use a set-associative table with "ways" entries per bucket and MRU insertion.
-    int ways = (work_memory_size >= 4096) ? 4 : 2; // increase associativity when memory allows
-
-    ways = 32; // FIXME: this seems to perform very well!
-
-    if (work_memory_size <= sizeof(shr_work_buffer_t)) {
-        return -4; // Not enough memory even for control structure
-    }
-
-    size_t available = work_memory_size - sizeof(shr_work_buffer_t);
-
-    // Compute the maximum number of buckets we can afford in the available arena:
-    // each bucket costs (ways * 2 bytes for positions) + (ways * 1 byte for tags)
-    size_t cost_per_bucket = (size_t)(ways * 3);
-    size_t max_buckets = available / cost_per_bucket;
-    if (max_buckets == 0) {
-        return -4; // Not enough memory for even a single bucket
-    }
-
-    // Choose hash_size as largest power-of-two <= max_buckets for fast masking
-    int hash_size = 1;
-    while (((size_t)hash_size << 1) <= max_buckets) hash_size <<= 1;
-
-    // Determine window size based on total storable entries (hash_size * ways)
-    // Pick a power-of-two window_size <= min(65536, 2 * hash_size * ways) with a minimum of 256
+// Window size for a table of hash_size buckets of the given number of ways:
+// a power of two <= min(max_window, 2 * hash_size * ways) with a minimum of 256
+static size_t match_window_size(int hash_size, int ways, size_t max_window) {
     size_t target_entries = (size_t)hash_size * (size_t)ways;
     size_t target_window = target_entries * 2; // tighter coupling with actual indexable entries
     if (target_window < 256) target_window = 256;
-    if (target_window > 65536) target_window = 65536;
+    if (target_window > max_window) target_window = max_window;
     // Round down to power of two
     size_t window_size = 1;
     while ((window_size << 1) <= target_window) window_size <<= 1;
-    int window_bits = 0;
-    size_t tmp_ws = window_size;
-    while ((tmp_ws >>= 1) != 0) window_bits++;
-    int window_mask = (int)(window_size - 1);
+    return window_size;
+}
+
+// Bytes per table entry: a position and a tag
+static size_t match_entry_size(size_t window_size) {
+    return (window_size > NARROW_WINDOW_SIZE ? sizeof(uint32_t) : sizeof(uint16_t)) + sizeof(uint8_t);
+}
 
-    // Compute actual arena size and allocate
-    size_t buckets_bytes = (size_t)hash_size * (size_t)ways * sizeof(uint16_t);
-    size_t tags_bytes = (size_t)hash_size * (size_t)ways * sizeof(uint8_t);
+// Largest power-of-two number of buckets for which the tables, plus
+// window_cost_x2 / 2 bytes per window byte, fit in the available memory.
+// Returns 0 if not even one bucket fits.
+static int fit_match_finder(size_t available, int ways, size_t max_window, size_t window_cost_x2,
+                            size_t *window_size) {
+    int hash_size = 0;
+    for (int h = 1; h <= (1 << 24); h <<= 1) {
+        size_t w = match_window_size(h, ways, max_window);
+        size_t need = (size_t)h * (size_t)ways * match_entry_size(w) + w * window_cost_x2 / 2;
+        if (need > available) break;
+        hash_size = h;
+        *window_size = w;
+    }
+    return hash_size;
+}
 
-    // Guard in case rounding left us slightly over the available arena; adjust down
-    if (buckets_bytes + tags_bytes > available) {
-        size_t usable_buckets = available / cost_per_bucket;
-        if (usable_buckets == 0) return -4;
-        // round down to power of two
-        hash_size = 1;
-        while (((size_t)hash_size << 1) <= usable_buckets) hash_size <<= 1;
-        buckets_bytes = (size_t)hash_size * (size_t)ways * sizeof(uint16_t);
-        tags_bytes = (size_t)hash_size * (size_t)ways * sizeof(uint8_t);
+// Choose the number of buckets and the window size for the available memory.
+// Windows larger than 64K need 32-bit positions, so they are used whenever
+// the memory holds enough of the wider entries for such a window, even
+// though that leaves fewer buckets than 16-bit positions would.
+static int choose_match_finder(size_t available, int ways, size_t max_window, size_t window_cost_x2,
+                               size_t *window_size) {
+    size_t narrow_max = max_window < NARROW_WINDOW_SIZE ? max_window : NARROW_WINDOW_SIZE;
+    int hash_size = fit_match_finder(available, ways, narrow_max, window_cost_x2, window_size);
+    if (max_window > NARROW_WINDOW_SIZE) {
+        size_t wide_window = 0;
+        int wide_hash_size = fit_match_finder(available, ways, max_window, window_cost_x2, &wide_window);
+        if (wide_window > NARROW_WINDOW_SIZE) {
+            *window_size = wide_window;
+            return wide_hash_size;
+        }
     }
+    return hash_size;
+}
 
-    size_t total_size = work_memory_size; // allocate exactly what caller provides
+// Set up the match finder tables in the arena, which must hold
+// hash_size * ways positions followed by as many tags
+static void init_match_finder(shr_work_buffer_t *mem, uint8_t *arena, int hash_size, int ways, size_t window_size) {
+    int window_bits = 0;
+    size_t tmp_ws = window_size;
+    while ((tmp_ws >>= 1) != 0) window_bits++;
 
-    shr_work_buffer_t *mem = malloc(total_size);
-    if (!mem) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
-        return -4; // Memory allocation failed
+    size_t entries = (size_t)hash_size * (size_t)ways;
+    mem->wide_positions = window_size > NARROW_WINDOW_SIZE;
+    if (mem->wide_positions) {
+        mem->buckets = NULL;
+        mem->wide_buckets = (uint32_t *)arena;
+        mem->tags = arena + entries * sizeof(uint32_t);
+    } else {
+        mem->buckets = (uint16_t *)arena;
+        mem->wide_buckets = NULL;
+        mem->tags = arena + entries * sizeof(uint16_t);
     }
-    // Zero the entire arena for deterministic behavior
-    memset(mem, 0, work_memory_size);
-    uint8_t *arena = (uint8_t *)(mem + 1);
-    mem->buckets = (uint16_t *)arena;
-    mem->tags = (uint8_t *)(arena + buckets_bytes);
 
     // Initialize match finder configuration
     mem->hash_size = hash_size;
@@ -657,11 +770,289 @@ static int compress_data(const unsigned char *input, int input_size,
     mem->hash_mask = hash_size - 1;
     mem->window_bits = window_bits;
     mem->window_size = (int)window_size;
-    mem->window_mask = window_mask;
+    mem->window_mask = (int)(window_size - 1);
+    mem->max_match_length = MAX_MATCH_LENGTH;
+    mem->effort = MINISHRINKLER_EFFORT_LAZY;
 
-    // Initialize tables: 0xFFFF means empty slot, tags to 0
-    for (int i = 0; i < mem->hash_size * mem->ways; i++) mem->buckets[i] = 0xFFFF;
+    // Initialize tables: all ones means empty slot, tags to 0
+    if (mem->wide_positions) {
+        memset(mem->wide_buckets, 0xFF, entries * sizeof(uint32_t));
+    } else {
+        for (int i = 0; i < mem->hash_size * mem->ways; i++) mem->buckets[i] = 0xFFFF;
+    }
     memset(mem->tags, 0, (size_t)(mem->hash_size * mem->ways));
+}
+
+// Encode the symbol at pos, using lazy matching unless the effort is greedy.
+// Returns the position after it.
+static int compress_step(shr_work_buffer_t *mem, const unsigned char *input, int input_size, int pos) {
+    // Update hash table
+    update_hash(mem, input, pos, input_size);
+    
+    int best_offset, best_length;
+    
+    if (find_match(mem, input, input_size, pos, &best_offset, &best_length)) {
+        // Lazy matching: look ahead for better matches
+        if (best_length >= 4 && pos + 1 < input_size && mem->effort != MINISHRINKLER_EFFORT_GREEDY) {
+            int next_offset, next_length;
+            
+            // Update hash for next position
+            update_hash(mem, input, pos + 1, input_size);
+            
+            if (find_match(mem, input, input_size, pos + 1, &next_offset, &next_length)) {
+                // Compare current match vs next position match
+                int current_cost = 2 + (best_length >= 8 ? 1 : 0) + (best_offset >= 256 ? 1 : 0);
+                int next_cost = 2 + (next_length >= 8 ? 1 : 0) + (next_offset >= 256 ? 1 : 0);
+                
+                // If next match is significantly better, encode literal and continue
+                if (next_length > best_length + 1 || 
+                    (next_length == best_length + 1 && next_cost <= current_cost)) {
+                    tracef("POS %d: LAZY LITERAL 0x%02x (waiting for better match)\n", pos, input[pos]);
+                    encode_literal(&mem->coder, input[pos], &mem->state);
+                    return pos + 1;
+                }
+            }
+        }
+        
+        // Encode reference
+        tracef("POS %d: MATCH offset=%d length=%d\n", pos, best_offset, best_length);
+        encode_reference(&mem->coder, best_offset, best_length, &mem->state);
+        return pos + best_length;
+    }
+
+    // Encode literal
+    tracef("POS %d: LITERAL 0x%02x (%c)\n", pos, input[pos], 
+           (input[pos] >= 32 && input[pos] <= 126) ? input[pos] : '.');
+    encode_literal(&mem->coder, input[pos], &mem->state);
+    return pos + 1;
+}
+
+// Optimal-lite parsing (MINISHRINKLER_EFFORT_OPTIMAL): the input is parsed in
+// blocks of up to PARSE_BLOCK bytes. Within a block, a forward pass finds the
+// cheapest sequence of literals and references, pricing each with the context
+// probabilities at the start of the block, and then the sequence is encoded.
+// References are cut at the block end, except that a match of at least
+// PARSE_BLOCK bytes at the start of a block is encoded directly.
+
+///@cond
+
+#define PARSE_BLOCK 128
+// Lengths below the full length of a match which are also considered
+#define PARSE_SHORT_LENGTHS 16
+
+///@endcond
+
+/** @brief Cheapest way found to reach a position in the parsed block */
+typedef struct {
+    uint32_t cost;                ///< Cost in 1/64 bits from the start of the block
+    int length;                   ///< Length of the symbol ending here (1 for a literal)
+    int offset;                   ///< Offset of that symbol, or 0 for a literal
+    int last_offset;              ///< Offset of the latest reference up to here
+    int next;                     ///< Position of the next symbol end on the chosen path
+} shr_parse_node_t;
+
+// Index of the highest set bit of a non-zero value
+static inline int highest_bit(uint32_t value) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(value);
+#else
+    int i = 0;
+    while (value >>= 1) i++;
+    return i;
+#endif
+}
+
+// Cost in 1/64 bits of coding a bit in a context with its current probability
+static inline int bit_cost(const shr_rangecoder_t *coder, int context_index, int bit) {
+    unsigned prob = coder->contexts[context_index];
+    unsigned p = bit ? prob : 0x10000 - prob;
+    // -log2(p / 65536) using the size table for the fractional part
+    int msb = highest_bit(p);
+    unsigned mantissa = msb >= 7 ? p >> (msb - 7) : p << (7 - msb);
+    return (15 - msb) * 64 + size_table[mantissa - 128];
+}
+
+// Cost of encode_number
+static int number_cost(const shr_rangecoder_t *coder, int context_group, int number) {
+    int base_context = 1 + (context_group << 8);
+    int cost = 0;
+    int i;
+    for (i = 0 ; (4 << i) <= number ; i++) {
+        cost += bit_cost(coder, base_context + (i * 2 + 2), 1);
+    }
+    cost += bit_cost(coder, base_context + (i * 2 + 2), 0);
+    for (; i >= 0 ; i--) {
+        cost += bit_cost(coder, base_context + (i * 2 + 1), (number >> i) & 1);
+    }
+    return cost;
+}
+
+// Cost of encode_literal
+static int literal_cost(const shr_rangecoder_t *coder, unsigned char value, int parity, bool after_first) {
+    int cost = after_first ? bit_cost(coder, 1 + CONTEXT_KIND + (parity << 8), 0) : 0;
+    int context = 1;
+    for (int i = 7; i >= 0; i--) {
+        int bit = (value >> i) & 1;
+        cost += bit_cost(coder, 1 + ((parity << 8) | context), bit);
+        context = (context << 1) | bit;
+    }
+    return cost;
+}
+
+// Cost of encode_reference, except for the length
+static int reference_offset_cost(const shr_rangecoder_t *coder, int offset, int parity,
+                                 bool prev_was_ref, int last_offset) {
+    int cost = bit_cost(coder, 1 + CONTEXT_KIND + (parity << 8), 1);
+    if (!prev_was_ref) {
+        int repeated = offset == last_offset;
+        cost += bit_cost(coder, 1 + CONTEXT_REPEATED, repeated);
+        if (repeated) return cost;
+    }
+    return cost + number_cost(coder, CONTEXT_GROUP_OFFSET, offset + 2);
+}
+
+// Relax the parse node at end with a reference from start
+static void parse_consider_reference(shr_parse_node_t *nodes, int start, int length, int offset, uint32_t cost) {
+    shr_parse_node_t *node = &nodes[start + length];
+    if (cost < node->cost) {
+        node->cost = cost;
+        node->length = length;
+        node->offset = offset;
+        node->last_offset = offset;
+    }
+}
+
+// Relax the nodes reached by a match of the given offset and full length
+// from position i of the block
+static void parse_consider_match(shr_work_buffer_t *mem, shr_parse_node_t *nodes, int i,
+                                 int offset, int length, int parity) {
+    const shr_rangecoder_t *coder = &mem->coder;
+    shr_parse_node_t *from = &nodes[i];
+    bool prev_was_ref = from->offset != 0;
+    uint32_t base = from->cost + reference_offset_cost(coder, offset, parity, prev_was_ref, from->last_offset);
+    parse_consider_reference(nodes, i, length, offset,
+                             base + number_cost(coder, CONTEXT_GROUP_LENGTH, length));
+    int short_end = min(length - 1, MIN_MATCH_LENGTH + PARSE_SHORT_LENGTHS - 1);
+    for (int l = MIN_MATCH_LENGTH; l <= short_end; l++) {
+        parse_consider_reference(nodes, i, l, offset, base + number_cost(coder, CONTEXT_GROUP_LENGTH, l));
+    }
+}
+
+// Parse and encode the block at pos. Returns the position after it.
+static int parse_block(shr_work_buffer_t *mem, shr_parse_node_t *nodes,
+                       const unsigned char *input, int input_size, int pos) {
+    shr_lzstate_t *state = &mem->state;
+    int block = min(PARSE_BLOCK, input_size - pos);
+
+    update_hash(mem, input, pos, input_size);
+    int best_offset, best_length;
+    bool found = find_match(mem, input, input_size, pos, &best_offset, &best_length);
+    if (found && best_length >= PARSE_BLOCK) {
+        encode_reference(&mem->coder, best_offset, best_length, state);
+        return pos + best_length;
+    }
+
+    nodes[0].cost = 0;
+    nodes[0].length = 0;
+    nodes[0].offset = state->prev_was_ref ? state->last_offsets[0] : 0;
+    nodes[0].last_offset = state->last_offsets[0];
+    for (int i = 1; i <= block; i++) {
+        nodes[i].cost = UINT32_MAX;
+    }
+
+    // Forward pass
+    for (int i = 0; i < block; i++) {
+        shr_parse_node_t *from = &nodes[i];
+        int parity = (state->parity + i) & 1;
+        bool after_first = state->after_first || i > 0;
+        shr_parse_node_t *next = &nodes[i + 1];
+        uint32_t cost = from->cost + literal_cost(&mem->coder, input[pos + i], parity, after_first);
+        if (cost < next->cost) {
+            next->cost = cost;
+            next->length = 1;
+            next->offset = 0;
+            next->last_offset = from->last_offset;
+        }
+
+        if (i > 0) update_hash(mem, input, pos + i, input_size);
+        int max_length = block - i;
+        if (max_length < MIN_MATCH_LENGTH || !after_first) continue;
+        if (i > 0) found = find_match(mem, input, input_size, pos + i, &best_offset, &best_length);
+        if (found) {
+            parse_consider_match(mem, nodes, i, best_offset, min(best_length, max_length), parity);
+        }
+
+        // The latest offset on the path is cheap to repeat after a literal
+        int last_offset = from->last_offset;
+        if (from->offset == 0 && last_offset > 0 && last_offset <= pos + i && last_offset < mem->window_size &&
+            (!found || last_offset != best_offset)) {
+            int length = match_length(&input[pos + i], &input[pos + i - last_offset], max_length);
+            if (length >= MIN_MATCH_LENGTH) {
+                parse_consider_match(mem, nodes, i, last_offset, length, parity);
+            }
+        }
+    }
+
+    // Link the chosen path forwards and encode it
+    for (int i = block; i > 0; i -= nodes[i].length) {
+        nodes[i - nodes[i].length].next = i;
+    }
+    for (int i = 0; i < block; i = nodes[i].next) {
+        shr_parse_node_t *node = &nodes[nodes[i].next];
+        if (node->offset == 0) {
+            encode_literal(&mem->coder, input[pos + i], state);
+        } else {
+            encode_reference(&mem->coder, node->offset, node->length, state);
+        }
+    }
+    return pos + block;
+}
+
+// Encode end marker (offset 0)
+static void encode_end(shr_work_buffer_t *mem) {
+    tracef("END: ENCODE_END_MARKER\n");
+    int parity = mem->state.parity & 1;
+    range_coder_code(&mem->coder, 1 + CONTEXT_KIND + (parity << 8), 1); // KIND_REF
+    range_coder_code(&mem->coder, 1 + CONTEXT_REPEATED, 0); // Not repeated
+    encode_number(&mem->coder, CONTEXT_GROUP_OFFSET, 2); // Offset 0 + 2 = 2 = end
+}
+
+// Compress using work_memory (aligned for shr_work_buffer_t) for all state
+static int compress_in_arena(const unsigned char *input, int input_size,
+                             unsigned char *output, int output_capacity,
+                             void *work_memory, size_t work_memory_size, int effort) {
+    int pos = 0;
+    
+    // Derive match-finder sizes from provided work memory (single malloc arena)
+    // We use a set-associative table with "ways" entries per bucket and MRU insertion.
+    int ways = (work_memory_size >= 4096) ? 4 : 2; // increase associativity when memory allows
+
+    ways = 32; // FIXME: this seems to perform very well!
+    assert(ways <= 32); // tag_match_mask probes at most 32 ways
+
+    if (work_memory_size <= sizeof(shr_work_buffer_t)) {
+        return -4; // Not enough memory even for control structure
+    }
+
+    size_t available = work_memory_size - sizeof(shr_work_buffer_t);
+
+    // Choose the largest power-of-two number of buckets (for fast masking)
+    // whose positions and tags fit in the available arena, with a window
+    // based on the total storable entries (hash_size * ways). A window
+    // beyond 64K only helps as far as it covers more of the input.
+    size_t max_window = NARROW_WINDOW_SIZE;
+    while (max_window < (size_t)input_size && max_window < MAX_WINDOW_SIZE) max_window <<= 1;
+    size_t window_size = 0;
+    int hash_size = choose_match_finder(available, ways, max_window, 0, &window_size);
+    if (hash_size == 0) {
+        return -4; // Not enough memory for even a single bucket
+    }
+
+    shr_work_buffer_t *mem = work_memory;
+    // Zero the entire arena for deterministic behavior
+    memset(mem, 0, work_memory_size);
+    init_match_finder(mem, (uint8_t *)(mem + 1), hash_size, ways, window_size);
+    mem->effort = effort;
     
     // Initialize
     range_coder_init(&mem->coder, output, output_capacity);
@@ -677,56 +1068,19 @@ static int compress_data(const unsigned char *input, int input_size,
     if (input_size > 32) tracef("...");
     tracef("\n\n");
     
-    // Compression with lazy matching
-    while (pos < input_size) {
-        // Update hash table
-        update_hash(mem, input, pos, input_size);
-        
-        int best_offset, best_length;
-        
-        if (find_match(mem, input, input_size, pos, &best_offset, &best_length)) {
-            // Lazy matching: look ahead for better matches
-            if (best_length >= 4 && pos + 1 < input_size) {
-                int next_offset, next_length;
-                
-                // Update hash for next position
-                update_hash(mem, input, pos + 1, input_size);
-                
-                if (find_match(mem, input, input_size, pos + 1, &next_offset, &next_length)) {
-                    // Compare current match vs next position match
-                    int current_cost = 2 + (best_length >= 8 ? 1 : 0) + (best_offset >= 256 ? 1 : 0);
-                    int next_cost = 2 + (next_length >= 8 ? 1 : 0) + (next_offset >= 256 ? 1 : 0);
-                    
-                    // If next match is significantly better, encode literal and continue
-                    if (next_length > best_length + 1 || 
-                        (next_length == best_length + 1 && next_cost <= current_cost)) {
-                        tracef("POS %d: LAZY LITERAL 0x%02x (waiting for better match)\n", pos, input[pos]);
-                        encode_literal(&mem->coder, input[pos], &mem->state);
-                        pos++;
-                        continue;
-                    }
-                }
-            }
-            
-            // Encode reference
-            tracef("POS %d: MATCH offset=%d length=%d\n", pos, best_offset, best_length);
-            encode_reference(&mem->coder, best_offset, best_length, &mem->state);
-            pos += best_length;
-        } else {
-            // Encode literal
-            tracef("POS %d: LITERAL 0x%02x (%c)\n", pos, input[pos], 
-                   (input[pos] >= 32 && input[pos] <= 126) ? input[pos] : '.');
-            encode_literal(&mem->coder, input[pos], &mem->state);
-            pos++;
+    // Compression with greedy or lazy matching, or by parsing blocks
+    if (effort == MINISHRINKLER_EFFORT_OPTIMAL) {
+        shr_parse_node_t nodes[PARSE_BLOCK + 1];
+        while (pos < input_size) {
+            pos = parse_block(mem, nodes, input, input_size, pos);
+        }
+    } else {
+        while (pos < input_size) {
+            pos = compress_step(mem, input, input_size, pos);
         }
     }
 
-    // Encode end marker (offset 0)
-    tracef("END: ENCODE_END_MARKER\n");
-    int parity = mem->state.parity & 1;
-    range_coder_code(&mem->coder, 1 + CONTEXT_KIND + (parity << 8), 1); // KIND_REF
-    range_coder_code(&mem->coder, 1 + CONTEXT_REPEATED, 0); // Not repeated
-    encode_number(&mem->coder, CONTEXT_GROUP_OFFSET, 2); // Offset 0 + 2 = 2 = end
+    encode_end(mem);
 
     // Finalize
     range_coder_finish(&mem->coder);
@@ -734,8 +1088,19 @@ static int compress_data(const unsigned char *input, int input_size,
     tracef("=== COMPRESSION COMPLETE ===\n");
     tracef("Final output size: %d bytes\n", mem->coder.output_size);
     
-    // Save output size before freeing memory
-    int output_size = mem->coder.output_size;
+    return mem->coder.output_size;
+}
+
+// Main compression function
+static int compress_data(const unsigned char *input, int input_size, 
+                        unsigned char *output, int output_capacity,
+                        size_t work_memory_size, int effort) {
+    void *mem = malloc(work_memory_size); // allocate exactly what caller provides
+    if (!mem) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -4; // Memory allocation failed
+    }
+    int output_size = compress_in_arena(input, input_size, output, output_capacity, mem, work_memory_size, effort);
     
     // Free embedded memory
     free(mem);
@@ -752,6 +1117,30 @@ size_t minishrinkler_get_max_compressed_size(size_t input_size) {
     return (input_size * 9 + 7) / 8 + 64; // Add some safety margin
 }
 
+/**
+ * @brief Get the work memory size for compressing input of the given size
+ */
+// Window of the given memory level for input of the given size
+static size_t level_window_size(size_t input_size, int level) {
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+
+    // Window covering the input at level 9, halved for each level below
+    size_t window_size = 256;
+    while (window_size < input_size && window_size < MAX_WINDOW_SIZE) window_size <<= 1;
+    window_size >>= 9 - level;
+    if (window_size < 256) window_size = 256;
+    return window_size;
+}
+
+size_t minishrinkler_work_memory_for(size_t input_size, int level) {
+    size_t window_size = level_window_size(input_size, level);
+
+    // The window holds twice as many positions as the table has entries
+    size_t entries = window_size / 2;
+    return sizeof(shr_work_buffer_t) + entries * match_entry_size(window_size);
+}
+
 /**
  * @brief Compress data from input buffer to output buffer
  */
@@ -761,9 +1150,25 @@ int minishrinkler_compress(
     uint8_t *output_buffer,
     size_t output_capacity,
     size_t work_memory_size
+) {
+    return minishrinkler_compress_effort(input_data, input_size, output_buffer, output_capacity,
+                                         work_memory_size, MINISHRINKLER_EFFORT_LAZY);
+}
+
+/**
+ * @brief Compress data from input buffer to output buffer with the given effort
+ */
+int minishrinkler_compress_effort(
+    const uint8_t *input_data,
+    size_t input_size,
+    uint8_t *output_buffer,
+    size_t output_capacity,
+    size_t work_memory_size,
+    int effort
 ) {
     // Validate input parameters
-    if (!input_data || !output_buffer || input_size == 0 || output_capacity == 0) {
+    if (!input_data || !output_buffer || input_size == 0 || output_capacity == 0 ||
+        effort < MINISHRINKLER_EFFORT_GREEDY || effort > MINISHRINKLER_EFFORT_OPTIMAL) {
         return -2; // Invalid parameters
     }
     
@@ -781,7 +1186,398 @@ int minishrinkler_compress(
     // Call the original compression function
     int result = compress_data((const unsigned char*)input_data, (int)input_size, 
                               (unsigned char*)output_buffer, (int)output_capacity,
-                              work_memory_size);
+                              work_memory_size, effort);
     
     return result;
 }
+
+///@cond
+
+#define BLOCKS_HEADER_SIZE 24      // Data file header, as written by Shrinkler -w
+#define BLOCKS_MAX_THREADS 64
+#define SHRINKLER_MAJOR_VERSION 4
+#define SHRINKLER_MINOR_VERSION 7
+#define FLAG_PARITY_CONTEXT 1
+#define FLAG_BLOCKS 2
+
+///@endcond
+
+/** @brief Blocks compressed by one thread: first, first + step, ... */
+typedef struct {
+    const uint8_t *input;         ///< Input data
+    size_t input_size;            ///< Size of the input data
+    size_t block_size;            ///< Size of each block but the last
+    uint32_t block_count;         ///< Number of blocks
+    uint8_t *slots;               ///< Output of block b at b * slot_size
+    size_t slot_size;             ///< Capacity for the output of a block
+    uint32_t *sizes;              ///< Compressed size of each block, or negative error code
+    void *work_memory;            ///< This thread's part of the work memory
+    size_t work_memory_size;      ///< Size of that part
+    int effort;                   ///< Parsing effort
+    uint32_t first;               ///< First block of this thread
+    uint32_t step;                ///< Distance between the blocks of this thread
+    int error;                    ///< Negative error code, or 0
+} shr_block_job_t;
+
+static void *block_job_run(void *arg) {
+    shr_block_job_t *job = arg;
+    for (uint32_t b = job->first; b < job->block_count && !job->error; b += job->step) {
+        size_t start = (size_t)b * job->block_size;
+        size_t size = job->input_size - start < job->block_size ? job->input_size - start : job->block_size;
+        int result = compress_in_arena(job->input + start, (int)size, job->slots + b * job->slot_size,
+                                       (int)job->slot_size, job->work_memory, job->work_memory_size, job->effort);
+        if (result < 0) {
+            job->error = result;
+        } else {
+            job->sizes[b] = (uint32_t)result;
+        }
+    }
+    return NULL;
+}
+
+static void write32be(uint8_t *dst, uint32_t value) {
+    dst[0] = (uint8_t)(value >> 24);
+    dst[1] = (uint8_t)(value >> 16);
+    dst[2] = (uint8_t)(value >> 8);
+    dst[3] = (uint8_t)value;
+}
+
+static uint32_t block_count_for(size_t input_size, size_t block_size) {
+    return (uint32_t)((input_size + block_size - 1) / block_size);
+}
+
+// Capacity for the output of one block, rounded up to keep slots aligned
+static size_t block_slot_size(size_t input_size, size_t block_size) {
+    size_t size = minishrinkler_get_max_compressed_size(input_size < block_size ? input_size : block_size);
+    return (size + 15) & ~(size_t)15;
+}
+
+/**
+ * @brief Get the maximum size of the output of minishrinkler_compress_blocks()
+ */
+size_t minishrinkler_get_max_blocks_size(size_t input_size, size_t block_size) {
+    if (input_size == 0 || block_size == 0) return 0;
+    size_t block_count = block_count_for(input_size, block_size);
+    return BLOCKS_HEADER_SIZE + 8 + 4 * block_count + block_count * block_slot_size(input_size, block_size);
+}
+
+/**
+ * @brief Compress data in independent blocks on several threads
+ */
+int minishrinkler_compress_blocks(
+    const uint8_t *input_data,
+    size_t input_size,
+    uint8_t *output_buffer,
+    size_t output_capacity,
+    void *work_memory,
+    size_t work_memory_size,
+    size_t block_size,
+    int threads,
+    int effort
+) {
+    if (!input_data || !output_buffer || !work_memory || input_size == 0 ||
+        block_size == 0 || (block_size & 1) || threads < 1 ||
+        effort < MINISHRINKLER_EFFORT_GREEDY || effort > MINISHRINKLER_EFFORT_OPTIMAL) {
+        return -2;
+    }
+    if (input_size > INT32_MAX || block_size > MAX_FILE_SIZE) {
+        return -3;
+    }
+    if (output_capacity < minishrinkler_get_max_blocks_size(input_size, block_size)) {
+        return -1;
+    }
+
+    uint32_t block_count = block_count_for(input_size, block_size);
+    if ((uint32_t)threads > block_count) threads = (int)block_count;
+    if (threads > BLOCKS_MAX_THREADS) threads = BLOCKS_MAX_THREADS;
+
+    // Each block is compressed into its own slot after the index, and the
+    // outputs are moved together afterwards. The sizes are collected at
+    // the end of the work memory.
+    uint8_t *index = output_buffer + BLOCKS_HEADER_SIZE;
+    uint8_t *blocks = index + 8 + 4 * (size_t)block_count;
+    size_t slot_size = block_slot_size(input_size, block_size);
+    size_t sizes_bytes = (sizeof(uint32_t) * block_count + 15) & ~(size_t)15;
+    size_t skip = (size_t)(-(uintptr_t)work_memory & 15);
+    if (work_memory_size < skip + sizes_bytes) return -4;
+    size_t part_size = ((work_memory_size - skip - sizes_bytes) / (size_t)threads) & ~(size_t)15;
+    uint8_t *parts = (uint8_t *)work_memory + skip;
+    uint32_t *sizes = (uint32_t *)(parts + part_size * (size_t)threads);
+
+    shr_block_job_t jobs[BLOCKS_MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        jobs[t].input = input_data;
+        jobs[t].input_size = input_size;
+        jobs[t].block_size = block_size;
+        jobs[t].block_count = block_count;
+        jobs[t].slots = blocks;
+        jobs[t].slot_size = slot_size;
+        jobs[t].sizes = sizes;
+        jobs[t].work_memory = parts + part_size * (size_t)t;
+        jobs[t].work_memory_size = part_size;
+        jobs[t].effort = effort;
+        jobs[t].first = (uint32_t)t;
+        jobs[t].step = (uint32_t)threads;
+        jobs[t].error = 0;
+    }
+#ifdef MINISHRINKLER_THREADS
+    pthread_t thread_ids[BLOCKS_MAX_THREADS];
+    int started = 1;
+    while (started < threads && pthread_create(&thread_ids[started], NULL, block_job_run, &jobs[started]) == 0) {
+        started++;
+    }
+    // Blocks of threads which could not be started are compressed here
+    for (int t = started; t < threads; t++) {
+        block_job_run(&jobs[t]);
+    }
+    block_job_run(&jobs[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(thread_ids[t], NULL);
+    }
+#else
+    for (int t = 0; t < threads; t++) {
+        block_job_run(&jobs[t]);
+    }
+#endif
+    for (int t = 0; t < threads; t++) {
+        if (jobs[t].error) return jobs[t].error;
+    }
+
+    // Index of block sizes, followed by the blocks
+    write32be(index, (uint32_t)block_size);
+    write32be(index + 4, block_count);
+    size_t compressed_size = blocks - index;
+    for (uint32_t b = 0; b < block_count; b++) {
+        write32be(index + 8 + 4 * (size_t)b, sizes[b]);
+        memmove(output_buffer + BLOCKS_HEADER_SIZE + compressed_size, blocks + b * slot_size, sizes[b]);
+        compressed_size += sizes[b];
+    }
+
+    // The compressed data needs no overlap with the output when decompressed
+    // in place with a margin of its own size
+    memcpy(output_buffer, "Shri", 4);
+    output_buffer[4] = SHRINKLER_MAJOR_VERSION;
+    output_buffer[5] = SHRINKLER_MINOR_VERSION;
+    output_buffer[6] = 0;
+    output_buffer[7] = BLOCKS_HEADER_SIZE - 8;
+    write32be(output_buffer + 8, (uint32_t)compressed_size);
+    write32be(output_buffer + 12, (uint32_t)input_size);
+    write32be(output_buffer + 16, (uint32_t)compressed_size);
+    write32be(output_buffer + 20, FLAG_PARITY_CONTEXT | FLAG_BLOCKS);
+    return (int)(BLOCKS_HEADER_SIZE + compressed_size);
+}
+
+///@cond
+
+// Coder output not yet passed on. One symbol codes fewer than 80 bits, each
+// moving the output on by at most 16 bits, so this holds the output of any
+// symbol plus the partial byte before it.
+#define STREAM_PENDING_SIZE 256
+// Final output collected before handing it to the write function
+#define STREAM_OUT_SIZE 128
+
+///@endcond
+
+/**
+ * @brief Streaming compressor state
+ *
+ * Lives at the start of the work memory given to minishrinkler_init(),
+ * followed by the match finder tables and the input window.
+ *
+ * The input window holds window_size bytes of history before the position
+ * being coded and lookahead bytes after it, so that the output does not
+ * depend on how the input is split into feeds. When it is full, it slides
+ * by window_size, which keeps the wrapped positions in the hash table valid.
+ *
+ * The range coder writes its output into the pending buffer. A carry can
+ * change output bytes back to the last byte with a zero bit, so complete
+ * bytes are passed on as that byte (carry_byte) and a count of 0xFF bytes
+ * after it (ff_run). Everything before carry_byte is final and written out.
+ */
+struct minishrinkler_stream {
+    shr_work_buffer_t mem;                     ///< Range coder, LZ state and match finder
+    minishrinkler_write_fn write;              ///< Receives the compressed output
+    void *user;                                ///< Passed to write
+    uint8_t *window;                           ///< Input history and lookahead
+    int window_capacity;                       ///< 2 * window_size + lookahead
+    int lookahead;                             ///< Input kept ahead of the coded position
+    int fill;                                  ///< Bytes in the window
+    int pos;                                   ///< Next position to code in the window
+    size_t total_input;                        ///< Bytes fed
+    size_t total_output;                       ///< Bytes written
+    int error;                                 ///< Sticky error code, or 0
+    int out_size;                              ///< Bytes in out
+    uint8_t pending[STREAM_PENDING_SIZE];      ///< Output of the range coder
+    uint8_t out[STREAM_OUT_SIZE];              ///< Final output not yet written
+};
+
+// Hand the collected final output to the write function
+static void stream_write(minishrinkler_stream_t *s) {
+    if (s->out_size > 0 && !s->error && s->write(s->user, s->out, (size_t)s->out_size) != 0) {
+        s->error = -3;
+    }
+    s->out_size = 0;
+}
+
+// Add count copies of a final output byte
+static void stream_put(minishrinkler_stream_t *s, uint8_t value, uint32_t count) {
+    while (count-- > 0) {
+        s->out[s->out_size++] = value;
+        s->total_output++;
+        if (s->out_size == STREAM_OUT_SIZE) stream_write(s);
+    }
+}
+
+// Pass on the coder output bytes before end, which only a carry can change
+static void stream_pass_on(minishrinkler_stream_t *s, uint32_t end) {
+    shr_rangecoder_t *coder = &s->mem.coder;
+    if (coder->carried) {
+        // No carry can reach the bytes passed on before a carry
+        if (coder->carry_byte >= 0) stream_put(s, (uint8_t)coder->carry_byte, 1);
+        stream_put(s, 0x00, coder->ff_run);
+        coder->carry_byte = -1;
+        coder->ff_run = 0;
+        coder->carried = false;
+    }
+    if (end <= coder->output_base) return;
+
+    uint32_t count = end - coder->output_base;
+    for (uint32_t i = 0; i < count; i++) {
+        // Bytes not yet touched by the coder are zero
+        uint8_t value = coder->output_base + i < coder->output_size ? coder->output[i] : 0;
+        if (value == 0xFF) {
+            coder->ff_run++;
+            continue;
+        }
+        if (coder->carry_byte >= 0) stream_put(s, (uint8_t)coder->carry_byte, 1);
+        stream_put(s, 0xFF, coder->ff_run);
+        coder->carry_byte = value;
+        coder->ff_run = 0;
+    }
+    if (coder->output_size > end) {
+        memmove(coder->output, coder->output + count, coder->output_size - end);
+    } else {
+        coder->output_size = end;
+    }
+    coder->output_base = end;
+}
+
+// Code the input in the window, keeping lookahead bytes unless all is set
+static void stream_code(minishrinkler_stream_t *s, bool all) {
+    shr_work_buffer_t *mem = &s->mem;
+    while (s->pos < s->fill && (all || s->fill - s->pos > s->lookahead)) {
+        s->pos = compress_step(mem, s->window, s->fill, s->pos);
+        // Bytes before the one holding the latest bit are complete
+        int dest_bit = mem->coder.dest_bit;
+        stream_pass_on(s, dest_bit > 0 ? (uint32_t)(dest_bit - 1) >> 3 : 0);
+    }
+}
+
+/**
+ * @brief Start a streaming compression in the given work memory
+ */
+minishrinkler_stream_t *minishrinkler_init(
+    void *work_memory,
+    size_t work_memory_size,
+    minishrinkler_write_fn write,
+    void *user
+) {
+    if (!work_memory || !write) return NULL;
+
+    // Align the state to 16 bytes
+    size_t skip = (size_t)(-(uintptr_t)work_memory & 15);
+    if (work_memory_size < skip + sizeof(minishrinkler_stream_t)) return NULL;
+    minishrinkler_stream_t *s = (minishrinkler_stream_t *)((uint8_t *)work_memory + skip);
+    size_t available = work_memory_size - skip - sizeof(minishrinkler_stream_t);
+
+    // Largest power-of-two number of buckets for which the tables and the
+    // input window (two and a half times the window size) fit in the arena
+    int ways = 32;
+    size_t window_size = 0;
+    int hash_size = choose_match_finder(available, ways, MAX_WINDOW_SIZE, 5, &window_size);
+    if (hash_size == 0) return NULL;
+
+    memset(s, 0, sizeof(minishrinkler_stream_t));
+    uint8_t *arena = (uint8_t *)(s + 1);
+    init_match_finder(&s->mem, arena, hash_size, ways, window_size);
+    s->lookahead = (int)(window_size / 2);
+    s->mem.max_match_length = s->lookahead;
+    s->window = arena + (size_t)hash_size * (size_t)ways * match_entry_size(window_size);
+    s->window_capacity = (int)(2 * window_size) + s->lookahead;
+    s->write = write;
+    s->user = user;
+    range_coder_init(&s->mem.coder, s->pending, STREAM_PENDING_SIZE);
+    lz_state_init(&s->mem.state);
+    return s;
+}
+
+/**
+ * @brief Get the work memory size for streaming input of the given size
+ */
+size_t minishrinkler_stream_memory_for(size_t input_size, int level) {
+    size_t window_size = level_window_size(input_size, level);
+    size_t entries = window_size / 2;
+
+    // Alignment, state, tables and the input window as in minishrinkler_init()
+    return 15 + sizeof(minishrinkler_stream_t) + entries * match_entry_size(window_size) + window_size * 5 / 2;
+}
+
+/**
+ * @brief Compress more input
+ */
+int minishrinkler_feed(minishrinkler_stream_t *stream, const uint8_t *data, size_t size) {
+    if (!stream || (!data && size > 0)) return -2;
+    minishrinkler_stream_t *s = stream;
+    while (size > 0 && !s->error) {
+        if (s->fill == s->window_capacity) {
+            // Slide the window, keeping window_size bytes of history
+            stream_code(s, false);
+            int shift = s->mem.window_size;
+            assert(s->pos >= 2 * shift - 1);
+            memmove(s->window, s->window + shift, (size_t)(s->fill - shift));
+            s->fill -= shift;
+            s->pos -= shift;
+        }
+        size_t n = (size_t)(s->window_capacity - s->fill);
+        if (n > size) n = size;
+        memcpy(s->window + s->fill, data, n);
+        s->fill += (int)n;
+        s->total_input += n;
+        data += n;
+        size -= n;
+    }
+    stream_code(s, false);
+    return s->error;
+}
+
+/**
+ * @brief Compress all input fed so far and write the final output
+ */
+int minishrinkler_flush(minishrinkler_stream_t *stream) {
+    if (!stream) return -2;
+    stream_code(stream, true);
+    stream_write(stream);
+    return stream->error;
+}
+
+/**
+ * @brief End the compressed stream
+ */
+int minishrinkler_finish(minishrinkler_stream_t *stream) {
+    if (!stream) return -2;
+    minishrinkler_stream_t *s = stream;
+    if (s->total_input == 0) return -2;
+    stream_code(s, true);
+    encode_end(&s->mem);
+    range_coder_finish(&s->mem.coder);
+
+    // No carries are left, so all output is final
+    shr_rangecoder_t *coder = &s->mem.coder;
+    stream_pass_on(s, coder->output_size);
+    if (coder->carry_byte >= 0) stream_put(s, (uint8_t)coder->carry_byte, 1);
+    stream_put(s, 0xFF, coder->ff_run);
+    coder->carry_byte = -1;
+    coder->ff_run = 0;
+    stream_write(s);
+    return s->error ? s->error : (int)s->total_output;
+}
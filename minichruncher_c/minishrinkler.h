@@ -4,7 +4,8 @@
  * @brief Minishrinkler compression API - Simplified Shrinkler compressor
  * 
  * This header provides a simple buffer-to-buffer compression API for the
- * Minishrinkler compressor, a simplified version of the Shrinkler algorithm.
+ * Minishrinkler compressor, a simplified version of the Shrinkler algorithm,
+ * and a streaming API working in caller-provided memory.
  * 
  * Features:
  * * A single dynamic memory allocations for all the work memory
@@ -56,6 +57,7 @@ extern "C" {
  * @param output_buffer Pointer to the output buffer for compressed data
  * @param output_capacity Maximum capacity of the output buffer in bytes
  * @param work_memory_size Size of work memory to allocate for hash table in bytes
+ *                         (see minishrinkler_work_memory_for())
  * 
  * @return On success: number of bytes written to output_buffer (compressed size)
  * @return On failure: negative value indicating error
@@ -94,6 +96,186 @@ int minishrinkler_compress(
  */
 size_t minishrinkler_get_max_compressed_size(size_t input_size);
 
+/** @brief Encode the longest match at each position */
+#define MINISHRINKLER_EFFORT_GREEDY 0
+/** @brief Defer a match by one literal when the next position has a longer one (default) */
+#define MINISHRINKLER_EFFORT_LAZY 1
+/**
+ * @brief Choose literals and references by their cost with the current
+ * probabilities, over blocks of 128 bytes
+ */
+#define MINISHRINKLER_EFFORT_OPTIMAL 2
+
+/**
+ * @brief Compress data with a chosen effort
+ *
+ * As minishrinkler_compress(), which uses MINISHRINKLER_EFFORT_LAZY. The
+ * optimal effort typically gives a few percent smaller output and takes a
+ * few times longer. It needs about 3KB of stack besides the work memory.
+ *
+ * @param effort One of MINISHRINKLER_EFFORT_GREEDY, MINISHRINKLER_EFFORT_LAZY
+ *               and MINISHRINKLER_EFFORT_OPTIMAL
+ *
+ * @return As for minishrinkler_compress()
+ */
+int minishrinkler_compress_effort(
+    const uint8_t *input_data,
+    size_t input_size,
+    uint8_t *output_buffer,
+    size_t output_capacity,
+    size_t work_memory_size,
+    int effort
+);
+
+/**
+ * @brief Get the maximum output size of minishrinkler_compress_blocks()
+ *
+ * @param input_size Size of the input data in bytes
+ * @param block_size Size of each block in bytes
+ * @return Output capacity needed, including the space used while compressing
+ */
+size_t minishrinkler_get_max_blocks_size(size_t input_size, size_t block_size);
+
+/**
+ * @brief Compress data in independent blocks on several threads
+ *
+ * Writes a data file in the block format of Shrinkler (--data --blocks),
+ * which shrinkler_dec can decompress on several threads: a header, an index
+ * of the compressed block sizes and the blocks, each compressed with fresh
+ * contexts and no references into earlier blocks.
+ *
+ * The work memory is split evenly between the threads (after a few bytes
+ * per block for the index), and each part is used as by minishrinkler_compress()
+ * for the blocks of one thread. The output does not depend on the number
+ * of threads if the part size does not change.
+ *
+ * @param input_data Pointer to the input data to compress
+ * @param input_size Size of the input data in bytes
+ * @param output_buffer Buffer for the data file
+ * @param output_capacity Capacity of the output buffer, at least
+ *                        minishrinkler_get_max_blocks_size()
+ * @param work_memory Memory for the compression state of all threads
+ * @param work_memory_size Size of the work memory in bytes
+ * @param block_size Size of each block in bytes, which must be even
+ * @param threads Number of threads to compress on
+ * @param effort As for minishrinkler_compress_effort()
+ *
+ * @return On success: size of the data file
+ * @return On failure: negative value indicating error, as for
+ *         minishrinkler_compress(), or -4 if the work memory is too small
+ */
+int minishrinkler_compress_blocks(
+    const uint8_t *input_data,
+    size_t input_size,
+    uint8_t *output_buffer,
+    size_t output_capacity,
+    void *work_memory,
+    size_t work_memory_size,
+    size_t block_size,
+    int threads,
+    int effort
+);
+
+/**
+ * @brief Get the work memory size to pass to minishrinkler_compress()
+ *
+ * At level 9, the match window covers the whole input (up to 1MB), so
+ * matches can reach back to its start. Each level below halves the window
+ * and the memory. Windows larger than 64K store 32-bit positions, which
+ * costs two thirds more memory per entry.
+ *
+ * @param input_size Size of the input data in bytes
+ * @param level Memory level from 1 (least memory) to 9 (best compression)
+ * @return Work memory size in bytes
+ */
+size_t minishrinkler_work_memory_for(size_t input_size, int level);
+
+/**
+ * @brief Receives compressed output from a streaming compression
+ *
+ * @param user The pointer given to minishrinkler_init()
+ * @param data Compressed bytes, which are final
+ * @param size Number of bytes
+ * @return 0 on success, anything else to fail the compression
+ */
+typedef int (*minishrinkler_write_fn)(void *user, const uint8_t *data, size_t size);
+
+/**
+ * @brief State of a streaming compression, stored in the work memory
+ */
+typedef struct minishrinkler_stream minishrinkler_stream_t;
+
+/**
+ * @brief Start a streaming compression
+ *
+ * The input is given in pieces with minishrinkler_feed(), and the compressed
+ * output is passed to the write function as soon as it is final. All state,
+ * including the input window and the hash table, lives in the given work
+ * memory, and no memory is allocated. The hash table gets the memory not
+ * needed for the window, so more memory gives better compression, up to
+ * around a megabyte.
+ *
+ * Matches are at most half the window long, so the output differs slightly
+ * from that of minishrinkler_compress(). It does not depend on how the input
+ * is split between calls to minishrinkler_feed().
+ *
+ * @param work_memory Memory for the compression state, valid until finished
+ * @param work_memory_size Size of the work memory in bytes
+ * @param write Function receiving the compressed output
+ * @param user Passed to the write function
+ *
+ * @return The stream, or NULL if the work memory is too small (a few
+ *         kilobytes are needed) or the parameters are invalid
+ */
+minishrinkler_stream_t *minishrinkler_init(
+    void *work_memory,
+    size_t work_memory_size,
+    minishrinkler_write_fn write,
+    void *user
+);
+
+/**
+ * @brief Get the work memory size to pass to minishrinkler_init()
+ *
+ * Gives the match window of minishrinkler_work_memory_for() at the same
+ * level, plus room for the input window and the state of the stream.
+ *
+ * @param input_size Expected size of the input data in bytes
+ * @param level Memory level from 1 (least memory) to 9 (best compression)
+ * @return Work memory size in bytes
+ */
+size_t minishrinkler_stream_memory_for(size_t input_size, int level);
+
+/**
+ * @brief Compress more input
+ *
+ * Input is kept in the window until enough follows it to find the longest
+ * matches, so output lags behind by up to half the window size.
+ *
+ * @return 0 on success, or a negative error code as for minishrinkler_finish()
+ */
+int minishrinkler_feed(minishrinkler_stream_t *stream, const uint8_t *data, size_t size);
+
+/**
+ * @brief Compress all input fed so far
+ *
+ * Writes all output which is final. No match will extend across the flush
+ * point, so flushing often makes compression worse.
+ *
+ * @return 0 on success, or a negative error code as for minishrinkler_finish()
+ */
+int minishrinkler_flush(minishrinkler_stream_t *stream);
+
+/**
+ * @brief End a streaming compression and write the rest of the output
+ *
+ * @return On success: total number of compressed bytes written
+ * @return On failure: negative value indicating error
+ *         -2: invalid parameters or no input
+ *         -3: the write function failed
+ */
+int minishrinkler_finish(minishrinkler_stream_t *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,23 +17,84 @@
 #include <errno.h>
 #include <stdbool.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MINISHRINKLER_CLI_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 /**
  * @brief Print usage information
  */
 static void print_usage(const char *program_name) {
-    printf("Usage: %s [--window <size_kb>] <input_file> <output_file>\n", program_name);
+    printf("Usage: %s [--window <size_kb> | --level <1-9>] [--effort <0-2>]\n"
+           "       [--stream <chunk_kb> | --blocks <block_kb> [--threads <n>]] <input_file> <output_file>\n", program_name);
     printf("MiniShrinkler - Embedded-friendly version of the Shrinkler compressor\n");
     printf("Outputs raw compressed data without header (compatible with -d option)\n");
     printf("\n");
     printf("Options:\n");
     printf("  --window <size_kb>  Set hash table size in kilobytes (default: 4)\n");
+    printf("  --level <1-9>       Size the hash table for the input; 9 lets matches\n");
+    printf("                      reach back over the whole input\n");
+    printf("  --effort <0-2>      Parsing effort: 0 greedy, 1 lazy (default), 2 optimal\n");
+    printf("  --stream <chunk_kb> Use the streaming API, feeding chunks of this size;\n");
+    printf("                      the work memory then also holds the input window\n");
+    printf("  --blocks <block_kb> Write a Shrinkler data file of independent blocks,\n");
+    printf("                      compressed in parallel with this much memory each\n");
+    printf("  --threads <n>       Number of threads for --blocks (default: all cores)\n");
     printf("\n");
 }
 
+#ifdef MINISHRINKLER_CLI_MMAP
+/**
+ * @brief Map file into memory (read-only)
+ * 
+ * @return Mapped data, or NULL if the file should be read normally
+ */
+static uint8_t* map_file(const char *filename, size_t *file_size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    
+    *file_size = (size_t)st.st_size;
+    return m;
+}
+#endif
+
 /**
  * @brief Read file into buffer
+ * 
+ * Where supported, the file is memory mapped instead of read into an
+ * allocated buffer. Release the data with free_file().
+ * 
+ * @param[out] mapped Set to whether the data is a mapping
  */
-static uint8_t* read_file(const char *filename, size_t *file_size) {
+static uint8_t* read_file(const char *filename, size_t *file_size, bool *mapped) {
+    *mapped = false;
+    
+#ifdef MINISHRINKLER_CLI_MMAP
+    uint8_t *mapping = map_file(filename, file_size);
+    if (mapping) {
+        *mapped = true;
+        return mapping;
+    }
+#endif
+    
     FILE *file = fopen(filename, "rb");
     if (!file) {
         fprintf(stderr, "Error: Cannot open input file '%s': %s\n", filename, strerror(errno));
@@ -80,6 +141,22 @@ static uint8_t* read_file(const char *filename, size_t *file_size) {
     return buffer;
 }
 
+/**
+ * @brief Release data returned by read_file()
+ */
+static void free_file(uint8_t *data, size_t size, bool mapped) {
+#ifdef MINISHRINKLER_CLI_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)mapped;
+#endif
+    free(data);
+}
+
 /**
  * @brief Write buffer to file
  */
@@ -102,6 +179,90 @@ static bool write_file(const char *filename, const uint8_t *data, size_t size) {
     return true;
 }
 
+/**
+ * @brief Write function for the streaming API, appending to a file
+ */
+static int write_stream(void *user, const uint8_t *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *)user) == size ? 0 : -1;
+}
+
+/**
+ * @brief Compress with the streaming API, feeding the input in chunks
+ * 
+ * @return Compressed size, or a negative error code
+ */
+static int compress_stream(const uint8_t *input_data, size_t input_size, const char *output_file,
+                           size_t work_memory_size, size_t chunk_size) {
+    void *work_memory = malloc(work_memory_size);
+    if (!work_memory) {
+        fprintf(stderr, "Error: Cannot allocate work memory\n");
+        return -4;
+    }
+    FILE *file = fopen(output_file, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot create output file '%s': %s\n", output_file, strerror(errno));
+        free(work_memory);
+        return -3;
+    }
+    
+    int result = -4;
+    minishrinkler_stream_t *stream = minishrinkler_init(work_memory, work_memory_size, write_stream, file);
+    if (stream) {
+        result = 0;
+        for (size_t pos = 0; pos < input_size && result == 0; pos += chunk_size) {
+            size_t size = input_size - pos < chunk_size ? input_size - pos : chunk_size;
+            result = minishrinkler_feed(stream, input_data + pos, size);
+        }
+        if (result == 0) {
+            result = minishrinkler_finish(stream);
+        }
+    }
+    
+    if (fclose(file) != 0 && result >= 0) {
+        result = -3;
+    }
+    free(work_memory);
+    return result;
+}
+
+/**
+ * @brief Number of threads to compress blocks on by default
+ */
+static int default_thread_count(void) {
+#ifdef MINISHRINKLER_CLI_MMAP
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > 64 ? 64 : (int)n;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Compress in independent blocks on several threads
+ * 
+ * @return Size of the data file written, or a negative error code
+ */
+static int compress_blocks(const uint8_t *input_data, size_t input_size, const char *output_file,
+                           size_t work_memory_size, size_t block_size, int threads, int effort) {
+    // Give each thread the requested memory, plus room for the block index
+    size_t block_count = (input_size + block_size - 1) / block_size;
+    size_t total_memory = work_memory_size * (size_t)threads + 4 * block_count + 32;
+    size_t output_capacity = minishrinkler_get_max_blocks_size(input_size, block_size);
+    void *work_memory = malloc(total_memory);
+    uint8_t *output_data = malloc(output_capacity);
+    int result = -4;
+    if (work_memory && output_data) {
+        result = minishrinkler_compress_blocks(input_data, input_size, output_data, output_capacity,
+                                               work_memory, total_memory, block_size, threads, effort);
+    }
+    if (result >= 0 && !write_file(output_file, output_data, (size_t)result)) {
+        result = -5;
+    }
+    free(work_memory);
+    free(output_data);
+    return result;
+}
+
 /**
  * @brief Main function
  */
@@ -109,6 +270,11 @@ int main(int argc, char *argv[]) {
     const char *input_file = NULL;
     const char *output_file = NULL;
     size_t window_size_kb = 5;  // Default: 5 KB
+    int level = 0;              // Default: use window_size_kb
+    int effort = MINISHRINKLER_EFFORT_LAZY;
+    size_t stream_chunk_kb = 0; // Default: compress in one go
+    size_t block_kb = 0;        // Default: a single stream
+    int threads = 0;            // Default: all cores
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -126,6 +292,66 @@ int main(int argc, char *argv[]) {
             }
             window_size_kb = (size_t)size;
             i++;  // Skip the size value
+        } else if (strcmp(argv[i], "--level") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --level requires a value\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            long value = strtol(argv[i + 1], &endptr, 10);
+            if (*endptr != '\0' || value < 1 || value > 9) {
+                fprintf(stderr, "Error: Invalid level '%s'. Must be 1-9\n", argv[i + 1]);
+                return 1;
+            }
+            level = (int)value;
+            i++;  // Skip the level value
+        } else if (strcmp(argv[i], "--effort") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --effort requires a value\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            long value = strtol(argv[i + 1], &endptr, 10);
+            if (*endptr != '\0' || value < MINISHRINKLER_EFFORT_GREEDY || value > MINISHRINKLER_EFFORT_OPTIMAL) {
+                fprintf(stderr, "Error: Invalid effort '%s'. Must be 0-2\n", argv[i + 1]);
+                return 1;
+            }
+            effort = (int)value;
+            i++;  // Skip the effort value
+        } else if (strcmp(argv[i], "--blocks") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            long value = strtol(argv[i + 1], &endptr, 10);
+            if (*endptr != '\0' || value < 1 || value > 1024) {
+                fprintf(stderr, "Error: Invalid %s value '%s'. Must be 1-1024\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--blocks") == 0) {
+                block_kb = (size_t)value;
+            } else {
+                threads = (int)value;
+            }
+            i++;  // Skip the value
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stream requires a chunk size\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            char *endptr;
+            long size = strtol(argv[i + 1], &endptr, 10);
+            if (*endptr != '\0' || size <= 0 || size > 1024) {
+                fprintf(stderr, "Error: Invalid chunk size '%s'. Must be 1-1024 KB\n", argv[i + 1]);
+                return 1;
+            }
+            stream_chunk_kb = (size_t)size;
+            i++;  // Skip the size value
         } else if (input_file == NULL) {
             input_file = argv[i];
         } else if (output_file == NULL) {
@@ -142,21 +368,98 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    if (stream_chunk_kb > 0 && effort != MINISHRINKLER_EFFORT_LAZY) {
+        fprintf(stderr, "Error: The streaming API only supports lazy matching\n");
+        return 1;
+    }
+    
+    if (stream_chunk_kb > 0 && block_kb > 0) {
+        fprintf(stderr, "Error: --stream and --blocks cannot be combined\n");
+        return 1;
+    }
+    
+    if (threads > 0 && block_kb == 0) {
+        fprintf(stderr, "Error: --threads requires --blocks\n");
+        return 1;
+    }
+    
     // Read input file
     size_t input_size;
-    uint8_t *input_data = read_file(input_file, &input_size);
+    bool input_mapped;
+    uint8_t *input_data = read_file(input_file, &input_size, &input_mapped);
     if (!input_data) {
         return 1;
     }
     
     printf("Compressing %zu bytes...\n", input_size);
     
+    if (level > 0) {
+        size_t level_size = block_kb > 0 && block_kb * 1024 < input_size ? block_kb * 1024 : input_size;
+        size_t work_memory_size = stream_chunk_kb > 0 ? minishrinkler_stream_memory_for(input_size, level)
+                                                      : minishrinkler_work_memory_for(level_size, level);
+        window_size_kb = (work_memory_size + 1023) / 1024;
+    }
+    
+    if (block_kb > 0) {
+        if (threads == 0) threads = default_thread_count();
+        printf("Compressing %zu KB blocks on %d thread%s with %zu KB of work memory each\n",
+               block_kb, threads, threads == 1 ? "" : "s", window_size_kb);
+        int file_size = compress_blocks(input_data, input_size, output_file, window_size_kb * 1024,
+                                        block_kb * 1024, threads, effort);
+        free_file(input_data, input_size, input_mapped);
+        if (file_size < 0) {
+            switch (file_size) {
+                case -4:
+                    fprintf(stderr, "Error: Work memory too small\n");
+                    break;
+                case -5:
+                    break; // Reported by write_file
+                default:
+                    fprintf(stderr, "Error: Compression failed (%d)\n", file_size);
+                    break;
+            }
+            return 1;
+        }
+        printf("Compression completed:\n");
+        printf("  Original size: %zu bytes\n", input_size);
+        printf("  Data file size: %d bytes\n", file_size);
+        printf("  Compression ratio: %.2f%%\n", (float)file_size / input_size * 100);
+        return 0;
+    }
+    
+    if (stream_chunk_kb > 0) {
+        size_t work_memory_size = window_size_kb * 1024;
+        printf("Streaming in %zu KB chunks with %zu KB of work memory\n", stream_chunk_kb, window_size_kb);
+        int compressed_size = compress_stream(input_data, input_size, output_file,
+                                              work_memory_size, stream_chunk_kb * 1024);
+        free_file(input_data, input_size, input_mapped);
+        if (compressed_size < 0) {
+            switch (compressed_size) {
+                case -3:
+                    fprintf(stderr, "Error: Failed to write file '%s'\n", output_file);
+                    break;
+                case -4:
+                    fprintf(stderr, "Error: Work memory too small\n");
+                    break;
+                default:
+                    fprintf(stderr, "Error: Unknown compression error (%d)\n", compressed_size);
+                    break;
+            }
+            return 1;
+        }
+        printf("Compression completed:\n");
+        printf("  Original size: %zu bytes\n", input_size);
+        printf("  Compressed size: %d bytes\n", compressed_size);
+        printf("  Compression ratio: %.2f%%\n", (float)compressed_size / input_size * 100);
+        return 0;
+    }
+    
     // Calculate output buffer size
     size_t output_capacity = minishrinkler_get_max_compressed_size(input_size);
     uint8_t *output_data = malloc(output_capacity);
     if (!output_data) {
         fprintf(stderr, "Error: Cannot allocate output buffer\n");
-        free(input_data);
+        free_file(input_data, input_size, input_mapped);
         return 1;
     }
     
@@ -166,7 +469,8 @@ int main(int argc, char *argv[]) {
     printf("Using hash table size: %zu KB (%zu bytes)\n", window_size_kb, work_memory_size);
     
     // Compress data
-    int compressed_size = minishrinkler_compress(input_data, input_size, output_data, output_capacity, work_memory_size);
+    int compressed_size = minishrinkler_compress_effort(input_data, input_size, output_data, output_capacity,
+                                                        work_memory_size, effort);
     
     if (compressed_size < 0) {
         switch (compressed_size) {
@@ -183,14 +487,14 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: Unknown compression error (%d)\n", compressed_size);
                 break;
         }
-        free(input_data);
+        free_file(input_data, input_size, input_mapped);
         free(output_data);
         return 1;
     }
     
     // Write output file
     if (!write_file(output_file, output_data, compressed_size)) {
-        free(input_data);
+        free_file(input_data, input_size, input_mapped);
         free(output_data);
         return 1;
     }
@@ -202,7 +506,7 @@ int main(int argc, char *argv[]) {
     printf("  Compression ratio: %.2f%%\n", (float)compressed_size / input_size * 100);
     
     // Cleanup
-    free(input_data);
+    free_file(input_data, input_size, input_mapped);
     free(output_data);
     
     return 0;
@@ -79,6 +79,10 @@ SPRITES_MINI_SIZE=0
 SPRITES_GZIP_SIZE=0
 SPRITES_LZ4_SIZE=0
 
+# Decoding mode statistics
+MODE_TESTS=0
+MODE_FAILED=0
+
 # Function to clean temporary files
 cleanup() {
     rm -rf "$OUTPUT_DIR" 2>/dev/null || true
@@ -102,6 +106,10 @@ print_final_report() {
     if [ $FAILED_FILES -gt 0 ]; then
         log_error "Failed tests: $FAILED_FILES"
     fi
+    log_info "Mode tests: $MODE_TESTS"
+    if [ $MODE_FAILED -gt 0 ]; then
+        log_error "Failed mode tests: $MODE_FAILED"
+    fi
     
     if [ $TOTAL_ORIGINAL_SIZE -gt 0 ]; then
         echo
@@ -191,7 +199,7 @@ print_final_report() {
         fi
     fi
     
-    if [ $FAILED_FILES -gt 0 ]; then
+    if [ $FAILED_FILES -gt 0 ] || [ $MODE_FAILED -gt 0 ]; then
         exit 1
     else
         log_success "All tests passed!"
@@ -495,6 +503,169 @@ test_directory() {
     fi
 }
 
+# Function to record the result of a mode test, comparing two files
+check_mode() {
+    local filename="$1"
+    local mode="$2"
+    local expected="$3"
+    local actual="$4"
+
+    MODE_TESTS=$((MODE_TESTS + 1))
+    if ! cmp -s "$expected" "$actual"; then
+        MODE_FAILED=$((MODE_FAILED + 1))
+        printf "%-50s %s\n" "$filename" "FAILED ($mode)"
+        return 1
+    fi
+    return 0
+}
+
+# Function to test the decoding modes on a single file
+test_file_modes() {
+    local input_file="$1"
+    local filename=$(basename "$input_file")
+    local base="$OUTPUT_DIR/${filename}"
+    local dec="./decruncher_c/shrinkler_dec"
+    local cpp="$BUILD_DIR_CPP/$CPP_EXECUTABLE"
+
+    mkdir -p "$OUTPUT_DIR"
+
+    # Streaming with a window as small as the crunch window
+    "$cpp" -d -w -1 --window 4 "$input_file" "$base.window.shr" >/dev/null 2>&1
+    "$dec" --stream 4096 "$base.window.shr" "$base.window.out" >/dev/null 2>&1
+    check_mode "$filename" "stream 4096, window 4" "$input_file" "$base.window.out"
+    "$dec" "$base.window.shr" "$base.window_full.out" >/dev/null 2>&1
+    check_mode "$filename" "window 4" "$input_file" "$base.window_full.out"
+
+    # A stream window smaller than the references must fail, not corrupt
+    "$cpp" -d -w -1 "$input_file" "$base.header.shr" >/dev/null 2>&1
+    "$dec" --stream 0 "$base.header.shr" "$base.stream.out" >/dev/null 2>&1
+    check_mode "$filename" "stream 0" "$input_file" "$base.stream.out"
+    if "$dec" --stream 4096 "$base.header.shr" "$base.small.out" >/dev/null 2>&1; then
+        check_mode "$filename" "stream 4096" "$input_file" "$base.small.out"
+    fi
+
+    # In-place decoding within the input buffer
+    "$dec" --in-place "$base.header.shr" "$base.inplace.out" >/dev/null 2>&1
+    check_mode "$filename" "in-place" "$input_file" "$base.inplace.out"
+
+    # Blocks, decoded in parallel and as a stream
+    "$cpp" -d -w -1 --blocks 4 "$input_file" "$base.blocks.shr" >/dev/null 2>&1
+    "$dec" -j 2 "$base.blocks.shr" "$base.blocks.out" >/dev/null 2>&1
+    check_mode "$filename" "blocks 4" "$input_file" "$base.blocks.out"
+    "$dec" --stream 0 "$base.blocks.shr" "$base.blocks_stream.out" >/dev/null 2>&1
+    check_mode "$filename" "blocks 4, stream 0" "$input_file" "$base.blocks_stream.out"
+
+    # Parse candidates and blocks crunched on several threads
+    "$cpp" -d -w -1 -j 2 "$input_file" "$base.threads.shr" >/dev/null 2>&1
+    "$dec" "$base.threads.shr" "$base.threads.out" >/dev/null 2>&1
+    check_mode "$filename" "threads 2" "$input_file" "$base.threads.out"
+    "$cpp" -d -w -1 -j 2 --blocks 4 "$input_file" "$base.blocks_threads.shr" >/dev/null 2>&1
+    "$dec" -j 2 "$base.blocks_threads.shr" "$base.blocks_threads.out" >/dev/null 2>&1
+    check_mode "$filename" "blocks 4, threads 2" "$input_file" "$base.blocks_threads.out"
+
+    # Hybrid, fast and hash chain parsing
+    "$cpp" -d -w -1 --hybrid 1 "$input_file" "$base.hybrid.shr" >/dev/null 2>&1
+    "$dec" "$base.hybrid.shr" "$base.hybrid.out" >/dev/null 2>&1
+    check_mode "$filename" "hybrid 1" "$input_file" "$base.hybrid.out"
+    "$cpp" -d -w -0 "$input_file" "$base.fast.shr" >/dev/null 2>&1
+    "$dec" "$base.fast.shr" "$base.fast.out" >/dev/null 2>&1
+    check_mode "$filename" "fast" "$input_file" "$base.fast.out"
+    "$cpp" -d -w -1 --hash-chain 4 "$input_file" "$base.hash_chain.shr" >/dev/null 2>&1
+    "$dec" "$base.hash_chain.shr" "$base.hash_chain.out" >/dev/null 2>&1
+    check_mode "$filename" "hash chain 4" "$input_file" "$base.hash_chain.out"
+
+    # Incremental crunching, recording the parse and then reusing it
+    rm -f "$base.parse"
+    "$cpp" -d -w -1 --incremental "$base.parse" "$input_file" "$base.incremental.shr" >/dev/null 2>&1
+    "$dec" "$base.incremental.shr" "$base.incremental.out" >/dev/null 2>&1
+    check_mode "$filename" "incremental" "$input_file" "$base.incremental.out"
+    "$cpp" -d -w -1 --incremental "$base.parse" "$input_file" "$base.incremental_reuse.shr" >/dev/null 2>&1
+    "$dec" "$base.incremental_reuse.shr" "$base.incremental_reuse.out" >/dev/null 2>&1
+    check_mode "$filename" "incremental, reused" "$input_file" "$base.incremental_reuse.out"
+
+    # C version on several threads and in a block of work memory, which
+    # must cover a worst case per position, so only of a part of the data
+    local c="$BUILD_DIR_C/$C_EXECUTABLE"
+    if [ -x "$c" ]; then
+        "$c" -d -j 2 "$input_file" "$base.c_threads.shr" >/dev/null 2>&1
+        "$dec" "$base.c_threads.shr" "$base.c_threads.out" >/dev/null 2>&1
+        check_mode "$filename" "C threads 2" "$input_file" "$base.c_threads.out"
+        head -c 2048 "$input_file" > "$base.head"
+        "$c" -d --work-memory 128 "$base.head" "$base.c_work_memory.shr" >/dev/null 2>&1
+        "$dec" "$base.c_work_memory.shr" "$base.c_work_memory.out" >/dev/null 2>&1
+        check_mode "$filename" "C work memory 128" "$base.head" "$base.c_work_memory.out"
+    fi
+
+    # A range of seekable blocks, crossing block boundaries
+    local size=$(wc -c < "$input_file")
+    local range_offset=$((size / 4))
+    local range_size=$((size / 2))
+    "$cpp" -d -w -1 --blocks 4 --seekable "$input_file" "$base.seekable.shr" >/dev/null 2>&1
+    "$dec" --range "$range_offset:$range_size" "$base.seekable.shr" "$base.range.out" >/dev/null 2>&1
+    tail -c +$((range_offset + 1)) "$input_file" | head -c "$range_size" > "$base.range.expected"
+    check_mode "$filename" "seekable range" "$base.range.expected" "$base.range.out"
+
+    # Dictionary holding the first half of the data
+    head -c $((size / 2)) "$input_file" > "$base.dict"
+    "$cpp" -d -w -1 --dictionary "$base.dict" "$input_file" "$base.dictionary.shr" >/dev/null 2>&1
+    "$dec" --dictionary "$base.dict" "$base.dictionary.shr" "$base.dictionary.out" >/dev/null 2>&1
+    check_mode "$filename" "dictionary" "$input_file" "$base.dictionary.out"
+
+    # Minishrinkler blocks, streaming, level and optimal parsing
+    local mini="$MINI_DIR/$MINI_EXECUTABLE"
+    "$mini" --blocks 4 --threads 2 "$input_file" "$base.mini_blocks.shr" >/dev/null 2>&1
+    "$dec" -j 2 "$base.mini_blocks.shr" "$base.mini_blocks.out" >/dev/null 2>&1
+    check_mode "$filename" "mini blocks 4" "$input_file" "$base.mini_blocks.out"
+    "$mini" --stream 4 "$input_file" "$base.mini_stream.shr" >/dev/null 2>&1
+    "$dec" "$base.mini_stream.shr" "$base.mini_stream.out" >/dev/null 2>&1
+    check_mode "$filename" "mini stream 4" "$input_file" "$base.mini_stream.out"
+    "$mini" --level 9 "$input_file" "$base.mini_level.shr" >/dev/null 2>&1
+    "$dec" "$base.mini_level.shr" "$base.mini_level.out" >/dev/null 2>&1
+    check_mode "$filename" "mini level 9" "$input_file" "$base.mini_level.out"
+    "$mini" --level 9 --stream 7 "$input_file" "$base.mini_level_stream.shr" >/dev/null 2>&1
+    "$dec" "$base.mini_level_stream.shr" "$base.mini_level_stream.out" >/dev/null 2>&1
+    check_mode "$filename" "mini level 9, stream 7" "$input_file" "$base.mini_level_stream.out"
+    "$mini" --effort 2 "$input_file" "$base.mini_effort.shr" >/dev/null 2>&1
+    "$dec" "$base.mini_effort.shr" "$base.mini_effort.out" >/dev/null 2>&1
+    check_mode "$filename" "mini effort 2" "$input_file" "$base.mini_effort.out"
+
+    # Keep a crunched copy for the batch test
+    mkdir -p "$OUTPUT_DIR/batch_in"
+    cp "$base.blocks.shr" "$OUTPUT_DIR/batch_in/${filename}.shr"
+}
+
+# Function to test batch decoding of all files crunched by test_file_modes
+test_batch() {
+    local dec="./decruncher_c/shrinkler_dec"
+    mkdir -p "$OUTPUT_DIR/batch_out"
+    "$dec" -j 2 --batch "$OUTPUT_DIR/batch_out" "$OUTPUT_DIR/batch_in" >/dev/null 2>&1
+    for input_file in "$TEST_DIR"/*/*; do
+        if [ -f "$input_file" ]; then
+            local filename=$(basename "$input_file")
+            check_mode "$filename" "batch" "$input_file" "$OUTPUT_DIR/batch_out/$filename"
+        fi
+    done
+}
+
+# Function to test the decoding modes on all test files
+test_modes() {
+    log_info "Testing decoding modes"
+    local passed_before=$((MODE_TESTS - MODE_FAILED))
+    local tests_before=$MODE_TESTS
+
+    for input_file in "$TEST_DIR"/*/*; do
+        if [ -f "$input_file" ]; then
+            # Failures are counted by check_mode, so keep going after one
+            test_file_modes "$input_file" || true
+        fi
+    done
+    test_batch || true
+
+    local passed=$((MODE_TESTS - MODE_FAILED - passed_before))
+    printf "%-50s %s\n" "--- mode summary ---" "$passed/$((MODE_TESTS - tests_before))"
+    echo
+}
+
 # Main function
 main() {
     # Parse optional args
@@ -543,6 +714,8 @@ main() {
             test_directory "$subdir"
         fi
     done
+
+    test_modes
     
     echo
     log_info "Tests completed!"